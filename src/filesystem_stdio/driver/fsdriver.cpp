@@ -25,3 +25,7 @@ auto FileDescriptor::CleanupArena() -> void {
 
 CFsDriver::CFsDriver() = default;
 CFsDriver::~CFsDriver() = default;
+
+auto CFsDriver::Map( const FileDescriptor* pDesc, uint64 pOffset, uint32 pCount ) -> CUtlRefCountedMemory* {
+	return nullptr;
+}
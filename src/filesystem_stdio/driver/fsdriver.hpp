@@ -6,6 +6,7 @@
 #include "tier0/platform.h"
 #include "utlvector.h"
 
+class CUtlRefCountedMemory;
 
 enum class FileType {
 	Regular = 1,
@@ -94,6 +95,12 @@ public:
 	virtual auto Write( const FileDescriptor* pDesc, const void* pBuffer, uint32 pCount ) -> int32 = 0;
 	virtual auto Flush( const FileDescriptor* pDesc ) -> bool = 0;
 	virtual auto Close( const FileDescriptor* pDesc ) -> void = 0;
+	/**
+	 * Maps a range of an open file in memory without copying it.
+	 * The mapping stays valid until the returned memory is released, even after the descriptor is closed.
+	 * @return the mapped memory, or `nullptr` if the driver can't map this file.
+	 */
+	virtual auto Map  ( const FileDescriptor* pDesc, uint64 pOffset, uint32 pCount ) -> CUtlRefCountedMemory*;
 	// generic ops
 	virtual auto ListDir( const char* pPattern, CUtlVector<const char*>& pResult ) -> bool = 0;
 	virtual auto Create ( const char* pPath, FileType pType, OpenMode pMode ) -> FileDescriptor* = 0;
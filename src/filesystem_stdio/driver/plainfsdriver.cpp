@@ -2,13 +2,17 @@
 // Created by ENDERZOMBI102 on 23/02/2024.
 //
 #include "plainfsdriver.hpp"
+#include <cerrno>
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "strtools.h"
 #include "dbg.h"
 #include "wildcard/wildcard.hpp"
+#include "tier1/pathmatchcache.h"
+#include "tier1/utlbufferview.h"
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -64,6 +68,14 @@ auto CPlainFsDriver::Open( const char* pPath, OpenMode pMode ) -> FileDescriptor
 
 		int file{ open( buffer, mode2 ) };
 
+		// content may differ in case from what the game asks for, retry with the on-disk spelling
+		if ( file == -1 && errno == ENOENT ) {
+			char resolved[1024];
+			if ( PathMatch_Resolve( buffer, resolved, sizeof( resolved ), pMode.write ) == kPathMatchChanged ) {
+				file = open( resolved, mode2 );
+			}
+		}
+
 		// Check if we got a valid handle, TODO: Actual error handling
 		if ( file == -1 ) {
 			return nullptr;
@@ -100,6 +112,34 @@ auto CPlainFsDriver::Flush( const FileDescriptor* pDesc ) -> bool {
 auto CPlainFsDriver::Close( const FileDescriptor* pDesc ) -> void {
 	close( static_cast<int>( pDesc->m_Handle ) );
 }
+auto CPlainFsDriver::Map( const FileDescriptor* pDesc, uint64 pOffset, uint32 pCount ) -> CUtlRefCountedMemory* {
+	AssertFatalMsg( pDesc, "Was given a `NULL` file handle!" );
+
+	if ( pCount == 0 ) {
+		return nullptr;
+	}
+
+	#if IsLinux()
+		// mappings must start on a page boundary
+		static const uint64 pageMask{ static_cast<uint64>( sysconf( _SC_PAGESIZE ) ) - 1 };
+		const uint64 start{ pOffset & ~pageMask };
+		const auto slack{ static_cast<uint32>( pOffset - start ) };
+
+		void* mapping{ mmap64( nullptr, slack + pCount, PROT_READ, MAP_PRIVATE, static_cast<int>( pDesc->m_Handle ), static_cast<__off64_t>( start ) ) };
+		if ( mapping == MAP_FAILED ) {
+			return nullptr;
+		}
+		// the caller is about to read all of it, start reading ahead now
+		madvise( mapping, slack + pCount, MADV_WILLNEED );
+
+		const auto unmap{ []( void* pMemory, int pSize, void* pContext ) -> void {
+			munmap( pContext, static_cast<size_t>( static_cast<char*>( pMemory ) - static_cast<char*>( pContext ) ) + pSize );
+		} };
+		return CUtlRefCountedMemory::Wrap( static_cast<char*>( mapping ) + slack, static_cast<int>( pCount ), unmap, mapping );
+	#else
+		return nullptr;
+	#endif
+}
 
 // TODO: Verify if this is feature-complete
 auto CPlainFsDriver::ListDir( const char* pPattern, CUtlVector<const char*>& pResult ) -> bool {
@@ -107,7 +147,15 @@ auto CPlainFsDriver::ListDir( const char* pPattern, CUtlVector<const char*>& pRe
 	V_StripFilename( path );
 
 	// first check if we can open the dir
-	const auto dir{ opendir( path ) };
+	auto dir{ opendir( path ) };
+	#if IsLinux()
+		if ( dir == nullptr && errno == ENOENT ) {
+			char resolved[1024];
+			if ( PathMatch_Resolve( path, resolved, sizeof( resolved ), false ) == kPathMatchChanged ) {
+				dir = opendir( resolved );
+			}
+		}
+	#endif
 	if ( dir == nullptr ) {
 		return false;
 	}
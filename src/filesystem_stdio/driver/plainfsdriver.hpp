@@ -25,6 +25,7 @@ public:
 	auto Write( const FileDescriptor* pDesc, const void* pBuffer, uint32 pCount ) -> int32 override;
 	auto Flush( const FileDescriptor* pDesc ) -> bool override;
 	auto Close( const FileDescriptor* pDesc ) -> void override;
+	auto Map  ( const FileDescriptor* pDesc, uint64 pOffset, uint32 pCount ) -> CUtlRefCountedMemory* override;
 	// generic ops
 	auto ListDir( const char* pPattern, CUtlVector<const char*>& pResult ) -> bool override;
 	auto Create ( const char* pPath, FileType pType, OpenMode pMode ) -> FileDescriptor* override;
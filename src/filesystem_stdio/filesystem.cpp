@@ -9,6 +9,8 @@
 #include "tier0/icommandline.h"
 #include "platform.h"
 #include "utlbuffer.h"
+#include "tier1/utlbufferview.h"
+#include "tier1/pathmatchcache.h"
 #include <algorithm>
 #include <utility>
 // memdbgon must be the last include file in a .cpp file!!!
@@ -716,6 +718,15 @@ void CFileSystemStdio::PrintSearchPaths() {
 			}
 		}
 	}
+
+	#if IsLinux()
+		PathMatchStats_t stats{};
+		PathMatch_GetStats( stats );
+		Log( "---- Case-insensitive path cache ----\n" );
+		Log( "lookups: %llu, exact: %llu, cached: %llu, slow path: %llu (%llu directory scans), failed: %llu\n",
+			stats.m_nLookups, stats.m_nExactHits, stats.m_nCacheHits, stats.m_nSlowPath, stats.m_nDirScans, stats.m_nFailures );
+		Log( "cached directories: %llu, invalidations: %llu\n", stats.m_nCachedDirs, stats.m_nInvalidations );
+	#endif
 }
 
 void CFileSystemStdio::SetWarningFunc( FileWarningFunc_t pWarning ) {
@@ -804,12 +815,16 @@ bool CFileSystemStdio::GetFileTypeForFullPath( char const* pFullPath, wchar_t* b
 
 bool CFileSystemStdio::ReadToBuffer( FileHandle_t hFile, CUtlBuffer& buf, int nMaxBytes, FSAllocFunc_t pfnAlloc ) {
 	AssertMsg( !buf.IsReadOnly(), "was given a read-only buffer!" );
-	int total{ static_cast<int>( Size( hFile ) ) };
+	int total{ static_cast<int>( Size( hFile ) - Tell( hFile ) ) };
 	total = nMaxBytes == 0 ? total : std::min( total, nMaxBytes );
 
-	buf.EnsureCapacity( total );
-	buf.SeekPut( CUtlBuffer::SEEK_HEAD, total );
-	return Read( buf.Base(), buf.Size(), hFile ) == total;
+	// read straight into the buffer, after what it already holds
+	buf.EnsureCapacity( buf.TellPut() + total );
+	if ( Read( buf.PeekPut(), total, hFile ) != total ) {
+		return false;
+	}
+	buf.SeekPut( CUtlBuffer::SEEK_CURRENT, total );
+	return true;
 }
 
 // ---- Optimal IO operations ----
@@ -893,5 +908,38 @@ void CFileSystemStdio::NotifyFileUnloaded( const char* pszFilename, const char*
 
 bool CFileSystemStdio::GetCaseCorrectFullPath_Ptr( const char* pFullPath, char* pDest, int maxLenInChars ) { AssertUnreachable(); return {}; }
 
+bool CFileSystemStdio::ReadFileView( const char* pFileName, const char* pPath, CUtlBufferView& view, int nMaxBytes, int nStartingByte, int nFlags ) {
+	const auto handle{ Open( pFileName, "rb", pPath ) };
+	if ( handle == nullptr ) {
+		return false;
+	}
+	auto* desc{ static_cast<FileDescriptor*>( handle ) };
+
+	const uint32 size{ Size( handle ) };
+	uint32 count{ static_cast<uint32>( nStartingByte ) < size ? size - nStartingByte : 0 };
+	count = nMaxBytes == 0 ? count : std::min( count, static_cast<uint32>( nMaxBytes ) );
+
+	// map it if the driver can, otherwise read it once into shared memory
+	auto* memory{ desc->m_Driver->Map( desc, desc->m_Offset + nStartingByte, count ) };
+	if ( memory != nullptr ) {
+		m_Stats.nReads += 1;
+		m_Stats.nBytesRead += count;
+	} else {
+		memory = CUtlRefCountedMemory::Allocate( static_cast<int>( count ) );
+		Seek( handle, nStartingByte, FILESYSTEM_SEEK_HEAD );
+		if ( Read( memory->Base(), static_cast<int>( count ), handle ) != static_cast<int>( count ) ) {
+			memory->Release();
+			Close( handle );
+			return false;
+		}
+	}
+	Close( handle );
+
+	// the view holds its own reference
+	view.SetView( memory->Base(), memory->Size(), memory, nFlags );
+	memory->Release();
+	return true;
+}
+
 
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CFileSystemStdio, IFileSystem, FILESYSTEM_INTERFACE_VERSION, s_FullFileSystem );
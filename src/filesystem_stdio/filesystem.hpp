@@ -400,6 +400,8 @@ public: // IFileSystem
 	// Returns true on successfully retrieve case-sensitive full path, otherwise false
 	// Prefer using the GetCaseCorrectFullPath template wrapper to calling this directly
 	bool GetCaseCorrectFullPath_Ptr( const char* pFullPath, OUT_Z_CAP( maxLenInChars ) char* pDest, int maxLenInChars ) override;
+
+	bool ReadFileView( const char* pFileName, const char* pPath, CUtlBufferView& view, int nMaxBytes = 0, int nStartingByte = 0, int nFlags = 0 ) override;
 private:
 	struct SearchPath {
 		SearchPath() = default;
@@ -22,6 +22,7 @@
 #include "stringpool.h"
 #include "fmtstr.h"
 #include "multiplay_gamerules.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -29,6 +30,17 @@
 ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose matching output (1 for simple, 2 for rule scoring). If set to 3, it will only show response success/failure for npc_selected NPCs." );
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
+ConVar rr_rule_index( "rr_rule_index", "1", FCVAR_NONE, "Only score the rules whose most selective required criterion matches the query, instead of every rule." );
+
+static void RecordQueriesChangedCallback( IConVar *var, const char *pOldValue, float flOldValue );
+ConVar rr_record_queries( "rr_record_queries", "0", FCVAR_NONE, "Record this many criteria sets passed to the response system, for rr_benchmark_rules. Changing it discards the queries recorded so far.", RecordQueriesChangedCallback );
+
+static CUtlVector< AI_CriteriaSet > g_RecordedQueries;
+
+static void RecordQueriesChangedCallback( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	g_RecordedQueries.Purge();
+}
 
 static CUtlSymbolTable g_RS;
 
@@ -59,6 +71,7 @@ public:
 		maxequals = false;
 		maxval = 0.0f;
 		minval = 0.0f;
+		tokenval = 0.0f;
 
 		token = UTL_INVAL_SYMBOL;
 		rawtoken = UTL_INVAL_SYMBOL;
@@ -110,6 +123,7 @@ public:
 
 	float	maxval;
 	float	minval;
+	float	tokenval;		// token parsed as a number, for isnumeric matchers
 
 	bool	valid : 1;      //1
 	bool	isnumeric : 1;  //2
@@ -575,6 +589,8 @@ public:
 
 	void		DumpDictionary( const char *pszName );
 
+	void		BenchmarkRules( const CUtlVector< AI_CriteriaSet > &queries, int nPasses );
+
 protected:
 
 	virtual const char *GetScriptFile( void ) = 0;
@@ -683,6 +699,12 @@ public:
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	float		FindBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool bUseIndex, CUtlVector< int > &bestrules );
+
+	void		BuildRuleIndex();
+	void		ClearRuleIndex();
+	void		GatherCandidateRules( const AI_CriteriaSet& set, CUtlVector< int > &candidates );
+	bool		GetIndexableCriterion( int icriterion, const char **ppszName, const char **ppszValue );
 
 	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false );
 	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ );
@@ -710,6 +732,15 @@ public:
 	CUtlDict< Rule, short >	m_Rules;
 	CUtlDict< Enumeration, short > m_Enumerations;
 
+	// Every rule that has a required criterion comparing a name against a
+	// plain string is filed under the least shared such name and value, and
+	// can only match queries carrying that value. Other rules are always scored.
+	CUtlDict< int, short >	m_RuleIndexNames;				// criterion name -> m_RuleIndexValues slot
+	CUtlVector< CUtlDict< int, int > * > m_RuleIndexValues;	// criterion value -> m_RuleIndexBuckets slot
+	CUtlVector< CUtlVector< int > > m_RuleIndexBuckets;	// rule indices, ascending
+	CUtlVector< int >		m_RuleIndexAlways;
+	bool		m_bRuleIndexDirty;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -762,6 +793,7 @@ CResponseSystem::CResponseSystem()
 	m_bUnget = false;
 	m_bPrecache = true;
 	m_bCustomManagable = false;
+	m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -769,6 +801,7 @@ CResponseSystem::CResponseSystem()
 //-----------------------------------------------------------------------------
 CResponseSystem::~CResponseSystem()
 {
+	ClearRuleIndex();
 }
 
 //-----------------------------------------------------------------------------
@@ -817,6 +850,7 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+	ClearRuleIndex();
 }
 
 //-----------------------------------------------------------------------------
@@ -988,6 +1022,7 @@ void CResponseSystem::ComputeMatcher( Criteria *c, Matcher& matcher )
 
 	matcher.SetToken( token );
 	matcher.SetRaw( rawtoken );
+	matcher.tokenval = (float)atof( token );
 	matcher.valid = true;
 }
 
@@ -996,11 +1031,19 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	if ( !m.valid )
 		return false;
 
-	float v = (float)atof( setValue );
-	if ( setValue[0] == '[' )
+	// Plain string matchers never look at the value as a number
+	float v = 0.0f;
+	if ( m.isnumeric || m.usemin || m.usemax )
 	{
-		bool found = false;
-		v = LookupEnumeration( setValue, found );
+		if ( setValue[0] == '[' )
+		{
+			bool found = false;
+			v = LookupEnumeration( setValue, found );
+		}
+		else
+		{
+			v = (float)atof( setValue );
+		}
 	}
 	
 	int minmaxcount = 0;
@@ -1047,7 +1090,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	{
 		if ( m.isnumeric )
 		{
-			if ( v == (float)atof( m.GetToken() ) )
+			if ( v == m.tokenval )
 				return false;
 		}
 		else
@@ -1066,7 +1109,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 		if ( !setValue || !setValue[0] )
 			return false;
 
-		return v == (float)atof( m.GetToken() );
+		return v == m.tokenval;
 	}
 
 	return !Q_stricmp( setValue, m.GetToken() ) ? true : false;
@@ -1685,27 +1728,7 @@ bool CResponseSystem::GetBestResponse( ResponseSearchResult& searchResult, Rule
 int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
 {
 	CUtlVector< int >	bestrules;
-	float bestscore = 0.001f;
-
-	int c = m_Rules.Count();
-	int i;
-	for ( i = 0; i < c; i++ )
-	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
-		// Check equals so that we keep track of all matching rules
-		if ( score >= bestscore )
-		{
-			// Reset bucket
-			if( score != bestscore )
-			{
-				bestscore = score;
-				bestrules.RemoveAll();
-			}
-
-			// Add to bucket
-			bestrules.AddToTail( i );
-		}
-	}
+	FindBestMatchingRules( set, verbose, rr_rule_index.GetBool(), bestrules );
 
 	int bestCount = bestrules.Count();
 	if ( bestCount <= 0 )
@@ -1723,6 +1746,264 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 	return bestrules[ idx ];
 }
 
+static inline void AddToBestRules( float score, int irule, float &bestscore, CUtlVector< int > &bestrules )
+{
+	// Check equals so that we keep track of all matching rules
+	if ( score >= bestscore )
+	{
+		// Reset bucket
+		if( score != bestscore )
+		{
+			bestscore = score;
+			bestrules.RemoveAll();
+		}
+
+		// Add to bucket
+		bestrules.AddToTail( irule );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills bestrules with the indices of the rules sharing the best
+//			score, in rule order, and returns that score
+//-----------------------------------------------------------------------------
+float CResponseSystem::FindBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool bUseIndex, CUtlVector< int > &bestrules )
+{
+	float bestscore = 0.001f;
+	bestrules.RemoveAll();
+
+	// Debug output wants to see every rule scored
+	const char *pszDebugRule = rr_debugrule.GetString();
+	if ( bUseIndex && !verbose && !( pszDebugRule && pszDebugRule[0] ) )
+	{
+		if ( m_bRuleIndexDirty )
+		{
+			BuildRuleIndex();
+		}
+
+		// Rules that aren't candidates would be excluded by a required criterion,
+		// so scoring the candidates in order gives the same bucket as a full scan
+		CUtlVector< int > candidates;
+		GatherCandidateRules( set, candidates );
+
+		int c = candidates.Count();
+		for ( int i = 0; i < c; i++ )
+		{
+			AddToBestRules( ScoreCriteriaAgainstRule( set, candidates[ i ] ), candidates[ i ], bestscore, bestrules );
+		}
+		return bestscore;
+	}
+
+	int c = m_Rules.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		AddToBestRules( ScoreCriteriaAgainstRule( set, i, verbose ), i, bestscore, bestrules );
+	}
+	return bestscore;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the name and value of a criterion that only matches a
+//			query carrying exactly that value
+//-----------------------------------------------------------------------------
+bool CResponseSystem::GetIndexableCriterion( int icriterion, const char **ppszName, const char **ppszValue )
+{
+	Criteria *c = &m_Criteria[ icriterion ];
+	if ( !c->required || c->IsSubCriteriaType() || !c->name )
+		return false;
+
+	// Numbers compare by value, so "1" and "1.0" are the same; keep them out of a string index
+	Matcher &m = c->matcher;
+	if ( !m.valid || m.isnumeric || m.notequal || m.usemin || m.usemax )
+		return false;
+
+	const char *pszValue = m.GetToken();
+	if ( !pszValue[0] )
+		return false;
+
+	*ppszName = c->name;
+	*ppszValue = pszValue;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Files every rule under its most selective required criterion
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	ClearRuleIndex();
+
+	// Count how many rules require each name and value
+	CUtlDict< int, int > keyCounts;
+	char key[ 256 ];
+
+	int nRules = m_Rules.Count();
+	for ( int i = 0; i < nRules; i++ )
+	{
+		Rule &rule = m_Rules[ i ];
+		for ( int j = 0; j < rule.m_Criteria.Count(); j++ )
+		{
+			const char *pszName, *pszValue;
+			if ( !GetIndexableCriterion( rule.m_Criteria[ j ], &pszName, &pszValue ) )
+				continue;
+
+			Q_snprintf( key, sizeof( key ), "%s\n%s", pszName, pszValue );
+			int iKey = keyCounts.Find( key );
+			if ( iKey == keyCounts.InvalidIndex() )
+			{
+				keyCounts.Insert( key, 1 );
+			}
+			else
+			{
+				keyCounts[ iKey ]++;
+			}
+		}
+	}
+
+	// File each rule under its least shared key
+	for ( int i = 0; i < nRules; i++ )
+	{
+		Rule &rule = m_Rules[ i ];
+		const char *pszBestName = NULL, *pszBestValue = NULL;
+		int nBestCount = INT_MAX;
+
+		for ( int j = 0; j < rule.m_Criteria.Count(); j++ )
+		{
+			const char *pszName, *pszValue;
+			if ( !GetIndexableCriterion( rule.m_Criteria[ j ], &pszName, &pszValue ) )
+				continue;
+
+			Q_snprintf( key, sizeof( key ), "%s\n%s", pszName, pszValue );
+			int nCount = keyCounts[ keyCounts.Find( key ) ];
+			if ( nCount < nBestCount )
+			{
+				nBestCount = nCount;
+				pszBestName = pszName;
+				pszBestValue = pszValue;
+			}
+		}
+
+		if ( !pszBestName )
+		{
+			m_RuleIndexAlways.AddToTail( i );
+			continue;
+		}
+
+		int iName = m_RuleIndexNames.Find( pszBestName );
+		if ( iName == m_RuleIndexNames.InvalidIndex() )
+		{
+			iName = m_RuleIndexNames.Insert( pszBestName, m_RuleIndexValues.AddToTail( new CUtlDict< int, int > ) );
+		}
+
+		CUtlDict< int, int > *pValues = m_RuleIndexValues[ m_RuleIndexNames[ iName ] ];
+		int iValue = pValues->Find( pszBestValue );
+		if ( iValue == pValues->InvalidIndex() )
+		{
+			iValue = pValues->Insert( pszBestValue, m_RuleIndexBuckets.AddToTail() );
+		}
+		m_RuleIndexBuckets[ pValues->Element( iValue ) ].AddToTail( i );
+	}
+
+	m_bRuleIndexDirty = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void CResponseSystem::ClearRuleIndex()
+{
+	m_RuleIndexNames.RemoveAll();
+	m_RuleIndexValues.PurgeAndDeleteElements();
+	m_RuleIndexBuckets.Purge();
+	m_RuleIndexAlways.Purge();
+	m_bRuleIndexDirty = true;
+}
+
+static int __cdecl RuleIndexCompare( const int *lhs, const int *rhs )
+{
+	return *lhs - *rhs;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects, in rule order, the rules that can possibly match the set
+//-----------------------------------------------------------------------------
+void CResponseSystem::GatherCandidateRules( const AI_CriteriaSet& set, CUtlVector< int > &candidates )
+{
+	candidates.CopyArray( m_RuleIndexAlways.Base(), m_RuleIndexAlways.Count() );
+
+	// A rule is filed under one name only and the set holds each name once, so there are no duplicates
+	int c = set.GetCount();
+	for ( int i = 0; i < c; i++ )
+	{
+		int iName = m_RuleIndexNames.Find( set.GetName( i ) );
+		if ( iName == m_RuleIndexNames.InvalidIndex() )
+			continue;
+
+		CUtlDict< int, int > *pValues = m_RuleIndexValues[ m_RuleIndexNames[ iName ] ];
+		int iValue = pValues->Find( set.GetValue( i ) );
+		if ( iValue == pValues->InvalidIndex() )
+			continue;
+
+		const CUtlVector< int > &rules = m_RuleIndexBuckets[ pValues->Element( iValue ) ];
+		candidates.AddMultipleToTail( rules.Count(), rules.Base() );
+	}
+
+	candidates.Sort( RuleIndexCompare );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times rule matching over recorded queries with and without the
+//			rule index, and checks that both find the same rules
+//-----------------------------------------------------------------------------
+void CResponseSystem::BenchmarkRules( const CUtlVector< AI_CriteriaSet > &queries, int nPasses )
+{
+	BuildRuleIndex();
+
+	CUtlVector< int > bestrules;
+	double flTime[2] = { 0, 0 };
+
+	// 0: every rule, 1: candidates from the index
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		CFastTimer timer;
+		timer.Start();
+		for ( int i = 0; i < nPasses; i++ )
+		{
+			for ( int j = 0; j < queries.Count(); j++ )
+			{
+				FindBestMatchingRules( queries[ j ], false, pass != 0, bestrules );
+			}
+		}
+		timer.End();
+		flTime[pass] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	int nMismatches = 0;
+	int nCandidates = 0;
+	CUtlVector< int > indexedrules;
+	CUtlVector< int > candidates;
+	for ( int j = 0; j < queries.Count(); j++ )
+	{
+		float flScore = FindBestMatchingRules( queries[ j ], false, false, bestrules );
+		float flIndexedScore = FindBestMatchingRules( queries[ j ], false, true, indexedrules );
+		if ( flScore != flIndexedScore || bestrules.Count() != indexedrules.Count() ||
+			 V_memcmp( bestrules.Base(), indexedrules.Base(), bestrules.Count() * sizeof( int ) ) )
+		{
+			nMismatches++;
+		}
+
+		GatherCandidateRules( queries[ j ], candidates );
+		nCandidates += candidates.Count();
+	}
+
+	int nQueries = queries.Count() * nPasses;
+	Msg( "Response rule benchmark: %d queries x %d passes against %d rules\n", queries.Count(), nPasses, m_Rules.Count() );
+	Msg( "  index: %d criterion names, %d rules always scored, %.1f candidates per query\n", m_RuleIndexNames.Count(), m_RuleIndexAlways.Count(), queries.Count() ? (float)nCandidates / queries.Count() : 0.0f );
+	Msg( "  every rule: %8.3f ms total, %7.4f ms per query\n", flTime[0], flTime[0] / nQueries );
+	Msg( "  indexed:    %8.3f ms total, %7.4f ms per query\n", flTime[1], flTime[1] / nQueries );
+	Msg( "  %d queries matched different rules\n", nMismatches );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : set - 
@@ -1732,6 +2013,11 @@ bool CResponseSystem::FindBestResponse( const AI_CriteriaSet& set, AI_Response&
 {
 	bool valid = false;
 
+	if ( g_RecordedQueries.Count() < rr_record_queries.GetInt() )
+	{
+		g_RecordedQueries.AddToTail( set );
+	}
+
 	int iDbgResponse = rr_debugresponses.GetInt();
 	bool showRules = ( iDbgResponse == 2 );
 	bool showResult = ( iDbgResponse == 1 || iDbgResponse == 2 );
@@ -2607,6 +2893,7 @@ void CResponseSystem::ParseRule( void )
 	if ( validRule )
 	{
 		m_Rules.Insert( ruleName, newRule );
+		m_bRuleIndexDirty = true;
 	}
 	else
 	{
@@ -2800,6 +3087,7 @@ void CResponseSystem::CopyRuleFrom( Rule *pSrcRule, int iRule, CResponseSystem *
 
 	// Add rule.
 	pCustomSystem->m_Rules.Insert( m_Rules.GetElementName( iRule ), dstRule );
+	pCustomSystem->m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -3047,6 +3335,21 @@ CON_COMMAND( rr_reloadresponsesystems, "Reload all response system scripts." )
 #endif
 }
 
+CON_COMMAND_F( rr_benchmark_rules, "Replays the queries recorded with rr_record_queries against the response rules, with and without the rule index. Usage: rr_benchmark_rules [passes]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !g_RecordedQueries.Count() )
+	{
+		Msg( "No queries recorded, set rr_record_queries to the number of queries to record and play for a while\n" );
+		return;
+	}
+
+	int nPasses = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 10;
+	defaultresponsesytem.BenchmarkRules( g_RecordedQueries, nPasses );
+}
+
 static short RESPONSESYSTEM_SAVE_RESTORE_VERSION = 1;
 
 // note:  this won't save/restore settings from instanced response systems.  Could add that with a CDefSaveRestoreOps implementation if needed
@@ -9,12 +9,25 @@
 #include "ServerNetworkProperty.h"
 #include "tier0/dbg.h"
 #include "gameinterface.h"
+#include "tier0/fasttimer.h"
+#include "tier1/bitbuf.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 extern CTimedEventMgr g_NetworkPropertyEventMgr;
 
+bool CServerNetworkProperty::s_bTrackChangedProps = false;
+
+static void TrackChangedPropsChanged( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	ConVarRef cvar( var );
+	CServerNetworkProperty::SetTrackChangedProps( cvar.GetBool() );
+}
+
+// Off until something reads the changed props, networkvar writes are cheaper without it
+ConVar sv_track_changed_props( "sv_track_changed_props", "0", 0, "Record which send props each networkvar change touches", TrackChangedPropsChanged );
+
 
 //-----------------------------------------------------------------------------
 // Save/load
@@ -49,6 +62,8 @@ CServerNetworkProperty::~CServerNetworkProperty()
 
 	engine->CleanUpEntityClusterList( &m_PVSInfo );
 
+	delete [] m_pChangedProps;
+
 	// remove the attached edict if it exists
 	DetachEdict();
 }
@@ -66,6 +81,9 @@ void CServerNetworkProperty::Init( CBaseEntity *pEntity )
 	m_bPendingStateChange = false;
 	m_PVSInfo.m_nClusterCount = 0;
 	m_TimerEvent.Init( &g_NetworkPropertyEventMgr, this );
+	m_pSendPropMap = NULL;
+	m_pChangedProps = NULL;
+	m_bAllPropsChanged = false;
 }
 
 
@@ -299,10 +317,335 @@ void CServerNetworkProperty::FireEvent()
 	// trigger a state change in the edict.
 	if ( m_bPendingStateChange )
 	{
+		if ( s_bTrackChangedProps )
+		{
+			RecordChangedProps( -1 );
+		}
 		m_pPev->StateChanged();
 		m_bPendingStateChange = false;
 	}
 }
 
 
+//-----------------------------------------------------------------------------
+// Changed send props
+//-----------------------------------------------------------------------------
+const CSendTablePropMap* CServerNetworkProperty::GetSendPropMap()
+{
+	if ( !m_pSendPropMap )
+	{
+		ServerClass *pServerClass = GetServerClass();
+		if ( pServerClass && pServerClass->m_pTable )
+		{
+			m_pSendPropMap = CSendTablePropMap::Get( pServerClass->m_pTable );
+		}
+	}
+	return m_pSendPropMap;
+}
+
+void CServerNetworkProperty::RecordChangedProps( int varOffset )
+{
+	// The engine clears the edict's change flags when it packs the entity, so whatever
+	// was recorded while they were set has been sent
+	bool bWasClean = !m_pPev->HasStateChanged();
+	if ( bWasClean )
+	{
+		m_bAllPropsChanged = false;
+		if ( m_pChangedProps )
+		{
+			V_memcpy( m_pChangedProps, m_pSendPropMap->GetUnmappedProps(), m_pSendPropMap->GetNumPropWords() * sizeof( uint32 ) );
+		}
+	}
+	else if ( m_bAllPropsChanged || ( m_pPev->m_fStateFlags & FL_FULL_EDICT_CHANGED ) )
+	{
+		m_bAllPropsChanged = true;
+		return;
+	}
+
+	if ( varOffset < 0 )
+	{
+		m_bAllPropsChanged = true;
+		return;
+	}
+
+	// Until the engine has asked for the server class the entity may still be constructing,
+	// and it hasn't been sent yet anyway
+	if ( !m_pSendPropMap )
+	{
+		if ( !m_pServerClass || !m_pServerClass->m_pTable )
+		{
+			m_bAllPropsChanged = true;
+			return;
+		}
+		m_pSendPropMap = CSendTablePropMap::Get( m_pServerClass->m_pTable );
+	}
+
+	const unsigned short *pProps;
+	int nProps;
+	if ( !m_pSendPropMap->FindPropsForOffset( varOffset, &pProps, &nProps ) )
+	{
+		m_bAllPropsChanged = true;
+		return;
+	}
+
+	if ( !m_pChangedProps )
+	{
+		m_pChangedProps = new uint32[ m_pSendPropMap->GetNumPropWords() ];
+		V_memcpy( m_pChangedProps, m_pSendPropMap->GetUnmappedProps(), m_pSendPropMap->GetNumPropWords() * sizeof( uint32 ) );
+
+		// Changes made before there was anywhere to record them
+		if ( !bWasClean )
+		{
+			m_bAllPropsChanged = true;
+			return;
+		}
+	}
+
+	for ( int i = 0; i < nProps; i++ )
+	{
+		m_pChangedProps[ pProps[i] >> 5 ] |= ( 1u << ( pProps[i] & 31 ) );
+	}
+}
+
+bool CServerNetworkProperty::GetLastChangedProps( const uint32 **ppChangedProps )
+{
+	if ( !s_bTrackChangedProps || ( !m_pChangedProps && !m_bAllPropsChanged ) )
+		return false;
+
+	*ppChangedProps = m_bAllPropsChanged ? NULL : m_pChangedProps;
+	return true;
+}
 
+void CServerNetworkProperty::SetTrackChangedProps( bool bTrack )
+{
+	if ( bTrack && !s_bTrackChangedProps )
+	{
+		// Nothing was recorded while tracking was off, so no entity's bits can be trusted
+		for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+		{
+			pEntity->NetworkProp()->m_bAllPropsChanged = true;
+		}
+	}
+	s_bTrackChangedProps = bTrack;
+}
+
+bool CServerNetworkProperty::GetChangedProps( const uint32 **ppChangedProps )
+{
+	if ( !m_pPev || !m_pPev->HasStateChanged() )
+		return false;
+
+	if ( ( m_pPev->m_fStateFlags & FL_FULL_EDICT_CHANGED ) || !GetLastChangedProps( ppChangedProps ) )
+	{
+		*ppChangedProps = NULL;
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs a prop's send proxy and writes its value, roughly the work the
+//			engine does for each prop it delta encodes
+//-----------------------------------------------------------------------------
+static void EncodeSendPropForBenchmark( const CSendTablePropMap *pMap, int iProp, const char *pObject, int objectID, bf_write &buf )
+{
+	const SendProp *pProp = pMap->GetProp( iProp );
+	const SendProp *pElementProp = pMap->GetElementProp( iProp );
+	const char *pStruct = pObject + pMap->GetStructOffset( iProp );
+	const char *pData = pObject + pMap->GetPropOffset( iProp );
+
+	int nElements = 1;
+	int stride = 0;
+	if ( pProp->GetType() == DPT_Array )
+	{
+		nElements = pProp->GetNumElements();
+		stride = pProp->GetElementStride();
+		buf.WriteUBitLong( nElements, pProp->GetNumArrayLengthBits() );
+	}
+
+	SendVarProxyFn proxy = pElementProp->GetProxyFn();
+	if ( !proxy )
+		return;
+
+	int nBits = clamp( pElementProp->m_nBits, 1, 32 );
+	unsigned int mask = ( nBits == 32 ) ? 0xFFFFFFFF : ( ( 1u << nBits ) - 1 );
+
+	for ( int iElement = 0; iElement < nElements; iElement++ )
+	{
+		DVariant var;
+		proxy( pElementProp, pStruct, pData + iElement * stride, &var, iElement, objectID );
+
+		switch ( pElementProp->GetType() )
+		{
+		case DPT_Int:
+			buf.WriteUBitLong( (unsigned int)var.m_Int & mask, nBits );
+			break;
+
+		case DPT_Float:
+			buf.WriteBitFloat( var.m_Float );
+			break;
+
+		case DPT_Vector:
+			buf.WriteBitFloat( var.m_Vector[0] );
+			buf.WriteBitFloat( var.m_Vector[1] );
+			buf.WriteBitFloat( var.m_Vector[2] );
+			break;
+
+		case DPT_VectorXY:
+			buf.WriteBitFloat( var.m_Vector[0] );
+			buf.WriteBitFloat( var.m_Vector[1] );
+			break;
+
+		case DPT_String:
+			buf.WriteString( var.m_pString ? var.m_pString : "" );
+			break;
+
+		default:
+			buf.WriteUBitLong( (unsigned int)var.m_Int, 32 );
+			break;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times encoding a 64 player snapshot sending every prop, and then
+//			sending only the props each player changed most recently. Players
+//			are repeated to fill 64 slots when fewer are connected. Also times
+//			what networkvar writes cost with and without sv_track_changed_props.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( sv_benchmark_netprops, "Times encoding every send prop of a 64 player snapshot against only the changed ones, and networkvar writes with and without change tracking. Usage: sv_benchmark_netprops [snapshots]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nSnapshots = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 100;
+
+	CUtlVector<CBasePlayer *> players;
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( pPlayer && pPlayer->edict() && pPlayer->NetworkProp()->GetSendPropMap() )
+		{
+			players.AddToTail( pPlayer );
+		}
+	}
+
+	if ( !players.Count() )
+	{
+		Msg( "sv_benchmark_netprops needs at least one player\n" );
+		return;
+	}
+
+	const int nSlots = 64;
+	int nRecorded = 0;
+	for ( int i = 0; i < players.Count(); i++ )
+	{
+		const uint32 *pChangedProps;
+		if ( players[i]->NetworkProp()->GetLastChangedProps( &pChangedProps ) && pChangedProps )
+		{
+			nRecorded++;
+		}
+	}
+
+	CUtlVector<unsigned char> buffer;
+	buffer.SetCount( 65536 );
+	bf_write buf( "sv_benchmark_netprops", buffer.Base(), buffer.Count() );
+
+	double flTime[2] = { 0, 0 };
+	int64 nPropsSent[2] = { 0, 0 };
+	int64 nBitsWritten[2] = { 0, 0 };
+
+	// 0: every prop, 1: only changed props
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		CFastTimer timer;
+		timer.Start();
+		for ( int iSnapshot = 0; iSnapshot < nSnapshots; iSnapshot++ )
+		{
+			for ( int iSlot = 0; iSlot < nSlots; iSlot++ )
+			{
+				CBasePlayer *pPlayer = players[iSlot % players.Count()];
+				CServerNetworkProperty *pNetworkProp = pPlayer->NetworkProp();
+				const CSendTablePropMap *pMap = pNetworkProp->GetSendPropMap();
+
+				// Players that haven't recorded a partial change have to send everything
+				const uint32 *pChangedProps = NULL;
+				if ( pass == 1 )
+				{
+					pNetworkProp->GetLastChangedProps( &pChangedProps );
+				}
+
+				buf.Reset();
+				for ( int iProp = 0; iProp < pMap->GetNumProps(); iProp++ )
+				{
+					if ( pChangedProps && !( pChangedProps[iProp >> 5] & ( 1u << ( iProp & 31 ) ) ) )
+						continue;
+
+					// Props the proxies compute from elsewhere can't be read by offset
+					if ( pMap->GetPropOffset( iProp ) < 0 )
+						continue;
+
+					EncodeSendPropForBenchmark( pMap, iProp, (const char *)pPlayer, pNetworkProp->entindex(), buf );
+					nPropsSent[pass]++;
+				}
+				nBitsWritten[pass] += buf.GetNumBitsWritten();
+			}
+		}
+		timer.End();
+		flTime[pass] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	// Setter overhead: mark every prop of every slot changed, untracked and then tracked
+	const CSendTablePropMap *pMap = players[0]->NetworkProp()->GetSendPropMap();
+	CUtlVector<unsigned short> offsets;
+	for ( int iProp = 0; iProp < pMap->GetNumProps(); iProp++ )
+	{
+		int offset = pMap->GetPropOffset( iProp );
+		if ( offset >= 0 && offset <= 0xFFFF )
+		{
+			offsets.AddToTail( (unsigned short)offset );
+		}
+	}
+
+	bool bWasTracking = CServerNetworkProperty::IsTrackingChangedProps();
+	double flSetterTime[2] = { 0, 0 };
+	int64 nWrites = (int64)nSnapshots * nSlots * offsets.Count();
+
+	// 0: untracked, 1: tracked
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		CServerNetworkProperty::SetTrackChangedProps( pass == 1 );
+
+		CFastTimer timer;
+		timer.Start();
+		for ( int iSnapshot = 0; iSnapshot < nSnapshots; iSnapshot++ )
+		{
+			for ( int iSlot = 0; iSlot < nSlots; iSlot++ )
+			{
+				CServerNetworkProperty *pNetworkProp = players[iSlot % players.Count()]->NetworkProp();
+				for ( int i = 0; i < offsets.Count(); i++ )
+				{
+					pNetworkProp->NetworkStateChanged( offsets[i] );
+				}
+			}
+		}
+		timer.End();
+		flSetterTime[pass] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	// Turning tracking back on drops whatever the untracked pass left behind
+	CServerNetworkProperty::SetTrackChangedProps( false );
+	CServerNetworkProperty::SetTrackChangedProps( bWasTracking );
+
+	Msg( "Send prop encode benchmark: %d snapshots of %d players (%d connected, %d with recorded changes)\n", nSnapshots, nSlots, players.Count(), nRecorded );
+	Msg( "  %s: %d props\n", players[0]->GetServerClass()->GetName(), pMap->GetNumProps() );
+	Msg( "  all props:     %8.3f ms total, %7.4f ms per snapshot, %.1f props and %.0f bits per player\n", flTime[0], flTime[0] / nSnapshots, (double)nPropsSent[0] / ( nSnapshots * nSlots ), (double)nBitsWritten[0] / ( nSnapshots * nSlots ) );
+	Msg( "  changed props: %8.3f ms total, %7.4f ms per snapshot, %.1f props and %.0f bits per player\n", flTime[1], flTime[1] / nSnapshots, (double)nPropsSent[1] / ( nSnapshots * nSlots ), (double)nBitsWritten[1] / ( nSnapshots * nSlots ) );
+	if ( nWrites )
+	{
+		Msg( "  networkvar writes: %lld per pass, untracked %8.3f ms (%.1f ns each), tracked %8.3f ms (%.1f ns each)\n", nWrites, flSetterTime[0], flSetterTime[0] * 1e6 / nWrites, flSetterTime[1], flSetterTime[1] * 1e6 / nWrites );
+	}
+	if ( !bWasTracking )
+	{
+		Msg( "  sv_track_changed_props is 0, so no changes were recorded\n" );
+	}
+}
@@ -54,6 +54,22 @@ public:
 	void NetworkStateChanged();
 	void NetworkStateChanged( unsigned short offset );
 
+	// Which send props have changed since the engine last packed the entity, as bits indexed
+	// like GetSendPropMap(). Returns false if nothing has changed; *ppChangedProps is NULL
+	// if every prop has to be treated as changed.
+	bool GetChangedProps( const uint32** ppChangedProps );
+
+	// The props of the entity's most recent change, which stay recorded after the engine has
+	// packed them. Returns false if nothing has been recorded.
+	bool GetLastChangedProps( const uint32** ppChangedProps );
+
+	// Changed props are only recorded while sv_track_changed_props is set, since every
+	// networkvar write pays for it. Turning it on treats every entity as fully changed.
+	static void SetTrackChangedProps( bool bTrack );
+	static bool IsTrackingChangedProps() { return s_bTrackChangedProps; }
+
+	const CSendTablePropMap* GetSendPropMap();
+
 	// Marks the PVS information dirty
 	void MarkPVSInformationDirty();
 
@@ -102,6 +118,9 @@ private:
 	// Marks the networkable that it will should transmit
 	void SetTransmit( CCheckTransmitInfo* pInfo );
 
+	// Records the props sending the variable at this offset, -1 for all of them
+	void RecordChangedProps( int varOffset );
+
 private:
 	CBaseEntity* m_pOuter;
 	// CBaseTransmitProxy *m_pTransmitProxy;
@@ -117,6 +136,13 @@ private:
 	CEventRegister m_TimerEvent;
 	bool m_bPendingStateChange : 1;
 
+	// Send props changed since the engine last packed the entity
+	const CSendTablePropMap* m_pSendPropMap;
+	uint32* m_pChangedProps;
+	bool m_bAllPropsChanged : 1;
+
+	static bool s_bTrackChangedProps;
+
 	//	friend class CBaseTransmitProxy;
 };
 
@@ -163,8 +189,12 @@ inline void CServerNetworkProperty::SetNetworkParent( EHANDLE hParent ) {
 // Methods related to the net state mgr
 //-----------------------------------------------------------------------------
 inline void CServerNetworkProperty::NetworkStateForceUpdate() {
-	if ( m_pPev )
+	if ( m_pPev ) {
+		if ( s_bTrackChangedProps ) {
+			RecordChangedProps( -1 );
+		}
 		m_pPev->StateChanged();
+	}
 }
 
 inline void CServerNetworkProperty::NetworkStateChanged() {
@@ -174,8 +204,12 @@ inline void CServerNetworkProperty::NetworkStateChanged() {
 		// when the timer goes off.
 		m_bPendingStateChange = true;
 	} else {
-		if ( m_pPev )
+		if ( m_pPev ) {
+			if ( s_bTrackChangedProps ) {
+				RecordChangedProps( -1 );
+			}
 			m_pPev->StateChanged();
+		}
 	}
 }
 
@@ -186,8 +220,12 @@ inline void CServerNetworkProperty::NetworkStateChanged( unsigned short varOffse
 		// when the timer goes off.
 		m_bPendingStateChange = true;
 	} else {
-		if ( m_pPev )
+		if ( m_pPev ) {
+			if ( s_bTrackChangedProps ) {
+				RecordChangedProps( varOffset );
+			}
 			m_pPev->StateChanged( varOffset );
+		}
 	}
 }
 
@@ -15,6 +15,7 @@
 #include "ai_link.h"
 #include "ai_network.h"
 #include "ai_networkmanager.h"
+#include "ai_routecache.h"
 #include "saverestore_utlvector.h"
 #include "editor_sendcommand.h"
 #include "bitstring.h"
@@ -485,6 +486,9 @@ void CAI_DynamicLink::SetLinkState(void)
 		CAI_Link* pLink = FindLink();
 		if ( pLink )
 		{
+			// A link coming on may open a shorter route than the cached ones
+			g_AIRouteCache.Invalidate();
+
 			pLink->m_pDynamicLink = this;
 			if (m_nLinkState == LINK_OFF)
 			{
@@ -16,11 +16,14 @@
 #include "ai_navigator.h"
 #include "world.h"
 #include "ai_moveprobe.h"
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 ConVar ai_no_node_cache( "ai_no_node_cache", "0" );
+ConVar ai_node_grid( "ai_node_grid", "1", 0, "Look up nodes near a point through the node grid rather than testing every node" );
 
 extern float MOVE_HEIGHT_EPSILON;
 
@@ -109,6 +112,12 @@ CAI_Network::CAI_Network()
 	m_iNumNodes				= 0;		// Number of nodes in this network
 	m_pAInode				= NULL;		// Array of all nodes in this network
 
+	m_vGridMins.Init();
+	m_flGridCellSize		= NODE_GRID_MIN_CELL_SIZE;
+	m_nGridCellsX			= 0;
+	m_nGridCellsY			= 0;
+	m_nGridNodes			= 0;
+
 	m_iNearestCacheNext	= NEARNODE_CACHE_SIZE - 1;
 	// Force empty node caches to be rebuild
 	for (int node=0;node<NEARNODE_CACHE_SIZE;node++)
@@ -209,9 +218,13 @@ int CAI_Network::ListNodesInBox( CNodeList &list, int maxListCount, const Vector
 	float flClosest = 1000000.0 * 1000000;
 	int closest = 0;
 
-// UNDONE: Store the nodes in a tree and query the tree instead of the entire list!!!
-	for ( int node = 0; node < m_iNumNodes; node++ )
+	// Only test the nodes in grid cells the box touches, in ID order like the full scan
+	bool bUseGrid = GatherGridNodesInBox( mins, maxs, m_GridGathered );
+	int nCandidates = ( bUseGrid ) ? m_GridGathered.Count() : m_iNumNodes;
+
+	for ( int i = 0; i < nCandidates; i++ )
 	{
+		int node = ( bUseGrid ) ? m_GridGathered[i] : i;
 		CAI_Node *pNode = m_pAInode[node];
 		const Vector &origin = pNode->GetOrigin();
 		// in box?
@@ -252,6 +265,121 @@ int CAI_Network::ListNodesInBox( CNodeList &list, int maxListCount, const Vector
 	return list.Count();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Buckets the nodes by origin so ListNodesInBox() only has to look
+//			at the nodes near the box. Sized so a map never needs more than
+//			NODE_GRID_MAX_CELLS cells on a side.
+//-----------------------------------------------------------------------------
+
+void CAI_Network::BuildNodeGrid()
+{
+	m_nGridNodes = m_iNumNodes;
+	m_nGridCellsX = 0;
+	m_nGridCellsY = 0;
+	m_GridCellStart.RemoveAll();
+	m_GridNodes.RemoveAll();
+
+	if ( !m_iNumNodes )
+		return;
+
+	Vector2D mins( FLT_MAX, FLT_MAX );
+	Vector2D maxs( -FLT_MAX, -FLT_MAX );
+	for ( int node = 0; node < m_iNumNodes; node++ )
+	{
+		const Vector &origin = m_pAInode[node]->GetOrigin();
+		mins.x = MIN( mins.x, origin.x );
+		mins.y = MIN( mins.y, origin.y );
+		maxs.x = MAX( maxs.x, origin.x );
+		maxs.y = MAX( maxs.y, origin.y );
+	}
+
+	float flExtent = MAX( maxs.x - mins.x, maxs.y - mins.y );
+	m_flGridCellSize = MAX( (float)NODE_GRID_MIN_CELL_SIZE, flExtent / ( NODE_GRID_MAX_CELLS - 1 ) );
+	m_vGridMins = mins;
+	m_nGridCellsX = MIN( (int)( ( maxs.x - mins.x ) / m_flGridCellSize ) + 1, (int)NODE_GRID_MAX_CELLS );
+	m_nGridCellsY = MIN( (int)( ( maxs.y - mins.y ) / m_flGridCellSize ) + 1, (int)NODE_GRID_MAX_CELLS );
+
+	// Counting sort by cell, which leaves the IDs within each cell ascending
+	int nCells = m_nGridCellsX * m_nGridCellsY;
+	CUtlVector<int> nodeCells;
+	nodeCells.SetCount( m_iNumNodes );
+	m_GridCellStart.SetCount( nCells + 1 );
+	V_memset( m_GridCellStart.Base(), 0, m_GridCellStart.Count() * sizeof(int) );
+
+	for ( int node = 0; node < m_iNumNodes; node++ )
+	{
+		const Vector &origin = m_pAInode[node]->GetOrigin();
+		int x = clamp( (int)( ( origin.x - m_vGridMins.x ) / m_flGridCellSize ), 0, m_nGridCellsX - 1 );
+		int y = clamp( (int)( ( origin.y - m_vGridMins.y ) / m_flGridCellSize ), 0, m_nGridCellsY - 1 );
+		nodeCells[node] = y * m_nGridCellsX + x;
+		m_GridCellStart[nodeCells[node] + 1]++;
+	}
+
+	for ( int cell = 0; cell < nCells; cell++ )
+	{
+		m_GridCellStart[cell + 1] += m_GridCellStart[cell];
+	}
+
+	CUtlVector<int> cellFill;
+	cellFill.CopyArray( m_GridCellStart.Base(), nCells );
+	m_GridNodes.SetCount( m_iNumNodes );
+	for ( int node = 0; node < m_iNumNodes; node++ )
+	{
+		m_GridNodes[cellFill[nodeCells[node]]++] = node;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+static int __cdecl CompareNodeIDs( const int *pLeft, const int *pRight )
+{
+	return ( *pLeft - *pRight );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills nodes with the IDs of the nodes in the grid cells the box
+//			overlaps, ascending. Returns false if every node must be tested.
+//-----------------------------------------------------------------------------
+
+bool CAI_Network::GatherGridNodesInBox( const Vector &mins, const Vector &maxs, CUtlVector<int> &nodes )
+{
+	if ( !ai_node_grid.GetBool() )
+		return false;
+
+	// Nodes added since, such as while editing in Hammer
+	if ( m_nGridNodes != m_iNumNodes )
+	{
+		BuildNodeGrid();
+	}
+
+	if ( !m_nGridCellsX )
+		return false;
+
+	int x0 = clamp( (int)floorf( ( mins.x - m_vGridMins.x ) / m_flGridCellSize ), 0, m_nGridCellsX - 1 );
+	int x1 = clamp( (int)floorf( ( maxs.x - m_vGridMins.x ) / m_flGridCellSize ), 0, m_nGridCellsX - 1 );
+	int y0 = clamp( (int)floorf( ( mins.y - m_vGridMins.y ) / m_flGridCellSize ), 0, m_nGridCellsY - 1 );
+	int y1 = clamp( (int)floorf( ( maxs.y - m_vGridMins.y ) / m_flGridCellSize ), 0, m_nGridCellsY - 1 );
+
+	nodes.RemoveAll();
+	for ( int y = y0; y <= y1; y++ )
+	{
+		int rowStart = y * m_nGridCellsX;
+		int first = m_GridCellStart[rowStart + x0];
+		int last = m_GridCellStart[rowStart + x1 + 1];
+		if ( last > first )
+		{
+			nodes.AddMultipleToTail( last - first, m_GridNodes.Base() + first );
+		}
+	}
+
+	if ( y1 > y0 || x1 > x0 )
+	{
+		nodes.Sort( CompareNodeIDs );
+	}
+
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Return ID of node nearest of vecOrigin for pNPC with the given
 //			tolerance distance.  If a route is required to get to the node
@@ -385,6 +513,116 @@ int	CAI_Network::NearestNodeToPoint(const Vector &vPosition, bool bCheckVisibili
 {
 	return NearestNodeToPoint( NULL, vPosition, bCheckVisibility );
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: Find the nearest nodes to many points at once, without regard to
+//			whether the nodes can be seen or reached
+//-----------------------------------------------------------------------------
+
+void CAI_Network::NearestNodesToPoints( const Vector *pPoints, int nPoints, int nMaxNodes, float flMaxDist, int *pResults )
+{
+	AI_PROFILE_SCOPE( CAI_Network_NearestNodesToPoints );
+
+	if ( nMaxNodes <= 0 )
+		return;
+
+	AI_NearNode_t *pBuffer = (AI_NearNode_t *)stackalloc( sizeof(AI_NearNode_t) * nMaxNodes );
+	Vector ext( flMaxDist, flMaxDist, flMaxDist );
+	float flMaxDistSqr = Square( flMaxDist );
+
+	for ( int i = 0; i < nPoints; i++ )
+	{
+		int *pPointResults = pResults + i * nMaxNodes;
+		int nFound = 0;
+
+		if ( m_iNumNodes )
+		{
+			CNodeFilter filter( pPoints[i] );
+			CNodeList list( pBuffer, nMaxNodes );
+
+			// The box corners reach past flMaxDist, but anything there is farther
+			// than every node inside it, so dropping it afterwards is safe
+			ListNodesInBox( list, nMaxNodes, pPoints[i] - ext, pPoints[i] + ext, &filter );
+
+			for( ;list.Count(); list.RemoveAtHead() )
+			{
+				if ( list.ElementAtHead().dist <= flMaxDistSqr )
+				{
+					pPointResults[nFound++] = list.ElementAtHead().nodeIndex;
+				}
+			}
+		}
+
+		while ( nFound < nMaxNodes )
+		{
+			pPointResults[nFound++] = NO_NODE;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times nearest node lookups around random nodes with and without
+//			the node grid, and checks that both find the same nodes
+//-----------------------------------------------------------------------------
+
+CON_COMMAND_F( ai_benchmark_nearest_node, "Times nearest node lookups with and without the node grid. Usage: ai_benchmark_nearest_node [points]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !g_pBigAINet || !g_pBigAINet->NumNodes() )
+	{
+		Msg( "ai_benchmark_nearest_node needs a map with nodes\n" );
+		return;
+	}
+
+	int nPoints = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 1000;
+
+	CUniformRandomStream random;
+	random.SetSeed( 0x5eed );
+
+	CUtlVector<Vector> points;
+	points.SetCount( nPoints );
+	for ( int i = 0; i < nPoints; i++ )
+	{
+		int node = random.RandomInt( 0, g_pBigAINet->NumNodes() - 1 );
+		Vector offset( random.RandomFloat( -MAX_NODE_LINK_DIST, MAX_NODE_LINK_DIST ),
+					   random.RandomFloat( -MAX_NODE_LINK_DIST, MAX_NODE_LINK_DIST ),
+					   random.RandomFloat( -MAX_NODE_LINK_DIST, MAX_NODE_LINK_DIST ) );
+		points[i] = g_pBigAINet->GetNode( node )->GetOrigin() + offset;
+	}
+
+	CUtlVector<int> results[2];
+	double flTime[2];
+	const bool bWasGrid = ai_node_grid.GetBool();
+
+	// 0: every node, 1: node grid
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		ai_node_grid.SetValue( pass );
+		results[pass].SetCount( nPoints * MAX_NEAR_NODES );
+
+		CFastTimer timer;
+		timer.Start();
+		g_pBigAINet->NearestNodesToPoints( points.Base(), nPoints, MAX_NEAR_NODES, MAX_NODE_LINK_DIST, results[pass].Base() );
+		timer.End();
+		flTime[pass] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	ai_node_grid.SetValue( bWasGrid );
+
+	int nMismatches = 0;
+	for ( int i = 0; i < nPoints * MAX_NEAR_NODES; i++ )
+	{
+		if ( results[0][i] != results[1][i] )
+			nMismatches++;
+	}
+
+	Msg( "Nearest node benchmark: %d points, %d nearest each, %d nodes\n", nPoints, MAX_NEAR_NODES, g_pBigAINet->NumNodes() );
+	Msg( "  every node: %8.3f ms, %7.4f ms per point\n", flTime[0], flTime[0] / nPoints );
+	Msg( "  node grid:  %8.3f ms, %7.4f ms per point\n", flTime[1], flTime[1] / nPoints );
+	Msg( "  %d mismatched results\n", nMismatches );
+}
 	
 //-----------------------------------------------------------------------------
 // Purpose: Check nearest node cache for checkPos and return cached nearest
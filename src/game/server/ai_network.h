@@ -96,6 +96,12 @@ public:
 	int NearestNodeToPoint( CAI_BaseNPC* pNPC, const Vector& vecOrigin, bool bCheckVisiblity = true ) { return NearestNodeToPoint( pNPC, vecOrigin, bCheckVisiblity, NULL ); }
 	int NearestNodeToPoint( const Vector& vPosition, bool bCheckVisiblity = true );
 
+	// Finds the nMaxNodes nodes nearest each point within flMaxDist, without visibility
+	// checks. pResults holds nMaxNodes IDs per point, closest first, padded with NO_NODE.
+	void NearestNodesToPoints( const Vector* pPoints, int nPoints, int nMaxNodes, float flMaxDist, int* pResults );
+
+	void BuildNodeGrid();// Call once node origins are final
+
 	int NumNodes() const { return m_iNumNodes; }
 	CAI_Node* GetNode( int id, bool bHandleError = true ) {
 		if ( id >= 0 &&
@@ -124,6 +130,7 @@ private:
 	int GetCachedNode( const Vector& checkPos, Hull_t nHull, int* pCachePos );
 
 	int ListNodesInBox( CNodeList& list, int maxListCount, const Vector& mins, const Vector& maxs, INodeListFilter* pFilter );
+	bool GatherGridNodesInBox( const Vector& mins, const Vector& maxs, CUtlVector<int>& nodes );
 
 	//---------------------------------
 
@@ -149,6 +156,21 @@ private:
 	NearNodeCache_T m_NearestCache[ NEARNODE_CACHE_SIZE ];// Cache of nearest nodes
 	int m_iNearestCacheNext;                              // Oldest record in the cache
 
+	// Node IDs bucketed by origin on a grid in x/y, ascending within each cell
+	enum {
+		NODE_GRID_MIN_CELL_SIZE = 256,
+		NODE_GRID_MAX_CELLS = 128,// Per axis
+	};
+
+	Vector2D m_vGridMins;
+	float m_flGridCellSize;
+	int m_nGridCellsX;
+	int m_nGridCellsY;
+	int m_nGridNodes;              // Node count the grid was built with
+	CUtlVector<int> m_GridCellStart;// Offset of each cell in m_GridNodes, plus one past the end
+	CUtlVector<int> m_GridNodes;
+	CUtlVector<int> m_GridGathered;// Scratch for ListNodesInBox()
+
 #ifdef AI_NODE_TREE
 	ISpatialPartition* m_pNodeTree;
 	CUtlVector<int> m_GatheredNodes;
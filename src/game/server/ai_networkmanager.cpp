@@ -686,6 +686,8 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 		DevMsg( "\n** Should run \"Check For Problems\" on the VMF then verify dynamic links\n" );
 #endif
 
+	m_pNetwork->BuildNodeGrid();
+
 	gm_fNetworksLoaded = true;
 	CAI_DynamicLink::gm_bInitialized = false;
 }
@@ -2290,6 +2292,8 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 	DevMsg( "...done determining zones. %f seconds\n", timer.GetDuration().GetSeconds() );
 	DevMsg( "...done building AI node graph, %f seconds\n", masterTimer.GetDuration().GetSeconds() );
 
+	pNetwork->BuildNodeGrid();
+
 	g_pAINetworkManager->FixupHints();
 
 	EndBuild();
@@ -20,7 +20,9 @@
 #include "ai_moveprobe.h"
 #include "ai_dynamiclink.h"
 #include "ai_hint.h"
+#include "ai_routecache.h"
 #include "bitstring.h"
+#include "tier1/utlpriorityqueue.h"
 
 //@todo: bad dependency!
 #include "ai_navigator.h"
@@ -165,35 +167,57 @@ Navigation_t CAI_Pathfinder::ComputeWaypointType( CAI_Node **ppNodes, int parent
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Given an array of parentID's and endID, fill pNodes with the node
+//			IDs of the route from the start node to endID
+//-----------------------------------------------------------------------------
+static void GetRouteNodesFromParents( const int *parentArray, int endID, CUtlVector<int> *pNodes )
+{
+	pNodes->RemoveAll();
+	for ( int currentID = endID; currentID != NO_NODE; currentID = parentArray[currentID] )
+	{
+		pNodes->AddToTail( currentID );
+	}
+
+	for ( int i = 0, j = pNodes->Count() - 1; i < j; i++, j-- )
+	{
+		V_swap( pNodes->Element( i ), pNodes->Element( j ) );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Given an array of parentID's and endID, contruct a linked 
 //			list of waypoints through those parents
 //-----------------------------------------------------------------------------
 AI_Waypoint_t* CAI_Pathfinder::MakeRouteFromParents( int *parentArray, int endID ) 
 {
+	CUtlVector<int> nodes;
+	GetRouteNodesFromParents( parentArray, endID, &nodes );
+	return MakeRouteFromNodes( nodes.Base(), nodes.Count() );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Given the node IDs of a route, start node first, contruct a linked 
+//			list of waypoints through those nodes
+//-----------------------------------------------------------------------------
+AI_Waypoint_t* CAI_Pathfinder::MakeRouteFromNodes( const int *pNodes, int nNodes ) 
+{
+	// If we have no previous node, then we use the next node, so a route needs two
+	if ( nNodes < 2 )
+		return NULL;
+
 	AI_Waypoint_t *pOldWaypoint = NULL;
 	AI_Waypoint_t *pNewWaypoint = NULL;
-	int	currentID = endID;
 
 	CAI_Node **pAInode = GetNetwork()->AccessNodes();
 
-	while (currentID != NO_NODE) 
+	for ( int i = nNodes - 1; i >= 0; i-- ) 
 	{
 		// Try to link it to the previous waypoint
-		int prevID = parentArray[currentID];
-
-		int destID; 
-		if (prevID != NO_NODE)
-		{
-			destID = prevID;
-		}
-		else
-		{		   
-			// If we have no previous node, then use the next node
-			if ( !pOldWaypoint )
-				return NULL;
-			destID = pOldWaypoint->iNodeID;
-		}
+		int currentID = pNodes[i];
+		int destID = ( i > 0 ) ? pNodes[i - 1] : pNodes[1];
 
 		Navigation_t waypointType = ComputeWaypointType( pAInode, currentID, destID );
 
@@ -211,14 +235,51 @@ AI_Waypoint_t* CAI_Pathfinder::MakeRouteFromParents( int *parentArray, int endID
 		// Link it up...
 		pNewWaypoint->SetNext( pOldWaypoint );
 		pOldWaypoint = pNewWaypoint;
-
-		currentID = prevID;
 	}
 
 	return pOldWaypoint;
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Checks a route found for another NPC against this one: every node
+//			must be usable and every link traversable, as FindBestPath()
+//			would require.
+//-----------------------------------------------------------------------------
+bool CAI_Pathfinder::IsCachedRouteUsable( const int *pNodes, int nNodes )
+{
+	int nNetworkNodes = GetNetwork()->NumNodes();
+	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		int nodeID = pNodes[i];
+		if ( nodeID < 0 || nodeID >= nNetworkNodes )
+			return false;
+
+		CAI_Node *pNode = pAInode[nodeID];
+		if ( GetOuter()->IsUnusableNode( nodeID, pNode->GetHint() ) )
+			return false;
+
+		if ( i == 0 )
+			continue;
+
+		int prevID = pNodes[i - 1];
+		CAI_Link *pLink = pAInode[prevID]->GetLink( nodeID );
+		if ( !pLink || !IsLinkUsable( pLink, prevID ) )
+			return false;
+
+		int moveType = pLink->m_iAcceptedMoveTypes[GetHullType()] & CapabilitiesGet();
+		Vector r1 = pAInode[prevID]->GetPosition(GetHullType());
+		Vector r2 = pNode->GetPosition(GetHullType());
+		if ( GetOuter()->GetNavigator()->MovementCost( moveType, r1, r2 ) == FLT_MAX )
+			return false;
+	}
+
+	return true;
+}
+
+
 //------------------------------------------------------------------------------
 // Purpose : Test if stale link is no longer stale
 //------------------------------------------------------------------------------
@@ -272,6 +333,25 @@ int CAI_Pathfinder::NearestNodeToPoint( const Vector &vecOrigin )
 	return GetNetwork()->NearestNodeToPoint( GetOuter(), vecOrigin );
 }
 
+//-----------------------------------------------------------------------------
+// Open list entry of FindBestPath(). A node is pushed again whenever its cost
+// improves, and entries that no longer match the node are skipped when popped.
+//-----------------------------------------------------------------------------
+
+struct AI_OpenNode_t
+{
+	float	f;
+	int		id;
+};
+
+static bool OpenNodeLessFunc( const AI_OpenNode_t &lhs, const AI_OpenNode_t &rhs )
+{
+	// Cheapest first, and the lowest node ID on ties, as the linear scan did
+	if ( lhs.f != rhs.f )
+		return ( lhs.f > rhs.f );
+	return ( lhs.id > rhs.id );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Build a path between two nodes
 //-----------------------------------------------------------------------------
@@ -287,6 +367,29 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	m_nPerfStatPB++;
 #endif
 
+	// Another NPC like this one may have just made the same search. Routes
+	// found while ignoring stale links are not for everyone, so skip those.
+	AI_RouteCacheKey_t cacheKey;
+	bool bUseCache = ( ai_pathfind_cache.GetBool() && !m_bIgnoreStaleLinks );
+	if ( bUseCache )
+	{
+		cacheKey.pNetwork = GetNetwork();
+		cacheKey.pszClassname = GetOuter()->GetClassname();
+		cacheKey.startID = startID;
+		cacheKey.endID = endID;
+		cacheKey.hull = GetHullType();
+		cacheKey.capabilities = CapabilitiesGet();
+
+		CUtlVector<int> cachedNodes;
+		if ( g_AIRouteCache.Find( cacheKey, &cachedNodes ) )
+		{
+			if ( IsCachedRouteUsable( cachedNodes.Base(), cachedNodes.Count() ) )
+				return MakeRouteFromNodes( cachedNodes.Base(), cachedNodes.Count() );
+
+			g_AIRouteCache.Reject( cacheKey );
+		}
+	}
+
 	int nNodes = GetNetwork()->NumNodes();
 	CAI_Node **pAInode = GetNetwork()->AccessNodes();
 
@@ -310,13 +413,22 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	nodeH[startID] = 0.1*(pAInode[startID]->GetPosition(GetHullType())-pAInode[endID]->GetPosition(GetHullType())).Length(); // Don't want to over estimate
 	nodeF[startID] = nodeG[startID] + nodeH[startID];
 
+	CUtlPriorityQueue<AI_OpenNode_t> openList( 0, 0, OpenNodeLessFunc );
+	AI_OpenNode_t openNode = { nodeF[startID], startID };
+
 	openBS.Set(startID);
 	closeBS.Set( startID );
+	openList.Insert( openNode );
 
 	// --------------- FIND BEST PATH ------------------
-	while (!openBS.IsAllClear()) 
+	while ( openList.Count() ) 
 	{
-		int smallestID = CAI_Network::FindBSSmallest(&openBS,nodeF,nNodes);
+		openNode = openList.ElementAtHead();
+		openList.RemoveAtHead();
+
+		int smallestID = openNode.id;
+		if ( !openBS.IsBitSet(smallestID) || openNode.f != nodeF[smallestID] )
+			continue;
 	
 		openBS.Clear(smallestID);
 
@@ -327,7 +439,15 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 
 		if (smallestID == endID) 
 		{
-			AI_Waypoint_t* route = MakeRouteFromParents(&nodeP[0], endID);
+			CUtlVector<int> routeNodes;
+			GetRouteNodesFromParents( &nodeP[0], endID, &routeNodes );
+
+			if ( bUseCache && routeNodes.Count() >= 2 )
+			{
+				g_AIRouteCache.Store( cacheKey, routeNodes.Base(), routeNodes.Count() );
+			}
+
+			AI_Waypoint_t* route = MakeRouteFromNodes( routeNodes.Base(), routeNodes.Count() );
 			return route;
 		}
 
@@ -362,6 +482,9 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 
 				closeBS.Set( testID );
 				openBS.Set( testID );
+
+				AI_OpenNode_t newOpenNode = { nodeF[testID], testID };
+				openList.Insert( newOpenNode );
 			}
 		}
 	}
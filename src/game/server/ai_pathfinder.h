@@ -117,6 +117,8 @@ private:
 	//---------------------------------
 	
 	AI_Waypoint_t*	MakeRouteFromParents(int *parentArray, int endID);
+	AI_Waypoint_t*	MakeRouteFromNodes(const int *pNodes, int nNodes);
+	bool			IsCachedRouteUsable(const int *pNodes, int nNodes);
 	AI_Waypoint_t*	CreateNodeWaypoint( Hull_t hullType, int nodeID, int nodeFlags = 0 );
 	
 	AI_Waypoint_t*	BuildRouteThroughPoints( Vector *vecPoints, int nNumPoints, int nDirection, int nStartIndex, int nEndIndex, Navigation_t navType, CBaseEntity *pTarget );
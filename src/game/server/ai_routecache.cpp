@@ -0,0 +1,252 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Cache of node graph routes
+//
+//=============================================================================//
+
+#include "cbase.h"
+
+#include "ai_routecache.h"
+#include "ai_basenpc.h"
+#include "ai_pathfinder.h"
+#include "ai_network.h"
+#include "ai_networkmanager.h"
+#include "ai_waypoint.h"
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar ai_pathfind_cache( "ai_pathfind_cache", "0", 0, "Reuse node routes found by other NPCs of the same class, hull and capabilities. Movement costs and unusable nodes are per NPC, so a reused route can differ from the one the NPC would find itself" );
+ConVar ai_pathfind_cache_lifetime( "ai_pathfind_cache_lifetime", "2.0", 0, "Seconds a cached node route stays valid" );
+ConVar ai_pathfind_cache_size( "ai_pathfind_cache_size", "1024", 0, "Maximum number of cached node routes" );
+
+CAI_RouteCache g_AIRouteCache;
+
+//-----------------------------------------------------------------------------
+
+CAI_RouteCache::CAI_RouteCache()
+ :	CAutoGameSystem( "CAI_RouteCache" )
+{
+	ResetStats();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies the cached route for the key into pNodes, start node first
+//-----------------------------------------------------------------------------
+
+bool CAI_RouteCache::Find( const AI_RouteCacheKey_t &key, CUtlVector<int> *pNodes )
+{
+	AUTO_LOCK( m_Mutex );
+
+	UtlHashHandle_t h = m_Entries.Find( key );
+	if ( h == m_Entries.InvalidHandle() )
+	{
+		m_nMisses++;
+		return false;
+	}
+
+	Entry_t *pEntry = m_Entries.Element( h );
+	if ( pEntry->flExpireTime <= gpGlobals->curtime )
+	{
+		delete pEntry;
+		m_Entries.Remove( key );
+		m_nMisses++;
+		return false;
+	}
+
+	pNodes->CopyArray( pEntry->nodes.Base(), pEntry->nodes.Count() );
+	m_nHits++;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Store( const AI_RouteCacheKey_t &key, const int *pNodes, int nNodes )
+{
+	AUTO_LOCK( m_Mutex );
+
+	UtlHashHandle_t h = m_Entries.Find( key );
+	Entry_t *pEntry;
+	if ( h != m_Entries.InvalidHandle() )
+	{
+		pEntry = m_Entries.Element( h );
+	}
+	else
+	{
+		if ( m_Entries.Count() >= ai_pathfind_cache_size.GetInt() )
+		{
+			// Routes are cheap to find again, so just start over rather than track ages
+			RemoveAllEntries();
+		}
+
+		pEntry = new Entry_t;
+		m_Entries.Insert( key, pEntry );
+	}
+
+	pEntry->nodes.CopyArray( pNodes, nNodes );
+	pEntry->flExpireTime = gpGlobals->curtime + ai_pathfind_cache_lifetime.GetFloat();
+	m_nStored++;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Reject( const AI_RouteCacheKey_t &key )
+{
+	AUTO_LOCK( m_Mutex );
+
+	UtlHashHandle_t h = m_Entries.Find( key );
+	if ( h != m_Entries.InvalidHandle() )
+	{
+		delete m_Entries.Element( h );
+		m_Entries.Remove( key );
+	}
+	m_nRejected++;
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::Invalidate()
+{
+	AUTO_LOCK( m_Mutex );
+	RemoveAllEntries();
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::RemoveAllEntries()
+{
+	FOR_EACH_HASHTABLE( m_Entries, it )
+	{
+		delete m_Entries.Element( it );
+	}
+	m_Entries.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::LevelShutdownPostEntity()
+{
+	Invalidate();
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::PrintStats()
+{
+	int nLookups = m_nHits + m_nMisses;
+	Msg( "AI route cache: %d routes cached\n", m_Entries.Count() );
+	Msg( "  lookups:  %d (%d hits, %.1f%%), %d rejected on validation\n", nLookups, m_nHits, nLookups ? 100.0f * m_nHits / nLookups : 0.0f, m_nRejected );
+	Msg( "  stored:   %d\n", m_nStored );
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_RouteCache::ResetStats()
+{
+	m_nHits = 0;
+	m_nMisses = 0;
+	m_nRejected = 0;
+	m_nStored = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+CON_COMMAND( ai_pathfind_cache_stats, "Prints node route cache statistics" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_AIRouteCache.PrintStats();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times FindBestPath() between random connected node pairs, without
+//			the route cache and then with it, using the first NPC that can
+//			pathfind.
+//-----------------------------------------------------------------------------
+
+CON_COMMAND_F( ai_benchmark_pathfind, "Times node graph searches with and without the route cache. Usage: ai_benchmark_pathfind [searches]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nSearches = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 200;
+
+	CAI_BaseNPC *pNPC = NULL;
+	for ( int i = 0; i < g_AI_Manager.NumAIs(); i++ )
+	{
+		CAI_BaseNPC *pCandidate = g_AI_Manager.AccessAIs()[i];
+		if ( pCandidate && pCandidate->IsAlive() && pCandidate->GetPathfinder() )
+		{
+			pNPC = pCandidate;
+			break;
+		}
+	}
+
+	if ( !pNPC || !g_pBigAINet || g_pBigAINet->NumNodes() < 2 )
+	{
+		Msg( "ai_benchmark_pathfind needs a map with nodes and at least one NPC\n" );
+		return;
+	}
+
+	// Pick the pairs up front so both runs search the same routes
+	CUniformRandomStream random;
+	random.SetSeed( 0x5eed );
+
+	CUtlVector<int> pairs;
+	int nAttempts = nSearches * 16;
+	while ( pairs.Count() < nSearches * 2 && nAttempts-- > 0 )
+	{
+		int startID = random.RandomInt( 0, g_pBigAINet->NumNodes() - 1 );
+		int endID = random.RandomInt( 0, g_pBigAINet->NumNodes() - 1 );
+		if ( startID != endID && g_pBigAINet->IsConnected( startID, endID ) )
+		{
+			pairs.AddToTail( startID );
+			pairs.AddToTail( endID );
+		}
+	}
+
+	nSearches = pairs.Count() / 2;
+	if ( !nSearches )
+	{
+		Msg( "ai_benchmark_pathfind found no connected node pairs\n" );
+		return;
+	}
+
+	const bool bWasCached = ai_pathfind_cache.GetBool();
+	double flTime[3] = { 0, 0, 0 };
+	int nFound[3] = { 0, 0, 0 };
+
+	// 0: no cache, 1: filling the cache, 2: from the cache
+	for ( int pass = 0; pass < 3; pass++ )
+	{
+		ai_pathfind_cache.SetValue( pass != 0 );
+		if ( pass == 1 )
+		{
+			g_AIRouteCache.Invalidate();
+		}
+
+		CFastTimer timer;
+		timer.Start();
+		for ( int i = 0; i < nSearches; i++ )
+		{
+			AI_Waypoint_t *pRoute = pNPC->GetPathfinder()->FindBestPath( pairs[i * 2], pairs[i * 2 + 1] );
+			if ( pRoute )
+			{
+				nFound[pass]++;
+				DeleteAll( pRoute );
+			}
+		}
+		timer.End();
+		flTime[pass] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	ai_pathfind_cache.SetValue( bWasCached );
+
+	Msg( "Node graph pathfind benchmark: %d searches by %s over %d nodes\n", nSearches, pNPC->GetClassname(), g_pBigAINet->NumNodes() );
+	Msg( "  uncached:    %8.3f ms total, %7.4f ms per search, %d routes\n", flTime[0], flTime[0] / nSearches, nFound[0] );
+	Msg( "  cache fill:  %8.3f ms total, %7.4f ms per search, %d routes\n", flTime[1], flTime[1] / nSearches, nFound[1] );
+	Msg( "  cached:      %8.3f ms total, %7.4f ms per search, %d routes\n", flTime[2], flTime[2] / nSearches, nFound[2] );
+}
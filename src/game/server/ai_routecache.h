@@ -0,0 +1,106 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Cache of node graph routes
+//
+//=============================================================================//
+
+#ifndef AI_ROUTECACHE_H
+#define AI_ROUTECACHE_H
+
+#include "igamesystem.h"
+#include "tier1/utlhashtable.h"
+
+#if IsWindows()
+#pragma once
+#endif
+
+class CAI_Network;
+
+//-----------------------------------------------------------------------------
+// Identifies a node route. Movement costs and unusable nodes are not part
+// of the key, so NPCs sharing it may not have found the same route.
+//-----------------------------------------------------------------------------
+
+struct AI_RouteCacheKey_t
+{
+	const CAI_Network *pNetwork;
+	const char *pszClassname;		// pooled, compared by pointer
+	int startID;
+	int endID;
+	int hull;
+	int capabilities;
+
+	bool operator==( const AI_RouteCacheKey_t &other ) const
+	{
+		return ( pNetwork == other.pNetwork && pszClassname == other.pszClassname &&
+				 startID == other.startID && endID == other.endID &&
+				 hull == other.hull && capabilities == other.capabilities );
+	}
+};
+
+struct AI_RouteCacheKeyHash_t
+{
+	unsigned int operator()( const AI_RouteCacheKey_t &key ) const
+	{
+		unsigned int hash = PointerHashFunctor()( key.pNetwork );
+		hash = hash * 31 + PointerHashFunctor()( key.pszClassname );
+		hash = hash * 31 + Mix32HashFunctor()( key.startID );
+		hash = hash * 31 + Mix32HashFunctor()( key.endID );
+		return hash * 31 + Mix32HashFunctor()( ( key.hull << 24 ) ^ key.capabilities );
+	}
+};
+
+//-----------------------------------------------------------------------------
+// CAI_RouteCache
+//
+// Purpose: Remembers the node sequence of recent successful FindBestPath()
+//			searches so other NPCs making the same search can skip it.
+//			Off unless ai_pathfind_cache is set.
+//
+//			A cached route is only a candidate: the pathfinder checks every
+//			link of it against the requesting NPC before using it. Entries
+//			expire after a short time and are dropped whenever a dynamic link
+//			changes state or the network is reloaded.
+//-----------------------------------------------------------------------------
+
+class CAI_RouteCache : public CAutoGameSystem
+{
+public:
+	CAI_RouteCache();
+
+	// Cached routes
+	bool Find( const AI_RouteCacheKey_t &key, CUtlVector<int> *pNodes );
+	void Store( const AI_RouteCacheKey_t &key, const int *pNodes, int nNodes );
+	void Reject( const AI_RouteCacheKey_t &key );		// the route no longer works for the NPC that found it
+	void Invalidate();									// the network or a link in it has changed
+
+	void PrintStats();
+	void ResetStats();
+
+	// CAutoGameSystem
+	virtual void LevelShutdownPostEntity();
+
+private:
+	struct Entry_t
+	{
+		CUtlVector<int> nodes;
+		float flExpireTime;
+	};
+
+	void RemoveAllEntries();
+
+	CUtlHashtable< AI_RouteCacheKey_t, Entry_t *, AI_RouteCacheKeyHash_t > m_Entries;
+	CThreadFastMutex m_Mutex;			// deferred navigation (ai_post_frame_navigation) searches on a worker thread
+
+	int m_nHits;
+	int m_nMisses;
+	int m_nRejected;
+	int m_nStored;
+};
+
+extern CAI_RouteCache g_AIRouteCache;
+extern ConVar ai_pathfind_cache;
+
+//-----------------------------------------------------------------------------
+
+#endif // AI_ROUTECACHE_H
@@ -120,20 +120,21 @@ void CAI_Senses::Listen( void )
 	
 	if ( iSoundMask != SOUND_NONE && !(GetOuter()->HasSpawnFlags(SF_NPC_WAIT_TILL_SEEN)) )
 	{
-		int	iSound = CSoundEnt::ActiveList();
-		
-		while ( iSound != SOUNDLIST_EMPTY )
+		// Only the sounds of interest in hearing range of the ear, in active list order
+		int sounds[MAX_WORLD_SOUNDS_MP];
+		int nSounds = CSoundEnt::GetSoundsInRange( iSoundMask, GetOuter()->EarPosition(), GetOuter()->HearingSensitivity(), sounds );
+
+		for ( int i = 0; i < nSounds; i++ )
 		{
+			int iSound = sounds[i];
 			CSound *pCurrentSound = CSoundEnt::SoundPointerForIndex( iSound );
 
-			if ( pCurrentSound	&& (iSoundMask & pCurrentSound->SoundType()) && CanHearSound( pCurrentSound ) )
+			if ( pCurrentSound && CanHearSound( pCurrentSound ) )
 			{
 	 			// the npc cares about this sound, and it's close enough to hear.
 				pCurrentSound->m_iNextAudible = m_iAudibleList;
 				m_iAudibleList = iSound;
 			}
-
-			iSound = pCurrentSound->NextSound();
 		}
 	}
 	
@@ -165,9 +166,19 @@ bool CAI_Senses::ShouldSeeEntity( CBaseEntity *pSightEnt )
 
 //-----------------------------------------------------------------------------
 
+extern bool g_bAsyncSightQuery;
+
 bool CAI_Senses::CanSeeEntity( CBaseEntity *pSightEnt )
 {
-	return ( GetOuter()->FInViewCone( pSightEnt ) && GetOuter()->FVisible( pSightEnt ) );
+	if ( !GetOuter()->FInViewCone( pSightEnt ) )
+		return false;
+
+	// Sight may lag a frame behind, so let the trace come from the batched ray queries
+	g_bAsyncSightQuery = true;
+	bool bVisible = GetOuter()->FVisible( pSightEnt );
+	g_bAsyncSightQuery = false;
+
+	return bVisible;
 }
 
 #ifdef PORTAL
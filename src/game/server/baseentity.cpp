@@ -62,6 +62,7 @@
 #include "env_debughistory.h"
 #include "tier1/utlstring.h"
 #include "utlhashtable.h"
+#include "querycache.h"
 
 #if defined( TF_DLL )
 #include "tf_gamerules.h"
@@ -614,6 +615,19 @@ CBaseEntity *CBaseEntity::GetFollowedEntity()
 void CBaseEntity::SetClassname( const char *className )
 {
 	m_iClassname = AllocPooledString( className );
+	gEntList.UpdateEntityStrings( this );
+}
+
+void CBaseEntity::SetName( string_t newName )
+{
+	m_iName = newName;
+	gEntList.UpdateEntityStrings( this );
+}
+
+void CBaseEntity::SetEntityTarget( string_t newTarget )
+{
+	m_target = newTarget;
+	gEntList.UpdateEntityStrings( this );
 }
 
 void CBaseEntity::SetModelIndex( int index )
@@ -2765,6 +2779,9 @@ bool CBaseEntity::Intersects( CBaseEntity *pOther )
 
 extern ConVar ai_LOS_mode;
 
+// Set by CAI_Senses while it looks, so FVisible() may answer from the last batch of ray queries
+bool g_bAsyncSightQuery = false;
+
 //=========================================================
 // FVisible - returns true if a line can be traced from
 // the caller's eyes to the target
@@ -2806,9 +2823,19 @@ bool CBaseEntity::FVisible( CBaseEntity *pEntity, int traceMask, CBaseEntity **p
 			traceMask &= ~CONTENTS_BLOCKLOS;
 		}
 
-		// Use the custom LOS trace filter
-		CTraceFilterLOS traceFilter( this, COLLISION_GROUP_NONE, pEntity );
-		UTIL_TraceLine( vecLookerOrigin, vecTargetOrigin, traceMask, &traceFilter, &tr );
+		RayQueryResult_t result;
+		if ( g_bAsyncSightQuery && SubmitRayQuery( RAYQUERY_NPC_SIGHT, this, pEntity, vecLookerOrigin, vecTargetOrigin, traceMask, COLLISION_GROUP_NONE, RAYQUERY_FILTER_LOS, &result ) )
+		{
+			tr.fraction = result.m_flFraction;
+			tr.startsolid = result.m_bStartSolid;
+			tr.m_pEnt = result.m_hHitEntity;
+		}
+		else
+		{
+			// Use the custom LOS trace filter
+			CTraceFilterLOS traceFilter( this, COLLISION_GROUP_NONE, pEntity );
+			UTIL_TraceLine( vecLookerOrigin, vecTargetOrigin, traceMask, &traceFilter, &tr );
+		}
 	}
 	
 	if (tr.fraction != 1.0 || tr.startsolid )
@@ -3226,6 +3253,9 @@ int CBaseEntity::Restore( IRestore &restore )
 		m_hGroundEntity->AddEntityToGroundList( this );
 	}
 
+	// Name, classname and target came back from the save
+	gEntList.UpdateEntityStrings( this );
+
 	return status;
 }
 
@@ -9,6 +9,7 @@
 #include "collisionproperty.h"
 #include "engine/ivmodelinfo.h"
 #include "entitylist.h"
+#include "entitysoa.h"
 #include "entityoutput.h"
 #include "networkvar.h"
 #include "shareddefs.h"
@@ -561,6 +562,7 @@ public:
 	CBaseEntity* NextMovePeer();
 
 	void SetName( string_t newTarget );
+	void SetEntityTarget( string_t newTarget );
 	void SetParent( string_t newParent, CBaseEntity* pActivator, int iAttachment = -1 );
 
 	// Set the movement parent. Your local origin and angles will become relative to this parent.
@@ -849,9 +851,13 @@ private:
 	// list handling
 	friend class CGlobalEntityList;
 	friend class CThinkSyncTester;
+	friend class CEntitySOAMirror;
+
+	// Flags this entity's row in g_EntitySOA as stale
+	void MarkSOADirty();
 
 	// was pev->nextthink
-	CNetworkVarForDerived( int, m_nNextThinkTick );
+	CNetworkVarForDerivedMirrored( int, m_nNextThinkTick, MarkSOADirty );
 	// was pev->effects
 	CNetworkVar( int, m_fEffects );
 
@@ -1578,7 +1584,7 @@ protected:
 private:
 	int m_iEFlags;// entity flags EFL_*
 	// was pev->flags
-	CNetworkVarForDerived( int, m_fFlags );
+	CNetworkVarForDerivedMirrored( int, m_fFlags, MarkSOADirty );
 
 	string_t m_iName;// name used to identify this entity
 
@@ -1664,7 +1670,7 @@ private:
 	int m_nPushEnumCount;
 
 	Vector m_vecAbsOrigin;
-	CNetworkVectorForDerived( m_vecVelocity );
+	CNetworkVectorForDerivedMirrored( m_vecVelocity, MarkSOADirty );
 
 	//Adrian
 	CNetworkVar( unsigned char, m_iTextureFrameIndex );
@@ -1681,7 +1687,7 @@ private:
 
 	QAngle m_angAbsRotation;
 
-	CNetworkVector( m_vecOrigin );
+	CNetworkVectorMirrored( m_vecOrigin, MarkSOADirty );
 	CNetworkQAngle( m_angRotation );
 	CBaseHandle m_RefEHandle;
 
@@ -1885,10 +1891,6 @@ inline string_t CBaseEntity::GetEntityName() {
 	return m_iName;
 }
 
-inline void CBaseEntity::SetName( string_t newName ) {
-	m_iName = newName;
-}
-
 
 inline bool CBaseEntity::NameMatches( const char* pszNameOrWildcard ) {
 	if ( IDENT_STRINGS( m_iName, pszNameOrWildcard ) )
@@ -1952,8 +1954,15 @@ inline int CBaseEntity::GetEFlags() const {
 	return m_iEFlags;
 }
 
+inline void CBaseEntity::MarkSOADirty() {
+	if ( m_RefEHandle.IsValid() ) {
+		g_EntitySOA.MarkDirty( m_RefEHandle.GetEntryIndex() );
+	}
+}
+
 inline void CBaseEntity::SetEFlags( int iEFlags ) {
 	m_iEFlags = iEFlags;
+	MarkSOADirty();
 
 	if ( iEFlags & ( EFL_FORCE_CHECK_TRANSMIT | EFL_IN_SKYBOX ) ) {
 		DispatchUpdateTransmitState();
@@ -1962,6 +1971,7 @@ inline void CBaseEntity::SetEFlags( int iEFlags ) {
 
 inline void CBaseEntity::AddEFlags( int nEFlagMask ) {
 	m_iEFlags |= nEFlagMask;
+	MarkSOADirty();
 
 	if ( nEFlagMask & ( EFL_FORCE_CHECK_TRANSMIT | EFL_IN_SKYBOX ) ) {
 		DispatchUpdateTransmitState();
@@ -1970,6 +1980,7 @@ inline void CBaseEntity::AddEFlags( int nEFlagMask ) {
 
 inline void CBaseEntity::RemoveEFlags( int nEFlagMask ) {
 	m_iEFlags &= ~nEFlagMask;
+	MarkSOADirty();
 
 	if ( nEFlagMask & ( EFL_FORCE_CHECK_TRANSMIT | EFL_IN_SKYBOX ) )
 		DispatchUpdateTransmitState();
@@ -86,6 +86,7 @@ OUTPUTS:
 #include "env_debughistory.h"
 
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -638,14 +639,18 @@ void CMultiInputVar::inputitem_t::operator delete( void *pMem )
 //
 // Purpose: holds and executes a global prioritized queue of entity actions
 //-----------------------------------------------------------------------------
-DEFINE_FIXEDSIZE_ALLOCATOR( EventQueuePrioritizedEvent_t, 128, CUtlMemoryPool::GROW_SLOW );
+DEFINE_FIXEDSIZE_ALLOCATOR( EventQueuePrioritizedEvent_t, 256, CUtlMemoryPool::GROW_FAST );
 
 CEventQueue g_EventQueue;
 
 CEventQueue::CEventQueue()
 {
-	m_Events.m_flFireTime = -FLT_MAX;
-	m_Events.m_pNext = NULL;
+	V_memset( m_Level0, 0, sizeof( m_Level0 ) );
+	V_memset( m_Level1, 0, sizeof( m_Level1 ) );
+	m_Overflow.m_pHead = m_Overflow.m_pTail = NULL;
+	m_nLevel0Count = m_nLevel1Count = 0;
+	m_nCurrentSlot = 0;
+	m_nEventCount = 0;
 
 	Init();
 }
@@ -759,21 +764,30 @@ void CEventQueue::Init( void )
 void CEventQueue::Clear( void )
 {
 	// delete all the events in the queue
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pe = FirstEvent();
 	
 	while ( pe != NULL )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *next = NextEvent( pe );
 		delete pe;
 		pe = next;
 	}
 
-	m_Events.m_pNext = NULL;
+	V_memset( m_Level0, 0, sizeof( m_Level0 ) );
+	V_memset( m_Level1, 0, sizeof( m_Level1 ) );
+	m_Overflow.m_pHead = m_Overflow.m_pTail = NULL;
+	m_nLevel0Count = m_nLevel1Count = 0;
+	m_nEventCount = 0;
+	m_TargetIndex.RemoveAll();
+	m_CallerIndex.RemoveAll();
+
+	// the clock may restart after this (new map, restore), the wheel catches up on the next service
+	m_nCurrentSlot = 0;
 }
 
 void CEventQueue::Dump( void )
 {
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	EventQueuePrioritizedEvent_t *pe = FirstEvent();
 
 	Msg("Dumping event queue. Current time is: %.2f\n",
 #ifdef TF_DLL
@@ -785,7 +799,7 @@ void CEventQueue::Dump( void )
 
 	while ( pe != NULL )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *next = NextEvent( pe );
 
 		Msg("   (%.2f) Target: '%s', Input: '%s', Parameter '%s'. Activator: '%s', Caller '%s'.  \n", 
 			pe->m_flFireTime, 
@@ -857,41 +871,317 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *action, float fireD
 
 
 //-----------------------------------------------------------------------------
-// Purpose: private function, adds an event into the list
+// Purpose: private function, adds an event into the queue
 // Input  : *newEvent - the (already built) event to add
 //-----------------------------------------------------------------------------
 void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
 {
-	// loop through the actions looking for a place to insert
-	EventQueuePrioritizedEvent_t *pe;
-	for ( pe = &m_Events; pe->m_pNext != NULL; pe = pe->m_pNext )
+	InsertIntoBucket( BucketForSlot( TimeToSlot( newEvent->m_flFireTime ) ), newEvent );
+
+	newEvent->m_pNextOnTarget = newEvent->m_pPrevOnTarget = NULL;
+	if ( newEvent->m_pEntTarget.IsValid() )
+	{
+		LinkIntoChain( m_TargetIndex, newEvent->m_pEntTarget.ToInt(), newEvent, &EventQueuePrioritizedEvent_t::m_pNextOnTarget, &EventQueuePrioritizedEvent_t::m_pPrevOnTarget );
+	}
+
+	newEvent->m_pNextFromCaller = newEvent->m_pPrevFromCaller = NULL;
+	if ( newEvent->m_pCaller.IsValid() )
+	{
+		LinkIntoChain( m_CallerIndex, newEvent->m_pCaller.ToInt(), newEvent, &EventQueuePrioritizedEvent_t::m_pNextFromCaller, &EventQueuePrioritizedEvent_t::m_pPrevFromCaller );
+	}
+
+	++m_nEventCount;
+}
+
+void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
+{
+	UnlinkFromBucket( pe );
+
+	if ( pe->m_pEntTarget.IsValid() )
+	{
+		UnlinkFromChain( m_TargetIndex, pe->m_pEntTarget.ToInt(), pe, &EventQueuePrioritizedEvent_t::m_pNextOnTarget, &EventQueuePrioritizedEvent_t::m_pPrevOnTarget );
+	}
+
+	if ( pe->m_pCaller.IsValid() )
+	{
+		UnlinkFromChain( m_CallerIndex, pe->m_pCaller.ToInt(), pe, &EventQueuePrioritizedEvent_t::m_pNextFromCaller, &EventQueuePrioritizedEvent_t::m_pPrevFromCaller );
+	}
+
+	--m_nEventCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: converts a fire time to a wheel slot. Multiplying by a power of two
+//			is exact, so later fire times never map to earlier slots.
+//-----------------------------------------------------------------------------
+int CEventQueue::TimeToSlot( float flTime )
+{
+	float flSlot = flTime * WHEEL_SLOTS_PER_SECOND;
+	if ( !( flSlot > 0.0f ) )
+		return 0;
+
+	// far enough out that the clock will never get there
+	if ( flSlot >= (float)( 1 << 30 ) )
+		return 1 << 30;
+
+	return (int)flSlot;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: picks the bucket an event due in the given slot belongs in
+//-----------------------------------------------------------------------------
+EventQueueBucket_t *CEventQueue::BucketForSlot( int nSlot )
+{
+	// late events go with the ones firing right now
+	if ( nSlot <= m_nCurrentSlot )
+		return &m_Level0[ m_nCurrentSlot & WHEEL_SLOT_MASK ];
+
+	if ( ( nSlot >> WHEEL_SLOT_BITS ) == ( m_nCurrentSlot >> WHEEL_SLOT_BITS ) )
+		return &m_Level0[ nSlot & WHEEL_SLOT_MASK ];
+
+	if ( ( nSlot >> ( 2 * WHEEL_SLOT_BITS ) ) == ( m_nCurrentSlot >> ( 2 * WHEEL_SLOT_BITS ) ) )
+		return &m_Level1[ ( nSlot >> WHEEL_SLOT_BITS ) & WHEEL_SLOT_MASK ];
+
+	return &m_Overflow;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: adds an event behind every event in the bucket firing at or before it,
+//			the same place the old sorted list put it. New events almost always
+//			go at the tail.
+//-----------------------------------------------------------------------------
+void CEventQueue::InsertIntoBucket( EventQueueBucket_t *pBucket, EventQueuePrioritizedEvent_t *pe )
+{
+	EventQueuePrioritizedEvent_t *pAfter = pBucket->m_pTail;
+	while ( pAfter && pAfter->m_flFireTime > pe->m_flFireTime )
+	{
+		pAfter = pAfter->m_pPrev;
+	}
+
+	pe->m_pBucket = pBucket;
+	pe->m_pPrev = pAfter;
+	pe->m_pNext = pAfter ? pAfter->m_pNext : pBucket->m_pHead;
+	if ( pe->m_pNext )
+	{
+		pe->m_pNext->m_pPrev = pe;
+	}
+	else
+	{
+		pBucket->m_pTail = pe;
+	}
+	if ( pAfter )
+	{
+		pAfter->m_pNext = pe;
+	}
+	else
+	{
+		pBucket->m_pHead = pe;
+	}
+
+	int nBucket = BucketIndex( pBucket );
+	if ( nBucket < WHEEL_SLOTS )
+	{
+		++m_nLevel0Count;
+	}
+	else if ( nBucket < 2 * WHEEL_SLOTS )
+	{
+		++m_nLevel1Count;
+	}
+}
+
+void CEventQueue::UnlinkFromBucket( EventQueuePrioritizedEvent_t *pe )
+{
+	EventQueueBucket_t *pBucket = pe->m_pBucket;
+	Assert( pBucket );
+
+	if ( pe->m_pPrev )
+	{
+		pe->m_pPrev->m_pNext = pe->m_pNext;
+	}
+	else
+	{
+		pBucket->m_pHead = pe->m_pNext;
+	}
+	if ( pe->m_pNext )
+	{
+		pe->m_pNext->m_pPrev = pe->m_pPrev;
+	}
+	else
+	{
+		pBucket->m_pTail = pe->m_pPrev;
+	}
+	pe->m_pNext = pe->m_pPrev = NULL;
+	pe->m_pBucket = NULL;
+
+	int nBucket = BucketIndex( pBucket );
+	if ( nBucket < WHEEL_SLOTS )
+	{
+		--m_nLevel0Count;
+	}
+	else if ( nBucket < 2 * WHEEL_SLOTS )
+	{
+		--m_nLevel1Count;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: turns the wheel forward, at most up to nLimitSlot. Empty stretches are
+//			skipped a whole block or span at a time, and the outer levels are
+//			poured into the inner ones as the wheel reaches them.
+//-----------------------------------------------------------------------------
+void CEventQueue::StepWheel( int nLimitSlot )
+{
+	const int nSpanBits = 2 * WHEEL_SLOT_BITS;
+	const int nSpanMask = ( 1 << nSpanBits ) - 1;
+
+	int nNext;
+	if ( m_nLevel0Count )
+	{
+		nNext = m_nCurrentSlot + 1;
+	}
+	else if ( m_nLevel1Count )
+	{
+		nNext = ( m_nCurrentSlot | WHEEL_SLOT_MASK ) + 1;
+	}
+	else
 	{
-		if ( pe->m_pNext->m_flFireTime > newEvent->m_flFireTime )
+		nNext = ( m_nCurrentSlot | nSpanMask ) + 1;
+	}
+	nNext = MIN( nNext, nLimitSlot );
+	if ( nNext <= m_nCurrentSlot )
+		return;
+
+	bool bNewBlock = ( nNext >> WHEEL_SLOT_BITS ) != ( m_nCurrentSlot >> WHEEL_SLOT_BITS );
+	bool bNewSpan = ( nNext >> nSpanBits ) != ( m_nCurrentSlot >> nSpanBits );
+
+	// Anything still in the slot we're leaving is late, carry it along to the new current slot
+	EventQueuePrioritizedEvent_t *pCarried = m_Level0[ m_nCurrentSlot & WHEEL_SLOT_MASK ].m_pHead;
+
+	m_nCurrentSlot = nNext;
+
+	while ( pCarried )
+	{
+		EventQueuePrioritizedEvent_t *pNextCarried = pCarried->m_pNext;
+		UnlinkFromBucket( pCarried );
+		InsertIntoBucket( BucketForSlot( TimeToSlot( pCarried->m_flFireTime ) ), pCarried );
+		pCarried = pNextCarried;
+	}
+
+	if ( bNewSpan )
+	{
+		while ( m_Overflow.m_pHead && ( TimeToSlot( m_Overflow.m_pHead->m_flFireTime ) >> nSpanBits ) == ( nNext >> nSpanBits ) )
 		{
-			break;
+			EventQueuePrioritizedEvent_t *pe = m_Overflow.m_pHead;
+			UnlinkFromBucket( pe );
+			InsertIntoBucket( BucketForSlot( TimeToSlot( pe->m_flFireTime ) ), pe );
 		}
 	}
 
-	Assert( pe );
+	if ( bNewBlock )
+	{
+		EventQueueBucket_t *pBlock = &m_Level1[ ( nNext >> WHEEL_SLOT_BITS ) & WHEEL_SLOT_MASK ];
+		while ( pBlock->m_pHead )
+		{
+			EventQueuePrioritizedEvent_t *pe = pBlock->m_pHead;
+			UnlinkFromBucket( pe );
+			InsertIntoBucket( BucketForSlot( TimeToSlot( pe->m_flFireTime ) ), pe );
+		}
+	}
+}
+
+int CEventQueue::BucketIndex( const EventQueueBucket_t *pBucket ) const
+{
+	if ( pBucket >= m_Level0 && pBucket < m_Level0 + WHEEL_SLOTS )
+		return pBucket - m_Level0;
+
+	if ( pBucket >= m_Level1 && pBucket < m_Level1 + WHEEL_SLOTS )
+		return WHEEL_SLOTS + ( pBucket - m_Level1 );
+
+	Assert( pBucket == &m_Overflow );
+	return 2 * WHEEL_SLOTS;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: first event in or after the given bucket. The inner levels only hold
+//			slots at or ahead of the wheel, so bucket order is firing order.
+//-----------------------------------------------------------------------------
+EventQueuePrioritizedEvent_t *CEventQueue::FirstEventFrom( int nBucket )
+{
+	for ( ; nBucket < WHEEL_SLOTS; ++nBucket )
+	{
+		if ( m_Level0[ nBucket ].m_pHead )
+			return m_Level0[ nBucket ].m_pHead;
+	}
 
-	// insert
-	newEvent->m_pNext = pe->m_pNext;
-	newEvent->m_pPrev = pe;
-	pe->m_pNext = newEvent;
-	if ( newEvent->m_pNext )
+	for ( ; nBucket < 2 * WHEEL_SLOTS; ++nBucket )
 	{
-		newEvent->m_pNext->m_pPrev = newEvent;
+		if ( m_Level1[ nBucket - WHEEL_SLOTS ].m_pHead )
+			return m_Level1[ nBucket - WHEEL_SLOTS ].m_pHead;
 	}
+
+	return m_Overflow.m_pHead;
 }
 
-void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
+EventQueuePrioritizedEvent_t *CEventQueue::NextEvent( EventQueuePrioritizedEvent_t *pe )
 {
-	Assert( pe->m_pPrev );
-	pe->m_pPrev->m_pNext = pe->m_pNext;
 	if ( pe->m_pNext )
+		return pe->m_pNext;
+
+	int nBucket = BucketIndex( pe->m_pBucket );
+	if ( nBucket >= 2 * WHEEL_SLOTS )
+		return NULL;
+
+	return FirstEventFrom( nBucket + 1 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: per entity chains of events, the head of each chain lives in the index
+//-----------------------------------------------------------------------------
+void CEventQueue::LinkIntoChain( EventChainIndex_t &index, uint32 key, EventQueuePrioritizedEvent_t *pe, EventQueuePrioritizedEvent_t *EventQueuePrioritizedEvent_t::*pNext, EventQueuePrioritizedEvent_t *EventQueuePrioritizedEvent_t::*pPrev )
+{
+	pe->*pPrev = NULL;
+
+	UtlHashHandle_t h = index.Find( key );
+	if ( h == index.InvalidHandle() )
 	{
-		pe->m_pNext->m_pPrev = pe->m_pPrev;
+		pe->*pNext = NULL;
+		index.Insert( key, pe );
+		return;
+	}
+
+	EventQueuePrioritizedEvent_t *pHead = index.Element( h );
+	pe->*pNext = pHead;
+	pHead->*pPrev = pe;
+	index.Element( h ) = pe;
+}
+
+void CEventQueue::UnlinkFromChain( EventChainIndex_t &index, uint32 key, EventQueuePrioritizedEvent_t *pe, EventQueuePrioritizedEvent_t *EventQueuePrioritizedEvent_t::*pNext, EventQueuePrioritizedEvent_t *EventQueuePrioritizedEvent_t::*pPrev )
+{
+	if ( pe->*pNext )
+	{
+		( pe->*pNext )->*pPrev = pe->*pPrev;
+	}
+
+	if ( pe->*pPrev )
+	{
+		( pe->*pPrev )->*pNext = pe->*pNext;
+	}
+	else
+	{
+		UtlHashHandle_t h = index.Find( key );
+		Assert( h != index.InvalidHandle() && index.Element( h ) == pe );
+		if ( pe->*pNext )
+		{
+			index.Element( h ) = pe->*pNext;
+		}
+		else
+		{
+			index.Remove( key );
+		}
 	}
+
+	pe->*pNext = pe->*pPrev = NULL;
 }
 
 
@@ -905,14 +1195,26 @@ void CEventQueue::ServiceEvents( void )
 		return;
 	}
 
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-
 #ifdef TF_DLL
-	while ( pe != NULL && pe->m_flFireTime <= engine->GetServerTime() )
+	const float flNow = engine->GetServerTime();
 #else
-	while ( pe != NULL && pe->m_flFireTime <= gpGlobals->curtime )
+	const float flNow = gpGlobals->curtime;
 #endif
+	const int nNowSlot = TimeToSlot( flNow );
+
+	while ( 1 )
 	{
+		// everything due before the current slot has fired, so the next event is at the head of it
+		EventQueuePrioritizedEvent_t *pe = m_Level0[ m_nCurrentSlot & WHEEL_SLOT_MASK ].m_pHead;
+		if ( pe == NULL || pe->m_flFireTime > flNow )
+		{
+			if ( m_nCurrentSlot >= nNowSlot )
+				break;
+
+			StepWheel( nNowSlot );
+			continue;
+		}
+
 		MDLCACHE_CRITICAL_SECTION();
 
 		bool targetFound = false;
@@ -993,8 +1295,7 @@ void CEventQueue::ServiceEvents( void )
 			}
 		}
 
-		// restart the list (to catch any new items have probably been added to the queue)
-		pe = m_Events.m_pNext;	
+		// the head of the current slot is looked up again, to catch any new items that have probably been added to the queue
 	}
 }
 
@@ -1010,6 +1311,75 @@ void CC_DumpEventQueue()
 }
 static ConCommand dumpeventqueue( "dumpeventqueue", CC_DumpEventQueue, "Dump the contents of the Entity I/O event queue to the console." );
 
+//-----------------------------------------------------------------------------
+// Purpose: Times posting a burst of events with delays across the whole wheel,
+//			looking them up by target and cancelling them again.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( ent_benchmark_eventqueue, "Times posting, querying and cancelling a burst of entity I/O events. Usage: ent_benchmark_eventqueue [events] [queries]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nEvents = ( args.ArgC() >= 2 ) ? MAX( atoi( args[ 1 ] ), 1 ) : 10000;
+	int nQueries = ( args.ArgC() >= 3 ) ? MAX( atoi( args[ 2 ] ), 1 ) : 1000;
+
+	// One entity posts everything so the whole batch can be cancelled at the end
+	CBaseEntity *pCaller = CreateEntityByName( "info_target" );
+	CBaseEntity *pTarget = CreateEntityByName( "info_target" );
+	if ( !pCaller || !pTarget )
+		return;
+	DispatchSpawn( pCaller );
+	DispatchSpawn( pTarget );
+
+	int nQueued = g_EventQueue.Count();
+	CFastTimer timer;
+
+	// Delays spread over every level of the wheel; long enough that nothing fires in between
+	timer.Start();
+	for ( int i = 0; i < nEvents; ++i )
+	{
+		float flDelay = ( i & 1 ) ? RandomFloat( 1.0f, 4.0f ) : RandomFloat( 60.0f, 3600.0f );
+		if ( i % 4 == 0 )
+		{
+			g_EventQueue.AddEvent( "bench_no_such_entity", "Use", variant_t(), flDelay, NULL, pCaller );
+		}
+		else
+		{
+			g_EventQueue.AddEvent( ( i % 4 == 1 ) ? pTarget : pCaller, "Use", flDelay, NULL, pCaller );
+		}
+	}
+	timer.End();
+	float flAddMs = timer.GetDuration().GetMillisecondsF();
+
+	int nPending = 0;
+	timer.Start();
+	for ( int i = 0; i < nQueries; ++i )
+	{
+		nPending += g_EventQueue.HasEventPending( pTarget, "Use" ) ? 1 : 0;
+		nPending += g_EventQueue.HasEventPending( gEntList.FirstEnt(), NULL ) ? 1 : 0;
+	}
+	timer.End();
+	float flQueryMs = timer.GetDuration().GetMillisecondsF();
+
+	timer.Start();
+	g_EventQueue.CancelEventOn( pTarget, "Use" );
+	g_EventQueue.CancelEvents( pCaller );
+	timer.End();
+	float flCancelMs = timer.GetDuration().GetMillisecondsF();
+
+	Msg( "ent_benchmark_eventqueue: %d events posted on top of %d queued\n", nEvents, nQueued );
+	Msg( "  post:   %8.4f ms (%.3f us/event)\n", flAddMs, flAddMs * 1000.0f / nEvents );
+	Msg( "  query:  %8.4f ms for %d pending checks (%d hits)\n", flQueryMs, nQueries * 2, nPending );
+	Msg( "  cancel: %8.4f ms\n", flCancelMs );
+	if ( g_EventQueue.Count() != nQueued )
+	{
+		Warning( "ent_benchmark_eventqueue: %d events left behind after cancelling!\n", g_EventQueue.Count() - nQueued );
+	}
+
+	UTIL_Remove( pCaller );
+	UTIL_Remove( pTarget );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Removes all pending events from the I/O queue that were added by the
 //			given caller.
@@ -1022,7 +1392,9 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 	if (!pCaller)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	// only the events posted by this caller are chained under its handle
+	UtlHashHandle_t h = m_CallerIndex.Find( pCaller->GetRefEHandle().ToInt() );
+	EventQueuePrioritizedEvent_t *pCur = ( h != m_CallerIndex.InvalidHandle() ) ? m_CallerIndex.Element( h ) : NULL;
 
 	while (pCur != NULL)
 	{
@@ -1039,7 +1411,7 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextFromCaller;
 
 		if (bDelete)
 		{
@@ -1060,7 +1432,8 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 	if (!pTarget)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	UtlHashHandle_t h = m_TargetIndex.Find( pTarget->GetRefEHandle().ToInt() );
+	EventQueuePrioritizedEvent_t *pCur = ( h != m_TargetIndex.InvalidHandle() ) ? m_TargetIndex.Element( h ) : NULL;
 
 	while (pCur != NULL)
 	{
@@ -1075,7 +1448,7 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextOnTarget;
 
 		if (bDelete)
 		{
@@ -1095,7 +1468,8 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 	if (!pTarget)
 		return false;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	UtlHashHandle_t h = m_TargetIndex.Find( pTarget->GetRefEHandle().ToInt() );
+	EventQueuePrioritizedEvent_t *pCur = ( h != m_TargetIndex.InvalidHandle() ) ? m_TargetIndex.Element( h ) : NULL;
 
 	while (pCur != NULL)
 	{
@@ -1108,7 +1482,7 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 				return true;
 		}
 
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextOnTarget;
 	}
 
 	return false;
@@ -1125,8 +1499,7 @@ void ServiceEventQueue( void )
 
 // save data description for the event queue
 BEGIN_SIMPLE_DATADESC( CEventQueue )
-	// These are saved explicitly in CEventQueue::Save below
-	// DEFINE_FIELD( m_Events, EventQueuePrioritizedEvent_t ),
+	// The events are saved explicitly in CEventQueue::Save below
 
 	DEFINE_FIELD( m_iListCount, FIELD_INTEGER ),	// this value is only used during save/restore
 END_DATADESC()
@@ -1145,6 +1518,7 @@ BEGIN_SIMPLE_DATADESC( EventQueuePrioritizedEvent_t )
 
 //	DEFINE_FIELD( m_pNext, FIELD_??? ),
 //	DEFINE_FIELD( m_pPrev, FIELD_??? ),
+//	the bucket and the target / caller chains are rebuilt when the event is added back
 END_DATADESC()
 
 
@@ -1153,18 +1527,14 @@ int CEventQueue::Save( ISave &save )
 	// count the number of items in the queue
 	EventQueuePrioritizedEvent_t *pe;
 
-	m_iListCount = 0;
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
-	{
-		m_iListCount++;
-	}
+	m_iListCount = m_nEventCount;
 
 	// save that value out to disk, so we know how many to restore
 	if ( !save.WriteFields( "EventQueue", this, NULL, m_DataMap.dataDesc, m_DataMap.dataNumFields ) )
 		return 0;
 	
-	// cycle through all the events, saving them all
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
+	// cycle through all the events in firing order, saving them all
+	for ( pe = FirstEvent(); pe != NULL; pe = NextEvent( pe ) )
 	{
 		if ( !save.WriteFields( "PEvent", pe, NULL, pe->m_DataMap.dataDesc, pe->m_DataMap.dataNumFields ) )
 			return 0;
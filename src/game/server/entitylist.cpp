@@ -17,6 +17,8 @@
 #include "ai_initutils.h"
 #include "globalstate.h"
 #include "datacache/imdlcache.h"
+#include "tier1/generichash.h"
+#include "tier0/fasttimer.h"
 
 #ifdef HL2_DLL
 #include "npc_playercompanion.h"
@@ -123,16 +125,28 @@ void AimTarget_ForceRepopulateList()
 }
 
 
+ConVar sv_think_wheel( "sv_think_wheel", "1", 0, "Find the entities due to think from a wheel of per-tick buckets instead of checking every thinking entity each tick" );
+
 // Manages a list of all entities currently doing game simulation or thinking
 // NOTE: This is usually a small subset of the global entity list, so it's
 // an optimization to maintain this list incrementally rather than polling each
 // frame.
+//
+// Entities that only think are also linked into a timing wheel, one bucket
+// per tick, so each tick only visits the entities whose next think falls
+// on it. Entities that simulate every tick, or that are due but haven't
+// rescheduled their think yet, sit in a separate bucket checked every tick.
 struct simthinkentry_t
 {
 	unsigned short	entEntry;
 	unsigned short	unused0;
 	int				nextThinkTick;
 };
+
+#define SIMTHINK_WHEEL_SLOTS	256		// must be a power of two; about four seconds of ticks
+#define SIMTHINK_WHEEL_MASK		( SIMTHINK_WHEEL_SLOTS - 1 )
+#define SIMTHINK_SLOT_ALWAYS	SIMTHINK_WHEEL_SLOTS
+
 class CSimThinkManager : public IEntityListener
 {
 public:
@@ -146,7 +160,13 @@ public:
 		for ( int i = 0; i < ARRAYSIZE(m_entinfoIndex); i++ )
 		{
 			m_entinfoIndex[i] = 0xFFFF;
+			m_wheelSlot[i] = 0xFFFF;
 		}
+		for ( int i = 0; i < ARRAYSIZE(m_wheelHead); i++ )
+		{
+			m_wheelHead[i] = 0xFFFF;
+		}
+		m_lastWheelTick = -1;
 	}
 	void LevelInitPreEntity()
 	{
@@ -177,6 +197,7 @@ public:
 			Assert(m_simThinkList[listHandle].entEntry == index);
 			m_simThinkList.FastRemove( listHandle );
 			m_entinfoIndex[index] = 0xFFFF;
+			UnlinkFromWheel( index );
 			
 			// fast remove shifted someone, update that someone
 			if ( listHandle < m_simThinkList.Count() )
@@ -192,6 +213,9 @@ public:
 
 	int ListCopy( CBaseEntity *pList[], int listMax )
 	{
+		if ( sv_think_wheel.GetBool() )
+			return WheelListCopy( pList, listMax );
+
 		int count = MIN(listMax, ListCount());
 		int out = 0;
 		for ( int i = 0; i < count; i++ )
@@ -255,12 +279,119 @@ public:
 					m_simThinkList[m_entinfoIndex[index]].nextThinkTick = 0;
 				}
 			}
+
+			UnlinkFromWheel( index );
+			LinkToWheel( index, m_simThinkList[m_entinfoIndex[index]].nextThinkTick );
 		}
 	}
 
 private:
+	void LinkToWheel( int index, int nextThinkTick )
+	{
+		// Ticks the wheel has already passed go in the bucket checked every tick
+		int slot = ( nextThinkTick <= m_lastWheelTick || nextThinkTick <= 0 ) ? SIMTHINK_SLOT_ALWAYS : ( nextThinkTick & SIMTHINK_WHEEL_MASK );
+
+		m_wheelSlot[index] = slot;
+		m_wheelPrev[index] = 0xFFFF;
+		m_wheelNext[index] = m_wheelHead[slot];
+		if ( m_wheelHead[slot] != 0xFFFF )
+		{
+			m_wheelPrev[m_wheelHead[slot]] = index;
+		}
+		m_wheelHead[slot] = index;
+	}
+
+	void UnlinkFromWheel( int index )
+	{
+		int slot = m_wheelSlot[index];
+		if ( slot == 0xFFFF )
+			return;
+
+		if ( m_wheelPrev[index] != 0xFFFF )
+		{
+			m_wheelNext[m_wheelPrev[index]] = m_wheelNext[index];
+		}
+		else
+		{
+			m_wheelHead[slot] = m_wheelNext[index];
+		}
+
+		if ( m_wheelNext[index] != 0xFFFF )
+		{
+			m_wheelPrev[m_wheelNext[index]] = m_wheelPrev[index];
+		}
+		m_wheelSlot[index] = 0xFFFF;
+	}
+
+	static int __cdecl HandleCompare( const unsigned short *lhs, const unsigned short *rhs )
+	{
+		return (int)*lhs - (int)*rhs;
+	}
+
+	// Same entities, in the same order, as the full walk in ListCopy()
+	int WheelListCopy( CBaseEntity *pList[], int listMax )
+	{
+		int tick = gpGlobals->tickcount;
+		if ( tick < m_lastWheelTick )
+		{
+			// The clock went back, sweep the whole wheel again
+			m_lastWheelTick = tick - SIMTHINK_WHEEL_SLOTS;
+		}
+
+		// Move everything due from the buckets the wheel has passed since last time
+		// into the always bucket, where it stays until its think is rescheduled
+		if ( tick > m_lastWheelTick )
+		{
+			int first = ( tick - m_lastWheelTick >= SIMTHINK_WHEEL_SLOTS ) ? tick - SIMTHINK_WHEEL_SLOTS + 1 : m_lastWheelTick + 1;
+			m_lastWheelTick = tick;
+
+			for ( int t = first; t <= tick; t++ )
+			{
+				int index = m_wheelHead[t & SIMTHINK_WHEEL_MASK];
+				while ( index != 0xFFFF )
+				{
+					int next = m_wheelNext[index];
+					if ( m_simThinkList[m_entinfoIndex[index]].nextThinkTick <= tick )
+					{
+						UnlinkFromWheel( index );
+						LinkToWheel( index, 0 );
+					}
+					index = next;
+				}
+			}
+		}
+
+		CUtlVectorFixedGrowable<unsigned short, 256> handles;
+		for ( int index = m_wheelHead[SIMTHINK_SLOT_ALWAYS]; index != 0xFFFF; index = m_wheelNext[index] )
+		{
+			int listHandle = m_entinfoIndex[index];
+			if ( listHandle < listMax && m_simThinkList[listHandle].nextThinkTick <= tick )
+			{
+				handles.AddToTail( listHandle );
+			}
+		}
+		handles.Sort( HandleCompare );
+
+		for ( int i = 0; i < handles.Count(); i++ )
+		{
+			const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( m_simThinkList[handles[i]].entEntry );
+			pList[i] = (CBaseEntity *)pInfo->m_pEntity;
+			Assert(m_simThinkList[handles[i]].nextThinkTick==0 || pList[i]->GetFirstThinkTick()==m_simThinkList[handles[i]].nextThinkTick);
+			Assert( gEntList.IsEntityPtr( pList[i] ) );
+		}
+
+		return handles.Count();
+	}
+
 	unsigned short m_entinfoIndex[NUM_ENT_ENTRIES];
 	CUtlVector<simthinkentry_t>	m_simThinkList;
+
+	// Timing wheel, linked through the entinfo index
+	unsigned short m_wheelHead[SIMTHINK_WHEEL_SLOTS + 1];
+	unsigned short m_wheelNext[NUM_ENT_ENTRIES];
+	unsigned short m_wheelPrev[NUM_ENT_ENTRIES];
+	unsigned short m_wheelSlot[NUM_ENT_ENTRIES];
+	int m_lastWheelTick;
 };
 
 CSimThinkManager g_SimThinkManager;
@@ -294,6 +425,181 @@ CGlobalEntityList::CGlobalEntityList()
 {
 	m_iHighestEnt = m_iNumEnts = m_iNumEdicts = 0;
 	m_bClearingEntities = false;
+
+	memset( m_iEntitySerial, 0, sizeof( m_iEntitySerial ) );
+	m_nNextEntitySerial = 0;
+	m_NameIndex.Init( m_iEntitySerial );
+	m_ClassnameIndex.Init( m_iEntitySerial );
+	m_TargetIndex.Init( m_iEntitySerial );
+}
+
+
+//-----------------------------------------------------------------------------
+// CEntityStringIndex
+//-----------------------------------------------------------------------------
+CEntityStringIndex::CEntityStringIndex() : m_Heads( 256 ), m_pSerials( NULL )
+{
+	for ( int i = 0; i < NUM_ENT_ENTRIES; i++ )
+	{
+		m_Nodes[i].m_iszKey = NULL_STRING;
+		m_Nodes[i].m_nHash = 0;
+		m_Nodes[i].m_iNext = m_Nodes[i].m_iPrev = -1;
+	}
+}
+
+void CEntityStringIndex::Set( int iEntry, string_t iszKey )
+{
+	Node_t &node = m_Nodes[iEntry];
+	if ( node.m_iszKey == iszKey )
+		return;
+
+	if ( node.m_iszKey != NULL_STRING )
+	{
+		Unlink( iEntry );
+	}
+
+	node.m_iszKey = iszKey;
+	if ( iszKey != NULL_STRING )
+	{
+		node.m_nHash = HashStringCaseless( STRING( iszKey ) );
+		Link( iEntry );
+	}
+}
+
+void CEntityStringIndex::Link( int iEntry )
+{
+	Node_t &node = m_Nodes[iEntry];
+
+	UtlHashHandle_t h = m_Heads.Find( node.m_nHash );
+	if ( h == m_Heads.InvalidHandle() )
+	{
+		node.m_iNext = -1;
+		node.m_iPrev = iEntry;
+		m_Heads.Insert( node.m_nHash, iEntry );
+		return;
+	}
+
+	// Walk back from the tail to keep list order; new entities land at the end
+	const int iHead = m_Heads.Element( h );
+	int iAfter = m_Nodes[iHead].m_iPrev;
+	while ( iAfter != -1 && m_pSerials[iAfter] > m_pSerials[iEntry] )
+	{
+		iAfter = ( iAfter == iHead ) ? -1 : m_Nodes[iAfter].m_iPrev;
+	}
+
+	if ( iAfter == -1 )
+	{
+		node.m_iNext = iHead;
+		node.m_iPrev = m_Nodes[iHead].m_iPrev;
+		m_Nodes[iHead].m_iPrev = iEntry;
+		m_Heads.Element( h ) = iEntry;
+		return;
+	}
+
+	node.m_iPrev = iAfter;
+	node.m_iNext = m_Nodes[iAfter].m_iNext;
+	if ( node.m_iNext != -1 )
+	{
+		m_Nodes[node.m_iNext].m_iPrev = iEntry;
+	}
+	else
+	{
+		m_Nodes[iHead].m_iPrev = iEntry;
+	}
+	m_Nodes[iAfter].m_iNext = iEntry;
+}
+
+void CEntityStringIndex::Unlink( int iEntry )
+{
+	Node_t &node = m_Nodes[iEntry];
+
+	UtlHashHandle_t h = m_Heads.Find( node.m_nHash );
+	Assert( h != m_Heads.InvalidHandle() );
+	const int iHead = m_Heads.Element( h );
+
+	if ( iEntry == iHead )
+	{
+		if ( node.m_iNext == -1 )
+		{
+			m_Heads.Remove( node.m_nHash );
+		}
+		else
+		{
+			m_Nodes[node.m_iNext].m_iPrev = node.m_iPrev;
+			m_Heads.Element( h ) = node.m_iNext;
+		}
+	}
+	else
+	{
+		m_Nodes[node.m_iPrev].m_iNext = node.m_iNext;
+		if ( node.m_iNext != -1 )
+		{
+			m_Nodes[node.m_iNext].m_iPrev = node.m_iPrev;
+		}
+		else
+		{
+			m_Nodes[iHead].m_iPrev = node.m_iPrev;
+		}
+	}
+
+	node.m_iszKey = NULL_STRING;
+	node.m_iNext = node.m_iPrev = -1;
+}
+
+void CEntityStringIndex::RemoveAll()
+{
+	for ( int i = 0; i < NUM_ENT_ENTRIES; i++ )
+	{
+		m_Nodes[i].m_iszKey = NULL_STRING;
+		m_Nodes[i].m_iNext = m_Nodes[i].m_iPrev = -1;
+	}
+	m_Heads.RemoveAll();
+}
+
+int CEntityStringIndex::FindNext( const char *pszKey, int iAfterEntry ) const
+{
+	const uint32 nHash = HashStringCaseless( pszKey );
+
+	// Continuing a search, the last result is normally in this bucket already
+	if ( iAfterEntry >= 0 && m_Nodes[iAfterEntry].m_iszKey != NULL_STRING && m_Nodes[iAfterEntry].m_nHash == nHash )
+		return m_Nodes[iAfterEntry].m_iNext;
+
+	UtlHashHandle_t h = m_Heads.Find( nHash );
+	if ( h == m_Heads.InvalidHandle() )
+		return -1;
+
+	int i = m_Heads.Element( h );
+	if ( iAfterEntry >= 0 )
+	{
+		while ( i != -1 && m_pSerials[i] <= m_pSerials[iAfterEntry] )
+		{
+			i = m_Nodes[i].m_iNext;
+		}
+	}
+	return i;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Refiles an entity in the string indices after one of its strings changed
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::UpdateEntityStrings( CBaseEntity *pEntity )
+{
+	const CBaseHandle &handle = pEntity->GetRefEHandle();
+	if ( !handle.IsValid() || LookupEntity( handle ) != pEntity )
+		return;
+
+	const int iEntry = handle.GetEntryIndex();
+	m_NameIndex.Set( iEntry, pEntity->m_iName );
+	m_ClassnameIndex.Set( iEntry, pEntity->m_iClassname );
+	m_TargetIndex.Set( iEntry, pEntity->m_target );
+}
+
+void CGlobalEntityList::GetStringIndexStats( int &nNames, int &nClassnames, int &nTargets ) const
+{
+	nNames = m_NameIndex.GetBucketCount();
+	nClassnames = m_ClassnameIndex.GetBucketCount();
+	nTargets = m_TargetIndex.GetBucketCount();
 }
 
 
@@ -480,6 +786,23 @@ bool CGlobalEntityList::IsEntityPtr( void *pTest )
 //			szName - Classname to search for.
 //-----------------------------------------------------------------------------
 CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity, const char *szName )
+{
+	// Wildcards can match any bucket
+	if ( !szName || !szName[0] || strchr( szName, '*' ) )
+		return FindEntityByClassnameScan( pStartEntity, szName );
+
+	int iStart = pStartEntity ? pStartEntity->GetRefEHandle().GetEntryIndex() : -1;
+	for ( int i = m_ClassnameIndex.FindNext( szName, iStart ); i != -1; i = m_ClassnameIndex.NextInBucket( i ) )
+	{
+		CBaseEntity *pEntity = (CBaseEntity *)GetEntInfoPtrByIndex( i )->m_pEntity;
+		if ( pEntity && pEntity->ClassMatches( szName ) )
+			return pEntity;
+	}
+
+	return NULL;
+}
+
+CBaseEntity *CGlobalEntityList::FindEntityByClassnameScan( CBaseEntity *pStartEntity, const char *szName )
 {
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -590,7 +913,29 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 
 		return NULL;
 	}
-	
+
+	// Wildcards can match any bucket
+	if ( strchr( szName, '*' ) )
+		return FindEntityByNameScan( pStartEntity, szName, pFilter );
+
+	int iStart = pStartEntity ? pStartEntity->GetRefEHandle().GetEntryIndex() : -1;
+	for ( int i = m_NameIndex.FindNext( szName, iStart ); i != -1; i = m_NameIndex.NextInBucket( i ) )
+	{
+		CBaseEntity *ent = (CBaseEntity *)GetEntInfoPtrByIndex( i )->m_pEntity;
+		if ( !ent || !ent->NameMatches( szName ) )
+			continue;
+
+		if ( pFilter && !pFilter->ShouldFindEntity(ent) )
+			continue;
+
+		return ent;
+	}
+
+	return NULL;
+}
+
+CBaseEntity *CGlobalEntityList::FindEntityByNameScan( CBaseEntity *pStartEntity, const char *szName, IEntityFindFilter *pFilter )
+{
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -653,6 +998,22 @@ CBaseEntity *CGlobalEntityList::FindEntityByModel( CBaseEntity *pStartEntity, co
 //-----------------------------------------------------------------------------
 // FIXME: obsolete, remove
 CBaseEntity	*CGlobalEntityList::FindEntityByTarget( CBaseEntity *pStartEntity, const char *szName )
+{
+	if ( !szName )
+		return FindEntityByTargetScan( pStartEntity, szName );
+
+	int iStart = pStartEntity ? pStartEntity->GetRefEHandle().GetEntryIndex() : -1;
+	for ( int i = m_TargetIndex.FindNext( szName, iStart ); i != -1; i = m_TargetIndex.NextInBucket( i ) )
+	{
+		CBaseEntity *ent = (CBaseEntity *)GetEntInfoPtrByIndex( i )->m_pEntity;
+		if ( ent && FStrEq( STRING(ent->m_target), szName ) )
+			return ent;
+	}
+
+	return NULL;
+}
+
+CBaseEntity *CGlobalEntityList::FindEntityByTargetScan( CBaseEntity *pStartEntity, const char *szName )
 {
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -1092,6 +1453,11 @@ void CGlobalEntityList::OnAddEntity( IHandleEntity *pEnt, CBaseHandle handle )
 	CBaseEntity *pBaseEnt = static_cast<IServerUnknown*>(pEnt)->GetBaseEntity();
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts++;
+
+	g_EntitySOA.AddEntity( pBaseEnt, handle.GetEntryIndex() );
+
+	m_iEntitySerial[handle.GetEntryIndex()] = m_nNextEntitySerial++;
+	UpdateEntityStrings( pBaseEnt );
 	
 	// NOTE: Must be a CBaseEntity on server
 	Assert( pBaseEnt );
@@ -1125,6 +1491,12 @@ void CGlobalEntityList::OnRemoveEntity( IHandleEntity *pEnt, CBaseHandle handle
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts--;
 
+	g_EntitySOA.RemoveEntity( handle.GetEntryIndex() );
+
+	m_NameIndex.Remove( handle.GetEntryIndex() );
+	m_ClassnameIndex.Remove( handle.GetEntryIndex() );
+	m_TargetIndex.Remove( handle.GetEntryIndex() );
+
 	m_iNumEnts--;
 }
 
@@ -1634,3 +2006,103 @@ CON_COMMAND(report_simthinklist, "Lists all simulating/thinking entities")
 	list.ReportEntityList();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Fills the map up to the requested number of entities with named
+//			path_corners that target each other in chains, then times name,
+//			classname and target searches through the string indices against
+//			full list walks. The extra entities are removed at the end of the
+//			frame.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( ent_benchmark_lookup, "Times indexed entity searches by name, classname and target against list walks on a map filled up to the given entity count. Usage: ent_benchmark_lookup [entities] [iterations]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nTargetCount = ( args.ArgC() >= 2 ) ? atoi( args[ 1 ] ) : 2000;
+	int nIterations = ( args.ArgC() >= 3 ) ? MAX( atoi( args[ 2 ] ), 1 ) : 20;
+
+	// Keep clear of the edict limit, running out of edicts is fatal
+	int nToCreate = MIN( nTargetCount - gEntList.NumberOfEntities(), MAX_EDICTS - 128 - engine->GetEntityCount() );
+
+	CUtlVector<EHANDLE> created;
+	for ( int i = 0; i < nToCreate; ++i )
+	{
+		CBaseEntity *pEnt = CreateEntityByName( "path_corner" );
+		if ( !pEnt )
+			break;
+
+		char szName[ 32 ], szTarget[ 32 ];
+		Q_snprintf( szName, sizeof( szName ), "bench_corner_%d", i );
+		Q_snprintf( szTarget, sizeof( szTarget ), "bench_corner_%d", ( i % 8 == 7 ) ? i - 7 : i + 1 );
+		pEnt->KeyValue( "targetname", szName );
+		pEnt->KeyValue( "target", szTarget );
+		DispatchSpawn( pEnt );
+		created.AddToTail( pEnt );
+	}
+
+	// A fixed set of queries: present names, a missing name, a common and a rare classname, and targets
+	const int nQueries = 64;
+	char szQueries[ nQueries ][ 32 ];
+	for ( int i = 0; i < nQueries; ++i )
+	{
+		Q_snprintf( szQueries[ i ], sizeof( szQueries[ i ] ), "bench_corner_%d", created.Count() ? RandomInt( 0, created.Count() - 1 ) : 0 );
+	}
+
+	int nIndexed = 0, nScanned = 0;
+	CFastTimer timer;
+
+	timer.Start();
+	for ( int n = 0; n < nIterations; ++n )
+	{
+		nIndexed = 0;
+		for ( int i = 0; i < nQueries; ++i )
+		{
+			nIndexed += gEntList.FindEntityByName( NULL, szQueries[ i ] ) ? 1 : 0;
+			nIndexed += gEntList.FindEntityByTarget( NULL, szQueries[ i ] ) ? 1 : 0;
+		}
+		nIndexed += gEntList.FindEntityByName( NULL, "bench_no_such_entity" ) ? 1 : 0;
+		for ( CBaseEntity *pEnt = NULL; ( pEnt = gEntList.FindEntityByClassname( pEnt, "path_corner" ) ) != NULL; )
+			++nIndexed;
+		for ( CBaseEntity *pEnt = NULL; ( pEnt = gEntList.FindEntityByClassname( pEnt, "worldspawn" ) ) != NULL; )
+			++nIndexed;
+	}
+	timer.End();
+	float flIndexedMs = timer.GetDuration().GetMillisecondsF() / nIterations;
+
+	timer.Start();
+	for ( int n = 0; n < nIterations; ++n )
+	{
+		nScanned = 0;
+		for ( int i = 0; i < nQueries; ++i )
+		{
+			nScanned += gEntList.FindEntityByNameScan( NULL, szQueries[ i ] ) ? 1 : 0;
+			nScanned += gEntList.FindEntityByTargetScan( NULL, szQueries[ i ] ) ? 1 : 0;
+		}
+		nScanned += gEntList.FindEntityByNameScan( NULL, "bench_no_such_entity" ) ? 1 : 0;
+		for ( CBaseEntity *pEnt = NULL; ( pEnt = gEntList.FindEntityByClassnameScan( pEnt, "path_corner" ) ) != NULL; )
+			++nScanned;
+		for ( CBaseEntity *pEnt = NULL; ( pEnt = gEntList.FindEntityByClassnameScan( pEnt, "worldspawn" ) ) != NULL; )
+			++nScanned;
+	}
+	timer.End();
+	float flScannedMs = timer.GetDuration().GetMillisecondsF() / nIterations;
+
+	int nNameBuckets, nClassnameBuckets, nTargetBuckets;
+	gEntList.GetStringIndexStats( nNameBuckets, nClassnameBuckets, nTargetBuckets );
+
+	Msg( "ent_benchmark_lookup: %d entities (%d added), %d iterations of %d searches\n",
+		gEntList.NumberOfEntities(), created.Count(), nIterations, nQueries * 2 + 3 );
+	Msg( "  indexed: %8.4f ms/iteration (%d hits)\n", flIndexedMs, nIndexed );
+	Msg( "  scan:    %8.4f ms/iteration (%d hits)\n", flScannedMs, nScanned );
+	Msg( "  buckets: %d names, %d classnames, %d targets\n", nNameBuckets, nClassnameBuckets, nTargetBuckets );
+	if ( nIndexed != nScanned )
+	{
+		Warning( "ent_benchmark_lookup: results differ, the string indices are out of sync!\n" );
+	}
+
+	for ( int i = 0; i < created.Count(); ++i )
+	{
+		if ( created[ i ].Get() )
+			UTIL_Remove( created[ i ] );
+	}
+}
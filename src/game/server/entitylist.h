@@ -7,6 +7,7 @@
 //=============================================================================//
 #pragma once
 #include "baseentity.h"
+#include "tier1/utlhashtable.h"
 
 class IEntityListener;
 
@@ -52,6 +53,48 @@ public:
 	virtual CBaseEntity* GetFilterResult( void ) = 0;
 };
 
+//-----------------------------------------------------------------------------
+// Purpose: Buckets entity list entries by the caseless hash of one of their
+//			pooled strings. Buckets are kept in entity list order, so searches
+//			can walk a bucket instead of the whole list and still return
+//			entities in the same order a full scan would.
+//			Different strings may share a bucket, callers check each result.
+//-----------------------------------------------------------------------------
+class CEntityStringIndex {
+public:
+	CEntityStringIndex();
+
+	// pSerials gives the entity list order of each entry
+	void Init( const int* pSerials ) { m_pSerials = pSerials; }
+
+	// Files the entry under iszKey, NULL_STRING unindexes it
+	void Set( int iEntry, string_t iszKey );
+	void Remove( int iEntry ) { Set( iEntry, NULL_STRING ); }
+	void RemoveAll();
+
+	// First entry of the bucket for pszKey that comes after iAfterEntry in list order, -1 to start from the beginning.
+	// Returns -1 when there are no more.
+	int FindNext( const char* pszKey, int iAfterEntry ) const;
+	int NextInBucket( int iEntry ) const { return m_Nodes[ iEntry ].m_iNext; }
+
+	int GetBucketCount() const { return m_Heads.Count(); }
+
+private:
+	struct Node_t {
+		string_t m_iszKey;// NULL_STRING when not indexed
+		uint32 m_nHash;
+		short m_iNext;// -1 terminated
+		short m_iPrev;// the head links back to the tail
+	};
+
+	void Link( int iEntry );
+	void Unlink( int iEntry );
+
+	Node_t m_Nodes[ NUM_ENT_ENTRIES ];
+	CUtlHashtable<uint32, short> m_Heads;
+	const int* m_pSerials;
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: a global list of all the entities in the game.  All iteration through
 //			entities is done through this object.
@@ -66,6 +109,13 @@ private:
 	bool m_bClearingEntities;
 	CUtlVector<IEntityListener*> m_entityListeners;
 
+	// Lookup indices for the string searches, see UpdateEntityStrings
+	int m_iEntitySerial[ NUM_ENT_ENTRIES ];
+	int m_nNextEntitySerial;
+	CEntityStringIndex m_NameIndex;
+	CEntityStringIndex m_ClassnameIndex;
+	CEntityStringIndex m_TargetIndex;
+
 public:
 	IServerNetworkable* GetServerNetworkable( CBaseHandle hEnt ) const;
 	CBaseNetworkable* GetBaseNetworkable( CBaseHandle hEnt ) const;
@@ -97,6 +147,12 @@ public:
 	void NotifyCreateEntity( CBaseEntity* pEnt );
 	void NotifySpawn( CBaseEntity* pEnt );
 	void NotifyRemoveEntity( CBaseHandle hEnt );
+
+	// Refiles the entity under its current name, classname and target. Called by the
+	// CBaseEntity setters, keyvalue parsing and restore; anything writing m_iName,
+	// m_iClassname or m_target directly must call it too or searches will miss the entity.
+	void UpdateEntityStrings( CBaseEntity* pEntity );
+	void GetStringIndexStats( int& nNames, int& nClassnames, int& nTargets ) const;
 	// iteration functions
 
 	// returns the next entity after pCurrentEnt;  if pCurrentEnt is NULL, return the first entity
@@ -140,6 +196,11 @@ public:
 
 	CBaseEntity* FindEntityProcedural( const char* szName, CBaseEntity* pSearchingEntity = NULL, CBaseEntity* pActivator = NULL, CBaseEntity* pCaller = NULL );
 
+	// Full list walks, kept for wildcard searches and for checking the indices against
+	CBaseEntity* FindEntityByClassnameScan( CBaseEntity* pStartEntity, const char* szName );
+	CBaseEntity* FindEntityByNameScan( CBaseEntity* pStartEntity, const char* szName, IEntityFindFilter* pFilter = NULL );
+	CBaseEntity* FindEntityByTargetScan( CBaseEntity* pStartEntity, const char* szName );
+
 	CGlobalEntityList();
 
 	// CBaseEntityList overrides.
@@ -0,0 +1,260 @@
+//===========================================================================//
+//
+// Purpose: Structure-of-arrays mirror of hot per-entity server fields.
+//
+//===========================================================================//
+
+#include "cbase.h"
+#include "entitysoa.h"
+#include "mathlib/ssemath.h"
+#include "world.h"
+#include "tier0/fasttimer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+CEntitySOAMirror g_EntitySOA;
+
+
+CEntitySOAMirror::CEntitySOAMirror() :
+	m_nHighestEntry( -1 ), m_nSyncCount( 0 )
+{
+	for ( int i = ENTSOA_ABSORIGIN_X; i <= ENTSOA_ABSVELOCITY_Z; ++i )
+	{
+		m_Data.SetAttributeType( i, ATTRDATATYPE_FLOAT );
+	}
+	m_Data.SetAttributeType( ENTSOA_NEXTTHINKTICK, ATTRDATATYPE_INT );
+	m_Data.SetAttributeType( ENTSOA_FLAGS, ATTRDATATYPE_INT );
+	m_Data.SetAttributeType( ENTSOA_EFLAGS, ATTRDATATYPE_INT );
+	m_Data.SetAttributeType( ENTSOA_ENTITY, ATTRDATATYPE_POINTER );
+}
+
+//-----------------------------------------------------------------------------
+// The columns are allocated on first use so nothing happens at static init time
+//-----------------------------------------------------------------------------
+void CEntitySOAMirror::EnsureAllocated()
+{
+	if ( m_Data.NumCols() == 0 )
+	{
+		m_Data.AllocateData( NUM_ENT_ENTRIES, 1 );
+
+		int *pThinkTicks = m_Data.ElementPointer<int>( ENTSOA_NEXTTHINKTICK );
+		for ( int i = 0; i < NUM_ENT_ENTRIES; ++i )
+		{
+			pThinkTicks[i] = TICK_NEVER_THINK;
+		}
+	}
+}
+
+void CEntitySOAMirror::AddEntity( CBaseEntity *pEntity, int iEntry )
+{
+	EnsureAllocated();
+
+	*m_Data.ElementPointer<CBaseEntity *>( ENTSOA_ENTITY, iEntry ) = pEntity;
+	if ( iEntry > m_nHighestEntry )
+	{
+		m_nHighestEntry = iEntry;
+	}
+
+	// The entity isn't spawned yet, fill the row in on the next sync
+	MarkDirty( iEntry );
+}
+
+void CEntitySOAMirror::RemoveEntity( int iEntry )
+{
+	if ( m_Data.NumCols() == 0 )
+		return;
+
+	// Leave the row looking like a non-thinking entity at the origin, queries skip it anyway
+	*m_Data.ElementPointer<CBaseEntity *>( ENTSOA_ENTITY, iEntry ) = NULL;
+	*m_Data.ElementPointer<int>( ENTSOA_NEXTTHINKTICK, iEntry ) = TICK_NEVER_THINK;
+	m_Dirty.Clear( iEntry );
+
+	while ( m_nHighestEntry >= 0 && !*m_Data.ElementPointer<CBaseEntity *>( ENTSOA_ENTITY, m_nHighestEntry ) )
+	{
+		--m_nHighestEntry;
+	}
+}
+
+void CEntitySOAMirror::WriteRow( int iEntry, CBaseEntity *pEntity )
+{
+	const Vector &vecOrigin = pEntity->GetAbsOrigin();
+	const Vector &vecVelocity = pEntity->GetAbsVelocity();
+
+	*m_Data.ElementPointer<float>( ENTSOA_ABSORIGIN_X, iEntry ) = vecOrigin.x;
+	*m_Data.ElementPointer<float>( ENTSOA_ABSORIGIN_Y, iEntry ) = vecOrigin.y;
+	*m_Data.ElementPointer<float>( ENTSOA_ABSORIGIN_Z, iEntry ) = vecOrigin.z;
+	*m_Data.ElementPointer<float>( ENTSOA_ABSVELOCITY_X, iEntry ) = vecVelocity.x;
+	*m_Data.ElementPointer<float>( ENTSOA_ABSVELOCITY_Y, iEntry ) = vecVelocity.y;
+	*m_Data.ElementPointer<float>( ENTSOA_ABSVELOCITY_Z, iEntry ) = vecVelocity.z;
+	*m_Data.ElementPointer<int>( ENTSOA_NEXTTHINKTICK, iEntry ) = pEntity->m_nNextThinkTick;
+	*m_Data.ElementPointer<int>( ENTSOA_FLAGS, iEntry ) = pEntity->m_fFlags;
+	*m_Data.ElementPointer<int>( ENTSOA_EFLAGS, iEntry ) = pEntity->m_iEFlags;
+}
+
+void CEntitySOAMirror::Sync()
+{
+	if ( m_Data.NumCols() == 0 )
+		return;
+
+	CBaseEntity * const *ppEntities = GetEntityColumn();
+	for ( int i = m_Dirty.FindNextSetBit( 0 ); i != -1; i = m_Dirty.FindNextSetBit( i + 1 ) )
+	{
+		// Clear first: computing the abs origin can dirty this row again
+		m_Dirty.Clear( i );
+
+		if ( ppEntities[i] )
+		{
+			WriteRow( i, ppEntities[i] );
+			++m_nSyncCount;
+		}
+	}
+}
+
+int CEntitySOAMirror::FindInBox( const Vector &vecMins, const Vector &vecMaxs, CBaseEntity **ppList, int nMaxCount )
+{
+	Sync();
+
+	int nCount = 0;
+	if ( m_nHighestEntry < 0 )
+		return nCount;
+
+	const float *pX = GetFloatColumn( ENTSOA_ABSORIGIN_X );
+	const float *pY = GetFloatColumn( ENTSOA_ABSORIGIN_Y );
+	const float *pZ = GetFloatColumn( ENTSOA_ABSORIGIN_Z );
+	CBaseEntity * const *ppEntities = GetEntityColumn();
+
+	const fltx4 mins[3] = { ReplicateX4( vecMins.x ), ReplicateX4( vecMins.y ), ReplicateX4( vecMins.z ) };
+	const fltx4 maxs[3] = { ReplicateX4( vecMaxs.x ), ReplicateX4( vecMaxs.y ), ReplicateX4( vecMaxs.z ) };
+
+	const int nRows = ( m_nHighestEntry + 4 ) & ~3;
+	for ( int i = 0; i < nRows; i += 4 )
+	{
+		fltx4 x = LoadAlignedSIMD( pX + i );
+		fltx4 y = LoadAlignedSIMD( pY + i );
+		fltx4 z = LoadAlignedSIMD( pZ + i );
+
+		fltx4 inside = AndSIMD( CmpGeSIMD( x, mins[0] ), CmpLeSIMD( x, maxs[0] ) );
+		inside = AndSIMD( inside, AndSIMD( CmpGeSIMD( y, mins[1] ), CmpLeSIMD( y, maxs[1] ) ) );
+		inside = AndSIMD( inside, AndSIMD( CmpGeSIMD( z, mins[2] ), CmpLeSIMD( z, maxs[2] ) ) );
+
+		for ( int nMask = TestSignSIMD( inside ); nMask; nMask &= nMask - 1 )
+		{
+			const int iEntry = i + FirstBitInWord( nMask, 0 );
+			if ( ppEntities[iEntry] )
+			{
+				if ( nCount == nMaxCount )
+					return nCount;
+				ppList[nCount++] = ppEntities[iEntry];
+			}
+		}
+	}
+
+	return nCount;
+}
+
+int CEntitySOAMirror::FindThinkersDue( int nTick, CBaseEntity **ppList, int nMaxCount )
+{
+	Sync();
+
+	int nCount = 0;
+	const int *pThinkTicks = GetIntColumn( ENTSOA_NEXTTHINKTICK );
+	CBaseEntity * const *ppEntities = GetEntityColumn();
+	for ( int i = 0; i <= m_nHighestEntry; ++i )
+	{
+		// Unused rows never think
+		if ( pThinkTicks[i] == TICK_NEVER_THINK || pThinkTicks[i] > nTick || !ppEntities[i] )
+			continue;
+
+		if ( nCount == nMaxCount )
+			break;
+		ppList[nCount++] = ppEntities[i];
+	}
+
+	return nCount;
+}
+
+int CEntitySOAMirror::GetAndResetSyncCount()
+{
+	int nCount = m_nSyncCount;
+	m_nSyncCount = 0;
+	return nCount;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compares walking the entity list against streaming over the mirror
+//			for the two scans it is meant for: a box test against abs origins
+//			and collecting the entities whose think is due. Use after
+//			Test_SpawnRandomEntities to get a realistic entity count.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( ent_benchmark_soa, "Times entity list scans against the SoA entity mirror. Usage: ent_benchmark_soa [iterations]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nIterations = ( args.ArgC() >= 2 ) ? MAX( atoi( args[ 1 ] ), 1 ) : 100;
+
+	// A box around a random spot covering roughly an eighth of the world
+	Vector vMin( -MAX_COORD_FLOAT, -MAX_COORD_FLOAT, -MAX_COORD_FLOAT ), vMax( MAX_COORD_FLOAT, MAX_COORD_FLOAT, MAX_COORD_FLOAT );
+	if ( CWorld *pWorld = GetWorldEntity() )
+	{
+		pWorld->GetWorldBounds( vMin, vMax );
+	}
+	Vector vCenter( RandomFloat( vMin.x, vMax.x ), RandomFloat( vMin.y, vMax.y ), RandomFloat( vMin.z, vMax.z ) );
+	Vector vExtents = ( vMax - vMin ) * 0.25f;
+	Vector vBoxMin = vCenter - vExtents, vBoxMax = vCenter + vExtents;
+
+	CBaseEntity *pList[ NUM_ENT_ENTRIES ];
+	int nTick = gpGlobals->tickcount;
+	int nEntities = 0, nListInBox = 0, nListThinkers = 0, nSOAInBox = 0, nSOAThinkers = 0;
+
+	CFastTimer timer;
+
+	// Entity list walk
+	timer.Start();
+	for ( int i = 0; i < nIterations; ++i )
+	{
+		nEntities = nListInBox = nListThinkers = 0;
+		for ( CBaseEntity *pEnt = gEntList.FirstEnt(); pEnt; pEnt = gEntList.NextEnt( pEnt ) )
+		{
+			++nEntities;
+
+			const Vector &vecOrigin = pEnt->GetAbsOrigin();
+			if ( vecOrigin.x >= vBoxMin.x && vecOrigin.x <= vBoxMax.x &&
+				 vecOrigin.y >= vBoxMin.y && vecOrigin.y <= vBoxMax.y &&
+				 vecOrigin.z >= vBoxMin.z && vecOrigin.z <= vBoxMax.z )
+			{
+				pList[ nListInBox++ ] = pEnt;
+			}
+
+			int nNextThink = pEnt->GetNextThinkTick();
+			if ( nNextThink != TICK_NEVER_THINK && nNextThink <= nTick )
+			{
+				++nListThinkers;
+			}
+		}
+	}
+	timer.End();
+	float flListMs = timer.GetDuration().GetMillisecondsF() / nIterations;
+
+	// Mirror, including the cost of refreshing whatever changed since the last sync
+	g_EntitySOA.Sync();
+	g_EntitySOA.GetAndResetSyncCount();
+	timer.Start();
+	for ( int i = 0; i < nIterations; ++i )
+	{
+		nSOAInBox = g_EntitySOA.FindInBox( vBoxMin, vBoxMax, pList, ARRAYSIZE( pList ) );
+		nSOAThinkers = g_EntitySOA.FindThinkersDue( nTick, pList, ARRAYSIZE( pList ) );
+	}
+	timer.End();
+	float flSOAMs = timer.GetDuration().GetMillisecondsF() / nIterations;
+
+	Msg( "ent_benchmark_soa: %d entities, %d iterations\n", nEntities, nIterations );
+	Msg( "  entity list: %8.4f ms/scan (%d in box, %d thinkers due)\n", flListMs, nListInBox, nListThinkers );
+	Msg( "  soa mirror:  %8.4f ms/scan (%d in box, %d thinkers due, %d rows resynced)\n", flSOAMs, nSOAInBox, nSOAThinkers, g_EntitySOA.GetAndResetSyncCount() );
+	if ( nSOAInBox != nListInBox || nSOAThinkers != nListThinkers )
+	{
+		Warning( "ent_benchmark_soa: results differ, the mirror is out of sync!\n" );
+	}
+}
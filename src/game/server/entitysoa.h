@@ -0,0 +1,90 @@
+//===========================================================================//
+//
+// Purpose: Structure-of-arrays mirror of hot per-entity server fields.
+//
+//  CBaseEntity keeps its origin, velocity, think tick and flags spread over
+//  a very large object, so code visiting every entity per tick misses the
+//  cache on each one. This mirror keeps copies of those fields in contiguous
+//  columns indexed by entity handle entry, for loops that only need them.
+//
+//  The networkvar setters and the physics invalidation flag a row as stale,
+//  and stale rows are refreshed in one pass the next time the mirror is read.
+//
+//===========================================================================//
+#pragma once
+
+#include "tier1/utlsoacontainer.h"
+#include "bitvec.h"
+#include "const.h"
+
+class CBaseEntity;
+
+
+//-----------------------------------------------------------------------------
+// Columns of the mirror
+//-----------------------------------------------------------------------------
+enum EntitySOAField_t
+{
+	ENTSOA_ABSORIGIN_X = 0,		// float
+	ENTSOA_ABSORIGIN_Y,
+	ENTSOA_ABSORIGIN_Z,
+	ENTSOA_ABSVELOCITY_X,		// float
+	ENTSOA_ABSVELOCITY_Y,
+	ENTSOA_ABSVELOCITY_Z,
+	ENTSOA_NEXTTHINKTICK,		// int, TICK_NEVER_THINK when not thinking
+	ENTSOA_FLAGS,				// int, FL_*
+	ENTSOA_EFLAGS,				// int, EFL_*
+	ENTSOA_ENTITY,				// CBaseEntity *, NULL for unused rows
+
+	ENTSOA_FIELD_COUNT,
+};
+
+
+class CEntitySOAMirror
+{
+public:
+	CEntitySOAMirror();
+
+	// Called by the entity list as entities come and go
+	void AddEntity( CBaseEntity *pEntity, int iEntry );
+	void RemoveEntity( int iEntry );
+
+	// Flags a row as stale, cheap enough to call from any setter
+	inline void MarkDirty( int iEntry )
+	{
+		Assert( iEntry >= 0 && iEntry < NUM_ENT_ENTRIES );
+		m_Dirty.Set( iEntry );
+	}
+
+	// Refreshes every stale row. Done by all the queries below; call it yourself
+	// before streaming over the raw columns.
+	void Sync();
+
+	// One past the highest row that may be in use
+	int GetRowCount() const { return m_nHighestEntry + 1; }
+
+	// Raw columns, 16 byte aligned and padded to a multiple of 4 rows
+	const float *GetFloatColumn( EntitySOAField_t nField ) const { return m_Data.ElementPointer<float>( nField ); }
+	const int *GetIntColumn( EntitySOAField_t nField ) const { return m_Data.ElementPointer<int>( nField ); }
+	CBaseEntity * const *GetEntityColumn() const { return m_Data.ElementPointer<CBaseEntity *>( ENTSOA_ENTITY ); }
+
+	// Entities whose abs origin lies within the box. Returns the number written.
+	int FindInBox( const Vector &vecMins, const Vector &vecMaxs, CBaseEntity **ppList, int nMaxCount );
+
+	// Entities whose base think is due at or before nTick. Returns the number written.
+	int FindThinkersDue( int nTick, CBaseEntity **ppList, int nMaxCount );
+
+	// Rows refreshed since the last call, for stats
+	int GetAndResetSyncCount();
+
+private:
+	void EnsureAllocated();
+	void WriteRow( int iEntry, CBaseEntity *pEntity );
+
+	CSOAContainer m_Data;
+	CBitVec<NUM_ENT_ENTRIES> m_Dirty;
+	int m_nHighestEntry;
+	int m_nSyncCount;
+};
+
+extern CEntitySOAMirror g_EntitySOA;
@@ -6,9 +6,23 @@
 //
 //			The queue is serviced once per server frame.
 //
+//			Pending events are kept in a two level timing wheel of 1/64 second
+//			slots, so posting an event doesn't scan the events already queued.
+//			Events are also linked per target and per caller entity for the
+//			cancel and pending queries.
+//
 //=============================================================================//
 #pragma once
 #include "mempool.h"
+#include "tier1/utlhashtable.h"
+
+struct EventQueuePrioritizedEvent_t;
+
+// a slot of the timing wheel, events in it are sorted by fire time, then by the order they were added
+struct EventQueueBucket_t {
+	EventQueuePrioritizedEvent_t* m_pHead;
+	EventQueuePrioritizedEvent_t* m_pTail;
+};
 
 struct EventQueuePrioritizedEvent_t {
 	float m_flFireTime;
@@ -23,6 +37,13 @@ struct EventQueuePrioritizedEvent_t {
 
 	EventQueuePrioritizedEvent_t* m_pNext;
 	EventQueuePrioritizedEvent_t* m_pPrev;
+	EventQueueBucket_t* m_pBucket;
+
+	// chains of the events sharing the same m_pEntTarget / m_pCaller
+	EventQueuePrioritizedEvent_t* m_pNextOnTarget;
+	EventQueuePrioritizedEvent_t* m_pPrevOnTarget;
+	EventQueuePrioritizedEvent_t* m_pNextFromCaller;
+	EventQueuePrioritizedEvent_t* m_pPrevFromCaller;
 
 	DECLARE_SIMPLE_DATADESC();
 
@@ -58,12 +79,53 @@ public:
 
 	void Dump();
 
+	// number of events waiting to be fired
+	int Count() const { return m_nEventCount; }
+
 private:
+	enum {
+		WHEEL_SLOT_BITS = 8,
+		WHEEL_SLOTS = 1 << WHEEL_SLOT_BITS,
+		WHEEL_SLOT_MASK = WHEEL_SLOTS - 1,
+		WHEEL_SLOTS_PER_SECOND = 64,// a power of two keeps the time to slot conversion exact
+	};
+
+	typedef CUtlHashtable<uint32, EventQueuePrioritizedEvent_t*> EventChainIndex_t;
+
 	void AddEvent( EventQueuePrioritizedEvent_t* event );
 	void RemoveEvent( EventQueuePrioritizedEvent_t* pe );
 
+	// wheel maintenance
+	static int TimeToSlot( float flTime );
+	EventQueueBucket_t* BucketForSlot( int nSlot );
+	void InsertIntoBucket( EventQueueBucket_t* pBucket, EventQueuePrioritizedEvent_t* pe );
+	void UnlinkFromBucket( EventQueuePrioritizedEvent_t* pe );
+	void StepWheel( int nLimitSlot );
+
+	// iterates every queued event in firing order; buckets are numbered level 0, level 1, then overflow
+	EventQueuePrioritizedEvent_t* FirstEvent() { return FirstEventFrom( 0 ); }
+	EventQueuePrioritizedEvent_t* NextEvent( EventQueuePrioritizedEvent_t* pe );
+	EventQueuePrioritizedEvent_t* FirstEventFrom( int nBucket );
+	int BucketIndex( const EventQueueBucket_t* pBucket ) const;
+
+	// per target and per caller chains
+	static void LinkIntoChain( EventChainIndex_t& index, uint32 key, EventQueuePrioritizedEvent_t* pe, EventQueuePrioritizedEvent_t* EventQueuePrioritizedEvent_t::*pNext, EventQueuePrioritizedEvent_t* EventQueuePrioritizedEvent_t::*pPrev );
+	static void UnlinkFromChain( EventChainIndex_t& index, uint32 key, EventQueuePrioritizedEvent_t* pe, EventQueuePrioritizedEvent_t* EventQueuePrioritizedEvent_t::*pNext, EventQueuePrioritizedEvent_t* EventQueuePrioritizedEvent_t::*pPrev );
+
 	DECLARE_SIMPLE_DATADESC();
-	EventQueuePrioritizedEvent_t m_Events;
+	// level 0 holds the slots of the current 256 slot block, level 1 the blocks of the current 256 block
+	// span and the overflow list everything further out. Lower levels are refilled as the wheel turns.
+	EventQueueBucket_t m_Level0[ WHEEL_SLOTS ];
+	EventQueueBucket_t m_Level1[ WHEEL_SLOTS ];
+	EventQueueBucket_t m_Overflow;
+	int m_nLevel0Count;
+	int m_nLevel1Count;
+	int m_nCurrentSlot;
+	int m_nEventCount;
+
+	EventChainIndex_t m_TargetIndex;
+	EventChainIndex_t m_CallerIndex;
+
 	int m_iListCount;
 };
 
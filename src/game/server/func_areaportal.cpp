@@ -179,6 +179,9 @@ bool CAreaPortal::KeyValue( const char *szKeyName, const char *szValue )
 bool CAreaPortal::UpdateState()
 {
 	engine->SetAreaPortalState( m_portalNumber, m_state );
+
+	// Which areas are connected decides who hears what
+	RecipientFilter_FlushMulticastCache();
 	return !!m_state;
 }
 
@@ -1121,7 +1121,10 @@ void CServerGameDLL::GameFrame( bool simulating ) {
 	UpdateQueryCache();
 	g_pServerBenchmark->UpdateBenchmark();
 
-	Physics_RunThinkFunctions( simulating );
+	{
+		SERVER_BENCHMARK_SECTION( BENCHMARK_SECTION_THINK );
+		Physics_RunThinkFunctions( simulating );
+	}
 
 	IGameSystem::FrameUpdatePostEntityThinkAllSystems();
 
@@ -1273,6 +1276,11 @@ void CServerGameDLL::LevelShutdown() {
 // Output : ServerClass*
 //-----------------------------------------------------------------------------
 ServerClass* CServerGameDLL::GetAllServerClasses() {
+	// Map the send props of every class while the engine registers them, so networkvar
+	// changes never have to build a map (see CServerNetworkProperty::RecordChangedProps)
+	for ( ServerClass* pClass = g_pServerClassHead; pClass; pClass = pClass->m_pNext ) {
+		CSendTablePropMap::Get( pClass->m_pTable );
+	}
 	return g_pServerClassHead;
 }
 
@@ -2097,6 +2105,8 @@ inline void CServerNetworkProperty::CheckTransmit( CCheckTransmitInfo *pInfo )
 } */
 
 void CServerGameEnts::CheckTransmit( CCheckTransmitInfo* pInfo, const unsigned short* pEdictIndices, int nEdicts ) {
+	SERVER_BENCHMARK_SECTION( BENCHMARK_SECTION_NETWORKING );
+
 	// NOTE: for speed's sake, this assumes that all networkables are CBaseEntities and that the edict list
 	// is consecutive in memory. If either of these things change, then this routine needs to change, but
 	// ideally we won't be calling any virtual from this routine. This speedy routine was added as an
@@ -14,6 +14,8 @@
 #include "hl2_player.h"
 #include "vehicle_base.h"
 #include "gamestats.h"
+#include "hl_gamemovement.h"
+#include "func_ladder.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -28,14 +30,22 @@ public:
 		m_bInGodMode( false ),
 		m_bInNoClip( false )
 	{
-		m_vecSaveOrigin.Init();
+	}
+
+	~CHLPlayerMove()
+	{
+		FreeMoveSlots();
 	}
 
 	void SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *pHelper, CMoveData *move );
 	void FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *move );
 
+	CMoveData *CreateMoveData( void ) { return new CHLMoveData; }
+	void DestroyMoveData( CMoveData *move ) { delete static_cast<CHLMoveData*>( move ); }
+	IGameMovement *CreateGameMovement( void ) { return new CHL2GameMovement; }
+	bool CanMoveInParallel( CBasePlayer *player, CMoveData *move );
+
 private:
-	Vector m_vecSaveOrigin;
 	bool m_bWasInVehicle;
 	bool m_bVehicleFlipped;
 	bool m_bInGodMode;
@@ -62,6 +72,42 @@ CMoveData *g_pMoveData = &g_HLMoveData;
 
 IPredictionSystem *IPredictionSystem::g_pPredictionSystems = NULL;
 
+//-----------------------------------------------------------------------------
+// Purpose: Mounting and dismounting ladders moves the player with a ladder
+//			entity, so anyone on or near one moves on the main thread
+//-----------------------------------------------------------------------------
+bool CHLPlayerMove::CanMoveInParallel( CBasePlayer *player, CMoveData *move )
+{
+	if ( !BaseClass::CanMoveInParallel( player, move ) )
+		return false;
+
+	CHL2_Player *pHL2Player = dynamic_cast<CHL2_Player*>( player );
+	if ( !pHL2Player )
+		return false;
+
+	// Players on a ladder are MOVETYPE_LADDER; this catches the mount and dismount
+	if ( pHL2Player->GetLadderMove()->m_bForceLadderMove )
+		return false;
+
+	const float flLadderRange = 128.0f;
+	Vector vecOrigin = player->GetAbsOrigin();
+	for ( int i = 0; i < CFuncLadder::GetLadderCount(); i++ )
+	{
+		CFuncLadder *pLadder = CFuncLadder::GetLadder( i );
+		if ( !pLadder || !pLadder->IsEnabled() )
+			continue;
+
+		Vector vecTop, vecBottom, vecClosest;
+		pLadder->GetTopPosition( vecTop );
+		pLadder->GetBottomPosition( vecBottom );
+		CalcClosestPointOnLineSegment( vecOrigin, vecBottom, vecTop, vecClosest );
+		if ( vecOrigin.DistToSqr( vecClosest ) < flLadderRange * flLadderRange )
+			return false;
+	}
+
+	return true;
+}
+
 void CHLPlayerMove::SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *pHelper, CMoveData *move )
 {
 	// Call the default SetupMove code.
@@ -90,12 +136,12 @@ void CHLPlayerMove::SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 			if ( !m_bWasInVehicle )
 			{
 				m_bWasInVehicle = true;
-				m_vecSaveOrigin.Init();
+				pHLMove->m_vecSaveOrigin.Init();
 			}
 		}
 		else
 		{
-			m_vecSaveOrigin = player->GetAbsOrigin();
+			pHLMove->m_vecSaveOrigin = player->GetAbsOrigin();
 			if ( m_bWasInVehicle )
 			{
 				m_bWasInVehicle = false;
@@ -109,6 +155,8 @@ void CHLPlayerMove::FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *
 {
 	// Call the default FinishMove code.
 	BaseClass::FinishMove( player, ucmd, move );
+
+	CHLMoveData *pHLMove = static_cast<CHLMoveData*>( move );
 	if ( gpGlobals->frametime != 0 )
 	{		
 		float distance = 0.0f;
@@ -121,10 +169,10 @@ void CHLPlayerMove::FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *
 			{
 				Vector newPos;
 				obj->GetPosition( &newPos, NULL );
-				distance = VectorLength( newPos - m_vecSaveOrigin );
-				if ( m_vecSaveOrigin == vec3_origin || distance > 100.0f )
+				distance = VectorLength( newPos - pHLMove->m_vecSaveOrigin );
+				if ( pHLMove->m_vecSaveOrigin == vec3_origin || distance > 100.0f )
 					distance = 0.0f;
-				m_vecSaveOrigin = newPos;
+				pHLMove->m_vecSaveOrigin = newPos;
 			}
 			
 			CPropVehicleDriveable *driveable = dynamic_cast< CPropVehicleDriveable * >( player->GetVehicleEntity() );
@@ -149,7 +197,7 @@ void CHLPlayerMove::FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *
 		else
 		{
 			m_bVehicleFlipped = false;
-			distance = VectorLength( player->GetAbsOrigin() - m_vecSaveOrigin );
+			distance = VectorLength( player->GetAbsOrigin() - pHLMove->m_vecSaveOrigin );
 		}
 		if ( distance > 0 )
 		{
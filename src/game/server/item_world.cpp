@@ -76,7 +76,7 @@ void CWorldItem::Spawn( void )
 	}
 	else
 	{
-		pEntity->m_target = m_target;
+		pEntity->SetEntityTarget( m_target );
 		pEntity->SetName( GetEntityName() );
 		pEntity->ClearSpawnFlags();
 		pEntity->AddSpawnFlags( m_spawnflags );
@@ -241,7 +241,7 @@ void CLogicMeasureMovement::InputSetMeasureReference( inputdata_t &inputdata )
 
 void CLogicMeasureMovement::InputSetTarget( inputdata_t &inputdata )
 {
-	m_target = MAKE_STRING( inputdata.value.String() );
+	SetEntityTarget( MAKE_STRING( inputdata.value.String() ) );
 	SetTarget( inputdata.value.String() );
 }
 
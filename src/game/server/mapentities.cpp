@@ -18,6 +18,8 @@
 #include "datacache/imdlcache.h"
 #include "world.h"
 #include "toolframework/iserverenginetools.h"
+#include "tier0/fasttimer.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -32,6 +34,12 @@ struct HierarchicalSpawnMapData_t
 static CStringRegistry *g_pClassnameSpawnPriority = NULL;
 extern edict_t *g_pForceAttachEdict;
 
+extern typedescription_t *FindKeyvalueField( typedescription_t *pFields, int iNumFields, const char *szKeyName, int *pObjectOffset );
+
+ConVar sv_parallel_entity_parse( "sv_parallel_entity_parse", "1", 0, "Tokenise the map's entities and find the datamap fields of their keys on worker threads" );
+
+static MapEntityKeyField_t s_ResolvedKeyField;
+
 // creates an entity by string name, but does not spawn it
 CBaseEntity *CreateEntityByName( const char *className, int iForceEdictIndex )
 {
@@ -303,6 +311,336 @@ void SpawnAllEntities( int nEntities, HierarchicalSpawn_t *pSpawnList, bool bAct
 	}
 }
 
+//-----------------------------------------------------------------------------
+// An entity block of the map data, tokenised on a worker thread with its keys
+// matched to the keyfields of the datamap of the class it names
+//-----------------------------------------------------------------------------
+struct MapEntityKey_t
+{
+	int m_nKey;						// offsets into the record's text
+	int m_nValue;
+	typedescription_t *m_pField;	// NULL if the datamap has no keyfield for it
+	int m_nObjectOffset;
+};
+
+struct MapEntityRecord_t
+{
+	const char *m_pMapData;			// just past the opening brace
+	const char *m_pCloseBrace;
+	const char *m_pEndData;			// where MapEntity_ParseEntity() would have stopped
+	datamap_t *m_pDataMap;
+	int m_nClassname;				// offset into m_Text, -1 if there is none
+	bool m_bParsed;					// the keys ended right at m_pCloseBrace
+	CUtlVector<char> m_Text;
+	CUtlVector<MapEntityKey_t> m_Keys;
+};
+
+static inline bool IsMapEntityBraceChar( int c )
+{
+	return ( c == '{' || c == '}' || c == '(' || c == ')' || c == '\'' );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the braces around each entity in the map data without copying
+//			any tokens, skipping quoted strings, bare words and comments the way
+//			MapEntity_ParseToken() does.
+// Output : false if the data has anything the serial parser should deal with
+//-----------------------------------------------------------------------------
+static bool MapEntity_FindEntityBlocks( const char *pMapData, CUtlVector<const char *> &braces )
+{
+	const char *p = pMapData;
+	bool bInEntity = false;
+
+	for ( ;; )
+	{
+		int c = *p;
+		if ( c == 0 )
+			return !bInEntity;
+
+		if ( c <= ' ' )
+		{
+			p++;
+		}
+		else if ( c == '/' && p[1] == '/' )
+		{
+			while ( *p && *p != '\n' )
+				p++;
+		}
+		else if ( c == '\"' )
+		{
+			const char *pStart = ++p;
+			while ( *p && *p != '\"' )
+				p++;
+
+			// Unterminated or truncated strings end somewhere odd
+			if ( !*p || p - pStart >= MAPKEY_MAXLENGTH )
+				return false;
+			p++;
+		}
+		else if ( c == '{' || c == '}' )
+		{
+			if ( bInEntity == ( c == '{' ) )
+				return false;
+
+			bInEntity = !bInEntity;
+			braces.AddToTail( p );
+			p++;
+		}
+		else if ( !bInEntity || IsMapEntityBraceChar( c ) )
+		{
+			// Only braces belong between entities, and the rest are single character tokens
+			if ( !bInEntity )
+				return false;
+			p++;
+		}
+		else
+		{
+			do
+			{
+				p++;
+				c = *p;
+			} while ( c > ' ' && !IsMapEntityBraceChar( c ) );
+		}
+	}
+}
+
+static int AddMapEntityText( MapEntityRecord_t &record, const char *pszText )
+{
+	int nOffset = record.m_Text.Count();
+	record.m_Text.AddMultipleToTail( V_strlen( pszText ) + 1, pszText );
+	return nOffset;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Job: tokenises one entity block and finds the keyfield each key sets
+//-----------------------------------------------------------------------------
+static void MapEntity_TokeniseRecord( MapEntityRecord_t &record )
+{
+	CEntityMapData entData( (char*)record.m_pMapData );
+	char keyName[MAPKEY_MAXLENGTH];
+	char value[MAPKEY_MAXLENGTH];
+
+	record.m_nClassname = -1;
+	record.m_pDataMap = NULL;
+	if ( entData.ExtractValue( "classname", value ) )
+	{
+		record.m_nClassname = AddMapEntityText( record, value );
+
+		IEntityFactory *pFactory = EntityFactoryDictionary()->FindFactory( value );
+		record.m_pDataMap = pFactory ? pFactory->GetDataDescMap() : NULL;
+	}
+
+	if ( entData.GetFirstKey( keyName, value ) )
+	{
+		do
+		{
+			MapEntityKey_t &key = record.m_Keys[ record.m_Keys.AddToTail() ];
+			key.m_nKey = AddMapEntityText( record, keyName );
+			key.m_nValue = AddMapEntityText( record, value );
+			key.m_pField = NULL;
+			key.m_nObjectOffset = 0;
+
+			// CBaseEntity::KeyValue() strips the # tokens before it searches the datamap
+			char *s = strchr( keyName, '#' );
+			if ( s )
+			{
+				*s = '\0';
+			}
+
+			for ( datamap_t *dmap = record.m_pDataMap; dmap != NULL && !key.m_pField; dmap = dmap->baseMap )
+			{
+				key.m_pField = FindKeyvalueField( dmap->dataDesc, dmap->dataNumFields, keyName, &key.m_nObjectOffset );
+			}
+		}
+		while ( entData.GetNextKey( keyName, value ) );
+	}
+
+	char token[MAPKEY_MAXLENGTH];
+	record.m_pEndData = entData.CurrentBufferPosition();
+	record.m_bParsed = ( MapEntity_ParseToken( record.m_pEndData, token ) == record.m_pCloseBrace + 1 && token[0] == '}' );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Tokenises every entity of the map data on worker threads
+// Output : The records in map order, or NULL if the map data needs the serial parser
+//-----------------------------------------------------------------------------
+static MapEntityRecord_t *MapEntity_TokeniseAllEntities( const char *pMapData, int *pRecordCount, double *pSplitTime )
+{
+	CFastTimer timer;
+	timer.Start();
+
+	CUtlVector<const char *> braces;
+	bool bSplit = MapEntity_FindEntityBlocks( pMapData, braces );
+
+	timer.End();
+	*pSplitTime = timer.GetDuration().GetMillisecondsF();
+
+	if ( !bSplit || !braces.Count() )
+		return NULL;
+
+	int nRecords = braces.Count() / 2;
+	MapEntityRecord_t *pRecords = new MapEntityRecord_t[nRecords];
+	for ( int i = 0; i < nRecords; i++ )
+	{
+		pRecords[i].m_pMapData = braces[i * 2] + 1;
+		pRecords[i].m_pCloseBrace = braces[i * 2 + 1];
+	}
+
+	// MapEntity_ParseToken() builds its brace table on first use
+	char token[MAPKEY_MAXLENGTH];
+	MapEntity_ParseToken( pMapData, token );
+
+	ParallelProcess( "MapEntity_TokeniseRecord", pRecords, nRecords, &MapEntity_TokeniseRecord );
+
+	for ( int i = 0; i < nRecords; i++ )
+	{
+		if ( !pRecords[i].m_bParsed )
+		{
+			DevWarning( "MapEntity_ParseAllEntities: entity %d doesn't tokenise cleanly, parsing the map serially\n", i );
+			delete [] pRecords;
+			return NULL;
+		}
+	}
+
+	*pRecordCount = nRecords;
+	return pRecords;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Passes the keys of a tokenised entity block to the entity, in order
+//-----------------------------------------------------------------------------
+static void MapEntity_ApplyKeys( CBaseEntity *pEntity, MapEntityRecord_t &record )
+{
+#if IsDebug()
+	pEntity->ValidateDataDescription();
+#endif
+
+	// A filter may have made something other than the class the map names
+	bool bResolved = ( pEntity->GetDataDescMap() == record.m_pDataMap );
+
+	char *pText = record.m_Text.Base();
+	for ( int i = 0; i < record.m_Keys.Count(); i++ )
+	{
+		const MapEntityKey_t &key = record.m_Keys[i];
+		if ( bResolved )
+		{
+			s_ResolvedKeyField.m_pszKeyName = pText + key.m_nKey;
+			s_ResolvedKeyField.m_pDataMap = record.m_pDataMap;
+			s_ResolvedKeyField.m_pField = key.m_pField;
+			s_ResolvedKeyField.m_nObjectOffset = key.m_nObjectOffset;
+		}
+
+		pEntity->KeyValue( pText + key.m_nKey, pText + key.m_nValue );
+	}
+
+	s_ResolvedKeyField.m_pszKeyName = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The field found for the key currently being passed to the entity,
+//			if any. Only the key buffer handed out by MapEntity_ApplyKeys()
+//			matches, so keys a KeyValue() override renames or makes up search
+//			the datamap as usual.
+//-----------------------------------------------------------------------------
+const MapEntityKeyField_t *MapEntity_GetResolvedKeyField( CBaseEntity *pEntity, const char *pszKeyName )
+{
+	if ( !s_ResolvedKeyField.m_pszKeyName || s_ResolvedKeyField.m_pszKeyName != pszKeyName )
+		return NULL;
+
+	if ( pEntity->GetDataDescMap() != s_ResolvedKeyField.m_pDataMap )
+		return NULL;
+
+	return &s_ResolvedKeyField;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Spawns the entities that must spawn straight away, and adds the
+//			rest to the point template or spawn lists.
+// Input  : pCurMapData - The entity's keys in the map data.
+//			pMapData - The end of its keys, where MapEntity_ParseEntity() stopped.
+//-----------------------------------------------------------------------------
+static void MapEntity_AddParsedEntity( CBaseEntity *pEntity, const char *pCurMapData, const char *pMapData,
+	HierarchicalSpawn_t *pSpawnList, HierarchicalSpawnMapData_t *pSpawnMapData, int &nEntities, CUtlVector< CPointTemplate* > &pPointTemplates )
+{
+	if (pEntity->IsTemplate())
+	{
+		// It's a template entity. Squirrel away its keyvalue text so that we can
+		// recreate the entity later via a spawner. pMapData points at the '}'
+		// so we must add one to include it in the string.
+		Templates_Add(pEntity, pCurMapData, (pMapData - pCurMapData) + 2);
+
+		// Remove the template entity so that it does not show up in FindEntityXXX searches.
+		UTIL_Remove(pEntity);
+		gEntList.CleanupDeleteList();
+		return;
+	}
+
+	// To 
+	if ( dynamic_cast<CWorld*>( pEntity ) )
+	{
+		VPROF( "MapEntity_ParseAllEntities_SpawnWorld");
+
+		pEntity->m_iParent = NULL_STRING;	// don't allow a parent on the first entity (worldspawn)
+
+		DispatchSpawn(pEntity);
+		return;
+	}
+			
+	CNodeEnt *pNode = dynamic_cast<CNodeEnt*>(pEntity);
+	if ( pNode )
+	{
+		VPROF( "MapEntity_ParseAllEntities_SpawnTransients");
+
+		// We overflow the max edicts on large maps that have lots of entities.
+		// Nodes & Lights remove themselves immediately on Spawn(), so dispatch their
+		// spawn now, to free up the slot inside this loop.
+		// NOTE: This solution prevents nodes & lights from being used inside point_templates.
+		//
+		// NOTE: Nodes spawn other entities (ai_hint) if they need to have a persistent presence.
+		//		 To ensure keys are copied over into the new entity, we pass the mapdata into the
+		//		 node spawn function.
+		if ( pNode->Spawn( pCurMapData ) < 0 )
+		{
+			gEntList.CleanupDeleteList();
+		}
+		return;
+	}
+
+	if ( dynamic_cast<CLight*>(pEntity) )
+	{
+		VPROF( "MapEntity_ParseAllEntities_SpawnTransients");
+
+		// We overflow the max edicts on large maps that have lots of entities.
+		// Nodes & Lights remove themselves immediately on Spawn(), so dispatch their
+		// spawn now, to free up the slot inside this loop.
+		// NOTE: This solution prevents nodes & lights from being used inside point_templates.
+		if (DispatchSpawn(pEntity) < 0)
+		{
+			gEntList.CleanupDeleteList();
+		}
+		return;
+	}
+
+	// Build a list of all point_template's so we can spawn them before everything else
+	CPointTemplate *pTemplate = dynamic_cast< CPointTemplate* >(pEntity);
+	if ( pTemplate )
+	{
+		pPointTemplates.AddToTail( pTemplate );
+	}
+	else
+	{
+		// Queue up this entity for spawning
+		pSpawnList[nEntities].m_pEntity = pEntity;
+		pSpawnList[nEntities].m_nDepth = 0;
+		pSpawnList[nEntities].m_pDeferredParentAttachment = NULL;
+		pSpawnList[nEntities].m_pDeferredParent = NULL;
+
+		pSpawnMapData[nEntities].m_pMapData = pCurMapData;
+		pSpawnMapData[nEntities].m_iMapDataLength = (pMapData - pCurMapData) + 2;
+		nEntities++;
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Only called on BSP load. Parses and spawns all the entities in the BSP.
 // Input  : pMapData - Pointer to the entity data block to parse.
@@ -325,115 +663,103 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 		pMapData = serverenginetools->GetEntityData( pMapData );
 	}
 
-	//  Loop through all entities in the map data, creating each.
-	for ( ; true; pMapData = MapEntity_SkipToNextEntity(pMapData, szTokenBuffer) )
-	{
-		//
-		// Parse the opening brace.
-		//
-		char token[MAPKEY_MAXLENGTH];
-		pMapData = MapEntity_ParseToken( pMapData, token );
+	CFastTimer timer;
+	double flSplitTime = 0.0;
+	double flTokeniseTime = 0.0;
 
-		//
-		// Check to see if we've finished or not.
-		//
-		if (!pMapData)
-			break;
+	timer.Start();
 
-		if (token[0] != '{')
-		{
-			Error( "MapEntity_ParseAllEntities: found %s when expecting {", token);
-			continue;
-		}
+	// Tokenising and finding fields happens up front on worker threads; creating,
+	// passing keys and spawning stays here, in map order
+	MapEntityRecord_t *pRecords = NULL;
+	int nRecords = 0;
+	if ( sv_parallel_entity_parse.GetBool() && pMapData )
+	{
+		pRecords = MapEntity_TokeniseAllEntities( pMapData, &nRecords, &flSplitTime );
 
-		//
-		// Parse the entity and add it to the spawn list.
-		//
-		CBaseEntity *pEntity;
-		const char *pCurMapData = pMapData;
-		pMapData = MapEntity_ParseEntity(pEntity, pMapData, pFilter);
-		if (pEntity == NULL)
-			continue;
+		timer.End();
+		flTokeniseTime = timer.GetDuration().GetMillisecondsF() - flSplitTime;
+		timer.Start();
+	}
 
-		if (pEntity->IsTemplate())
+	if ( pRecords )
+	{
+		for ( int i = 0; i < nRecords; i++ )
 		{
-			// It's a template entity. Squirrel away its keyvalue text so that we can
-			// recreate the entity later via a spawner. pMapData points at the '}'
-			// so we must add one to include it in the string.
-			Templates_Add(pEntity, pCurMapData, (pMapData - pCurMapData) + 2);
+			MapEntityRecord_t &record = pRecords[i];
+			if ( record.m_nClassname < 0 )
+			{
+				Error( "classname missing from entity!\n" );
+			}
 
-			// Remove the template entity so that it does not show up in FindEntityXXX searches.
-			UTIL_Remove(pEntity);
-			gEntList.CleanupDeleteList();
-			continue;
-		}
+			const char *pszClassname = record.m_Text.Base() + record.m_nClassname;
 
-		// To 
-		if ( dynamic_cast<CWorld*>( pEntity ) )
-		{
-			VPROF( "MapEntity_ParseAllEntities_SpawnWorld");
+			CBaseEntity *pEntity = NULL;
+			if ( !pFilter || pFilter->ShouldCreateEntity( pszClassname ) )
+			{
+				if ( pFilter )
+					pEntity = pFilter->CreateNextEntity( pszClassname );
+				else
+					pEntity = CreateEntityByName( pszClassname );
 
-			pEntity->m_iParent = NULL_STRING;	// don't allow a parent on the first entity (worldspawn)
+				if ( pEntity != NULL )
+				{
+					MapEntity_ApplyKeys( pEntity, record );
+				}
+				else
+				{
+					Warning( "Can't init %s\n", pszClassname );
+				}
+			}
 
-			DispatchSpawn(pEntity);
-			continue;
-		}
-				
-		CNodeEnt *pNode = dynamic_cast<CNodeEnt*>(pEntity);
-		if ( pNode )
-		{
-			VPROF( "MapEntity_ParseAllEntities_SpawnTransients");
+			if ( pEntity == NULL )
+				continue;
 
-			// We overflow the max edicts on large maps that have lots of entities.
-			// Nodes & Lights remove themselves immediately on Spawn(), so dispatch their
-			// spawn now, to free up the slot inside this loop.
-			// NOTE: This solution prevents nodes & lights from being used inside point_templates.
-			//
-			// NOTE: Nodes spawn other entities (ai_hint) if they need to have a persistent presence.
-			//		 To ensure keys are copied over into the new entity, we pass the mapdata into the
-			//		 node spawn function.
-			if ( pNode->Spawn( pCurMapData ) < 0 )
-			{
-				gEntList.CleanupDeleteList();
-			}
-			continue;
+			MapEntity_AddParsedEntity( pEntity, record.m_pMapData, record.m_pEndData, pSpawnList, pSpawnMapData, nEntities, pPointTemplates );
 		}
 
-		if ( dynamic_cast<CLight*>(pEntity) )
+		delete [] pRecords;
+	}
+	else
+	{
+		//  Loop through all entities in the map data, creating each.
+		for ( ; true; pMapData = MapEntity_SkipToNextEntity(pMapData, szTokenBuffer) )
 		{
-			VPROF( "MapEntity_ParseAllEntities_SpawnTransients");
+			//
+			// Parse the opening brace.
+			//
+			char token[MAPKEY_MAXLENGTH];
+			pMapData = MapEntity_ParseToken( pMapData, token );
 
-			// We overflow the max edicts on large maps that have lots of entities.
-			// Nodes & Lights remove themselves immediately on Spawn(), so dispatch their
-			// spawn now, to free up the slot inside this loop.
-			// NOTE: This solution prevents nodes & lights from being used inside point_templates.
-			if (DispatchSpawn(pEntity) < 0)
+			//
+			// Check to see if we've finished or not.
+			//
+			if (!pMapData)
+				break;
+
+			if (token[0] != '{')
 			{
-				gEntList.CleanupDeleteList();
+				Error( "MapEntity_ParseAllEntities: found %s when expecting {", token);
+				continue;
 			}
-			continue;
-		}
 
-		// Build a list of all point_template's so we can spawn them before everything else
-		CPointTemplate *pTemplate = dynamic_cast< CPointTemplate* >(pEntity);
-		if ( pTemplate )
-		{
-			pPointTemplates.AddToTail( pTemplate );
-		}
-		else
-		{
-			// Queue up this entity for spawning
-			pSpawnList[nEntities].m_pEntity = pEntity;
-			pSpawnList[nEntities].m_nDepth = 0;
-			pSpawnList[nEntities].m_pDeferredParentAttachment = NULL;
-			pSpawnList[nEntities].m_pDeferredParent = NULL;
-
-			pSpawnMapData[nEntities].m_pMapData = pCurMapData;
-			pSpawnMapData[nEntities].m_iMapDataLength = (pMapData - pCurMapData) + 2;
-			nEntities++;
+			//
+			// Parse the entity and add it to the spawn list.
+			//
+			CBaseEntity *pEntity;
+			const char *pCurMapData = pMapData;
+			pMapData = MapEntity_ParseEntity(pEntity, pMapData, pFilter);
+			if (pEntity == NULL)
+				continue;
+
+			MapEntity_AddParsedEntity( pEntity, pCurMapData, pMapData, pSpawnList, pSpawnMapData, nEntities, pPointTemplates );
 		}
 	}
 
+	timer.End();
+	double flCreateTime = timer.GetDuration().GetMillisecondsF();
+	timer.Start();
+
 	// Now loop through all our point_template entities and tell them to make templates of everything they're pointing to
 	int iTemplates = pPointTemplates.Count();
 	for ( int i = 0; i < iTemplates; i++ )
@@ -481,8 +807,22 @@ void MapEntity_ParseAllEntities(const char *pMapData, IMapEntityFilter *pFilter,
 		pPointTemplate->FinishBuildingTemplates();
 	}
 
+	timer.End();
+	double flTemplateTime = timer.GetDuration().GetMillisecondsF();
+	timer.Start();
+
 	SpawnHierarchicalList( nEntities, pSpawnList, bActivateEntities );
 
+	timer.End();
+	double flSpawnTime = timer.GetDuration().GetMillisecondsF();
+
+	DevMsg( "MapEntity_ParseAllEntities: %d entities (%s)\n", nEntities, nRecords ? "parallel parse" : "serial parse" );
+	DevMsg( "  split:     %8.2f ms\n", flSplitTime );
+	DevMsg( "  tokenise:  %8.2f ms (%d entity blocks)\n", flTokeniseTime, nRecords );
+	DevMsg( "  create:    %8.2f ms\n", flCreateTime );
+	DevMsg( "  templates: %8.2f ms (%d point_templates)\n", flTemplateTime, iTemplates );
+	DevMsg( "  spawn:     %8.2f ms\n", flSpawnTime );
+
 	delete [] pSpawnMapData;
 	delete [] pSpawnList;
 }
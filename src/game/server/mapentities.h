@@ -21,6 +21,17 @@ public:
 void MapEntity_ParseAllEntities( const char* pMapData, IMapEntityFilter* pFilter = nullptr, bool bActivateEntities = false );
 
 const char* MapEntity_ParseEntity( CBaseEntity*& pEntity, const char* pEntData, IMapEntityFilter* pFilter );
+
+// A map key whose datamap field was found while the map data was parsed on worker
+// threads. CBaseEntity::KeyValue() uses it instead of searching the datamap itself.
+struct MapEntityKeyField_t {
+	const char* m_pszKeyName;     // the key buffer being passed to KeyValue()
+	datamap_t* m_pDataMap;        // the datamap that was searched
+	typedescription_t* m_pField;  // NULL if no keyfield in it takes the key
+	int m_nObjectOffset;          // of the embedded object holding m_pField
+};
+
+const MapEntityKeyField_t* MapEntity_GetResolvedKeyField( CBaseEntity* pEntity, const char* pszKeyName );
 void MapEntity_PrecacheEntity( const char* pEntData, int& nStringSize );
 
 
@@ -13,6 +13,7 @@
 #include "movehelper_server.h"
 #include "shake.h"				// For screen fade constants
 #include "engine/IEngineSound.h"
+#include "tier1/callqueue.h"
 
 //=============================================================================
 // HPE_BEGIN
@@ -66,6 +67,7 @@ public:
 	virtual IPhysicsSurfaceProps *GetSurfaceProps( void );
 
 	void			SetHost( CBasePlayer *host );
+	CBasePlayer*	GetHost() const { return m_pHostPlayer; }
 
 	virtual bool IsWorldEntity( const CBaseHandle &handle );
 
@@ -414,3 +416,173 @@ bool CMoveHelperServer::IsWorldEntity( const CBaseHandle &handle )
 {
 	return handle == CBaseEntity::Instance( 0 );
 }
+
+
+//-----------------------------------------------------------------------------
+// Deferred move helper, for player movement on worker threads
+//-----------------------------------------------------------------------------
+
+static CTHREADLOCALPTR( CCallQueue ) s_pDeferredMovementCalls;
+
+CCallQueue *GetDeferredMovementCallQueue()
+{
+	return s_pDeferredMovementCalls;
+}
+
+static void DeferredStartSound( Vector origin, const char *soundname )
+{
+	MoveHelperServer()->StartSound( origin, soundname );
+}
+
+static void DeferredStartSoundEx( Vector origin, int channel, const char *sample, float volume, soundlevel_t soundlevel, int fFlags, int pitch )
+{
+	MoveHelperServer()->StartSound( origin, channel, sample, volume, soundlevel, fFlags, pitch );
+}
+
+// trace_t can't be copy constructed, so touches are queued by pointer
+struct DeferredTouch_t
+{
+	trace_t trace;
+	Vector impactvelocity;
+};
+
+static void DeferredAddToTouched( DeferredTouch_t *pTouch )
+{
+	MoveHelperServer()->AddToTouched( pTouch->trace, pTouch->impactvelocity );
+	delete pTouch;
+}
+
+static void DeferredConNPrintf( int idx, CUtlString msg )
+{
+	engine->Con_NPrintf( idx, "%s", msg.Get() );
+}
+
+class CMoveHelperDeferred : public IMoveHelperDeferred
+{
+public:
+	CMoveHelperDeferred() : m_pPlayer( NULL ) {}
+
+	virtual void	BeginDeferring( CBasePlayer *pPlayer );
+	virtual void	EndDeferring();
+	virtual void	CommitDeferredCalls();
+
+	// Lookups are safe to make from the worker
+	virtual	char const*		GetName( EntityHandle_t handle ) const { return MoveHelperServer()->GetName( handle ); }
+	virtual IPhysicsSurfaceProps *GetSurfaceProps( void ) { return MoveHelperServer()->GetSurfaceProps(); }
+	virtual bool	IsWorldEntity( const CBaseHandle &handle ) { return MoveHelperServer()->IsWorldEntity( handle ); }
+
+	virtual void	ResetTouchList( void );
+	virtual bool	AddToTouched( const trace_t &tr, const Vector& impactvelocity );
+	virtual void	ProcessImpacts( void );
+	virtual bool	PlayerFallingDamage( void );
+	virtual void	PlayerSetAnimation( PLAYER_ANIM eAnim );
+	virtual void	Con_NPrintf( int idx, char const* fmt, ... );
+	virtual void	StartSound( const Vector& origin, int channel, char const* sample, float volume, soundlevel_t soundlevel, int fFlags, int pitch );
+	virtual void	StartSound( const Vector& origin, const char *soundname );
+	virtual void	PlaybackEventFull( int flags, int clientindex, unsigned short eventindex, float delay, Vector& origin, Vector& angles, float fparam1, float fparam2, int iparam1, int iparam2, int bparam1, int bparam2 ) {}
+
+private:
+	CCallQueue		m_Calls;
+	CBasePlayer		*m_pPlayer;
+};
+
+IMoveHelperDeferred *CreateDeferredMoveHelper()
+{
+	return new CMoveHelperDeferred;
+}
+
+void DestroyDeferredMoveHelper( IMoveHelperDeferred *pMoveHelper )
+{
+	delete static_cast<CMoveHelperDeferred *>( pMoveHelper );
+}
+
+void CMoveHelperDeferred::BeginDeferring( CBasePlayer *pPlayer )
+{
+	m_pPlayer = pPlayer;
+	SetThreadSingleton( this );
+	s_pDeferredMovementCalls = &m_Calls;
+}
+
+void CMoveHelperDeferred::EndDeferring()
+{
+	m_pPlayer = NULL;
+	SetThreadSingleton( NULL );
+	s_pDeferredMovementCalls = NULL;
+}
+
+void CMoveHelperDeferred::CommitDeferredCalls()
+{
+	Assert( ThreadInMainThread() );
+	m_Calls.CallQueued();
+}
+
+void CMoveHelperDeferred::ResetTouchList( void )
+{
+	m_Calls.QueueCall( MoveHelperServer(), &IMoveHelper::ResetTouchList );
+}
+
+bool CMoveHelperDeferred::AddToTouched( const trace_t &tr, const Vector& impactvelocity )
+{
+	if ( !tr.m_pEnt )
+		return false;
+
+	DeferredTouch_t *pTouch = new DeferredTouch_t;
+	pTouch->trace = tr;
+	pTouch->impactvelocity = impactvelocity;
+	m_Calls.QueueCall( &DeferredAddToTouched, pTouch );
+	return true;
+}
+
+void CMoveHelperDeferred::ProcessImpacts( void )
+{
+	m_Calls.QueueCall( MoveHelperServer(), &IMoveHelper::ProcessImpacts );
+}
+
+static void DeferredPlayerFallingDamage( float flFallVelocity )
+{
+	// CheckFalling() has cleared the fall velocity the damage is worked out from by now
+	CBasePlayer *pPlayer = MoveHelperServer()->GetHost();
+	float flLandingVelocity = pPlayer->m_Local.m_flFallVelocity;
+	pPlayer->m_Local.m_flFallVelocity = flFallVelocity;
+	MoveHelperServer()->PlayerFallingDamage();
+	pPlayer->m_Local.m_flFallVelocity = flLandingVelocity;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The damage is applied on commit, so movement carries on as if the
+//			player survived the fall. CPlayerMove::CanMoveInParallel() keeps
+//			players who could land this hard on the serial path, so this is
+//			only a fallback.
+//-----------------------------------------------------------------------------
+bool CMoveHelperDeferred::PlayerFallingDamage( void )
+{
+	m_Calls.QueueCall( &DeferredPlayerFallingDamage, (float)m_pPlayer->m_Local.m_flFallVelocity );
+	return true;
+}
+
+void CMoveHelperDeferred::PlayerSetAnimation( PLAYER_ANIM eAnim )
+{
+	m_Calls.QueueCall( MoveHelperServer(), &IMoveHelper::PlayerSetAnimation, eAnim );
+}
+
+void CMoveHelperDeferred::Con_NPrintf( int idx, char const* pFormat, ...)
+{
+	va_list marker;
+	char msg[8192];
+
+	va_start(marker, pFormat);
+	Q_vsnprintf(msg, sizeof( msg ), pFormat, marker);
+	va_end(marker);
+
+	m_Calls.QueueCall( &DeferredConNPrintf, idx, CUtlString( msg ) );
+}
+
+void CMoveHelperDeferred::StartSound( const Vector& origin, int channel, char const* sample, float volume, soundlevel_t soundlevel, int fFlags, int pitch )
+{
+	m_Calls.QueueCall( &DeferredStartSoundEx, origin, channel, sample, volume, soundlevel, fFlags, pitch );
+}
+
+void CMoveHelperDeferred::StartSound( const Vector& origin, const char *soundname )
+{
+	m_Calls.QueueCall( &DeferredStartSound, origin, soundname );
+}
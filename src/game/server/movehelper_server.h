@@ -23,6 +23,7 @@ class CBaseEntity;
 abstract_class IMoveHelperServer : public IMoveHelper {
 public:
 	virtual void SetHost( CBasePlayer * host ) = 0;
+	virtual CBasePlayer* GetHost() const = 0;
 };
 
 //-----------------------------------------------------------------------------
@@ -30,3 +31,27 @@ public:
 //-----------------------------------------------------------------------------
 
 IMoveHelperServer* MoveHelperServer();
+
+//-----------------------------------------------------------------------------
+// Stands in for MoveHelperServer() while a player moves on a worker thread
+// (sv_parallel_player_movement). Anything that reaches other entities is
+// queued, and replayed against MoveHelperServer() on the main thread by
+// CommitDeferredCalls() with the player set as its host.
+//-----------------------------------------------------------------------------
+
+abstract_class IMoveHelperDeferred : public IMoveHelper {
+public:
+	// Install and remove the helper for the calling thread, which moves pPlayer
+	virtual void BeginDeferring( CBasePlayer* pPlayer ) = 0;
+	virtual void EndDeferring() = 0;
+
+	virtual void CommitDeferredCalls() = 0;
+};
+
+IMoveHelperDeferred* CreateDeferredMoveHelper();
+void DestroyDeferredMoveHelper( IMoveHelperDeferred* pMoveHelper );
+
+// Non-NULL while the calling thread runs deferred player movement. Entity code
+// reached from movement queues its side effects here instead of running them.
+class CCallQueue;
+CCallQueue* GetDeferredMovementCallQueue();
@@ -936,6 +936,8 @@ void CNavArea::FinishMerge( CNavArea *adjArea )
 		m_invDxCorners = m_invDyCorners = 0;
 	}
 
+	TheNavMesh->InvalidateAreaBounds();
+
 	// reassign the adjacent area's internal nodes to the final area
 	adjArea->AssignNodes( this );
 
@@ -1771,6 +1773,8 @@ bool CNavArea::MergeEdit( CNavArea *adj )
 	else
 		m_swZ = GetZ( m_nwCorner.x, m_seCorner.y );
 
+	TheNavMesh->InvalidateAreaBounds();
+
 	// merge adjacency links - we gain all the connections that adjArea had
 	MergeAdjacentConnections( adj );
 
@@ -3589,6 +3593,8 @@ void CNavArea::SetCorner( NavCornerType corner, const Vector& newPosition )
 		m_invDxCorners = m_invDyCorners = 0;
 	}
 
+	TheNavMesh->InvalidateAreaBounds();
+
 	CalcDebugID();
 }
 
@@ -4350,6 +4356,8 @@ void CNavArea::RaiseCorner( NavCornerType corner, int amount, bool raiseAdjacent
 		m_invDxCorners = m_invDyCorners = 0;
 	}
 
+	TheNavMesh->InvalidateAreaBounds();
+
 	if ( !raiseAdjacentCorners || nav_corner_adjust_adjacent.GetFloat() <= 0.0f )
 	{
 		return;
@@ -4549,6 +4557,8 @@ void CNavArea::Shift( const Vector &shift )
 	m_seCorner += shift;
 	
 	m_center += shift;
+
+	TheNavMesh->InvalidateAreaBounds();
 }
 
 
@@ -239,7 +239,7 @@ protected:
 	/* 100*/	NavLadderConnectVector m_ladder[ CNavLadder::NUM_LADDER_DIRECTIONS ];	// list of ladders leading up and down from this area
 	/* 108*/	NavConnectVector m_elevatorAreas;							// a list of areas reachable via elevator from this area
 
-	/* 112*/	unsigned int m_nearNavSearchMarker;							// used in GetNearestNavArea()
+	/* 112*/	unsigned int m_nearNavSearchMarker;							// used by the ForAllAreas*() grid walks (main thread only)
 
 	/* 116*/	CNavArea *m_parent;											// the area just prior to this on in the search path
 	/* 120*/	NavTraverseType m_parentHow;								// how we get from parent to us
@@ -12,6 +12,7 @@
 #include "cbase.h"
 #include "nav_mesh.h"
 #include "nav_pathfind.h"
+#include "nav_pathfinder.h"
 #include "nav_node.h"
 #include "nav_colors.h"
 #include "Color.h"
@@ -547,6 +548,8 @@ void StepAlongClimbableSurface( Vector &pos, const Vector &increment, const Vect
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavBuildLadder( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	if ( !IsEditMode( NORMAL ) || !m_climbableSurface )
 	{
 		return;
@@ -1140,6 +1143,8 @@ void CNavMesh::SetMarkedArea( CNavArea *area )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavDelete( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -1241,6 +1246,8 @@ public:
 //-------------------------------------------------------------------------------------------------------------- 
 void CNavMesh::CommandNavDeleteMarked( void ) 
 { 
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost(); 
 	if (player == NULL) 
 		return; 
@@ -2038,6 +2045,8 @@ private:
  */
 void CNavMesh::CommandNavEndShiftXY( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -2404,6 +2413,8 @@ void CNavMesh::CommandNavSelectOrphans( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavSplit( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -2480,6 +2491,8 @@ bool MakeSniperSpots( CNavArea *area )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavMakeSniperSpots( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -2516,6 +2529,8 @@ void CNavMesh::CommandNavMakeSniperSpots( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavMerge( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -2760,6 +2775,8 @@ void CNavMesh::CommandNavBeginArea( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavEndArea( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -2895,6 +2912,8 @@ void CNavMesh::CommandNavEndArea( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavConnect( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -3014,6 +3033,8 @@ void CNavMesh::CommandNavConnect( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavDisconnect( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -3112,6 +3133,8 @@ void CNavMesh::CommandNavDisconnect( void )
 // Disconnect all outgoing one-way connects from each area in the selected set
 void CNavMesh::CommandNavDisconnectOutgoingOneWays( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if ( !player )
 		return;
@@ -3160,6 +3183,8 @@ void CNavMesh::CommandNavDisconnectOutgoingOneWays( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavSplice( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -3478,6 +3503,8 @@ void CNavMesh::CommandNavCornerSelect( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavCornerRaise( const CCommand &args )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -3529,6 +3556,8 @@ void CNavMesh::CommandNavCornerRaise( const CCommand &args )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavCornerLower( const CCommand &args )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -3580,6 +3609,8 @@ void CNavMesh::CommandNavCornerLower( const CCommand &args )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavCornerPlaceOnGround( const CCommand &args )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
@@ -3694,6 +3725,8 @@ void CNavMesh::CommandNavWarpToMark( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavLadderFlip( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	CBasePlayer *player = UTIL_GetListenServerHost();
 	if (player == NULL)
 		return;
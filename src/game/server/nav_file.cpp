@@ -19,6 +19,7 @@
 #endif
 
 #include "tier1/lzmaDecoder.h"
+#include "tier1/utlbufferview.h"
 
 #ifdef CSTRIKE_DLL
 #include "cs_shareddefs.h"
@@ -1178,6 +1179,12 @@ bool CNavMesh::Save( void ) const
 	unsigned int navSize = filesystem->Size( filename );
 	DevMsg( "Size of nav file '%s' is %u bytes.\n", filename, navSize );
 
+	// keep the flat copy in step with the file just written
+	if ( nav_save_flat.GetBool() )
+	{
+		SaveFlat();
+	}
+
 	return true;
 }
 
@@ -1290,10 +1297,10 @@ const CUtlVector< Place > *CNavMesh::GetPlacesFromNavFile( bool *hasUnnamedPlace
 	char filename[256];
 	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
 
-	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
-	if ( !filesystem->ReadFile( filename, "GAME", fileBuffer ) )	// this ignores .nav files embedded in the .bsp ...
+	CUtlBufferView fileBuffer;
+	if ( !filesystem->ReadFileView( filename, "GAME", fileBuffer ) )	// this ignores .nav files embedded in the .bsp ...
 	{
-		if ( !filesystem->ReadFile( filename, "BSP", fileBuffer ) )	// ... and this looks for one if it's the only one around.
+		if ( !filesystem->ReadFileView( filename, "BSP", fileBuffer ) )	// ... and this looks for one if it's the only one around.
 		{
 			return NULL;
 		}
@@ -1364,16 +1371,29 @@ NavErrorType CNavMesh::Load( void )
 
 	CNavArea::m_nextID = 1;
 
+	// use the flat copy of the nav file when there is an up to date one
+	m_isLoadedFromFlatFile = false;
+	NavErrorType flatResult = LoadFlat();
+	if ( flatResult == NAV_OK )
+	{
+		m_isLoadedFromFlatFile = true;
+		return NAV_OK;
+	}
+	else if ( flatResult != NAV_CANT_ACCESS_FILE )
+	{
+		DevMsg( "Ignoring the flat navigation file, it is out of date or invalid.\n" );
+	}
+
 	// nav filename is derived from map filename
 	char filename[256];
 	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
 
 	bool navIsInBsp = false;
-	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
-	if ( !filesystem->ReadFile( filename, "MOD", fileBuffer ) )	// this ignores .nav files embedded in the .bsp ...
+	CUtlBufferView fileBuffer;
+	if ( !filesystem->ReadFileView( filename, "MOD", fileBuffer ) )	// this ignores .nav files embedded in the .bsp ...
 	{
 		navIsInBsp = true;
-		if ( !filesystem->ReadFile( filename, "BSP", fileBuffer ) )	// ... and this looks for one if it's the only one around.
+		if ( !filesystem->ReadFileView( filename, "BSP", fileBuffer ) )	// ... and this looks for one if it's the only one around.
 		{
 			return NAV_CANT_ACCESS_FILE;
 		}
@@ -1638,6 +1658,18 @@ NavErrorType CNavMesh::PostLoad( unsigned int version )
 		oneWayLinks[i].destArea->AddIncomingConnection( oneWayLinks[i].area, (NavDirType)oneWayLinks[i].backD );	
 	}
 
+	OnLoadComplete();
+	
+	return NAV_OK;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Invoked once all areas are loaded and bound, whichever file they came from
+ */
+void CNavMesh::OnLoadComplete( void )
+{
 	ValidateNavAreaConnections();
 
 	// TERROR: loading into a map directly creates entities before the mesh is loaded.  Tell the preexisting
@@ -1649,6 +1681,4 @@ NavErrorType CNavMesh::PostLoad( unsigned int version )
 
 	// the Navigation Mesh has been successfully loaded
 	m_isLoaded = true;
-	
-	return NAV_OK;
 }
@@ -0,0 +1,1057 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Flat, memory-mappable copy of the nav file
+//
+//=============================================================================//
+// nav_flat_file.cpp
+//
+// A .navb file holds the same mesh as the .nav file next to it, laid out as contiguous
+// arrays of fixed-size records that refer to each other by array index instead of by ID.
+// The loader maps the file, checks every index once, and then builds the mesh straight
+// from the arrays. It skips the field-by-field parsing, the ID lookups and the derived
+// data (connection lengths, encounter paths, one-way links, hiding spot areas) that the
+// .nav loader has to recompute.
+//
+// The .nav file stays the authoritative format. The flat copy is ignored whenever it is
+// missing, has a different format version, or was not written from the current .nav file.
+
+#include "cbase.h"
+#include "nav_mesh.h"
+#include "tier1/utlbufferview.h"
+#include "tier1/utlhashtable.h"
+#include "tier0/fasttimer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar nav_load_flat( "nav_load_flat", "1", FCVAR_GAMEDLL, "If nonzero, load the flat .navb copy of the nav file when it is present and up to date." );
+ConVar nav_save_flat( "nav_save_flat", "1", FCVAR_GAMEDLL, "If nonzero, saving the Navigation Mesh also writes a flat .navb copy of it." );
+
+#define NAV_FLAT_MAGIC_NUMBER 0xFEEDF1A7			// to help identify flat nav files
+
+#define FORMAT_NAVFILE "maps\\%s.nav"
+#define FORMAT_NAVFLATFILE "maps\\%s.navb"
+
+//--------------------------------------------------------------------------------------------------------------
+/// The current version of the flat nav file format. Bump it whenever a record below changes.
+const unsigned int NavFlatCurrentVersion = 1;
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The arrays stored in a flat nav file, in file order
+ */
+enum NavFlatLumpType
+{
+	NAV_FLAT_LUMP_STRINGS = 0,				// char, NUL terminated place names
+	NAV_FLAT_LUMP_PLACES,					// NavFlatPlace
+	NAV_FLAT_LUMP_AREAS,					// NavFlatArea
+	NAV_FLAT_LUMP_CONNECTIONS,				// NavFlatConnect
+	NAV_FLAT_LUMP_LADDER_CONNECTIONS,		// unsigned int, ladder index
+	NAV_FLAT_LUMP_HIDING_SPOTS,				// NavFlatHidingSpot
+	NAV_FLAT_LUMP_ENCOUNTERS,				// NavFlatEncounter
+	NAV_FLAT_LUMP_ENCOUNTER_SPOTS,			// NavFlatSpotOrder
+	NAV_FLAT_LUMP_VISIBLE_AREAS,			// NavFlatVisibleArea
+	NAV_FLAT_LUMP_LADDERS,					// NavFlatLadder
+
+	NAV_FLAT_LUMP_COUNT
+};
+
+struct NavFlatLump
+{
+	unsigned int offset;					// from the start of the file, 4 byte aligned
+	unsigned int count;						// number of records
+};
+
+struct NavFlatHeader
+{
+	unsigned int magic;						// NAV_FLAT_MAGIC_NUMBER
+	unsigned int version;					// NavFlatCurrentVersion
+	unsigned int bspSize;					// size of the bsp the mesh was built for
+	unsigned int navSize;					// size of the .nav file this was written with, zero if there was none
+	unsigned int navTime;					// modification time of that .nav file
+	unsigned int isAnalyzed;
+	float extentLo[2];						// 2D extent of all areas, for the grid
+	float extentHi[2];
+	NavFlatLump lumps[ NAV_FLAT_LUMP_COUNT ];
+};
+
+struct NavFlatPlace
+{
+	unsigned int name;						// offset into the string lump
+};
+
+/**
+ * The connections of an area are stored together, outgoing for each direction followed by
+ * incoming (one-way) for each direction. Indices "plus one" use zero for "none".
+ */
+struct NavFlatArea
+{
+	unsigned int id;
+	int attributeFlags;
+	float nwCorner[3];
+	float seCorner[3];
+	float neZ;
+	float swZ;
+	unsigned int place;						// place index plus one
+	unsigned int inheritVisibilityFrom;		// area index plus one
+	float earliestOccupyTime[ MAX_NAV_TEAMS ];
+	float lightIntensity[ NUM_CORNERS ];
+
+	unsigned int firstConnect;
+	unsigned short connectCount[ NUM_DIRECTIONS ];
+	unsigned short incomingCount[ NUM_DIRECTIONS ];
+	unsigned int firstLadderConnect;
+	unsigned short ladderConnectCount[ CNavLadder::NUM_LADDER_DIRECTIONS ];
+	unsigned int firstHidingSpot;
+	unsigned int hidingSpotCount;
+	unsigned int firstEncounter;
+	unsigned int encounterCount;
+	unsigned int firstVisibleArea;
+	unsigned int visibleAreaCount;
+};
+
+struct NavFlatConnect
+{
+	unsigned int area;						// area index
+	float length;							// distance between the area centers
+};
+
+struct NavFlatHidingSpot
+{
+	unsigned int id;
+	float pos[3];
+	unsigned int flags;
+	unsigned int area;						// index plus one of the area containing the spot
+};
+
+struct NavFlatEncounter
+{
+	unsigned int from;						// area index plus one
+	unsigned int fromDir;
+	unsigned int to;						// area index plus one
+	unsigned int toDir;
+	float pathFrom[3];
+	float pathTo[3];
+	unsigned int firstSpot;
+	unsigned int spotCount;
+};
+
+struct NavFlatSpotOrder
+{
+	unsigned int spot;						// hiding spot index plus one
+	float t;
+};
+
+struct NavFlatVisibleArea
+{
+	unsigned int area;						// area index
+	unsigned int attributes;
+};
+
+struct NavFlatLadder
+{
+	unsigned int id;
+	float width;
+	float top[3];
+	float bottom[3];
+	float length;
+	unsigned int dir;
+	unsigned int area[5];					// area index plus one of the top forward, left, right and behind areas, and the bottom area
+};
+
+static_assert( sizeof( NavFlatHeader ) % 4 == 0 );
+static_assert( sizeof( NavFlatArea ) % 4 == 0 );
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The lumps of a mapped flat nav file
+ */
+struct NavFlatFile
+{
+	const NavFlatHeader *header;
+	const char *strings;
+	const NavFlatPlace *places;
+	const NavFlatArea *areas;
+	const NavFlatConnect *connections;
+	const unsigned int *ladderConnections;
+	const NavFlatHidingSpot *hidingSpots;
+	const NavFlatEncounter *encounters;
+	const NavFlatSpotOrder *encounterSpots;
+	const NavFlatVisibleArea *visibleAreas;
+	const NavFlatLadder *ladders;
+
+	unsigned int Count( NavFlatLumpType lump ) const	{ return header->lumps[ lump ].count; }
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the given lump, or NULL if it does not fit in the file
+ */
+static const void *GetFlatLump( const byte *base, unsigned int fileSize, NavFlatLumpType lump, unsigned int recordSize )
+{
+	const NavFlatLump &info = reinterpret_cast< const NavFlatHeader * >( base )->lumps[ lump ];
+
+	if ( info.offset % 4 || info.offset > fileSize || info.count > ( fileSize - info.offset ) / recordSize )
+		return NULL;
+
+	return base + info.offset;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool IsFlatRangeValid( unsigned int first, unsigned int count, unsigned int total )
+{
+	return first <= total && count <= total - first;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Check every index in the file, so the mesh can be built without further checks
+ */
+static bool ValidateFlatNavFile( const NavFlatFile &file )
+{
+	const unsigned int stringCount = file.Count( NAV_FLAT_LUMP_STRINGS );
+	const unsigned int placeCount = file.Count( NAV_FLAT_LUMP_PLACES );
+	const unsigned int areaCount = file.Count( NAV_FLAT_LUMP_AREAS );
+	const unsigned int connectCount = file.Count( NAV_FLAT_LUMP_CONNECTIONS );
+	const unsigned int ladderConnectCount = file.Count( NAV_FLAT_LUMP_LADDER_CONNECTIONS );
+	const unsigned int hidingSpotCount = file.Count( NAV_FLAT_LUMP_HIDING_SPOTS );
+	const unsigned int encounterCount = file.Count( NAV_FLAT_LUMP_ENCOUNTERS );
+	const unsigned int encounterSpotCount = file.Count( NAV_FLAT_LUMP_ENCOUNTER_SPOTS );
+	const unsigned int visibleAreaCount = file.Count( NAV_FLAT_LUMP_VISIBLE_AREAS );
+	const unsigned int ladderCount = file.Count( NAV_FLAT_LUMP_LADDERS );
+
+	if ( areaCount == 0 )
+		return false;
+
+	if ( stringCount && file.strings[ stringCount-1 ] != '\0' )
+		return false;
+
+	for( unsigned int i=0; i<placeCount; ++i )
+	{
+		if ( file.places[i].name >= stringCount )
+			return false;
+	}
+
+	for( unsigned int i=0; i<areaCount; ++i )
+	{
+		const NavFlatArea &area = file.areas[i];
+
+		if ( area.place > placeCount || area.inheritVisibilityFrom > areaCount )
+			return false;
+
+		unsigned int areaConnectCount = 0;
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			areaConnectCount += area.connectCount[d] + area.incomingCount[d];
+		}
+
+		unsigned int areaLadderConnectCount = 0;
+		for( int d=0; d<CNavLadder::NUM_LADDER_DIRECTIONS; ++d )
+		{
+			areaLadderConnectCount += area.ladderConnectCount[d];
+		}
+
+		if ( !IsFlatRangeValid( area.firstConnect, areaConnectCount, connectCount ) ||
+			 !IsFlatRangeValid( area.firstLadderConnect, areaLadderConnectCount, ladderConnectCount ) ||
+			 !IsFlatRangeValid( area.firstHidingSpot, area.hidingSpotCount, hidingSpotCount ) ||
+			 !IsFlatRangeValid( area.firstEncounter, area.encounterCount, encounterCount ) ||
+			 !IsFlatRangeValid( area.firstVisibleArea, area.visibleAreaCount, visibleAreaCount ) )
+			return false;
+	}
+
+	for( unsigned int i=0; i<connectCount; ++i )
+	{
+		if ( file.connections[i].area >= areaCount )
+			return false;
+	}
+
+	for( unsigned int i=0; i<ladderConnectCount; ++i )
+	{
+		if ( file.ladderConnections[i] >= ladderCount )
+			return false;
+	}
+
+	for( unsigned int i=0; i<hidingSpotCount; ++i )
+	{
+		if ( file.hidingSpots[i].area > areaCount )
+			return false;
+	}
+
+	for( unsigned int i=0; i<encounterCount; ++i )
+	{
+		const NavFlatEncounter &encounter = file.encounters[i];
+
+		if ( encounter.from > areaCount || encounter.to > areaCount ||
+			 encounter.fromDir >= NUM_DIRECTIONS || encounter.toDir >= NUM_DIRECTIONS ||
+			 !IsFlatRangeValid( encounter.firstSpot, encounter.spotCount, encounterSpotCount ) )
+			return false;
+	}
+
+	for( unsigned int i=0; i<encounterSpotCount; ++i )
+	{
+		if ( file.encounterSpots[i].spot > hidingSpotCount )
+			return false;
+	}
+
+	for( unsigned int i=0; i<visibleAreaCount; ++i )
+	{
+		if ( file.visibleAreas[i].area >= areaCount )
+			return false;
+	}
+
+	for( unsigned int i=0; i<ladderCount; ++i )
+	{
+		const NavFlatLadder &ladder = file.ladders[i];
+
+		if ( ladder.dir >= NUM_DIRECTIONS )
+			return false;
+
+		for( int c=0; c<ARRAYSIZE( ladder.area ); ++c )
+		{
+			if ( ladder.area[c] > areaCount )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Maps the objects a flat file record can link to onto their index in the file
+ */
+template < typename T >
+class CNavFlatIndex
+{
+public:
+	void Add( const T *object, unsigned int index )
+	{
+		if ( !m_index.HasElement( object ) )
+		{
+			m_index.Insert( object, index );
+		}
+	}
+
+	bool HasElement( const T *object ) const	{ return m_index.HasElement( object ); }
+	unsigned int operator[]( const T *object ) const	{ return m_index.Element( m_index.Find( object ) ); }
+
+	// index plus one, zero for NULL or for something that is not part of the mesh
+	unsigned int IndexPlusOne( const T *object ) const
+	{
+		UtlHashHandle_t h = object ? m_index.Find( object ) : m_index.InvalidHandle();
+		return ( h == m_index.InvalidHandle() ) ? 0 : m_index.Element( h ) + 1;
+	}
+
+private:
+	CUtlHashtable< const T *, unsigned int, PointerHashFunctor, PointerEqualFunctor > m_index;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Append a lump to the file being written
+ */
+template < typename T >
+static void PutFlatLump( CUtlBuffer &fileBuffer, NavFlatHeader *header, NavFlatLumpType lump, const CUtlVector< T > &records )
+{
+	// keep every lump aligned so it can be used in place
+	while ( fileBuffer.TellPut() % 4 )
+	{
+		fileBuffer.PutUnsignedChar( 0 );
+	}
+
+	header->lumps[ lump ].offset = fileBuffer.TellPut();
+	header->lumps[ lump ].count = records.Count();
+
+	fileBuffer.Put( records.Base(), records.Count() * sizeof( T ) );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Store a flat copy of the Navigation Mesh next to the .nav file
+ */
+bool CNavMesh::SaveFlat( void ) const
+{
+	if ( GetSubVersionNumber() != 0 )
+	{
+		// derived meshes keep custom data the flat layout has no room for
+		DevMsg( "This Navigation Mesh cannot be saved as a flat nav file.\n" );
+		return false;
+	}
+
+	if ( TheNavAreas.Count() == 0 )
+		return false;
+
+	char filename[256];
+	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFLATFILE, STRING( gpGlobals->mapname ) );
+
+	char navFilename[256];
+	Q_snprintf( navFilename, sizeof( navFilename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
+
+	char bspFilename[256];
+	Q_snprintf( bspFilename, sizeof( bspFilename ), "maps\\%s.bsp", STRING( gpGlobals->mapname ) );
+
+	NavFlatHeader header;
+	V_memset( &header, 0, sizeof( header ) );
+	header.magic = NAV_FLAT_MAGIC_NUMBER;
+	header.version = NavFlatCurrentVersion;
+	header.bspSize = filesystem->Size( bspFilename );
+	if ( filesystem->FileExists( navFilename, "MOD" ) )
+	{
+		header.navSize = filesystem->Size( navFilename, "MOD" );
+		header.navTime = (unsigned int)filesystem->GetFileTime( navFilename, "MOD" );
+	}
+	header.isAnalyzed = m_isAnalyzed;
+
+	//
+	// Give every area, ladder and hiding spot its index in the file
+	//
+	CNavFlatIndex< CNavArea > areaIndex;
+	CNavFlatIndex< CNavLadder > ladderIndex;
+	CNavFlatIndex< HidingSpot > hidingSpotIndex;
+
+	header.extentLo[0] = header.extentLo[1] = FLT_MAX;
+	header.extentHi[0] = header.extentHi[1] = -FLT_MAX;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		areaIndex.Add( area, it );
+
+		Extent areaExtent;
+		area->GetExtent( &areaExtent );
+		header.extentLo[0] = MIN( header.extentLo[0], areaExtent.lo.x );
+		header.extentLo[1] = MIN( header.extentLo[1], areaExtent.lo.y );
+		header.extentHi[0] = MAX( header.extentHi[0], areaExtent.hi.x );
+		header.extentHi[1] = MAX( header.extentHi[1], areaExtent.hi.y );
+	}
+
+	FOR_EACH_VEC( m_ladders, lit )
+	{
+		ladderIndex.Add( m_ladders[ lit ], lit );
+	}
+
+	// each area owns a contiguous run of hiding spots, as in the .nav file
+	CUtlVector< NavFlatHidingSpot > hidingSpots;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		FOR_EACH_VEC( area->m_hidingSpots, hit )
+		{
+			const HidingSpot *spot = area->m_hidingSpots[ hit ];
+			hidingSpotIndex.Add( spot, hidingSpots.Count() );
+
+			NavFlatHidingSpot &record = hidingSpots[ hidingSpots.AddToTail() ];
+			record.id = spot->m_id;
+			record.pos[0] = spot->m_pos.x;
+			record.pos[1] = spot->m_pos.y;
+			record.pos[2] = spot->m_pos.z;
+			record.flags = spot->m_flags;
+			record.area = areaIndex.IndexPlusOne( spot->m_area );
+		}
+	}
+
+	//
+	// Place directory
+	//
+	CUtlVector< char > strings;
+	CUtlVector< NavFlatPlace > places;
+	CUtlVector< Place > placeList;
+
+	//
+	// Areas and everything they own
+	//
+	CUtlVector< NavFlatArea > areas;
+	CUtlVector< NavFlatConnect > connections;
+	CUtlVector< unsigned int > ladderConnections;
+	CUtlVector< NavFlatEncounter > encounters;
+	CUtlVector< NavFlatSpotOrder > encounterSpots;
+	CUtlVector< NavFlatVisibleArea > visibleAreas;
+
+	areas.EnsureCapacity( TheNavAreas.Count() );
+	unsigned int hidingSpotCursor = 0;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		NavFlatArea &record = areas[ areas.AddToTail() ];
+		V_memset( &record, 0, sizeof( record ) );
+
+		record.id = area->m_id;
+		record.attributeFlags = area->m_attributeFlags;
+		record.nwCorner[0] = area->m_nwCorner.x;
+		record.nwCorner[1] = area->m_nwCorner.y;
+		record.nwCorner[2] = area->m_nwCorner.z;
+		record.seCorner[0] = area->m_seCorner.x;
+		record.seCorner[1] = area->m_seCorner.y;
+		record.seCorner[2] = area->m_seCorner.z;
+		record.neZ = area->m_neZ;
+		record.swZ = area->m_swZ;
+
+		if ( area->m_place != UNDEFINED_PLACE )
+		{
+			int placeIndex = placeList.Find( area->m_place );
+			if ( placeIndex == placeList.InvalidIndex() )
+			{
+				const char *name = PlaceToName( area->m_place );
+				if ( name )
+				{
+					placeIndex = placeList.AddToTail( area->m_place );
+
+					NavFlatPlace &place = places[ places.AddToTail() ];
+					place.name = strings.Count();
+					strings.AddMultipleToTail( V_strlen( name ) + 1, name );
+				}
+			}
+
+			record.place = placeIndex + 1;
+		}
+
+		record.inheritVisibilityFrom = areaIndex.IndexPlusOne( area->m_inheritVisibilityFrom.area );
+
+		for( int i=0; i<MAX_NAV_TEAMS; ++i )
+		{
+			record.earliestOccupyTime[i] = area->m_earliestOccupyTime[i];
+		}
+
+		for( int i=0; i<NUM_CORNERS; ++i )
+		{
+			record.lightIntensity[i] = area->m_lightIntensity[i];
+		}
+
+		// outgoing, then incoming connections
+		record.firstConnect = connections.Count();
+		for( int d=0; d<NUM_DIRECTIONS * 2; ++d )
+		{
+			const NavConnectVector &connectList = ( d < NUM_DIRECTIONS ) ? area->m_connect[d] : area->m_incomingConnect[ d - NUM_DIRECTIONS ];
+			unsigned short count = 0;
+
+			FOR_EACH_VEC( connectList, cit )
+			{
+				const NavConnect &connect = connectList[ cit ];
+				if ( !areaIndex.HasElement( connect.area ) || count == USHRT_MAX )
+					continue;
+
+				NavFlatConnect &flatConnect = connections[ connections.AddToTail() ];
+				flatConnect.area = areaIndex[ connect.area ];
+				flatConnect.length = ( connect.area->GetCenter() - area->GetCenter() ).Length();
+				++count;
+			}
+
+			if ( d < NUM_DIRECTIONS )
+			{
+				record.connectCount[d] = count;
+			}
+			else
+			{
+				record.incomingCount[ d - NUM_DIRECTIONS ] = count;
+			}
+		}
+
+		record.firstLadderConnect = ladderConnections.Count();
+		for( int d=0; d<CNavLadder::NUM_LADDER_DIRECTIONS; ++d )
+		{
+			FOR_EACH_VEC( area->m_ladder[d], lit )
+			{
+				const CNavLadder *ladder = area->m_ladder[d][ lit ].ladder;
+				if ( !ladderIndex.HasElement( ladder ) || record.ladderConnectCount[d] == USHRT_MAX )
+					continue;
+
+				ladderConnections.AddToTail( ladderIndex[ ladder ] );
+				++record.ladderConnectCount[d];
+			}
+		}
+
+		record.firstHidingSpot = hidingSpotCursor;
+		record.hidingSpotCount = area->m_hidingSpots.Count();
+		hidingSpotCursor += record.hidingSpotCount;
+
+		record.firstEncounter = encounters.Count();
+		record.encounterCount = area->m_spotEncounters.Count();
+		FOR_EACH_VEC( area->m_spotEncounters, eit )
+		{
+			const SpotEncounter *e = area->m_spotEncounters[ eit ];
+
+			NavFlatEncounter &encounter = encounters[ encounters.AddToTail() ];
+			encounter.from = areaIndex.IndexPlusOne( e->from.area );
+			encounter.fromDir = e->fromDir;
+			encounter.to = areaIndex.IndexPlusOne( e->to.area );
+			encounter.toDir = e->toDir;
+			encounter.pathFrom[0] = e->path.from.x;
+			encounter.pathFrom[1] = e->path.from.y;
+			encounter.pathFrom[2] = e->path.from.z;
+			encounter.pathTo[0] = e->path.to.x;
+			encounter.pathTo[1] = e->path.to.y;
+			encounter.pathTo[2] = e->path.to.z;
+			encounter.firstSpot = encounterSpots.Count();
+			encounter.spotCount = e->spots.Count();
+
+			FOR_EACH_VEC( e->spots, oit )
+			{
+				NavFlatSpotOrder &order = encounterSpots[ encounterSpots.AddToTail() ];
+				order.spot = hidingSpotIndex.IndexPlusOne( e->spots[ oit ].spot );
+				order.t = e->spots[ oit ].t;
+			}
+		}
+
+		record.firstVisibleArea = visibleAreas.Count();
+		FOR_EACH_VEC( area->m_potentiallyVisibleAreas, vit )
+		{
+			const CNavArea::AreaBindInfo &info = area->m_potentiallyVisibleAreas[ vit ];
+			if ( !info.area || !areaIndex.HasElement( info.area ) )
+				continue;
+
+			NavFlatVisibleArea &visibleArea = visibleAreas[ visibleAreas.AddToTail() ];
+			visibleArea.area = areaIndex[ info.area ];
+			visibleArea.attributes = info.attributes;
+			++record.visibleAreaCount;
+		}
+	}
+
+	//
+	// Ladders
+	//
+	CUtlVector< NavFlatLadder > ladders;
+	ladders.EnsureCapacity( m_ladders.Count() );
+
+	FOR_EACH_VEC( m_ladders, lit )
+	{
+		const CNavLadder *ladder = m_ladders[ lit ];
+
+		NavFlatLadder &record = ladders[ ladders.AddToTail() ];
+		record.id = ladder->m_id;
+		record.width = ladder->m_width;
+		record.top[0] = ladder->m_top.x;
+		record.top[1] = ladder->m_top.y;
+		record.top[2] = ladder->m_top.z;
+		record.bottom[0] = ladder->m_bottom.x;
+		record.bottom[1] = ladder->m_bottom.y;
+		record.bottom[2] = ladder->m_bottom.z;
+		record.length = ladder->m_length;
+		record.dir = ladder->m_dir;
+		record.area[0] = areaIndex.IndexPlusOne( ladder->m_topForwardArea );
+		record.area[1] = areaIndex.IndexPlusOne( ladder->m_topLeftArea );
+		record.area[2] = areaIndex.IndexPlusOne( ladder->m_topRightArea );
+		record.area[3] = areaIndex.IndexPlusOne( ladder->m_topBehindArea );
+		record.area[4] = areaIndex.IndexPlusOne( ladder->m_bottomArea );
+	}
+
+	//
+	// Write the header, then each lump
+	//
+	CUtlBuffer fileBuffer( 4096, 1024*1024 );
+	fileBuffer.Put( &header, sizeof( header ) );
+
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_STRINGS, strings );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_PLACES, places );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_AREAS, areas );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_CONNECTIONS, connections );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_LADDER_CONNECTIONS, ladderConnections );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_HIDING_SPOTS, hidingSpots );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_ENCOUNTERS, encounters );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_ENCOUNTER_SPOTS, encounterSpots );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_VISIBLE_AREAS, visibleAreas );
+	PutFlatLump( fileBuffer, &header, NAV_FLAT_LUMP_LADDERS, ladders );
+
+	// the lump table is only known now
+	V_memcpy( fileBuffer.Base(), &header, sizeof( header ) );
+
+	if ( !filesystem->WriteFile( filename, "MOD", fileBuffer ) )
+	{
+		Warning( "Unable to save %d bytes to %s\n", fileBuffer.TellPut(), filename );
+		return false;
+	}
+
+	DevMsg( "Size of flat nav file '%s' is %d bytes.\n", filename, fileBuffer.TellPut() );
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Load the flat copy of the nav file, if there is one that was written from the current .nav file.
+ * Nothing is touched unless the whole file checks out, so on failure the caller can go on
+ * and load the .nav file instead.
+ */
+NavErrorType CNavMesh::LoadFlat( void )
+{
+	if ( !nav_load_flat.GetBool() || GetSubVersionNumber() != 0 )
+		return NAV_CANT_ACCESS_FILE;
+
+	char filename[256];
+	Q_snprintf( filename, sizeof( filename ), FORMAT_NAVFLATFILE, STRING( gpGlobals->mapname ) );
+
+	// map the file, the records are used in place
+	CUtlBufferView fileBuffer;
+	if ( !filesystem->ReadFileView( filename, "MOD", fileBuffer ) )
+		return NAV_CANT_ACCESS_FILE;
+
+	const byte *base = (const byte *)fileBuffer.Base();
+	const unsigned int fileSize = fileBuffer.TellMaxPut();
+
+	if ( fileSize < sizeof( NavFlatHeader ) )
+		return NAV_INVALID_FILE;
+
+	NavFlatFile file;
+	file.header = reinterpret_cast< const NavFlatHeader * >( base );
+
+	if ( file.header->magic != NAV_FLAT_MAGIC_NUMBER )
+		return NAV_INVALID_FILE;
+
+	if ( file.header->version != NavFlatCurrentVersion )
+		return NAV_BAD_FILE_VERSION;
+
+	// the flat copy is only good for the .nav file it was written with
+	char navFilename[256];
+	Q_snprintf( navFilename, sizeof( navFilename ), FORMAT_NAVFILE, STRING( gpGlobals->mapname ) );
+	if ( filesystem->FileExists( navFilename, "MOD" ) )
+	{
+		if ( filesystem->Size( navFilename, "MOD" ) != file.header->navSize ||
+			 (unsigned int)filesystem->GetFileTime( navFilename, "MOD" ) != file.header->navTime )
+		{
+			return NAV_FILE_OUT_OF_DATE;
+		}
+	}
+
+	file.strings = (const char *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_STRINGS, sizeof( char ) );
+	file.places = (const NavFlatPlace *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_PLACES, sizeof( NavFlatPlace ) );
+	file.areas = (const NavFlatArea *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_AREAS, sizeof( NavFlatArea ) );
+	file.connections = (const NavFlatConnect *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_CONNECTIONS, sizeof( NavFlatConnect ) );
+	file.ladderConnections = (const unsigned int *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_LADDER_CONNECTIONS, sizeof( unsigned int ) );
+	file.hidingSpots = (const NavFlatHidingSpot *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_HIDING_SPOTS, sizeof( NavFlatHidingSpot ) );
+	file.encounters = (const NavFlatEncounter *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_ENCOUNTERS, sizeof( NavFlatEncounter ) );
+	file.encounterSpots = (const NavFlatSpotOrder *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_ENCOUNTER_SPOTS, sizeof( NavFlatSpotOrder ) );
+	file.visibleAreas = (const NavFlatVisibleArea *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_VISIBLE_AREAS, sizeof( NavFlatVisibleArea ) );
+	file.ladders = (const NavFlatLadder *)GetFlatLump( base, fileSize, NAV_FLAT_LUMP_LADDERS, sizeof( NavFlatLadder ) );
+
+	if ( !file.strings || !file.places || !file.areas || !file.connections || !file.ladderConnections || !file.hidingSpots ||
+		 !file.encounters || !file.encounterSpots || !file.visibleAreas || !file.ladders || !ValidateFlatNavFile( file ) )
+	{
+		Warning( "Corrupt flat navigation file '%s'.\n", filename );
+		return NAV_CORRUPT_DATA;
+	}
+
+	//
+	// The file checks out - from here on nothing can fail
+	//
+	char bspFilename[256];
+	Q_snprintf( bspFilename, sizeof( bspFilename ), "maps\\%s.bsp", STRING( gpGlobals->mapname ) );
+	if ( filesystem->Size( bspFilename ) != file.header->bspSize )
+	{
+		DevMsg( "The Navigation Mesh was built using a different version of this map.\n" );
+		m_isOutOfDate = true;
+	}
+
+	m_isAnalyzed = file.header->isAnalyzed != 0;
+
+	// resolve the place names
+	const unsigned int placeCount = file.Count( NAV_FLAT_LUMP_PLACES );
+	CUtlVector< Place > places;
+	places.EnsureCapacity( placeCount );
+	for( unsigned int i=0; i<placeCount; ++i )
+	{
+		const char *placeName = file.strings + file.places[i].name;
+
+		Place place = NameToPlace( placeName );
+		if ( place == UNDEFINED_PLACE )
+		{
+			Warning( "Warning: NavMesh place %s is undefined?\n", placeName );
+		}
+		places.AddToTail( place );
+	}
+
+	//
+	// Create the areas
+	//
+	const unsigned int areaCount = file.Count( NAV_FLAT_LUMP_AREAS );
+
+	PreLoadAreas( areaCount );
+	TheNavAreas.EnsureCapacity( areaCount );
+
+	for( unsigned int i=0; i<areaCount; ++i )
+	{
+		const NavFlatArea &record = file.areas[i];
+		CNavArea *area = CreateArea();
+
+		area->m_id = record.id;
+		if ( area->m_id >= CNavArea::m_nextID )
+			CNavArea::m_nextID = area->m_id + 1;
+
+		area->m_attributeFlags = record.attributeFlags;
+		area->m_nwCorner.Init( record.nwCorner[0], record.nwCorner[1], record.nwCorner[2] );
+		area->m_seCorner.Init( record.seCorner[0], record.seCorner[1], record.seCorner[2] );
+		area->m_neZ = record.neZ;
+		area->m_swZ = record.swZ;
+
+		area->m_center = ( area->m_nwCorner + area->m_seCorner ) * 0.5f;
+
+		if ( ( area->m_seCorner.x - area->m_nwCorner.x ) > 0.0f && ( area->m_seCorner.y - area->m_nwCorner.y ) > 0.0f )
+		{
+			area->m_invDxCorners = 1.0f / ( area->m_seCorner.x - area->m_nwCorner.x );
+			area->m_invDyCorners = 1.0f / ( area->m_seCorner.y - area->m_nwCorner.y );
+		}
+		else
+		{
+			area->m_invDxCorners = area->m_invDyCorners = 0;
+		}
+
+		area->SetPlace( record.place ? places[ record.place - 1 ] : UNDEFINED_PLACE );
+
+		for( int t=0; t<MAX_NAV_TEAMS; ++t )
+		{
+			area->m_earliestOccupyTime[t] = record.earliestOccupyTime[t];
+		}
+
+		for( int c=0; c<NUM_CORNERS; ++c )
+		{
+			area->m_lightIntensity[c] = record.lightIntensity[c];
+		}
+
+		area->CheckWaterLevel();
+
+		TheNavAreas.AddToTail( area );
+	}
+
+	// add the areas to the grid
+	AllocateGrid( file.header->extentLo[0], file.header->extentHi[0], file.header->extentLo[1], file.header->extentHi[1] );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		AddNavArea( TheNavAreas[ it ] );
+	}
+
+	//
+	// Create the hiding spots, already knowing which area each is in
+	//
+	const unsigned int hidingSpotCount = file.Count( NAV_FLAT_LUMP_HIDING_SPOTS );
+	CUtlVector< HidingSpot * > hidingSpots;
+	hidingSpots.EnsureCapacity( hidingSpotCount );
+
+	for( unsigned int i=0; i<hidingSpotCount; ++i )
+	{
+		const NavFlatHidingSpot &record = file.hidingSpots[i];
+		HidingSpot *spot = CreateHidingSpot();
+
+		spot->m_id = record.id;
+		if ( spot->m_id >= HidingSpot::m_nextID )
+			HidingSpot::m_nextID = spot->m_id + 1;
+
+		spot->m_pos.Init( record.pos[0], record.pos[1], record.pos[2] );
+		spot->m_flags = (unsigned char)record.flags;
+		spot->m_area = record.area ? TheNavAreas[ record.area - 1 ] : NULL;
+
+		hidingSpots.AddToTail( spot );
+	}
+
+	//
+	// Create the ladders
+	//
+	const unsigned int ladderCount = file.Count( NAV_FLAT_LUMP_LADDERS );
+	m_ladders.EnsureCapacity( ladderCount );
+
+	for( unsigned int i=0; i<ladderCount; ++i )
+	{
+		const NavFlatLadder &record = file.ladders[i];
+		CNavLadder *ladder = new CNavLadder;
+
+		ladder->m_id = record.id;
+		if ( ladder->m_id >= CNavLadder::m_nextID )
+			CNavLadder::m_nextID = ladder->m_id + 1;
+
+		ladder->m_width = record.width;
+		ladder->m_top.Init( record.top[0], record.top[1], record.top[2] );
+		ladder->m_bottom.Init( record.bottom[0], record.bottom[1], record.bottom[2] );
+		ladder->m_length = record.length;
+		ladder->SetDir( (NavDirType)record.dir );
+
+		CNavArea **connections[] = { &ladder->m_topForwardArea, &ladder->m_topLeftArea, &ladder->m_topRightArea, &ladder->m_topBehindArea, &ladder->m_bottomArea };
+		for( int c=0; c<ARRAYSIZE( connections ); ++c )
+		{
+			*connections[c] = record.area[c] ? TheNavAreas[ record.area[c] - 1 ] : NULL;
+		}
+
+		ladder->FindLadderEntity();
+
+		m_ladders.AddToTail( ladder );
+	}
+
+	//
+	// Link the areas together. Every list is sized once, straight from the file.
+	//
+	for( unsigned int i=0; i<areaCount; ++i )
+	{
+		const NavFlatArea &record = file.areas[i];
+		CNavArea *area = TheNavAreas[i];
+
+		const NavFlatConnect *flatConnect = file.connections + record.firstConnect;
+		for( int d=0; d<NUM_DIRECTIONS * 2; ++d )
+		{
+			NavConnectVector &connectList = ( d < NUM_DIRECTIONS ) ? area->m_connect[d] : area->m_incomingConnect[ d - NUM_DIRECTIONS ];
+			int count = ( d < NUM_DIRECTIONS ) ? record.connectCount[d] : record.incomingCount[ d - NUM_DIRECTIONS ];
+
+			connectList.EnsureCapacity( count );
+			for( int c=0; c<count; ++c, ++flatConnect )
+			{
+				NavConnect connect;
+				connect.area = TheNavAreas[ flatConnect->area ];
+				connect.length = flatConnect->length;
+				connectList.AddToTail( connect );
+			}
+		}
+
+		const unsigned int *flatLadderConnect = file.ladderConnections + record.firstLadderConnect;
+		for( int d=0; d<CNavLadder::NUM_LADDER_DIRECTIONS; ++d )
+		{
+			area->m_ladder[d].EnsureCapacity( record.ladderConnectCount[d] );
+			for( int c=0; c<record.ladderConnectCount[d]; ++c, ++flatLadderConnect )
+			{
+				NavLadderConnect connect;
+				connect.ladder = m_ladders[ *flatLadderConnect ];
+				area->m_ladder[d].AddToTail( connect );
+			}
+		}
+
+		area->m_hidingSpots.EnsureCapacity( record.hidingSpotCount );
+		for( unsigned int h=0; h<record.hidingSpotCount; ++h )
+		{
+			area->m_hidingSpots.AddToTail( hidingSpots[ record.firstHidingSpot + h ] );
+		}
+
+		area->m_spotEncounters.EnsureCapacity( record.encounterCount );
+		for( unsigned int e=0; e<record.encounterCount; ++e )
+		{
+			const NavFlatEncounter &flatEncounter = file.encounters[ record.firstEncounter + e ];
+			SpotEncounter *encounter = new SpotEncounter;
+
+			encounter->from.area = flatEncounter.from ? TheNavAreas[ flatEncounter.from - 1 ] : NULL;
+			encounter->fromDir = (NavDirType)flatEncounter.fromDir;
+			encounter->to.area = flatEncounter.to ? TheNavAreas[ flatEncounter.to - 1 ] : NULL;
+			encounter->toDir = (NavDirType)flatEncounter.toDir;
+			encounter->path.from.Init( flatEncounter.pathFrom[0], flatEncounter.pathFrom[1], flatEncounter.pathFrom[2] );
+			encounter->path.to.Init( flatEncounter.pathTo[0], flatEncounter.pathTo[1], flatEncounter.pathTo[2] );
+
+			encounter->spots.EnsureCapacity( flatEncounter.spotCount );
+			for( unsigned int s=0; s<flatEncounter.spotCount; ++s )
+			{
+				const NavFlatSpotOrder &flatOrder = file.encounterSpots[ flatEncounter.firstSpot + s ];
+
+				SpotOrder order;
+				order.spot = flatOrder.spot ? hidingSpots[ flatOrder.spot - 1 ] : NULL;
+				order.t = flatOrder.t;
+				encounter->spots.AddToTail( order );
+			}
+
+			area->m_spotEncounters.AddToTail( encounter );
+		}
+
+		area->m_potentiallyVisibleAreas.EnsureCapacity( record.visibleAreaCount );
+		for( unsigned int v=0; v<record.visibleAreaCount; ++v )
+		{
+			const NavFlatVisibleArea &flatVisibleArea = file.visibleAreas[ record.firstVisibleArea + v ];
+
+			CNavArea::AreaBindInfo info;
+			info.area = TheNavAreas[ flatVisibleArea.area ];
+			info.attributes = (unsigned char)flatVisibleArea.attributes;
+			area->m_potentiallyVisibleAreas.AddToTail( info );
+		}
+
+		area->m_inheritVisibilityFrom.area = record.inheritVisibilityFrom ? TheNavAreas[ record.inheritVisibilityFrom - 1 ] : NULL;
+
+		// func avoid/prefer attributes are controlled by func_nav_cost entities
+		area->ClearAllNavCostEntities();
+	}
+
+	// the STAIRS attribute and one-way links were saved with the areas, so MarkStairAreas()
+	// and the rest of PostLoad() have nothing left to do
+	OnLoadComplete();
+
+	if ( !m_isAnalyzed )
+	{
+		Warning( "The nav mesh needs a full nav_analyze\n" );
+	}
+
+	DevMsg( "Loaded flat navigation file '%s'.\n", filename );
+
+	return NAV_OK;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Write a flat copy of the currently loaded Navigation Mesh, so shipped .nav files can be converted without an edit session
+ */
+void CommandNavSaveFlatFile( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !TheNavMesh->IsLoaded() )
+	{
+		Msg( "No Navigation Mesh is loaded.\n" );
+		return;
+	}
+
+	if ( TheNavMesh->SaveFlat() )
+	{
+		Msg( "Flat navigation map saved.\n" );
+	}
+	else
+	{
+		Msg( "ERROR: Cannot save flat navigation map.\n" );
+	}
+}
+static ConCommand nav_save_flat_file( "nav_save_flat_file", CommandNavSaveFlatFile, "Writes a flat, memory-mappable copy (.navb) of the currently loaded Navigation Mesh.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Time repeated loads of the current map's Navigation Mesh from the .nav file and from its flat copy
+ */
+void CommandNavBenchmarkLoad( const CCommand &args )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int iterations = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 10;
+
+	const bool wasFlat = nav_load_flat.GetBool();
+	double loadTime[2] = { 0.0, 0.0 };
+	bool loadOk[2] = { true, true };
+
+	for( int flat=0; flat<2; ++flat )
+	{
+		nav_load_flat.SetValue( flat );
+
+		for( int i=0; i<iterations; ++i )
+		{
+			CFastTimer timer;
+			timer.Start();
+			NavErrorType result = TheNavMesh->Load();
+			timer.End();
+
+			loadTime[ flat ] += timer.GetDuration().GetMillisecondsF();
+			// a stale or missing .navb silently falls back to the .nav file, which would skew the numbers
+			loadOk[ flat ] &= ( result == NAV_OK && TheNavMesh->IsLoadedFromFlatFile() == ( flat != 0 ) );
+		}
+	}
+
+	// leave the mesh loaded the way it normally would be
+	nav_load_flat.SetValue( wasFlat );
+	TheNavMesh->Load();
+
+	Msg( "Nav load benchmark, %d loads each, %d areas:\n", iterations, TheNavAreas.Count() );
+	Msg( "  .nav file:  %8.3f ms per load%s\n", loadTime[0] / iterations, loadOk[0] ? "" : " (load failed)" );
+	Msg( "  .navb file: %8.3f ms per load%s\n", loadTime[1] / iterations, loadOk[1] ? "" : " (not loaded from the .navb file, run nav_save_flat_file first)" );
+}
+static ConCommand nav_benchmark_load( "nav_benchmark_load", CommandNavBenchmarkLoad, "Times loading the Navigation Mesh from the .nav file and from its flat .navb copy. Usage: nav_benchmark_load [iterations]", FCVAR_GAMEDLL | FCVAR_CHEAT );
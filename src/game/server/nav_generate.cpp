@@ -14,9 +14,13 @@
 #include "nav_mesh.h"
 #include "nav_node.h"
 #include "nav_pathfind.h"
+#include "nav_pathfinder.h"
 #include "viewport_panel_names.h"
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlhashtable.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef TERROR
 #include "func_simpleladder.h"
@@ -42,6 +46,9 @@ ConVar nav_generate_fixup_jump_areas( "nav_generate_fixup_jump_areas", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_parallel( "nav_generate_parallel", "1", FCVAR_CHEAT, "Run the traces of nav generation on the job pool. The generated mesh is the same either way." );
+ConVar nav_generate_lookahead( "nav_generate_lookahead", "4", FCVAR_CHEAT, "How many steps ahead of walkable space sampling to trace on the job pool" );
+ConVar nav_generate_headless_budget( "nav_generate_headless_budget", "0.5", FCVAR_CHEAT, "Seconds per frame spent generating on a dedicated server with no players" );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -51,6 +58,87 @@ bool FindGroundForNode( Vector *pos, Vector *normal );	// find a ground Z for po
 const float MaxTraversableHeight = StepHeight;		// max internal obstacle height that can occur between nav nodes and safely disregarded
 const float MinObstacleAreaWidth = 10.0f;			// min width of a nav area we will generate on top of an obstacle
 
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Outcome of one sampling step, which depends only on the position stepped from and the direction.
+ * That is what lets the job pool trace them ahead of the (strictly ordered) sampling without changing the mesh.
+ */
+struct NavSampleStep
+{
+	Vector from;
+	NavDirType dir;
+
+	bool isValid;						// false if no node can be added in this direction
+	Vector to;
+	Vector toNormal;
+	bool isOnDisplacement;
+	float obstacleHeight;
+	float obstacleStartDist;
+	float obstacleEndDist;
+
+	bool hasCrouch;						// true if 'crouch' holds the crouch tests for a node at 'to'
+	NavNodeCrouchInfo crouch;
+};
+
+struct NavSampleStepKey
+{
+	Vector from;
+	NavDirType dir;
+
+	bool operator==( const NavSampleStepKey &other ) const { return from == other.from && dir == other.dir; }
+};
+
+struct NavSampleStepKeyHash
+{
+	unsigned int operator()( const NavSampleStepKey &key ) const
+	{
+		unsigned int hash = Mix32HashFunctor()( *(const uint32 *)&key.from.x );
+		hash = hash * 31 + Mix32HashFunctor()( *(const uint32 *)&key.from.y );
+		hash = hash * 31 + Mix32HashFunctor()( *(const uint32 *)&key.from.z );
+		return hash * 31 + key.dir;
+	}
+};
+
+static CUtlHashtable< NavSampleStepKey, NavSampleStep, NavSampleStepKeyHash > s_sampleSteps;	// steps traced ahead of the sampling
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A speculative TestArea() run on the job pool
+ */
+struct NavAreaFitTest
+{
+	CNavNode *node;
+	int width;
+	int height;
+	bool fits;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Prints how long each step of the generation took
+ */
+class CNavGenerationTimer
+{
+public:
+	CNavGenerationTimer( void )
+	{
+		m_timer.Start();
+	}
+
+	void Lap( const char *name )
+	{
+		m_timer.End();
+		Msg( "  %-40s %8.2f seconds\n", name, m_timer.GetDuration().GetSeconds() );
+		m_timer.Start();
+	}
+
+private:
+	CFastTimer m_timer;
+};
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Shortest path cost, paying attention to "blocked" areas
@@ -1510,6 +1598,8 @@ void CNavMesh::RemoveJumpAreas( void )
 //--------------------------------------------------------------------------------------------------------------
 void CNavMesh::CommandNavRemoveJumpAreas( void )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	JumpConnector connector;
 	ForAllAreas( connector );
 
@@ -2892,8 +2982,10 @@ public:
  * All of the nodes within the test area must have the same attributes.
  * All of the nodes must be approximately co-planar w.r.t the NW node's normal, with the
  * exception of 1x1 areas which can be any angle.
+ * A speculative test skips the checks against areas already built and only reads the nodes
+ * and the world, so it can run on a worker thread.
  */
-bool CNavMesh::TestArea( CNavNode *node, int width, int height )
+bool CNavMesh::TestArea( CNavNode *node, int width, int height, bool speculative )
 {
 	Vector normal = *node->GetNormal();
 	float d = -DotProduct( normal, *node->GetPosition() );
@@ -3029,7 +3121,8 @@ bool CNavMesh::TestArea( CNavNode *node, int width, int height )
 			if (horizNodeAttributes != nodeAttributes)
 				return false;
 
-			if (horizNode->IsCovered())
+			// whether nodes are covered changes as areas are built, so speculative tests leave it out
+			if (!speculative && horizNode->IsCovered())
 				return false;
 
 			if (!horizNode->IsClosedCell())
@@ -3119,7 +3212,7 @@ bool CNavMesh::TestArea( CNavNode *node, int width, int height )
 		vertNode = vertNode->GetConnectedNode( SOUTH );
 	}
 
-	if ( m_generationMode == GENERATE_INCREMENTAL )
+	if ( m_generationMode == GENERATE_INCREMENTAL && !speculative )
 	{
 		// Incremental generation needs to check that it's not overlapping existing areas...
 		const Vector *nw = node->GetPosition();
@@ -3287,13 +3380,37 @@ void CNavMesh::CreateNavAreasFromNodes( void )
 	int tryHeight = tryWidth;
 	int uncoveredNodes = CNavNode::GetListLength();
 
+	CNavGenerationTimer timer;
+	CUtlVector< NavAreaFitTest > tests;
+
 	while( uncoveredNodes > 0 )
 	{
+		tests.RemoveAll();
 		for( CNavNode *node = CNavNode::GetFirst(); node; node = node->GetNext() )
 		{
 			if (node->IsCovered())
 				continue;
 
+			NavAreaFitTest &test = tests[ tests.AddToTail() ];
+			test.node = node;
+			test.width = tryWidth;
+			test.height = tryHeight;
+			test.fits = true;
+		}
+
+		// Test every node on the job pool first, ignoring the areas built during this pass. A node that fails
+		// here would fail below as well, so only the ones that pass are tested again, in the same order as before.
+		if ( nav_generate_parallel.GetBool() )
+		{
+			ParallelProcess( "CNavMesh::TestArea", tests.Base(), tests.Count(), this, &CNavMesh::TestAreaJob );
+		}
+
+		FOR_EACH_VEC( tests, it )
+		{
+			CNavNode *node = tests[ it ].node;
+			if (node->IsCovered() || !tests[ it ].fits)
+				continue;
+
 			if (TestArea( node, tryWidth, tryHeight ))
 			{
 				int covered = BuildArea( node, tryWidth, tryHeight );
@@ -3316,6 +3433,8 @@ void CNavMesh::CreateNavAreasFromNodes( void )
 			break;
 	}
 
+	timer.Lap( "Creating areas from nodes" );
+
 	if ( !TheNavAreas.Count() )
 	{
 		// If we somehow have no areas, don't try to create an impossibly-large grid
@@ -3356,15 +3475,22 @@ void CNavMesh::CreateNavAreasFromNodes( void )
 
 	
 	ConnectGeneratedAreas();
+	timer.Lap( "Connecting areas" );
 	MarkPlayerClipAreas();
 	MarkJumpAreas();	// mark jump areas before we merge generated areas, so we don't merge jump and non-jump areas
+	timer.Lap( "Marking player clip and jump areas" );
 	MergeGeneratedAreas();
+	timer.Lap( "Merging areas" );
 	SplitAreasUnderOverhangs();
 	SquareUpAreas();
+	timer.Lap( "Splitting and squaring up areas" );
 	MarkStairAreas();
 	StichAndRemoveJumpAreas();
+	timer.Lap( "Marking stairs, removing jump areas" );
 	HandleObstacleTopAreas();
+	timer.Lap( "Handling obstacle tops" );
 	FixUpGeneratedAreas();
+	timer.Lap( "Fixing up areas" );
 
 	/// @TODO: incremental generation doesn't create ladders yet
 	if ( m_generationMode != GENERATE_INCREMENTAL )
@@ -3374,10 +3500,21 @@ void CNavMesh::CreateNavAreasFromNodes( void )
 			CNavLadder *ladder = m_ladders[i];
 			ladder->ConnectGeneratedLadder( 0.0f );
 		}
+		timer.Lap( "Connecting ladders" );
 	}
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Job pool half of CreateNavAreasFromNodes()
+ */
+void CNavMesh::TestAreaJob( NavAreaFitTest &test )
+{
+	test.fits = TestArea( test.node, test.width, test.height, true );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 // adds walkable positions for any/all positions a mod specifies
 void CNavMesh::AddWalkableSeeds( void )
@@ -3404,7 +3541,7 @@ void CNavMesh::AddWalkableSeeds( void )
 /**
  * Initiate the generation process
  */
-void CNavMesh::BeginGeneration( bool incremental )
+void CNavMesh::BeginGeneration( bool incremental, bool quitWhenFinished )
 {
 	IGameEvent *event = gameeventmanager->CreateEvent( "nav_generate" );
 	if ( event )
@@ -3436,7 +3573,9 @@ void CNavMesh::BeginGeneration( bool incremental )
 	m_generationState = SAMPLE_WALKABLE_SPACE;
 	m_sampleTick = 0;
 	m_generationMode = (incremental) ? GENERATE_INCREMENTAL : GENERATE_FULL;
+	m_bQuitWhenFinished = quitWhenFinished;
 	lastMsgTime = 0.0f;
+	s_sampleSteps.RemoveAll();
 
 	// clear any previous mesh
 	DestroyNavigationMesh( incremental );
@@ -3469,11 +3608,33 @@ void CNavMesh::BeginGeneration( bool incremental )
 	// initialize seed list index
 	m_seedIdx = 0;
 
-	Msg( "Generating Navigation Mesh...\n" );
+	Msg( "Generating Navigation Mesh%s...\n", ( nav_generate_parallel.GetBool() && g_pThreadPool ) ? CFmtStr( " on %d worker threads", g_pThreadPool->NumThreads() + 1 ).Get() : "" );
 	m_generationStartTime = Plat_FloatTime();
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Seconds of generation work to do each frame. A dedicated server with nobody on it can spend most of
+ * the frame generating.
+ */
+float CNavMesh::GetGenerationFrameBudget( void ) const
+{
+	const float defaultBudget = 0.03f;
+
+	if ( !engine->IsDedicatedServer() )
+		return defaultBudget;
+
+	for( int i=1; i<=gpGlobals->maxClients; ++i )
+	{
+		if ( UTIL_PlayerByIndex( i ) )
+			return defaultBudget;
+	}
+
+	return MAX( nav_generate_headless_budget.GetFloat(), defaultBudget );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Re-analyze an existing Mesh.  Determine Hiding Spots, Encounter Spots, etc.
@@ -3631,12 +3792,39 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 	static ConVarRef host_thread_mode( "host_thread_mode" );
 
+	// report how long each state took as we leave it
+	static const char *s_generationStateNames[ NUM_GENERATION_STATES ] =
+	{
+		"Sampling walkable space",
+		"Creating areas from samples",
+		"Finding hiding spots",
+		"Finding encounter spots",
+		"Finding sniper spots",
+		"Finding earliest occupy times",
+		"Finding light intensity",
+		"Computing mesh visibility",
+		"Custom analysis",
+		"Saving",
+	};
+	static int s_timedState = NUM_GENERATION_STATES;
+	static double s_timedStateStartTime = 0.0;
+	if ( s_timedState != m_generationState )
+	{
+		if ( s_timedState != NUM_GENERATION_STATES )
+		{
+			Msg( "%s took %.2f seconds.\n", s_generationStateNames[ s_timedState ], startTime - s_timedStateStartTime );
+		}
+
+		s_timedState = ( m_generationState == SAVE_NAV_MESH ) ? NUM_GENERATION_STATES : m_generationState;
+		s_timedStateStartTime = startTime;
+	}
+
 	switch( m_generationState )
 	{
 		//---------------------------------------------------------------------------
 		case SAMPLE_WALKABLE_SPACE:
 		{
-			AnalysisProgress( "Sampling walkable space...", 100, m_sampleTick / 10, false );
+			AnalysisProgress( CFmtStr( "Sampling walkable space... %u nodes", CNavNode::GetListLength() ), 100, m_sampleTick / 10, false );
 			m_sampleTick = ( m_sampleTick + 1 ) % 1000;
 
 			while ( SampleStep() )
@@ -3649,6 +3837,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 			// sampling is complete, now build nav areas
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
+			s_sampleSteps.Purge();
 
 			return true;
 		}
@@ -4079,7 +4268,7 @@ const char *CNavMesh::GetPlayerSpawnName( void ) const
  * Node Z positions are ground level.
  */
 CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDirType dir, CNavNode *source, bool isOnDisplacement, 
-							float obstacleHeight, float obstacleStartDist, float obstacleEndDist )
+							float obstacleHeight, float obstacleStartDist, float obstacleEndDist, const NavNodeCrouchInfo *crouch )
 {
 	// check if a node exists at this location
 	CNavNode *node = CNavNode::GetNode( destPos );
@@ -4116,7 +4305,8 @@ CNavNode *CNavMesh::AddNode( const Vector &destPos, const Vector &normal, NavDir
 		m_currentNode = node;
 	}
 
-	node->CheckCrouch();
+	// the crouch tests may already have been run for this position on the job pool
+	node->CheckCrouch( ( crouch && *node->GetPosition() == destPos ) ? crouch : NULL );
 
 	// determine if there's a cliff nearby and set an attribute on this node
 	for ( int i = 0; i < NUM_DIRECTIONS; i++ )
@@ -4397,151 +4587,21 @@ bool CNavMesh::SampleStep( void )
 			{
 				// have not searched in this direction yet
 
-				// start at current node position
-				Vector pos = *m_currentNode->GetPosition();
-
-				// snap to grid
-				int cx = SnapToGrid( pos.x );
-				int cy = SnapToGrid( pos.y );
-
-				// attempt to move to adjacent node
-				switch( dir )
-				{
-					case NORTH:		cy -= GenerationStepSize; break;
-					case SOUTH:		cy += GenerationStepSize; break;
-					case EAST:		cx += GenerationStepSize; break;
-					case WEST:		cx -= GenerationStepSize; break;
-				}
-
-				pos.x = cx;
-				pos.y = cy;
-
 				m_generationDir = (NavDirType)dir;
 
 				// mark direction as visited
 				m_currentNode->MarkAsVisited( m_generationDir );
 
-				// sanity check to not generate across the world for incremental generation
-				const float incrementalRange = nav_generate_incremental_range.GetFloat();
-				if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
-				{
-					bool inRange = false;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
-						{
-							inRange = true;
-							break;
-						}
-					}
-
-					if ( !inRange )
-					{
-						return true;
-					}
-				}
-
-				if ( m_generationMode == GENERATE_SIMPLIFY )
-				{
-					if ( !m_simplifyGenerationExtent.Contains( pos ) )
-					{
-						return true;
-					}
-				}
-
-				// test if we can move to new position
-				trace_t result;
-				Vector from( *m_currentNode->GetPosition() );
-				CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
-				Vector to, toNormal;
-				float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
-				if ( TraceAdjacentNode( 0, from, pos, &result ) )
-				{
-					to = result.endpos;
-					toNormal = result.plane.normal;
-				}
-				else
-				{
-					// test going up ClimbUpHeight
-					bool success = false;
-					for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
-					{						
-						trace_t tr;
-						Vector start( from );
-						Vector end( pos );
-						start.z += height;
-						end.z += height;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-						if ( !tr.startsolid && tr.fraction == 1.0f )
-						{
-							if ( !StayOnFloor( &tr ) )
-							{
-								break;
-							}
-
-							to = tr.endpos;
-							toNormal = tr.plane.normal;
-
-							start = end = from;
-							end.z += height;
-							UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-							if ( tr.fraction < 1.0f )
-							{
-								break;
-							}
-
-							// keep track of far up we had to go to find a path to the next node
-							obstacleHeight = height;
-							success = true;
-							break;
-						}
-						else
-						{
-							// Could not trace from node to node at this height, something is in the way.
-							// Trace in the other direction to see if we hit something
-							Vector vecToObstacleStart = tr.endpos - start;
-							Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
-							if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
-							{
-								UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
-								if ( !tr.startsolid && tr.fraction < 1.0 )
-								{
-									// We hit something going the other direction.  There is some obstacle between the two nodes.
-									Vector vecToObstacleEnd = tr.endpos - start;
-									Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
-									if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
-									{
-										// Remember the distances to start and end of the obstacle (with respect to the "from" node).
-										// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
-										// If we do eventually clear the obstacle, these values will be the start and end distance to the
-										// very tip of the obstacle.
-										obstacleStartDist = vecToObstacleStart.Length();
-										obstacleEndDist = vecToObstacleEnd.Length();
-										if ( obstacleEndDist == 0 )
-										{
-											obstacleEndDist = GenerationStepSize;
-										}
-									}								
-								}
-							}
-						}
-					}
-
-					if ( !success )
-					{
-						return true;
-					}
-				}
-
-				// Don't generate nodes if we spill off the end of the world onto skybox
-				if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+				// trace the step, or pick up the result the job pool traced ahead of time
+				NavSampleStep step;
+				GetSampleStep( *m_currentNode->GetPosition(), m_generationDir, &step );
+				if ( !step.isValid )
 				{
 					return true;
 				}
 
 				// If we're incrementally generating, don't overlap existing nav areas.
-				Vector testPos( to );
+				Vector testPos( step.to );
 				bool overlapSE = IsNodeOverlapped( testPos, Vector(  1,  1, HalfHumanHeight ) );
 				bool overlapSW = IsNodeOverlapped( testPos, Vector( -1,  1, HalfHumanHeight ) );
 				bool overlapNE = IsNodeOverlapped( testPos, Vector(  1, -1, HalfHumanHeight ) );
@@ -4551,77 +4611,344 @@ bool CNavMesh::SampleStep( void )
 					return true;
 				}
 
-				int nTolerance = nav_generate_incremental_tolerance.GetInt();
-				if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
-				{
-					bool bValid = false;
-					int zPos = to.z;
-					for ( int i=0; i<m_walkableSeeds.Count(); ++i )
-					{
-						const Vector &seedPos = m_walkableSeeds[i].pos;
-						int zMin = seedPos.z - nTolerance;
-						int zMax = seedPos.z + nTolerance;
+				// we can move here
+				// create a new navigation node, and update current node pointer
+				AddNode( step.to, step.toNormal, m_generationDir, m_currentNode, step.isOnDisplacement, step.obstacleHeight, step.obstacleStartDist, step.obstacleEndDist, step.hasCrouch ? &step.crouch : NULL );
 
-						if ( zPos >= zMin && zPos <= zMax )
-						{
-							bValid = true;
-							break;
-						}
-					}
+				return true;
+			}
+		}
 
-					if ( !bValid )
-						return true;
+		// all directions have been searched from this node - pop back to its parent and continue
+		m_currentNode = m_currentNode->GetParent();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Trace one sampling step from 'step.from' in 'step.dir'. Only reads the world and settings that don't change
+ * while sampling, so it can run on a worker thread. The test against existing areas is left to SampleStep().
+ */
+void CNavMesh::ComputeSampleStep( NavSampleStep &step )
+{
+	step.isValid = false;
+	step.hasCrouch = false;
+
+	// start at the position we are stepping from
+	Vector pos = step.from;
+
+	// snap to grid
+	int cx = SnapToGrid( pos.x );
+	int cy = SnapToGrid( pos.y );
+
+	// attempt to move to adjacent node
+	switch( step.dir )
+	{
+		case NORTH:		cy -= GenerationStepSize; break;
+		case SOUTH:		cy += GenerationStepSize; break;
+		case EAST:		cx += GenerationStepSize; break;
+		case WEST:		cx -= GenerationStepSize; break;
+	}
+
+	pos.x = cx;
+	pos.y = cy;
+
+	// sanity check to not generate across the world for incremental generation
+	const float incrementalRange = nav_generate_incremental_range.GetFloat();
+	if ( m_generationMode == GENERATE_INCREMENTAL && incrementalRange > 0 )
+	{
+		bool inRange = false;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			if ( (seedPos - pos).IsLengthLessThan( incrementalRange ) )
+			{
+				inRange = true;
+				break;
+			}
+		}
+
+		if ( !inRange )
+		{
+			return;
+		}
+	}
+
+	if ( m_generationMode == GENERATE_SIMPLIFY )
+	{
+		if ( !m_simplifyGenerationExtent.Contains( pos ) )
+		{
+			return;
+		}
+	}
+
+	// test if we can move to new position
+	trace_t result;
+	Vector from( step.from );
+	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
+	Vector to, toNormal;
+	float obstacleHeight = 0, obstacleStartDist = 0, obstacleEndDist = GenerationStepSize;
+	if ( TraceAdjacentNode( 0, from, pos, &result ) )
+	{
+		to = result.endpos;
+		toNormal = result.plane.normal;
+	}
+	else
+	{
+		// test going up ClimbUpHeight
+		bool success = false;
+		for ( float height = StepHeight; height <= ClimbUpHeight; height += 1.0f )
+		{						
+			trace_t tr;
+			Vector start( from );
+			Vector end( pos );
+			start.z += height;
+			end.z += height;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+			if ( !tr.startsolid && tr.fraction == 1.0f )
+			{
+				if ( !StayOnFloor( &tr ) )
+				{
+					break;
 				}
 
+				to = tr.endpos;
+				toNormal = tr.plane.normal;
 
-				bool isOnDisplacement = result.IsDispSurface();
+				start = end = from;
+				end.z += height;
+				UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+				if ( tr.fraction < 1.0f )
+				{
+					break;
+				}
 
-				if ( nav_displacement_test.GetInt() > 0 )
+				// keep track of far up we had to go to find a path to the next node
+				obstacleHeight = height;
+				success = true;
+				break;
+			}
+			else
+			{
+				// Could not trace from node to node at this height, something is in the way.
+				// Trace in the other direction to see if we hit something
+				Vector vecToObstacleStart = tr.endpos - start;
+				Assert( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) );
+				if ( vecToObstacleStart.LengthSqr() <= Square( GenerationStepSize ) )
 				{
-					// Test for nodes under displacement surfaces.
-					// This happens during development, and is a pain because the space underneath a displacement
-					// is not 'solid'.
-					Vector start = to + Vector( 0, 0, 0 );
-					Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
-					UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-
-					if ( result.fraction > 0 )
+					UTIL_TraceHull( end, start, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &tr );
+					if ( !tr.startsolid && tr.fraction < 1.0 )
 					{
-						end = start;
-						start = result.endpos;
-						UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
-						if ( result.fraction < 1 )
+						// We hit something going the other direction.  There is some obstacle between the two nodes.
+						Vector vecToObstacleEnd = tr.endpos - start;
+						Assert( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize ) );
+						if ( vecToObstacleEnd.LengthSqr() <= Square( GenerationStepSize )  )
 						{
-							// if we made it down to within StepHeight, maybe we're on a static prop
-							if ( result.endpos.z > to.z + StepHeight )
+							// Remember the distances to start and end of the obstacle (with respect to the "from" node).
+							// Keep track of the last distances to obstacle as we keep increasing the height we do a trace for.
+							// If we do eventually clear the obstacle, these values will be the start and end distance to the
+							// very tip of the obstacle.
+							obstacleStartDist = vecToObstacleStart.Length();
+							obstacleEndDist = vecToObstacleEnd.Length();
+							if ( obstacleEndDist == 0 )
 							{
-								return true;
+								obstacleEndDist = GenerationStepSize;
 							}
-						}
+						}								
 					}
 				}
+			}
+		}
+
+		if ( !success )
+		{
+			return;
+		}
+	}
+
+	// Don't generate nodes if we spill off the end of the world onto skybox
+	if ( result.surface.flags & ( SURF_SKY|SURF_SKY2D ) )
+	{
+		return;
+	}
+
+	int nTolerance = nav_generate_incremental_tolerance.GetInt();
+	if ( nTolerance > 0 && m_generationMode == GENERATE_INCREMENTAL )
+	{
+		bool bValid = false;
+		int zPos = to.z;
+		for ( int i=0; i<m_walkableSeeds.Count(); ++i )
+		{
+			const Vector &seedPos = m_walkableSeeds[i].pos;
+			int zMin = seedPos.z - nTolerance;
+			int zMax = seedPos.z + nTolerance;
 
-				float deltaZ = to.z - m_currentNode->GetPosition()->z;
-				// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
-				// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
-				// and distances
-				if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+			if ( zPos >= zMin && zPos <= zMax )
+			{
+				bValid = true;
+				break;
+			}
+		}
+
+		if ( !bValid )
+			return;
+	}
+
+
+	bool isOnDisplacement = result.IsDispSurface();
+
+	if ( nav_displacement_test.GetInt() > 0 )
+	{
+		// Test for nodes under displacement surfaces.
+		// This happens during development, and is a pain because the space underneath a displacement
+		// is not 'solid'.
+		Vector start = to + Vector( 0, 0, 0 );
+		Vector end = start + Vector( 0, 0, nav_displacement_test.GetInt() );
+		UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+
+		if ( result.fraction > 0 )
+		{
+			end = start;
+			start = result.endpos;
+			UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, GetGenerationTraceMask(), &filter, &result );
+			if ( result.fraction < 1 )
+			{
+				// if we made it down to within StepHeight, maybe we're on a static prop
+				if ( result.endpos.z > to.z + StepHeight )
 				{
-					obstacleHeight = 0;
-					obstacleStartDist = 0;
-					obstacleEndDist = GenerationStepSize;
+					return;
 				}
+			}
+		}
+	}
 
-				// we can move here
-				// create a new navigation node, and update current node pointer
-				AddNode( to, toNormal, m_generationDir, m_currentNode, isOnDisplacement, obstacleHeight, obstacleStartDist, obstacleEndDist );
+	float deltaZ = to.z - step.from.z;
+	// If there's an obstacle in the way and it's traversable, or the obstacle is not higher than the destination node itself minus a small epsilon
+	// (meaning the obstacle was just the height change to get to the destination node, no extra obstacle between the two), clear obstacle height
+	// and distances
+	if ( ( obstacleHeight < MaxTraversableHeight ) || ( deltaZ > ( obstacleHeight - 2.0f ) ) )
+	{
+		obstacleHeight = 0;
+		obstacleStartDist = 0;
+		obstacleEndDist = GenerationStepSize;
+	}
 
-				return true;
+	// we can move here
+	step.isValid = true;
+	step.to = to;
+	step.toNormal = toNormal;
+	step.isOnDisplacement = isOnDisplacement;
+	step.obstacleHeight = obstacleHeight;
+	step.obstacleStartDist = obstacleStartDist;
+	step.obstacleEndDist = obstacleEndDist;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Job pool version of ComputeSampleStep(), which also runs the crouch tests for a node at the destination
+ */
+void CNavMesh::SampleStepJob( NavSampleStep &step )
+{
+	ComputeSampleStep( step );
+
+	if ( step.isValid )
+	{
+		CNavNode::ComputeCrouch( step.to, &step.crouch );
+		step.hasCrouch = true;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the outcome of stepping from 'from' in direction 'dir'. With nav_generate_parallel the steps are
+ * traced on the job pool ahead of the sampling, otherwise right here. Either way the result is the same.
+ */
+void CNavMesh::GetSampleStep( const Vector &from, NavDirType dir, NavSampleStep *step )
+{
+	if ( nav_generate_parallel.GetBool() )
+	{
+		NavSampleStepKey key = { from, dir };
+		UtlHashHandle_t h = s_sampleSteps.Find( key );
+		if ( h == s_sampleSteps.InvalidHandle() )
+		{
+			PrefetchSampleSteps( from );
+			h = s_sampleSteps.Find( key );
+		}
+
+		if ( h != s_sampleSteps.InvalidHandle() )
+		{
+			*step = s_sampleSteps.Element( h );
+			s_sampleSteps.Remove( key );
+			return;
+		}
+	}
+
+	step->from = from;
+	step->dir = dir;
+	ComputeSampleStep( *step );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Trace the steps from 'start' on the job pool, then the steps from where those lead, and so on for
+ * nav_generate_lookahead levels. The sampling will come through these positions next as long as no
+ * node exists at them yet.
+ */
+void CNavMesh::PrefetchSampleSteps( const Vector &start )
+{
+	VPROF( "CNavMesh::PrefetchSampleSteps" );
+
+	const int maxStepsPerBatch = 1024;
+	const int maxCachedSteps = 64 * 1024;
+
+	if ( s_sampleSteps.Count() > maxCachedSteps )
+	{
+		// mostly steps the sampling went around; dropping them only costs tracing them again
+		s_sampleSteps.RemoveAll();
+	}
+
+	CUtlVector< Vector > frontier;
+	frontier.AddToTail( start );
+
+	CUtlVector< NavSampleStep > batch;
+	for( int depth=0; depth <= nav_generate_lookahead.GetInt() && frontier.Count(); ++depth )
+	{
+		batch.RemoveAll();
+		FOR_EACH_VEC( frontier, it )
+		{
+			for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+			{
+				NavSampleStepKey key = { frontier[ it ], (NavDirType)dir };
+				if ( s_sampleSteps.HasElement( key ) )
+					continue;
+
+				NavSampleStep &step = batch[ batch.AddToTail() ];
+				step.from = frontier[ it ];
+				step.dir = (NavDirType)dir;
 			}
+
+			if ( batch.Count() >= maxStepsPerBatch )
+				break;
 		}
 
-		// all directions have been searched from this node - pop back to its parent and continue
-		m_currentNode = m_currentNode->GetParent();
+		ParallelProcess( "CNavMesh::PrefetchSampleSteps", batch.Base(), batch.Count(), this, &CNavMesh::SampleStepJob );
+
+		frontier.RemoveAll();
+		FOR_EACH_VEC( batch, it )
+		{
+			const NavSampleStep &step = batch[ it ];
+			NavSampleStepKey key = { step.from, step.dir };
+			s_sampleSteps.Insert( key, step );
+
+			if ( step.isValid && CNavNode::GetNode( step.to ) == NULL && !frontier.HasElement( step.to ) )
+			{
+				frontier.AddToTail( step.to );
+			}
+		}
 	}
 }
 
@@ -4788,6 +5115,8 @@ public:
  */
 void CNavMesh::CommandNavSubdivide( const CCommand &args )
 {
+	TheNavPathfinder.WaitForAllRequests();
+
 	int depth = 1;
 	
 	if (args.ArgC() == 2)
@@ -93,6 +93,8 @@ public:
 	CBaseEntity *GetLadderEntity( void ) const;
 
 private:
+	friend class CNavMesh;									///< for the flat nav file loader
+
 	void FindLadderEntity( void );
 
 	EHANDLE m_ladderEntity;
@@ -14,6 +14,7 @@ set(
 	"${NAV_MESH_DIR}/nav_entities.cpp"
 	"${NAV_MESH_DIR}/nav_entities.h"
 	"${NAV_MESH_DIR}/nav_file.cpp"
+	"${NAV_MESH_DIR}/nav_flat_file.cpp"
 	"${NAV_MESH_DIR}/nav_generate.cpp"
 	"${NAV_MESH_DIR}/nav_ladder.cpp"
 	"${NAV_MESH_DIR}/nav_ladder.h"
@@ -24,6 +25,8 @@ set(
 	"${NAV_MESH_DIR}/nav_node.cpp"
 	"${NAV_MESH_DIR}/nav_node.h"
 	"${NAV_MESH_DIR}/nav_pathfind.h"
+	"${NAV_MESH_DIR}/nav_pathfinder.cpp"
+	"${NAV_MESH_DIR}/nav_pathfinder.h"
 	"${NAV_MESH_DIR}/nav_simplify.cpp"
 )
 
@@ -13,9 +13,12 @@
 #include "filesystem.h"
 #include "nav_mesh.h"
 #include "nav_node.h"
+#include "nav_pathfinder.h"
 #include "fmtstr.h"
 #include "utlbuffer.h"
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
+#include "mathlib/ssemath.h"
 #ifdef TERROR
 #include "func_simpleladder.h"
 #endif
@@ -37,7 +40,18 @@
  */
 CNavMesh *TheNavMesh = NULL;
 
-ConVar nav_edit( "nav_edit", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "Set to one to interactively edit the Navigation Mesh. Set to zero to leave edit mode." );
+//--------------------------------------------------------------------------------------------------------------
+static void NavEditChanged( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	// editing commands can follow in the same frame, before CNavMesh::Update() notices edit mode
+	ConVarRef cvar( var );
+	if ( cvar.GetBool() )
+	{
+		TheNavPathfinder.WaitForAllRequests();
+	}
+}
+
+ConVar nav_edit( "nav_edit", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "Set to one to interactively edit the Navigation Mesh. Set to zero to leave edit mode.", NavEditChanged );
 ConVar nav_quicksave( "nav_quicksave", "1", FCVAR_GAMEDLL | FCVAR_CHEAT, "Set to one to skip the time consuming phases of the analysis.  Useful for data collection and testing." );	// TERROR: defaulting to 1, since we don't need the other data
 ConVar nav_show_approach_points( "nav_show_approach_points", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "Show Approach Points in the Navigation Mesh." );
 ConVar nav_show_danger( "nav_show_danger", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "Show current 'danger' levels." );
@@ -62,6 +76,7 @@ CNavMesh::CNavMesh( void )
 {
 	m_spawnName = NULL;
 	m_gridCellSize = 300.0f;
+	m_areaBoundsDirty = true;
 	m_editMode = NORMAL;
 	m_bQuitWhenFinished = false;
 	m_hostThreadModeRestoreValue = 0;
@@ -158,6 +173,9 @@ CNavArea *CNavMesh::GetMarkedArea( void ) const
  */
 void CNavMesh::DestroyNavigationMesh( bool incremental )
 {
+	// searches still running on the job pool hold pointers to the areas
+	TheNavPathfinder.Reset();
+
 	m_blockedAreas.RemoveAll();
 	m_avoidanceObstacleAreas.RemoveAll();
 	m_transientAreas.RemoveAll();
@@ -208,6 +226,7 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 		m_grid.RemoveAll();
 		m_gridSizeX = 0;
 		m_gridSizeY = 0;
+		m_areaBoundsDirty = true;
 	}
 
 	// clear the hash table
@@ -240,6 +259,7 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 	if ( !incremental )
 	{
 		m_isLoaded = false;
+		m_isLoadedFromFlatFile = false;
 	}
 }
 
@@ -254,7 +274,7 @@ void CNavMesh::Update( void )
 
 	if (IsGenerating())
 	{
-		UpdateGeneration( 0.03 );
+		UpdateGeneration( GetGenerationFrameBudget() );
 		return; // don't bother trying to draw stuff while we're generating
 	}
 
@@ -268,14 +288,26 @@ void CNavMesh::Update( void )
 	UpdateBlockedAreas();
 	UpdateAvoidanceObstacleAreas();
 
+	// rebuild the packed area bounds here, rather than in the first query, which may be on a worker thread
+	UpdateAreaBounds();
+
+	// hand out the path searches that finished on the job pool since last frame
+	TheNavPathfinder.Update();
+
 	if (nav_edit.GetBool())
 	{
 		if (m_isEditing == false)
 		{
+			// no more searches go to the job pool while editing, let the running ones finish before anything changes
+			TheNavPathfinder.WaitForAllRequests();
+
 			OnEditModeStart();
 			m_isEditing = true;
 		}
 
+		// any edit can change paths, don't trust the path cache while editing
+		TheNavPathfinder.Invalidate();
+
 		DrawEditMode();
 	}
 	else
@@ -458,6 +490,7 @@ void CNavMesh::AllocateGrid( float minX, float maxX, float minY, float maxY )
 	m_gridSizeY = (int)((maxY - minY) / m_gridCellSize) + 1;
 
 	m_grid.SetCount( m_gridSizeX * m_gridSizeY );
+	m_areaBoundsDirty = true;
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -485,6 +518,7 @@ void CNavMesh::AddNavArea( CNavArea *area )
 			m_grid[ x + y*m_gridSizeX ].AddToTail( const_cast<CNavArea *>( area ) );
 		}
 	}
+	m_areaBoundsDirty = true;
 
 	// add to hash table
 	int key = ComputeHashKey( area->GetID() );
@@ -519,6 +553,9 @@ void CNavMesh::AddNavArea( CNavArea *area )
  */
 void CNavMesh::RemoveNavArea( CNavArea *area )
 {
+	// paths and searches in flight may refer to this area
+	TheNavPathfinder.Reset();
+
 	// add to grid
 	int loX = WorldToGridX( area->GetCorner( NORTH_WEST ).x );
 	int loY = WorldToGridY( area->GetCorner( NORTH_WEST ).y );
@@ -532,6 +569,7 @@ void CNavMesh::RemoveNavArea( CNavArea *area )
 			m_grid[ x + y*m_gridSizeX ].FindAndRemove( area );
 		}
 	}
+	m_areaBoundsDirty = true;
 
 	// remove from hash table
 	int key = ComputeHashKey( area->GetID() );
@@ -683,6 +721,111 @@ inline void CNavMesh::GridToWorld( int gridX, int gridY, Vector *pos ) const
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Rebuild the packed copies of the area extents, one run of blocks per grid cell.
+ * Update() does this on the main thread each frame before any path search starts, so queries
+ * from other threads normally find them current. The lock covers the rest, and areas only
+ * move while no search is running on the job pool.
+ */
+void CNavMesh::UpdateAreaBounds( void ) const
+{
+	// pairs with the release below, so the bounds are complete once the flag reads clear
+	if ( !m_areaBoundsDirty.load( std::memory_order_acquire ) )
+		return;
+
+	AUTO_LOCK( m_areaBoundsMutex );
+
+	// another thread may have rebuilt them while we waited
+	if ( !m_areaBoundsDirty.load( std::memory_order_acquire ) )
+		return;
+
+	VPROF_BUDGET( "CNavMesh::UpdateAreaBounds", "NextBot" );
+
+	// GetZ() interpolates between the corners, pad the heights so rounding never makes the bounds too tight
+	const float zTolerance = 1.0f;
+
+	m_areaBounds.RemoveAll();
+	m_areaBoundsStart.SetCount( m_grid.Count() + 1 );
+
+	FOR_EACH_VEC( m_grid, iGrid )
+	{
+		const NavAreaVector &areaVector = m_grid[ iGrid ];
+		m_areaBoundsStart[ iGrid ] = m_areaBounds.Count();
+
+		for( int first = 0; first < areaVector.Count(); first += 4 )
+		{
+			NavAreaBoundsBlock &block = m_areaBounds[ m_areaBounds.AddToTail() ];
+			for( int lane = 0; lane < 4; ++lane )
+			{
+				if ( first + lane >= areaVector.Count() )
+				{
+					block.loX[ lane ] = block.loY[ lane ] = block.loZ[ lane ] = FLT_MAX;
+					block.hiX[ lane ] = block.hiY[ lane ] = block.hiZ[ lane ] = -FLT_MAX;
+					continue;
+				}
+
+				const CNavArea *area = areaVector[ first + lane ];
+				const Vector &nw = area->GetCorner( NORTH_WEST );
+				const Vector &se = area->GetCorner( SOUTH_EAST );
+				float neZ = area->GetZ( se.x, nw.y );
+				float swZ = area->GetZ( nw.x, se.y );
+
+				block.loX[ lane ] = nw.x;
+				block.loY[ lane ] = nw.y;
+				block.hiX[ lane ] = se.x;
+				block.hiY[ lane ] = se.y;
+				block.loZ[ lane ] = MIN( MIN( nw.z, se.z ), MIN( neZ, swZ ) ) - zTolerance;
+				block.hiZ[ lane ] = MAX( MAX( nw.z, se.z ), MAX( neZ, swZ ) ) + zTolerance;
+			}
+		}
+	}
+
+	m_areaBoundsStart[ m_grid.Count() ] = m_areaBounds.Count();
+	m_areaBoundsDirty.store( false, std::memory_order_release );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+inline const NavAreaBoundsBlock *CNavMesh::GetAreaBounds( int iGrid, int *blockCount ) const
+{
+	UpdateAreaBounds();
+
+	int start = m_areaBoundsStart[ iGrid ];
+	*blockCount = m_areaBoundsStart[ iGrid + 1 ] - start;
+	return m_areaBounds.Base() + start;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return a bit per lane for the areas of the block whose 2D extent contains (x,y) and whose
+ * heights overlap [bottomZ, topZ]
+ */
+static inline int NavAreaBoundsContainMask( const NavAreaBoundsBlock &block, const fltx4 &x, const fltx4 &y, const fltx4 &bottomZ, const fltx4 &topZ )
+{
+	fltx4 inside = AndSIMD( CmpGeSIMD( x, LoadUnalignedSIMD( block.loX ) ), CmpLeSIMD( x, LoadUnalignedSIMD( block.hiX ) ) );
+	inside = AndSIMD( inside, AndSIMD( CmpGeSIMD( y, LoadUnalignedSIMD( block.loY ) ), CmpLeSIMD( y, LoadUnalignedSIMD( block.hiY ) ) ) );
+	inside = AndSIMD( inside, AndSIMD( CmpLeSIMD( LoadUnalignedSIMD( block.loZ ), topZ ), CmpGeSIMD( LoadUnalignedSIMD( block.hiZ ), bottomZ ) ) );
+	return TestSignSIMD( inside );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return a bit per lane for the areas of the block that may have a point closer to (x,y,z) than
+ * sqrt( rangeSq ). The distance to the padded bounds never exceeds the distance to the closest point on the area.
+ */
+static inline int NavAreaBoundsWithinRangeMask( const NavAreaBoundsBlock &block, const fltx4 &x, const fltx4 &y, const fltx4 &z, float rangeSq )
+{
+	fltx4 dx = MaxSIMD( MaxSIMD( SubSIMD( LoadUnalignedSIMD( block.loX ), x ), SubSIMD( x, LoadUnalignedSIMD( block.hiX ) ) ), Four_Zeros );
+	fltx4 dy = MaxSIMD( MaxSIMD( SubSIMD( LoadUnalignedSIMD( block.loY ), y ), SubSIMD( y, LoadUnalignedSIMD( block.hiY ) ) ), Four_Zeros );
+	fltx4 dz = MaxSIMD( MaxSIMD( SubSIMD( LoadUnalignedSIMD( block.loZ ), z ), SubSIMD( z, LoadUnalignedSIMD( block.hiZ ) ) ), Four_Zeros );
+	fltx4 distSq = AddSIMD( AddSIMD( MulSIMD( dx, dx ), MulSIMD( dy, dy ) ), MulSIMD( dz, dz ) );
+	return TestSignSIMD( CmpLtSIMD( distSq, ReplicateX4( rangeSq ) ) );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Given a position, return the nav area that IsOverlapping and is *immediately* beneath it
@@ -697,20 +840,28 @@ CNavArea *CNavMesh::GetNavArea( const Vector &pos, float beneathLimit ) const
 	// get list in cell that contains position
 	int x = WorldToGridX( pos.x );
 	int y = WorldToGridY( pos.y );
-	NavAreaVector *areaVector = &m_grid[ x + y*m_gridSizeX ];
+	int iGrid = x + y*m_gridSizeX;
+	NavAreaVector *areaVector = &m_grid[ iGrid ];
 
 	// search cell list to find correct area
 	CNavArea *use = NULL;
 	float useZ = -99999999.9f;
 	Vector testPos = pos + Vector( 0, 0, 5 );
 
-	FOR_EACH_VEC( (*areaVector), it )
-	{
-		CNavArea *area = (*areaVector)[ it ];
+	// reject the areas that can't contain the position four at a time, then run the exact tests in the original order
+	int blockCount;
+	const NavAreaBoundsBlock *blocks = GetAreaBounds( iGrid, &blockCount );
+	const fltx4 simdX = ReplicateX4( testPos.x );
+	const fltx4 simdY = ReplicateX4( testPos.y );
+	const fltx4 simdTopZ = ReplicateX4( testPos.z );
+	const fltx4 simdBottomZ = ReplicateX4( pos.z - beneathLimit );
 
-		// check if position is within 2D boundaries of this area
-		if (area->IsOverlapping( testPos ))
+	for( int b = 0; b < blockCount; ++b )
+	{
+		for( int mask = NavAreaBoundsContainMask( blocks[ b ], simdX, simdY, simdBottomZ, simdTopZ ); mask; mask &= mask - 1 )
 		{
+			CNavArea *area = (*areaVector)[ b*4 + FirstBitInWord( mask, 0 ) ];
+
 			// project position onto area to get Z
 			float z = area->GetZ( testPos );
 
@@ -765,42 +916,50 @@ CNavArea *CNavMesh::GetNavArea( CBaseEntity *pEntity, int nFlags, float flBeneat
 	// get list in cell that contains position
 	int x = WorldToGridX( testPos.x );
 	int y = WorldToGridY( testPos.y );
-	NavAreaVector *areaVector = &m_grid[ x + y*m_gridSizeX ];
+	int iGrid = x + y*m_gridSizeX;
+	NavAreaVector *areaVector = &m_grid[ iGrid ];
 
 	// search cell list to find correct area
 	CNavArea *use = NULL;
 	float useZ = -99999999.9f;
 
+	int blockCount;
+	const NavAreaBoundsBlock *blocks = GetAreaBounds( iGrid, &blockCount );
+	const fltx4 simdX = ReplicateX4( testPos.x );
+	const fltx4 simdY = ReplicateX4( testPos.y );
+	const fltx4 simdTopZ = ReplicateX4( testPos.z + flStepHeight );
+	const fltx4 simdBottomZ = ReplicateX4( testPos.z - flBeneathLimit );
+
 	bool bSkipBlockedAreas = ( ( nFlags & GETNAVAREA_ALLOW_BLOCKED_AREAS ) == 0 );
-	FOR_EACH_VEC( (*areaVector), it )
+	for( int b = 0; b < blockCount; ++b )
 	{
-		CNavArea *pArea = (*areaVector)[ it ];
-
-		// check if position is within 2D boundaries of this area
-		if ( !pArea->IsOverlapping( testPos ) )
-			continue;
+		// only the areas overlapping the position in 2D and roughly at the right height are left in the mask
+		for( int mask = NavAreaBoundsContainMask( blocks[ b ], simdX, simdY, simdBottomZ, simdTopZ ); mask; mask &= mask - 1 )
+		{
+			CNavArea *pArea = (*areaVector)[ b*4 + FirstBitInWord( mask, 0 ) ];
 
-		// don't consider blocked areas
-		if ( bSkipBlockedAreas && pArea->IsBlocked( pEntity->GetTeamNumber() ) )
-			continue;
+			// don't consider blocked areas
+			if ( bSkipBlockedAreas && pArea->IsBlocked( pEntity->GetTeamNumber() ) )
+				continue;
 
-		// project position onto area to get Z
-		float z = pArea->GetZ( testPos );
+			// project position onto area to get Z
+			float z = pArea->GetZ( testPos );
 
-		// if area is above us, skip it
-		if ( z > testPos.z + flStepHeight )
-			continue;
+			// if area is above us, skip it
+			if ( z > testPos.z + flStepHeight )
+				continue;
 
-		// if area is too far below us, skip it
-		if ( z < testPos.z - flBeneathLimit )
-			continue;
+			// if area is too far below us, skip it
+			if ( z < testPos.z - flBeneathLimit )
+				continue;
 
-		// if area is lower than the one we have, skip it
-		if ( z <= useZ )
-			continue;
+			// if area is lower than the one we have, skip it
+			if ( z <= useZ )
+				continue;
 
-		use = pArea;
-		useZ = z;
+			use = pArea;
+			useZ = z;
+		}
 	}
 
 	// Check LOS if necessary
@@ -863,15 +1022,10 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 
 	// find closest nav area
 
-	// use a unique marker for this method, so it can be used within a SearchSurroundingArea() call
-	static unsigned int searchMarker = RandomInt(0, 1024*1024 );
-
-	++searchMarker;
-
-	if ( searchMarker == 0 )
-	{
-		++searchMarker;
-	}
+	// Areas spanning more than one grid cell are remembered here rather than in a
+	// marker on the area, so this can run on several threads at once and from
+	// within a SearchSurroundingArea() call.
+	CUtlVectorFixedGrowable< const CNavArea *, 32 > visitedAreas;
 
 
 	// get list in cell that contains position
@@ -880,6 +1034,10 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 
 	int shiftLimit = ceil(maxDist / m_gridCellSize);
 
+	const fltx4 simdPosX = ReplicateX4( pos.x );
+	const fltx4 simdPosY = ReplicateX4( pos.y );
+	const fltx4 simdPosZ = ReplicateX4( pos.z );
+
 	//
 	// Search in increasing rings out from origin, starting with cell
 	// that contains the given position.
@@ -906,84 +1064,95 @@ CNavArea *CNavMesh::GetNearestNavArea( const Vector &pos, bool anyZ, float maxDi
 					 y < originY + shift )
 					continue;
 
-				NavAreaVector *areaVector = &m_grid[ x + y*m_gridSizeX ];
+				int iGrid = x + y*m_gridSizeX;
+				NavAreaVector *areaVector = &m_grid[ iGrid ];
+
+				int blockCount;
+				const NavAreaBoundsBlock *blocks = GetAreaBounds( iGrid, &blockCount );
 
 				// find closest area in this cell
-				FOR_EACH_VEC( (*areaVector), it )
+				for( int b = 0; b < blockCount; ++b )
 				{
-					CNavArea *area = (*areaVector)[ it ];
+					// areas that can't beat the closest one so far are rejected four at a time from their bounds
+					for( int mask = NavAreaBoundsWithinRangeMask( blocks[ b ], simdPosX, simdPosY, simdPosZ, closeDistSq ); mask; mask &= mask - 1 )
+					{
+						CNavArea *area = (*areaVector)[ b*4 + FirstBitInWord( mask, 0 ) ];
 
-					// skip if we've already visited this area
-					if ( area->m_nearNavSearchMarker == searchMarker )
-						continue;
+						// don't consider blocked areas
+						if ( area->IsBlocked( team ) )
+							continue;
 
-					// don't consider blocked areas
-					if ( area->IsBlocked( team ) )
-						continue;
+						// skip if we've already visited this area in another cell
+						if ( WorldToGridX( area->GetCorner( NORTH_WEST ).x ) != WorldToGridX( area->GetCorner( SOUTH_EAST ).x ) ||
+							 WorldToGridY( area->GetCorner( NORTH_WEST ).y ) != WorldToGridY( area->GetCorner( SOUTH_EAST ).y ) )
+						{
+							if ( visitedAreas.Find( area ) != visitedAreas.InvalidIndex() )
+								continue;
 
-					// mark as visited
-					area->m_nearNavSearchMarker = searchMarker;
+							visitedAreas.AddToTail( area );
+						}
 
-					Vector areaPos;
-					area->GetClosestPointOnArea( source, &areaPos );
+						Vector areaPos;
+						area->GetClosestPointOnArea( source, &areaPos );
 
-					// TERROR: Using the original pos for distance calculations.  Since it's a pure 3D distance,
-					// with no Z restrictions or LOS checks, this should work for passing in bot foot positions.
-					// This needs to be ported back to CS:S.
-					float distSq = ( areaPos - pos ).LengthSqr();
+						// TERROR: Using the original pos for distance calculations.  Since it's a pure 3D distance,
+						// with no Z restrictions or LOS checks, this should work for passing in bot foot positions.
+						// This needs to be ported back to CS:S.
+						float distSq = ( areaPos - pos ).LengthSqr();
 
-					// keep the closest area
-					if ( distSq >= closeDistSq )
-						continue;
+						// keep the closest area
+						if ( distSq >= closeDistSq )
+							continue;
 
-					// check LOS to area
-					// REMOVED: If we do this for !anyZ, it's likely we wont have LOS and will enumerate every area in the mesh
-					// It is still good to do this in some isolated cases, however
-					if ( checkLOS )
-					{
-						trace_t result;
+						// check LOS to area
+						// REMOVED: If we do this for !anyZ, it's likely we wont have LOS and will enumerate every area in the mesh
+						// It is still good to do this in some isolated cases, however
+						if ( checkLOS )
+						{
+							trace_t result;
 
-						// make sure 'pos' is not embedded in the world
-						Vector safePos;
+							// make sure 'pos' is not embedded in the world
+							Vector safePos;
 
-						UTIL_TraceLine( pos, pos + Vector( 0, 0, StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
-						if ( result.startsolid )
-						{
-							// it was embedded - move it out
-							safePos = result.endpos + Vector( 0, 0, 1.0f );
-						}
-						else
-						{
-							safePos = pos;
-						}
+							UTIL_TraceLine( pos, pos + Vector( 0, 0, StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+							if ( result.startsolid )
+							{
+								// it was embedded - move it out
+								safePos = result.endpos + Vector( 0, 0, 1.0f );
+							}
+							else
+							{
+								safePos = pos;
+							}
 
-						// Don't bother tracing from the nav area up to safePos.z if it's within StepHeight of the area, since areas can be embedded in the ground a bit
-						float heightDelta = fabs(areaPos.z - safePos.z);
-						if ( heightDelta > StepHeight )
-						{
-							// trace to the height of the original point
-							UTIL_TraceLine( areaPos + Vector( 0, 0, StepHeight ), Vector( areaPos.x, areaPos.y, safePos.z ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+							// Don't bother tracing from the nav area up to safePos.z if it's within StepHeight of the area, since areas can be embedded in the ground a bit
+							float heightDelta = fabs(areaPos.z - safePos.z);
+							if ( heightDelta > StepHeight )
+							{
+								// trace to the height of the original point
+								UTIL_TraceLine( areaPos + Vector( 0, 0, StepHeight ), Vector( areaPos.x, areaPos.y, safePos.z ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
 							
+								if ( result.fraction != 1.0f )
+								{
+									continue;
+								}
+							}
+
+							// trace to the original point's height above the area
+							UTIL_TraceLine( safePos, Vector( areaPos.x, areaPos.y, safePos.z + StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+
 							if ( result.fraction != 1.0f )
 							{
 								continue;
 							}
 						}
 
-						// trace to the original point's height above the area
-						UTIL_TraceLine( safePos, Vector( areaPos.x, areaPos.y, safePos.z + StepHeight ), MASK_NPCSOLID_BRUSHONLY, NULL, COLLISION_GROUP_NONE, &result );
+						closeDistSq = distSq;
+						close = area;
 
-						if ( result.fraction != 1.0f )
-						{
-							continue;
-						}
+						// look one more step outwards
+						shiftLimit = shift+1;
 					}
-
-					closeDistSq = distSq;
-					close = area;
-
-					// look one more step outwards
-					shiftLimit = shift+1;
 				}
 			}
 		}
@@ -1017,6 +1186,209 @@ CNavArea *CNavMesh::GetNearestNavArea( CBaseEntity *pEntity, int nFlags, float m
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+struct NavBatchQuery
+{
+	int m_grid;
+	const Vector *m_pos;
+	int m_index;
+};
+
+// orders by cell, then position, so exact duplicates end up next to each other
+static int NavBatchQueryCompare( const NavBatchQuery *lhs, const NavBatchQuery *rhs )
+{
+	if ( lhs->m_grid != rhs->m_grid )
+		return lhs->m_grid - rhs->m_grid;
+
+	for( int i=0; i<3; ++i )
+	{
+		if ( (*lhs->m_pos)[i] != (*rhs->m_pos)[i] )
+			return ( (*lhs->m_pos)[i] < (*rhs->m_pos)[i] ) ? -1 : 1;
+	}
+
+	return lhs->m_index - rhs->m_index;
+}
+
+// true if this query has the same position as the one sorted just before it, so can reuse its answer
+static inline bool IsDuplicateNavBatchQuery( const CUtlVector< NavBatchQuery > &queries, int it )
+{
+	return it > 0 && queries[ it-1 ].m_grid == queries[ it ].m_grid && *queries[ it-1 ].m_pos == *queries[ it ].m_pos;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * GetNavArea() for each of the given positions
+ */
+void CNavMesh::GetNavAreas( const Vector *positions, int count, CNavArea **areas, float beneathLimit ) const
+{
+	VPROF_BUDGET( "CNavMesh::GetNavAreas", "NextBot" );
+
+	if ( !m_grid.Count() )
+	{
+		for( int i=0; i<count; ++i )
+			areas[i] = NULL;
+		return;
+	}
+
+	// visit the positions cell by cell, so neighboring queries share the same packed bounds and areas while they are still in the cache
+	CUtlVector< NavBatchQuery > queries;
+	queries.SetCount( count );
+	for( int i=0; i<count; ++i )
+	{
+		queries[i].m_grid = WorldToGridX( positions[i].x ) + WorldToGridY( positions[i].y ) * m_gridSizeX;
+		queries[i].m_pos = &positions[i];
+		queries[i].m_index = i;
+	}
+	queries.Sort( NavBatchQueryCompare );
+
+	FOR_EACH_VEC( queries, it )
+	{
+		int i = queries[ it ].m_index;
+
+		if ( IsDuplicateNavBatchQuery( queries, it ) )
+		{
+			areas[i] = areas[ queries[ it-1 ].m_index ];
+			continue;
+		}
+
+		areas[i] = GetNavArea( positions[i], beneathLimit );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * GetNearestNavArea() for each of the given positions
+ */
+void CNavMesh::GetNearestNavAreas( const Vector *positions, int count, CNavArea **areas, bool anyZ, float maxDist, bool checkLOS, bool checkGround, int team ) const
+{
+	VPROF_BUDGET( "CNavMesh::GetNearestNavAreas", "NextBot" );
+
+	if ( !m_grid.Count() )
+	{
+		for( int i=0; i<count; ++i )
+			areas[i] = NULL;
+		return;
+	}
+
+	// visit the positions cell by cell, so neighboring queries share the same packed bounds and areas while they are still in the cache
+	CUtlVector< NavBatchQuery > queries;
+	queries.SetCount( count );
+	for( int i=0; i<count; ++i )
+	{
+		queries[i].m_grid = WorldToGridX( positions[i].x ) + WorldToGridY( positions[i].y ) * m_gridSizeX;
+		queries[i].m_pos = &positions[i];
+		queries[i].m_index = i;
+	}
+	queries.Sort( NavBatchQueryCompare );
+
+	FOR_EACH_VEC( queries, it )
+	{
+		int i = queries[ it ].m_index;
+
+		if ( IsDuplicateNavBatchQuery( queries, it ) )
+		{
+			areas[i] = areas[ queries[ it-1 ].m_index ];
+			continue;
+		}
+
+		areas[i] = GetNearestNavArea( positions[i], anyZ, maxDist, checkLOS, checkGround, team );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Time area lookups around random nav areas, one at a time and batched
+ */
+CON_COMMAND_F( nav_benchmark_queries, "Times GetNavArea and GetNearestNavArea for random positions near the mesh, one by one and batched. Arguments: [positions] [iterations]", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !TheNavAreas.Count() )
+	{
+		Msg( "No nav mesh loaded.\n" );
+		return;
+	}
+
+	int count = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 64;
+	int iterations = ( args.ArgC() > 2 ) ? MAX( atoi( args[2] ), 1 ) : 100;
+
+	// positions on, just above and just off the mesh
+	CUtlVector< Vector > positions;
+	positions.SetCount( count );
+	for( int i=0; i<count; ++i )
+	{
+		const CNavArea *area = TheNavAreas[ RandomInt( 0, TheNavAreas.Count()-1 ) ];
+		positions[i] = area->GetCenter() + Vector( RandomFloat( -200.0f, 200.0f ), RandomFloat( -200.0f, 200.0f ), RandomFloat( 0.0f, 60.0f ) );
+	}
+
+	CUtlVector< CNavArea * > single, batched;
+	single.SetCount( count );
+	batched.SetCount( count );
+
+	CFastTimer timer;
+	timer.Start();
+	for( int n=0; n<iterations; ++n )
+	{
+		for( int i=0; i<count; ++i )
+		{
+			single[i] = TheNavMesh->GetNavArea( positions[i] );
+		}
+	}
+	timer.End();
+	float singleMs = timer.GetDuration().GetMillisecondsF() / iterations;
+
+	timer.Start();
+	for( int n=0; n<iterations; ++n )
+	{
+		TheNavMesh->GetNavAreas( positions.Base(), count, batched.Base() );
+	}
+	timer.End();
+	float batchedMs = timer.GetDuration().GetMillisecondsF() / iterations;
+
+	int mismatches = 0;
+	for( int i=0; i<count; ++i )
+	{
+		mismatches += ( single[i] != batched[i] ) ? 1 : 0;
+	}
+
+	timer.Start();
+	for( int n=0; n<iterations; ++n )
+	{
+		for( int i=0; i<count; ++i )
+		{
+			single[i] = TheNavMesh->GetNearestNavArea( positions[i], false, 10000.0f, false, false );
+		}
+	}
+	timer.End();
+	float nearestSingleMs = timer.GetDuration().GetMillisecondsF() / iterations;
+
+	timer.Start();
+	for( int n=0; n<iterations; ++n )
+	{
+		TheNavMesh->GetNearestNavAreas( positions.Base(), count, batched.Base(), false, 10000.0f, false, false );
+	}
+	timer.End();
+	float nearestBatchedMs = timer.GetDuration().GetMillisecondsF() / iterations;
+
+	for( int i=0; i<count; ++i )
+	{
+		mismatches += ( single[i] != batched[i] ) ? 1 : 0;
+	}
+
+	Msg( "nav_benchmark_queries: %d positions, %d areas, %d iterations\n", count, TheNavAreas.Count(), iterations );
+	Msg( "  GetNavArea:         %8.4f ms single, %8.4f ms batched\n", singleMs, batchedMs );
+	Msg( "  GetNearestNavArea:  %8.4f ms single, %8.4f ms batched\n", nearestSingleMs, nearestBatchedMs );
+	if ( mismatches )
+	{
+		Warning( "nav_benchmark_queries: %d batched results differ from the single queries!\n", mismatches );
+	}
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Given an ID, return the associated area
@@ -2595,14 +2967,17 @@ static ConCommand nav_ladder_flip( "nav_ladder_flip", CommandNavLadderFlip, "Fli
 
 
 //--------------------------------------------------------------------------------------------------------------
-void CommandNavGenerate( void )
+void CommandNavGenerate( const CCommand &args )
 {
 	if ( !UTIL_IsCommandIssuedByServerAdmin() )
 		return;
 
-	TheNavMesh->BeginGeneration();
+	// 'nav_generate quit' is for running on a dedicated server from the command line, e.g. +map foo +nav_generate quit
+	bool quitWhenFinished = ( args.ArgC() > 1 && !Q_stricmp( args[1], "quit" ) );
+
+	TheNavMesh->BeginGeneration( false, quitWhenFinished );
 }
-static ConCommand nav_generate( "nav_generate", CommandNavGenerate, "Generate a Navigation Mesh for the current map and save it to disk.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+static ConCommand nav_generate( "nav_generate", CommandNavGenerate, "Generate a Navigation Mesh for the current map and save it to disk. 'nav_generate quit' exits when done.", FCVAR_GAMEDLL | FCVAR_CHEAT );
 
 
 //--------------------------------------------------------------------------------------------------------------
@@ -3129,6 +3504,8 @@ void CNavMesh::OnAreaBlocked( CNavArea *area )
 	{
 		m_blockedAreas.AddToTail( area );
 	}
+
+	TheNavPathfinder.Invalidate();
 }
 
 
@@ -3137,6 +3514,8 @@ void CNavMesh::OnAreaBlocked( CNavArea *area )
 void CNavMesh::OnAreaUnblocked( CNavArea *area )
 {
 	m_blockedAreas.FindAndRemove( area );
+
+	TheNavPathfinder.Invalidate();
 }
 
 
@@ -19,6 +19,7 @@
 #ifndef _NAV_MESH_H_
 #define _NAV_MESH_H_
 
+#include <atomic>
 #include "utlbuffer.h"
 #include "filesystem.h"
 #include "GameEventListener.h"
@@ -31,11 +32,27 @@
 class CNavArea;
 class CBaseEntity; 
 class CBreakable;
+struct NavNodeCrouchInfo;
+struct NavSampleStep;
+struct NavAreaFitTest;
 
 extern ConVar nav_edit;
 extern ConVar nav_quicksave;
 extern ConVar nav_show_approach_points;
 extern ConVar nav_show_danger;
+extern ConVar nav_save_flat;
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Copies of the extents of up to four nav areas of one grid cell, laid out for SIMD tests.
+ * Unused lanes hold an empty extent that never passes a test.
+ */
+struct NavAreaBoundsBlock
+{
+	float loX[4], loY[4], loZ[4];
+	float hiX[4], hiY[4], hiZ[4];
+};
+
 
 //--------------------------------------------------------------------------------------------------------
 class NavAreaCollector
@@ -274,6 +291,7 @@ public:
 	virtual NavErrorType Load( void );									// load navigation data from a file
 	virtual NavErrorType PostLoad( unsigned int version );				// (EXTEND) invoked after all areas have been loaded - for pointer binding, etc
 	bool IsLoaded( void ) const		{ return m_isLoaded; }				// return true if a Navigation Mesh has been loaded
+	bool IsLoadedFromFlatFile( void ) const	{ return m_isLoadedFromFlatFile; }	// return true if the mesh came from the flat .navb copy of the nav file
 	bool IsAnalyzed( void ) const	{ return m_isAnalyzed; }			// return true if a Navigation Mesh has been analyzed
 
 	/**
@@ -285,6 +303,7 @@ public:
 	const CUtlVector< Place > *GetPlacesFromNavFile( bool *hasUnnamedPlaces );	// Reads the used place names from the nav file (can be used to selectively precache before the nav is loaded)
 
 	virtual bool Save( void ) const;									// store Navigation Mesh to a file
+	bool SaveFlat( void ) const;										// store a flat, memory-mappable copy of the Navigation Mesh next to the .nav file
 	bool IsOutOfDate( void ) const	{ return m_isOutOfDate; }			// return true if the Navigation Mesh is older than the current map version
 
 	virtual unsigned int GetSubVersionNumber( void ) const;										// returns sub-version number of data format used by derived classes
@@ -323,6 +342,12 @@ public:
 	CNavArea *GetNearestNavArea( const Vector &pos, bool anyZ = false, float maxDist = 10000.0f, bool checkLOS = false, bool checkGround = true, int team = TEAM_ANY ) const;
 	CNavArea *GetNearestNavArea( CBaseEntity *pEntity, int nGetNavAreaFlags = GETNAVAREA_CHECK_GROUND, float maxDist = 10000.0f ) const;
 
+	// Batched versions of the above for many positions at once, such as a whole team of bots each tick. Results are written to areas[i] for positions[i].
+	void GetNavAreas( const Vector *positions, int count, CNavArea **areas, float beneathLimit = 120.0f ) const;
+	void GetNearestNavAreas( const Vector *positions, int count, CNavArea **areas, bool anyZ = false, float maxDist = 10000.0f, bool checkLOS = false, bool checkGround = true, int team = TEAM_ANY ) const;
+
+	void InvalidateAreaBounds( void )	{ m_areaBoundsDirty = true; }	// must be called when the corners of an area in the grid move
+
 	Place GetPlace( const Vector &pos ) const;							// return Place at given coordinate
 	const char *PlaceToName( Place place ) const;						// given a place, return its name
 	Place NameToPlace( const char *name ) const;						// given a place name, return a place ID or zero if no place is defined
@@ -347,7 +372,7 @@ public:
 	// Auto-generation
 	//
 	#define INCREMENTAL_GENERATION true
-	void BeginGeneration( bool incremental = false );					// initiate the generation process
+	void BeginGeneration( bool incremental = false, bool quitWhenFinished = false );	// initiate the generation process
 	void BeginAnalysis( bool quitWhenFinished = false );						// re-analyze an existing Mesh.  Determine Hiding Spots, Encounter Spots, etc.
 
 	bool IsGenerating( void ) const		{ return m_generationMode != GENERATE_NONE; }	// return true while a Navigation Mesh is being generated
@@ -1045,6 +1070,7 @@ public:
 	EditModeType GetEditMode( void ) const;						// return the current edit mode
 	void SetEditMode( EditModeType mode );						// change the edit mode
 	bool IsEditMode( EditModeType mode ) const;					// return true if current mode matches given mode
+	bool IsEditing( void ) const	{ return m_isEditing; }		// return true while nav_edit is on
 
 	bool FindNavAreaOrLadderAlongRay( const Vector &start, const Vector &end, CNavArea **area, CNavLadder **ladder, CNavArea *ignore = NULL );
 
@@ -1070,9 +1096,17 @@ private:
 	int m_gridSizeY;
 	float m_minX;
 	float m_minY;
+
+	mutable CUtlVector< NavAreaBoundsBlock > m_areaBounds;		// packed extents of the areas in each grid cell, in the same order as m_grid
+	mutable CUtlVector< int > m_areaBoundsStart;				// first block of each grid cell in m_areaBounds, plus one past the last
+	mutable std::atomic< bool > m_areaBoundsDirty;				// true if m_areaBounds must be rebuilt before use, set whenever m_grid changes
+	mutable CThreadFastMutex m_areaBoundsMutex;					// serializes rebuilds by queries on other threads
+	void UpdateAreaBounds( void ) const;						// rebuild the packed extents if the grid or an area changed
+	const NavAreaBoundsBlock *GetAreaBounds( int iGrid, int *blockCount ) const;	// packed extents of the given grid cell
 	unsigned int m_areaCount;									// total number of nav areas
 
 	bool m_isLoaded;											// true if a Navigation Mesh has been loaded
+	bool m_isLoadedFromFlatFile;								// true if the loaded mesh came from the flat copy of the nav file
 	bool m_isOutOfDate;											// true if the Navigation Mesh is older than the actual BSP
 	bool m_isAnalyzed;											// true if the Navigation Mesh needs analysis
 
@@ -1087,6 +1121,9 @@ private:
 
 	void AddNavArea( CNavArea *area );							// add an area to the grid
 
+	NavErrorType LoadFlat( void );								// load the flat copy of the nav file, if it is present and up to date
+	void OnLoadComplete( void );								// finish a load once all areas are bound
+
 	void DestroyNavigationMesh( bool incremental = false );		// free all resources of the mesh and reset it to empty state
 	void DestroyHidingSpots( void );
 
@@ -1156,16 +1193,22 @@ private:
 
 	CNavNode *m_currentNode;									// the current node we are sampling from
 	NavDirType m_generationDir;
-	CNavNode *AddNode( const Vector &destPos, const Vector &destNormal, NavDirType dir, CNavNode *source, bool isOnDisplacement, float obstacleHeight, float flObstacleStartDist, float flObstacleEndDist );		// add a nav node and connect it, update current node
+	CNavNode *AddNode( const Vector &destPos, const Vector &destNormal, NavDirType dir, CNavNode *source, bool isOnDisplacement, float obstacleHeight, float flObstacleStartDist, float flObstacleEndDist, const NavNodeCrouchInfo *crouch = NULL );		// add a nav node and connect it, update current node
+	float GetGenerationFrameBudget( void ) const;				// seconds of generation work to do each frame
 
 	NavLadderVector m_ladders;									// list of ladder navigation representations
 	void BuildLadders( void );
 	void DestroyLadders( void );
 
 	bool SampleStep( void );									// sample the walkable areas of the map
+	void ComputeSampleStep( NavSampleStep &step );				// trace one sampling step, safe on worker threads
+	void SampleStepJob( NavSampleStep &step );
+	void GetSampleStep( const Vector &from, NavDirType dir, NavSampleStep *step );	// traced ahead on the job pool if possible
+	void PrefetchSampleSteps( const Vector &start );			// trace the steps the sampling is about to take on the job pool
 	void CreateNavAreasFromNodes( void );						// cover all of the sampled nodes with nav areas
 
-	bool TestArea( CNavNode *node, int width, int height );		// check if an area of size (width, height) can fit, starting from node as upper left corner
+	bool TestArea( CNavNode *node, int width, int height, bool speculative = false );	// check if an area of size (width, height) can fit, starting from node as upper left corner
+	void TestAreaJob( NavAreaFitTest &test );
 	int BuildArea( CNavNode *node, int width, int height );		// create a CNavArea of size (width, height) starting fom node at upper left corner
 	bool CheckObstacles( CNavNode *node, int width, int height, int x, int y );
 
@@ -273,14 +273,15 @@ float CNavNode::GetGroundHeightAboveNode( NavCornerType cornerType ) const
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * Look up to JumpCrouchHeight in the air to see if we can fit a whole HumanHeight box
+ * Look up to JumpCrouchHeight in the air to see if we can fit a whole HumanHeight box.
+ * Only reads the world, so it can run on a worker thread; 'debugNode' is NULL there.
  */
-bool CNavNode::TestForCrouchArea( NavCornerType cornerNum, const Vector& mins, const Vector& maxs, float *groundHeightAboveNode )
+bool CNavNode::TestForCrouchArea( const Vector &pos, const Vector& mins, const Vector& maxs, float *groundHeightAboveNode, bool *isBlocked, const CNavNode *debugNode )
 {
 	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_PLAYER_MOVEMENT, WALK_THRU_EVERYTHING );
 	trace_t tr;
 
-	Vector start( m_pos );
+	Vector start( pos );
 	Vector end( start );
 	end.z += JumpCrouchHeight;
 	UTIL_TraceHull( start, end, NavTraceMins, NavTraceMaxs, MASK_NPCSOLID_BRUSHONLY, &filter, &tr );
@@ -291,14 +292,14 @@ bool CNavNode::TestForCrouchArea( NavCornerType cornerNum, const Vector& mins, c
 
 	for ( float height = 0; height <= maxHeight; height += 1.0f )
 	{
-		start = m_pos;
+		start = pos;
 		start.z += height;
 
 		realMaxs.z = HumanCrouchHeight;
 		UTIL_TraceHull( start, start, mins, realMaxs, MASK_NPCSOLID_BRUSHONLY, &filter, &tr );
 		if ( !tr.startsolid )
 		{
-			*groundHeightAboveNode = start.z - m_pos.z;
+			*groundHeightAboveNode = start.z - pos.z;
 
 			// We found a crouch-sized space.  See if we can stand up.
 			realMaxs.z = HumanHeight;
@@ -307,7 +308,7 @@ bool CNavNode::TestForCrouchArea( NavCornerType cornerNum, const Vector& mins, c
 			{
 				// We found a crouch-sized space.  See if we can stand up.
 #if DEBUG_NAV_NODES
-				if ( (unsigned int)(nav_test_node_crouch.GetInt()) == GetID() )
+				if ( debugNode && (unsigned int)(nav_test_node_crouch.GetInt()) == debugNode->GetID() )
 				{
 					NDebugOverlay::Box( start, mins, maxs, 0, 255, 255, 100, 100 );
 				}
@@ -315,7 +316,7 @@ bool CNavNode::TestForCrouchArea( NavCornerType cornerNum, const Vector& mins, c
 				return true;
 			}
 #if DEBUG_NAV_NODES
-			if ( (unsigned int)(nav_test_node_crouch.GetInt()) == GetID() )
+			if ( debugNode && (unsigned int)(nav_test_node_crouch.GetInt()) == debugNode->GetID() )
 			{
 				NDebugOverlay::Box( start, mins, maxs, 255, 0, 0, 100, 100 );
 			}
@@ -326,17 +327,26 @@ bool CNavNode::TestForCrouchArea( NavCornerType cornerNum, const Vector& mins, c
 	}
 
 	*groundHeightAboveNode = JumpCrouchHeight;
-	m_isBlocked[ cornerNum ] = true;
+	*isBlocked = true;
 	return false;
 }
 
 
 //--------------------------------------------------------------------------------------------------------------
-void CNavNode::CheckCrouch( void )
+/**
+ * Run the crouch tests for a node at 'pos'. Only reads the world, so the generator can run it on
+ * worker threads for positions it is about to add nodes at.
+ */
+void CNavNode::ComputeCrouch( const Vector &pos, NavNodeCrouchInfo *info, const CNavNode *debugNode )
 {
 	// For each direction, trace upwards from our best ground height to VEC_HULL_MAX.z to see if we have standing room.
 	for ( int i=0; i<NUM_CORNERS; ++i )
 	{
+		info->isTested[i] = false;
+		info->isBlocked[i] = false;
+		info->crouch[i] = false;
+		info->groundHeightAboveNode[i] = 0.0f;
+
 #if DEBUG_NAV_NODES
 		if ( nav_test_node_crouch_dir.GetInt() != NUM_CORNERS && i != nav_test_node_crouch_dir.GetInt() )
 			continue;
@@ -378,10 +388,41 @@ void CNavNode::CheckCrouch( void )
 			}
 		}
 
-		if ( !TestForCrouchArea( corner, mins, maxs, &m_groundHeightAboveNode[i] ) )
+		info->isTested[i] = true;
+		info->crouch[i] = !TestForCrouchArea( pos, mins, maxs, &info->groundHeightAboveNode[i], &info->isBlocked[i], debugNode );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Update the crouch state of the node, from 'info' if the tests were already run for this position
+ */
+void CNavNode::CheckCrouch( const NavNodeCrouchInfo *info )
+{
+	NavNodeCrouchInfo computed;
+	if ( info == NULL )
+	{
+		ComputeCrouch( m_pos, &computed, this );
+		info = &computed;
+	}
+
+	for ( int i=0; i<NUM_CORNERS; ++i )
+	{
+		if ( !info->isTested[i] )
+			continue;
+
+		m_groundHeightAboveNode[i] = info->groundHeightAboveNode[i];
+
+		if ( info->isBlocked[i] )
+		{
+			m_isBlocked[i] = true;
+		}
+
+		if ( info->crouch[i] )
 		{
 			SetAttributes( NAV_MESH_CROUCH );
-			m_crouch[corner] = true;
+			m_crouch[i] = true;
 		}
 	}
 }
@@ -18,6 +18,19 @@
 // nav_show_node_id allows you to show the IDs of nodes that didn't get used to create areas.
 #define DEBUG_NAV_NODES 1
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Outcome of the crouch tests at a node position, see CNavNode::CheckCrouch()
+ */
+struct NavNodeCrouchInfo
+{
+	bool isTested[ NUM_CORNERS ];
+	bool isBlocked[ NUM_CORNERS ];									///< no room even to crouch in this corner
+	bool crouch[ NUM_CORNERS ];										///< no room to stand in this corner
+	float groundHeightAboveNode[ NUM_CORNERS ];
+};
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Navigation Nodes.
@@ -69,8 +82,9 @@ private:
 	CNavNode() {}													// constructor used only for hash lookup
 	friend class CNavMesh;
 
-	bool TestForCrouchArea( NavCornerType cornerNum, const Vector& mins, const Vector& maxs, float *groundHeightAboveNode );
-	void CheckCrouch( void );
+	static bool TestForCrouchArea( const Vector &pos, const Vector& mins, const Vector& maxs, float *groundHeightAboveNode, bool *isBlocked, const CNavNode *debugNode );
+	static void ComputeCrouch( const Vector &pos, NavNodeCrouchInfo *info, const CNavNode *debugNode = NULL );	///< run the crouch tests for a node at pos, safe on worker threads
+	void CheckCrouch( const NavNodeCrouchInfo *info = NULL );		///< update crouch state, from precomputed tests if given
 
 	Vector m_pos;													///< position of this node in the world
 	Vector m_normal;												///< surface normal at this location
@@ -37,11 +37,18 @@ enum RouteType
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Functor used with NavAreaBuildPath()
+ * The overload taking 'fromCostSoFar' is the one used by the re-entrant searches in nav_pathfinder.h, which
+ * keep their costs in their own tables instead of in the areas.
  */
 class ShortestPathCost
 {
 public:
 	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		return operator()( area, fromArea, ladder, elevator, length, fromArea ? fromArea->GetCostSoFar() : 0.0f );
+	}
+
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length, float fromCostSoFar ) const
 	{
 		if ( fromArea == NULL )
 		{
@@ -66,7 +73,7 @@ public:
 				dist = ( area->GetCenter() - fromArea->GetCenter() ).Length();
 			}
 
-			float cost = dist + fromArea->GetCostSoFar();
+			float cost = dist + fromCostSoFar;
 
 			// if this is a "crouch" area, add penalty
 			if ( area->GetAttributes() & NAV_MESH_CROUCH )
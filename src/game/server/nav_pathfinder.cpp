@@ -0,0 +1,648 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Re-entrant, cached and asynchronous path searches over the Navigation Mesh
+//
+//=============================================================================//
+// nav_pathfinder.cpp
+
+#include "cbase.h"
+#include "nav_mesh.h"
+#include "nav_pathfinder.h"
+#include "tier0/fasttimer.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+CNavPathfinder TheNavPathfinder;
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::Clear( void )
+{
+	m_nodes.RemoveAll();
+	m_nodeIndex.RemoveAll();
+	m_openHeap.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the search node for the given area, creating it if the search has not seen the area yet
+ */
+int CNavPathSearch::FindOrAddNode( CNavArea *area )
+{
+	UtlHashHandle_t h = m_nodeIndex.Find( area );
+	if ( h != m_nodeIndex.InvalidHandle() )
+		return m_nodeIndex.Element( h );
+
+	int node = m_nodes.AddToTail();
+	Node &newNode = m_nodes[ node ];
+	newNode.area = area;
+	newNode.parent = -1;
+	newNode.how = NUM_TRAVERSE_TYPES;
+	newNode.state = NODE_NEW;
+	newNode.heapIndex = -1;
+	newNode.costSoFar = 0.0f;
+	newNode.totalCost = 0.0f;
+	newNode.pathLengthSoFar = 0.0f;
+
+	m_nodeIndex.Insert( area, node );
+	return node;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Collect the areas reachable from 'area', in the same order NavAreaBuildPath() visits them:
+ * floor connections, then the tops of up ladders (never the area behind the top), bottoms of down
+ * ladders, and finally elevator stops.
+ */
+void CNavPathSearch::GatherNeighbors( const CNavArea *area )
+{
+	m_neighbors.RemoveAll();
+
+	for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+	{
+		const NavConnectVector *floorList = area->GetAdjacentAreas( (NavDirType)dir );
+		FOR_EACH_VEC( (*floorList), it )
+		{
+			const NavConnect &floorConnect = floorList->Element( it );
+			Neighbor &neighbor = m_neighbors[ m_neighbors.AddToTail() ];
+			neighbor.area = floorConnect.area;
+			neighbor.how = (NavTraverseType)dir;
+			neighbor.ladder = NULL;
+			neighbor.elevator = NULL;
+			neighbor.length = floorConnect.length;
+		}
+	}
+
+	const NavLadderConnectVector *ladderList = area->GetLadders( CNavLadder::LADDER_UP );
+	FOR_EACH_VEC( (*ladderList), it )
+	{
+		const CNavLadder *ladder = ladderList->Element( it ).ladder;
+		CNavArea *tops[] = { ladder->m_topForwardArea, ladder->m_topLeftArea, ladder->m_topRightArea };
+		for( int i=0; i<ARRAYSIZE( tops ); ++i )
+		{
+			if ( tops[i] == NULL )
+				continue;
+
+			Neighbor &neighbor = m_neighbors[ m_neighbors.AddToTail() ];
+			neighbor.area = tops[i];
+			neighbor.how = GO_LADDER_UP;
+			neighbor.ladder = ladder;
+			neighbor.elevator = NULL;
+			neighbor.length = -1.0f;
+		}
+	}
+
+	ladderList = area->GetLadders( CNavLadder::LADDER_DOWN );
+	FOR_EACH_VEC( (*ladderList), it )
+	{
+		const CNavLadder *ladder = ladderList->Element( it ).ladder;
+		if ( ladder->m_bottomArea == NULL )
+			continue;
+
+		Neighbor &neighbor = m_neighbors[ m_neighbors.AddToTail() ];
+		neighbor.area = ladder->m_bottomArea;
+		neighbor.how = GO_LADDER_DOWN;
+		neighbor.ladder = ladder;
+		neighbor.elevator = NULL;
+		neighbor.length = -1.0f;
+	}
+
+	const CFuncElevator *elevator = area->GetElevator();
+	if ( elevator )
+	{
+		const NavConnectVector &elevatorAreas = area->GetElevatorAreas();
+		FOR_EACH_VEC( elevatorAreas, it )
+		{
+			Neighbor &neighbor = m_neighbors[ m_neighbors.AddToTail() ];
+			neighbor.area = elevatorAreas[ it ].area;
+			neighbor.how = ( neighbor.area->GetCenter().z > area->GetCenter().z ) ? GO_ELEVATOR_UP : GO_ELEVATOR_DOWN;
+			neighbor.ladder = NULL;
+			neighbor.elevator = elevator;
+			neighbor.length = -1.0f;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Walk the parent links back from 'goalNode' and store the path in start to goal order
+ */
+void CNavPathSearch::BuildResult( int goalNode, bool isSuccess, CNavPathResult *result ) const
+{
+	result->m_isSuccess = isSuccess;
+	result->m_closestArea = m_nodes[ goalNode ].area;
+	result->m_cost = m_nodes[ goalNode ].costSoFar;
+
+	int count = 0;
+	for( int node = goalNode; node >= 0; node = m_nodes[ node ].parent )
+		++count;
+
+	result->m_path.SetCount( count );
+	for( int node = goalNode; node >= 0; node = m_nodes[ node ].parent )
+	{
+		NavPathSegment &segment = result->m_path[ --count ];
+		segment.area = m_nodes[ node ].area;
+		segment.how = m_nodes[ node ].how;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::PushOpen( int node )
+{
+	m_nodes[ node ].state = NODE_OPEN;
+	m_nodes[ node ].heapIndex = m_openHeap.AddToTail( node );
+	SiftUp( m_nodes[ node ].heapIndex );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int CNavPathSearch::PopOpen( void )
+{
+	int node = m_openHeap[0];
+	int last = m_openHeap.Count() - 1;
+
+	m_openHeap[0] = m_openHeap[ last ];
+	m_nodes[ m_openHeap[0] ].heapIndex = 0;
+	m_openHeap.RemoveMultipleFromTail( 1 );
+
+	if ( m_openHeap.Count() )
+	{
+		SiftDown( 0 );
+	}
+
+	// a popped area is neither open nor closed until it has been expanded, as with CNavArea::PopOpenList()
+	m_nodes[ node ].state = NODE_NEW;
+	m_nodes[ node ].heapIndex = -1;
+	return node;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The total cost of an open node went down, move it towards the top of the heap
+ */
+void CNavPathSearch::UpdateOpen( int node )
+{
+	SiftUp( m_nodes[ node ].heapIndex );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::SiftUp( int heapIndex )
+{
+	int node = m_openHeap[ heapIndex ];
+	float cost = m_nodes[ node ].totalCost;
+
+	while( heapIndex > 0 )
+	{
+		int parentIndex = ( heapIndex - 1 ) / 2;
+		int parent = m_openHeap[ parentIndex ];
+		if ( m_nodes[ parent ].totalCost <= cost )
+			break;
+
+		m_openHeap[ heapIndex ] = parent;
+		m_nodes[ parent ].heapIndex = heapIndex;
+		heapIndex = parentIndex;
+	}
+
+	m_openHeap[ heapIndex ] = node;
+	m_nodes[ node ].heapIndex = heapIndex;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathSearch::SiftDown( int heapIndex )
+{
+	int count = m_openHeap.Count();
+	int node = m_openHeap[ heapIndex ];
+	float cost = m_nodes[ node ].totalCost;
+
+	while( true )
+	{
+		int childIndex = heapIndex * 2 + 1;
+		if ( childIndex >= count )
+			break;
+
+		if ( childIndex + 1 < count && m_nodes[ m_openHeap[ childIndex + 1 ] ].totalCost < m_nodes[ m_openHeap[ childIndex ] ].totalCost )
+			++childIndex;
+
+		int child = m_openHeap[ childIndex ];
+		if ( cost <= m_nodes[ child ].totalCost )
+			break;
+
+		m_openHeap[ heapIndex ] = child;
+		m_nodes[ child ].heapIndex = heapIndex;
+		heapIndex = childIndex;
+	}
+
+	m_openHeap[ heapIndex ] = node;
+	m_nodes[ node ].heapIndex = heapIndex;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------
+CNavPathfinder::CNavPathfinder( void )
+{
+	m_cacheGeneration = 0;
+	m_generation = 0;
+	m_cacheHits = 0;
+	m_cacheMisses = 0;
+	m_asyncSearches = 0;
+	m_staleSearches = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathfinder::~CNavPathfinder()
+{
+	// the job pool is gone by the time static destructors run, so only free what is left
+	FOR_EACH_LL( m_requests, it )
+	{
+		delete m_requests[ it ];
+	}
+	m_requests.RemoveAll();
+
+	FOR_EACH_HASHTABLE( m_cache, it )
+	{
+		delete m_cache.Element( it );
+	}
+	m_cache.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Searches only go to worker threads while nothing is changing the mesh under them. nav_edit is checked
+ * directly since IsEditing() only catches up on the next nav mesh update.
+ */
+bool CNavPathfinder::CanRunAsync( void ) const
+{
+	if ( g_pThreadPool == NULL || g_pThreadPool->NumThreads() == 0 )
+		return false;
+
+	return !TheNavMesh->IsGenerating() && !TheNavMesh->IsEditing() && !nav_edit.GetBool();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+NavPathRequestHandle CNavPathfinder::AddRequest( CNavPathRequestBase *request )
+{
+	return m_requests.AddToTail( request );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathfinder::StartRequest( CNavPathRequestBase *request )
+{
+	request->m_generation = m_generation;
+	request->m_isComplete = false;
+
+	if ( CanRunAsync() )
+	{
+		request->m_job = g_pThreadPool->QueueCall( request, &CNavPathRequestBase::Run );
+		++m_asyncSearches;
+	}
+	else
+	{
+		// the result is still handed out on the next tick, so callers see the same behavior either way
+		request->Run();
+	}
+
+	++m_cacheMisses;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathfinder::WaitForRequest( CNavPathRequestBase *request )
+{
+	if ( request->m_job )
+	{
+		request->m_job->WaitForFinish();
+		request->m_job->Release();
+		request->m_job = NULL;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavPathfinder::IsRequestComplete( NavPathRequestHandle handle ) const
+{
+	if ( !m_requests.IsValidIndex( handle ) )
+		return false;
+
+	return m_requests[ handle ]->m_isComplete;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+const CNavPathResult *CNavPathfinder::GetRequestResult( NavPathRequestHandle handle ) const
+{
+	if ( !IsRequestComplete( handle ) )
+		return NULL;
+
+	return &m_requests[ handle ]->m_result;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathfinder::ReleaseRequest( NavPathRequestHandle handle )
+{
+	if ( !m_requests.IsValidIndex( handle ) )
+		return;
+
+	CNavPathRequestBase *request = m_requests[ handle ];
+	WaitForRequest( request );
+	delete request;
+	m_requests.Remove( handle );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+int CNavPathfinder::GetPendingRequestCount( void ) const
+{
+	int count = 0;
+	FOR_EACH_LL( m_requests, it )
+	{
+		if ( !m_requests[ it ]->m_isComplete )
+			++count;
+	}
+	return count;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Hand out the searches that finished since the last tick. A search that started before the mesh last
+ * changed may have walked through a newly blocked area, so it is run again instead.
+ */
+void CNavPathfinder::Update( void )
+{
+	VPROF_BUDGET( "CNavPathfinder::Update", "NextBot" );
+
+	FOR_EACH_LL( m_requests, it )
+	{
+		CNavPathRequestBase *request = m_requests[ it ];
+		if ( request->m_isComplete )
+			continue;
+
+		if ( request->m_job )
+		{
+			if ( !request->m_job->IsFinished() )
+				continue;
+
+			request->m_job->Release();
+			request->m_job = NULL;
+		}
+
+		if ( request->m_generation != m_generation )
+		{
+			++m_staleSearches;
+			StartRequest( request );
+			continue;
+		}
+
+		request->m_isComplete = true;
+
+		if ( request->m_key.costID && request->m_key.startArea && request->m_key.goalArea )
+		{
+			AddCachedPath( request->m_key, request->m_result );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Blocking or unblocking an area can change any path, so forget them all. The cache itself is emptied
+ * the next time it is used, since this can be called many times per tick.
+ */
+void CNavPathfinder::Invalidate( void )
+{
+	++m_generation;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Searches on the job pool walk area connections without any locking, so the mesh must not be split, merged
+ * or reconnected while one is running. The searches are left for Update() to hand out as usual.
+ */
+void CNavPathfinder::WaitForAllRequests( void )
+{
+	FOR_EACH_LL( m_requests, it )
+	{
+		WaitForRequest( m_requests[ it ] );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The requests themselves are kept, since their owners still hold the handles. They complete as failed and
+ * forget their areas, which are about to be deleted.
+ */
+void CNavPathfinder::Reset( void )
+{
+	FOR_EACH_LL( m_requests, it )
+	{
+		CNavPathRequestBase *request = m_requests[ it ];
+		WaitForRequest( request );
+
+		request->m_key.startArea = NULL;
+		request->m_key.goalArea = NULL;
+		request->m_result.Reset();
+		request->m_isComplete = true;
+	}
+
+	FOR_EACH_HASHTABLE( m_cache, it )
+	{
+		delete m_cache.Element( it );
+	}
+	m_cache.RemoveAll();
+
+	m_result.Reset();
+	++m_generation;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+const CNavPathResult *CNavPathfinder::FindCachedPath( const NavPathCacheKey &key )
+{
+	if ( m_cacheGeneration != m_generation )
+	{
+		FOR_EACH_HASHTABLE( m_cache, it )
+		{
+			delete m_cache.Element( it );
+		}
+		m_cache.RemoveAll();
+		m_cacheGeneration = m_generation;
+	}
+
+	UtlHashHandle_t h = m_cache.Find( key );
+	if ( h == m_cache.InvalidHandle() )
+		return NULL;
+
+	++m_cacheHits;
+	return m_cache.Element( h );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathfinder::AddCachedPath( const NavPathCacheKey &key, const CNavPathResult &result )
+{
+	if ( m_cacheGeneration != m_generation )
+	{
+		// the cache was emptied by FindCachedPath() for this generation, or this result is from an older one
+		return;
+	}
+
+	UtlHashHandle_t h = m_cache.Find( key );
+	if ( h != m_cache.InvalidHandle() )
+	{
+		m_cache.Element( h )->CopyFrom( result );
+		return;
+	}
+
+	if ( m_cache.Count() >= MAX_CACHED_PATHS )
+	{
+		// full - start over rather than track ages, the cache refills within a few ticks
+		FOR_EACH_HASHTABLE( m_cache, it )
+		{
+			delete m_cache.Element( it );
+		}
+		m_cache.RemoveAll();
+	}
+
+	CNavPathResult *cached = new CNavPathResult;
+	cached->CopyFrom( result );
+	m_cache.Insert( key, cached );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathfinder::PrintStats( void ) const
+{
+	Msg( "Nav pathfinder: %d cached paths, %d hits, %d misses, %d searches on the job pool, %d stale searches rerun, %d requests pending\n",
+		m_cache.Count(), m_cacheHits, m_cacheMisses, m_asyncSearches, m_staleSearches, GetPendingRequestCount() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_pathfind_stats, "Print nav path cache and async search counts", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavPathfinder.PrintStats();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Compare NavAreaBuildPath(), CNavPathSearch, cached lookups and the job pool on random area pairs
+ */
+CON_COMMAND_F( nav_benchmark_pathfind, "Times path searches between random areas: NavAreaBuildPath, re-entrant search, cached, and on the job pool. Arguments: [paths]", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( TheNavAreas.Count() < 2 )
+	{
+		Msg( "No nav mesh loaded.\n" );
+		return;
+	}
+
+	int count = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 256;
+
+	CUtlVector< CNavArea * > starts, goals;
+	starts.SetCount( count );
+	goals.SetCount( count );
+	for( int i=0; i<count; ++i )
+	{
+		starts[i] = TheNavAreas[ RandomInt( 0, TheNavAreas.Count()-1 ) ];
+		goals[i] = TheNavAreas[ RandomInt( 0, TheNavAreas.Count()-1 ) ];
+	}
+
+	ShortestPathCost cost;
+	CUtlVector< bool > found;
+	found.SetCount( count );
+
+	CFastTimer timer;
+	timer.Start();
+	for( int i=0; i<count; ++i )
+	{
+		found[i] = NavAreaBuildPath( starts[i], goals[i], NULL, cost );
+	}
+	timer.End();
+	float legacyMs = timer.GetDuration().GetMillisecondsF();
+
+	CNavPathSearch search;
+	CNavPathResult result;
+	int mismatches = 0;
+	timer.Start();
+	for( int i=0; i<count; ++i )
+	{
+		if ( search.Run( starts[i], goals[i], NULL, cost, &result ) != found[i] )
+			++mismatches;
+	}
+	timer.End();
+	float searchMs = timer.GetDuration().GetMillisecondsF();
+
+	// fill the cache, then time lookups that all hit it
+	const unsigned int benchmarkCostID = 0xBE7C;
+	TheNavPathfinder.Invalidate();
+	for( int i=0; i<count; ++i )
+	{
+		TheNavPathfinder.FindPath( starts[i], goals[i], cost, benchmarkCostID );
+	}
+	timer.Start();
+	for( int i=0; i<count; ++i )
+	{
+		if ( TheNavPathfinder.FindPath( starts[i], goals[i], cost, benchmarkCostID ).IsSuccess() != found[i] )
+			++mismatches;
+	}
+	timer.End();
+	float cachedMs = timer.GetDuration().GetMillisecondsF();
+
+	// uncached requests on the job pool, waited on here instead of on the next tick
+	TheNavPathfinder.Invalidate();
+	CUtlVector< NavPathRequestHandle > handles;
+	handles.SetCount( count );
+	timer.Start();
+	for( int i=0; i<count; ++i )
+	{
+		handles[i] = TheNavPathfinder.RequestPath( starts[i], goals[i], cost, 0 );
+	}
+	while( TheNavPathfinder.GetPendingRequestCount() )
+	{
+		TheNavPathfinder.Update();
+		ThreadPause();
+	}
+	timer.End();
+	float asyncMs = timer.GetDuration().GetMillisecondsF();
+
+	for( int i=0; i<count; ++i )
+	{
+		const CNavPathResult *asyncResult = TheNavPathfinder.GetRequestResult( handles[i] );
+		if ( asyncResult == NULL || asyncResult->IsSuccess() != found[i] )
+			++mismatches;
+		TheNavPathfinder.ReleaseRequest( handles[i] );
+	}
+
+	Msg( "%d paths over %d areas (%d worker threads):\n", count, TheNavAreas.Count(), g_pThreadPool ? g_pThreadPool->NumThreads() : 0 );
+	Msg( "  NavAreaBuildPath:   %8.3f ms\n", legacyMs );
+	Msg( "  CNavPathSearch:     %8.3f ms\n", searchMs );
+	Msg( "  cached FindPath:    %8.3f ms\n", cachedMs );
+	Msg( "  job pool requests:  %8.3f ms\n", asyncMs );
+	if ( mismatches )
+	{
+		Warning( "  %d results disagree with NavAreaBuildPath!\n", mismatches );
+	}
+}
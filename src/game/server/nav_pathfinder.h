@@ -0,0 +1,468 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Re-entrant, cached and asynchronous path searches over the Navigation Mesh
+//
+//=============================================================================//
+// nav_pathfinder.h
+//
+// NavAreaBuildPath() keeps its open and closed lists and its costs inside the areas themselves, so only one
+// search can run at a time and its result is only valid until the next one. CNavPathSearch does the same A*
+// search with the bookkeeping in tables owned by the search, so any number of them can run at once, and the
+// path is returned as a list of areas.
+//
+// CNavPathfinder sits on top of that: it caches finished paths by (start area, goal area, cost functor id,
+// team), drops the cache whenever an area is blocked or unblocked, and can run searches on the job pool and
+// hand the results back on the next tick.
+//
+// Cost functors used here take the cost so far of 'fromArea' as an extra argument (see ShortestPathCost),
+// and the ones given to asynchronous requests must be safe to call from a worker thread.
+
+#ifndef _NAV_PATHFINDER_H_
+#define _NAV_PATHFINDER_H_
+
+#include "nav_pathfind.h"
+#include "tier1/utlhashtable.h"
+#include "tier1/utllinkedlist.h"
+#include "vstdlib/jobthread.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * One step of a path: the area, and how it was entered from the previous one
+ */
+struct NavPathSegment
+{
+	CNavArea *area;
+	NavTraverseType how;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The outcome of a path search
+ */
+class CNavPathResult
+{
+public:
+	CNavPathResult( void )	{ Reset(); }
+
+	void Reset( void )
+	{
+		m_isSuccess = false;
+		m_cost = 0.0f;
+		m_closestArea = NULL;
+		m_path.RemoveAll();
+	}
+
+	void CopyFrom( const CNavPathResult &other )
+	{
+		m_isSuccess = other.m_isSuccess;
+		m_cost = other.m_cost;
+		m_closestArea = other.m_closestArea;
+		m_path.CopyArray( other.m_path.Base(), other.m_path.Count() );
+	}
+
+	bool IsSuccess( void ) const				{ return m_isSuccess; }		// true if the goal was reached
+	float GetCost( void ) const					{ return m_cost; }			// cost so far at the last area of the path
+	CNavArea *GetClosestArea( void ) const		{ return m_closestArea; }	// the goal on success, otherwise the reachable area closest to it
+
+	// The path from the start area to the goal, or to the closest area if the search failed. The first segment is the start area.
+	int GetSegmentCount( void ) const						{ return m_path.Count(); }
+	const NavPathSegment &GetSegment( int i ) const			{ return m_path[i]; }
+
+private:
+	friend class CNavPathSearch;
+
+	bool m_isSuccess;
+	float m_cost;
+	CNavArea *m_closestArea;
+	CUtlVector< NavPathSegment > m_path;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A* search over the mesh with its own open and closed lists, so it can run alongside other searches.
+ * Reusing one instance for many searches keeps its tables allocated.
+ */
+class CNavPathSearch
+{
+public:
+	/**
+	 * Same search as NavAreaBuildPath(), see there for the meaning of the arguments.
+	 * Returns true if a path exists. The path, or the path to the closest area if there is none, goes to 'result'.
+	 */
+	template< typename CostFunctor >
+	bool Run( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavPathResult *result, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false );
+
+private:
+	enum NodeState { NODE_NEW, NODE_OPEN, NODE_CLOSED };
+
+	struct Node
+	{
+		CNavArea *area;
+		int parent;
+		NavTraverseType how;
+		NodeState state;
+		int heapIndex;
+		float costSoFar;
+		float totalCost;
+		float pathLengthSoFar;
+	};
+
+	struct Neighbor
+	{
+		CNavArea *area;
+		NavTraverseType how;
+		const CNavLadder *ladder;
+		const CFuncElevator *elevator;
+		float length;
+	};
+
+	void Clear( void );
+	int FindOrAddNode( CNavArea *area );
+	void GatherNeighbors( const CNavArea *area );
+	void BuildResult( int goalNode, bool isSuccess, CNavPathResult *result ) const;
+
+	// binary heap of open nodes ordered by total cost
+	void PushOpen( int node );
+	int PopOpen( void );
+	void UpdateOpen( int node );
+	void SiftUp( int heapIndex );
+	void SiftDown( int heapIndex );
+
+	CUtlVector< Node > m_nodes;
+	CUtlHashtable< const CNavArea *, int, PointerHashFunctor, PointerEqualFunctor > m_nodeIndex;
+	CUtlVector< int > m_openHeap;
+	CUtlVector< Neighbor > m_neighbors;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+template< typename CostFunctor >
+bool CNavPathSearch::Run( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavPathResult *result, float maxPathLength, int teamID, bool ignoreNavBlockers )
+{
+	VPROF_BUDGET( "CNavPathSearch::Run", "NextBotSpiky" );
+
+	result->Reset();
+	result->m_closestArea = startArea;
+
+	if ( startArea == NULL )
+		return false;
+
+	if ( goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ) )
+		goalArea = NULL;
+
+	if ( goalArea == NULL && goalPos == NULL )
+		return false;
+
+	Clear();
+
+	// if we are already in the goal area, build trivial path
+	if ( startArea == goalArea )
+	{
+		int start = FindOrAddNode( startArea );
+		BuildResult( start, true, result );
+		return true;
+	}
+
+	// determine actual goal position
+	Vector actualGoalPos = ( goalPos ) ? *goalPos : goalArea->GetCenter();
+
+	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f, 0.0f );
+	if ( initCost < 0.0f )
+		return false;
+
+	int start = FindOrAddNode( startArea );
+	m_nodes[ start ].costSoFar = initCost;
+	m_nodes[ start ].totalCost = ( startArea->GetCenter() - actualGoalPos ).Length();
+	m_nodes[ start ].pathLengthSoFar = 0.0f;
+	PushOpen( start );
+
+	// keep track of the area we visit that is closest to the goal
+	int closest = start;
+	float closestAreaDist = m_nodes[ start ].totalCost;
+	bool bHaveMaxPathLength = ( maxPathLength > 0.0f );
+
+	while( m_openHeap.Count() )
+	{
+		int current = PopOpen();
+		CNavArea *area = m_nodes[ current ].area;
+
+		// don't consider blocked areas
+		if ( area->IsBlocked( teamID, ignoreNavBlockers ) )
+			continue;
+
+		// check if we have found the goal area or position
+		if ( area == goalArea || ( goalArea == NULL && goalPos && area->Contains( *goalPos ) ) )
+		{
+			BuildResult( current, true, result );
+			return true;
+		}
+
+		const int parent = m_nodes[ current ].parent;
+		const CNavArea *parentArea = ( parent >= 0 ) ? m_nodes[ parent ].area : NULL;
+		const float costSoFar = m_nodes[ current ].costSoFar;
+		const float pathLengthSoFar = m_nodes[ current ].pathLengthSoFar;
+
+		GatherNeighbors( area );
+		FOR_EACH_VEC( m_neighbors, it )
+		{
+			const Neighbor &neighbor = m_neighbors[ it ];
+			CNavArea *newArea = neighbor.area;
+
+			// don't backtrack
+			if ( newArea == parentArea || newArea == area )
+				continue;
+
+			// don't consider blocked areas
+			if ( newArea->IsBlocked( teamID, ignoreNavBlockers ) )
+				continue;
+
+			float newCostSoFar = costFunc( newArea, area, neighbor.ladder, neighbor.elevator, neighbor.length, costSoFar );
+			if ( IS_NAN( newCostSoFar ) )
+				newCostSoFar = 1e30f;
+
+			// check if cost functor says this area is a dead-end
+			if ( newCostSoFar < 0.0f )
+				continue;
+
+			// every step costs something, as in NavAreaBuildPath()
+			newCostSoFar = Max( newCostSoFar, costSoFar * 1.00001f + 0.00001f );
+
+			// stop if path length limit reached
+			float newLengthSoFar = 0.0f;
+			if ( bHaveMaxPathLength )
+			{
+				newLengthSoFar = pathLengthSoFar + ( newArea->GetCenter() - area->GetCenter() ).Length();
+				if ( newLengthSoFar > maxPathLength )
+					continue;
+			}
+
+			int node = FindOrAddNode( newArea );
+			Node &newNode = m_nodes[ node ];
+			if ( newNode.state != NODE_NEW && newNode.costSoFar <= newCostSoFar )
+			{
+				// this is a worse path - skip it
+				continue;
+			}
+
+			// compute estimate of distance left to go
+			float distSq = ( newArea->GetCenter() - actualGoalPos ).LengthSqr();
+			float newCostRemaining = ( distSq > 0.0 ) ? FastSqrt( distSq ) : 0.0;
+
+			// track closest area to goal in case path fails
+			if ( newCostRemaining < closestAreaDist )
+			{
+				closest = node;
+				closestAreaDist = newCostRemaining;
+			}
+
+			newNode.parent = current;
+			newNode.how = neighbor.how;
+			newNode.costSoFar = newCostSoFar;
+			newNode.totalCost = newCostSoFar + newCostRemaining;
+			newNode.pathLengthSoFar = newLengthSoFar;
+
+			if ( newNode.state == NODE_OPEN )
+			{
+				// area already on open list, update the heap to keep costs sorted
+				UpdateOpen( node );
+			}
+			else
+			{
+				PushOpen( node );
+			}
+		}
+
+		// we have searched this area
+		m_nodes[ current ].state = NODE_CLOSED;
+	}
+
+	BuildResult( closest, false, result );
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+typedef int NavPathRequestHandle;
+#define NAV_PATH_REQUEST_INVALID -1
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Identifies a cached path
+ */
+struct NavPathCacheKey
+{
+	CNavArea *startArea;
+	CNavArea *goalArea;
+	unsigned int costID;
+	int teamID;
+	bool ignoreNavBlockers;
+
+	bool operator==( const NavPathCacheKey &other ) const
+	{
+		return startArea == other.startArea && goalArea == other.goalArea && costID == other.costID && teamID == other.teamID && ignoreNavBlockers == other.ignoreNavBlockers;
+	}
+};
+
+struct NavPathCacheKeyHash
+{
+	unsigned int operator()( const NavPathCacheKey &key ) const
+	{
+		unsigned int hash = PointerHashFunctor()( key.startArea );
+		hash = hash * 31 + PointerHashFunctor()( key.goalArea );
+		hash = hash * 31 + Mix32HashFunctor()( key.costID * 2 + ( key.ignoreNavBlockers ? 1 : 0 ) );
+		return hash * 31 + Mix32HashFunctor()( key.teamID );
+	}
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A queued asynchronous search. The templated subclass holds a copy of the cost functor.
+ */
+class CNavPathRequestBase
+{
+public:
+	CNavPathRequestBase( void ) : m_job( NULL ), m_generation( 0 ), m_isComplete( false ) { }
+	virtual ~CNavPathRequestBase() { }
+
+	virtual void Run( void ) = 0;		// invoked on a worker thread, or on the main thread when there is no job pool
+
+	NavPathCacheKey m_key;
+	CNavPathResult m_result;
+	CJob *m_job;
+	int m_generation;					// CNavPathfinder generation the search was started in
+	bool m_isComplete;
+};
+
+template< typename CostFunctor >
+class CNavPathRequest : public CNavPathRequestBase
+{
+public:
+	CNavPathRequest( const CostFunctor &costFunc ) : m_costFunc( costFunc ) { }
+
+	virtual void Run( void )
+	{
+		CNavPathSearch search;
+		search.Run( m_key.startArea, m_key.goalArea, NULL, m_costFunc, &m_result, 0.0f, m_key.teamID, m_key.ignoreNavBlockers );
+	}
+
+private:
+	CostFunctor m_costFunc;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Cached and asynchronous path searches between areas
+ */
+class CNavPathfinder
+{
+public:
+	CNavPathfinder( void );
+	~CNavPathfinder();
+
+	/**
+	 * Search for a path right away. 'costID' must differ for every cost functor type and setting that can
+	 * change the path; 0 bypasses the cache. The result is valid until the next call.
+	 */
+	template< typename CostFunctor >
+	const CNavPathResult &FindPath( CNavArea *startArea, CNavArea *goalArea, CostFunctor &costFunc, unsigned int costID, int teamID = TEAM_ANY, bool ignoreNavBlockers = false );
+
+	/**
+	 * Queue a search on the job pool. Cached paths complete at once, the others are collected by Update() on a
+	 * later tick. The handle must be given back with ReleaseRequest(), and stays valid until then even if the
+	 * mesh is reset, in which case the request completes with a failed result.
+	 */
+	template< typename CostFunctor >
+	NavPathRequestHandle RequestPath( CNavArea *startArea, CNavArea *goalArea, const CostFunctor &costFunc, unsigned int costID, int teamID = TEAM_ANY, bool ignoreNavBlockers = false );
+
+	bool IsRequestComplete( NavPathRequestHandle handle ) const;
+	const CNavPathResult *GetRequestResult( NavPathRequestHandle handle ) const;	// NULL until the request is complete
+	void ReleaseRequest( NavPathRequestHandle handle );
+
+	void Update( void );				// collect finished searches, invoked once per tick by the nav mesh
+	void Invalidate( void );			// the paths through the mesh may have changed, drop the cache
+	void WaitForAllRequests( void );	// block until no search is running on the job pool, invoked before the mesh is edited
+	void Reset( void );					// the mesh is going away, wait for every search, fail the pending requests and drop the cache
+
+	int GetPendingRequestCount( void ) const;
+	void PrintStats( void ) const;
+
+private:
+	enum { MAX_CACHED_PATHS = 1024 };
+
+	bool CanRunAsync( void ) const;
+	void WaitForRequest( CNavPathRequestBase *request );
+	NavPathRequestHandle AddRequest( CNavPathRequestBase *request );
+	void StartRequest( CNavPathRequestBase *request );
+
+	const CNavPathResult *FindCachedPath( const NavPathCacheKey &key );
+	void AddCachedPath( const NavPathCacheKey &key, const CNavPathResult &result );
+
+	CNavPathSearch m_search;			// used by FindPath() on the main thread
+	CNavPathResult m_result;
+
+	CUtlLinkedList< CNavPathRequestBase *, int > m_requests;
+
+	CUtlHashtable< NavPathCacheKey, CNavPathResult *, NavPathCacheKeyHash > m_cache;
+	int m_cacheGeneration;				// generation the cached paths belong to
+	int m_generation;					// bumped whenever the cached paths may be wrong
+
+	int m_cacheHits;
+	int m_cacheMisses;
+	int m_asyncSearches;
+	int m_staleSearches;
+};
+
+extern CNavPathfinder TheNavPathfinder;
+
+
+//--------------------------------------------------------------------------------------------------------------
+template< typename CostFunctor >
+const CNavPathResult &CNavPathfinder::FindPath( CNavArea *startArea, CNavArea *goalArea, CostFunctor &costFunc, unsigned int costID, int teamID, bool ignoreNavBlockers )
+{
+	NavPathCacheKey key = { startArea, goalArea, costID, teamID, ignoreNavBlockers };
+	const CNavPathResult *cached = ( costID && startArea && goalArea ) ? FindCachedPath( key ) : NULL;
+	if ( cached )
+	{
+		m_result.CopyFrom( *cached );
+		return m_result;
+	}
+
+	m_search.Run( startArea, goalArea, NULL, costFunc, &m_result, 0.0f, teamID, ignoreNavBlockers );
+
+	if ( costID && startArea && goalArea )
+	{
+		AddCachedPath( key, m_result );
+	}
+
+	return m_result;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+template< typename CostFunctor >
+NavPathRequestHandle CNavPathfinder::RequestPath( CNavArea *startArea, CNavArea *goalArea, const CostFunctor &costFunc, unsigned int costID, int teamID, bool ignoreNavBlockers )
+{
+	CNavPathRequest< CostFunctor > *request = new CNavPathRequest< CostFunctor >( costFunc );
+	NavPathCacheKey key = { startArea, goalArea, costID, teamID, ignoreNavBlockers };
+	request->m_key = key;
+
+	const CNavPathResult *cached = ( costID && startArea && goalArea ) ? FindCachedPath( key ) : NULL;
+	if ( cached )
+	{
+		request->m_result.CopyFrom( *cached );
+		request->m_isComplete = true;
+		return AddRequest( request );
+	}
+
+	NavPathRequestHandle handle = AddRequest( request );
+	StartRequest( request );
+	return handle;
+}
+
+#endif // _NAV_PATHFINDER_H_
@@ -44,6 +44,7 @@
 #include "vphysics/performance.h"
 #include "positionwatcher.h"
 #include "tier1/callqueue.h"
+#include "serverbenchmark_base.h"
 #include "vphysics/constraints.h"
 
 #ifdef PORTAL
@@ -1676,6 +1677,8 @@ void PhysFrame( float deltaTime )
 	if ( !g_PhysicsHook.ShouldSimulate() )
 		return;
 
+	SERVER_BENCHMARK_SECTION( BENCHMARK_SECTION_PHYSICS );
+
 	// Trap interrupts and clock changes
 	if ( deltaTime > 1.0f || deltaTime < 0.0f )
 	{
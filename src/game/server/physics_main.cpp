@@ -16,8 +16,12 @@
 #include "mempool.h"
 #include "movevars_shared.h"
 #include "player.h"
+#include "player_command.h"
 #include "pushentity.h"
+#include "tier0/fasttimer.h"
 #include "tier0/vprof.h"
+#include "tier1/fmtstr.h"
+#include "tier1/utldict.h"
 #include "trains.h"
 #include "vphysics_interface.h"
 #include "vphysicsupdateai.h"
@@ -784,6 +788,85 @@ CBaseEntity* CPhysicsPushedEntities::PerformLinearPush( CBaseEntity* pRoot, floa
 //
 //-----------------------------------------------------------------------------
 
+//-----------------------------------------------------------------------------
+// Think time histogram, per classname
+//-----------------------------------------------------------------------------
+ConVar think_histogram( "think_histogram", "0", 0, "Record how long entity thinks take per classname, see think_histogram_print" );
+
+#define THINK_HISTOGRAM_BUCKETS 12		// under 8us, then doubling up to 8ms and over
+
+struct ThinkHistogram_t {
+	const char* pszClassname;		// owned by s_ThinkHistograms
+	int nThinks;
+	double flTotalMs;
+	float flMaxMs;
+	int nBuckets[ THINK_HISTOGRAM_BUCKETS ];
+};
+
+// Keyed by a copy of the classname, the pooled strings entities point at are freed on level shutdown
+static CUtlDict<ThinkHistogram_t, int> s_ThinkHistograms( k_eDictCompareTypeCaseSensitive );
+
+static void RecordThinkTime( const char* pszClassname, float flMs ) {
+	int h = s_ThinkHistograms.Find( pszClassname );
+	if ( h == s_ThinkHistograms.InvalidIndex() ) {
+		ThinkHistogram_t empty;
+		V_memset( &empty, 0, sizeof( empty ) );
+		h = s_ThinkHistograms.Insert( pszClassname, empty );
+		s_ThinkHistograms[ h ].pszClassname = s_ThinkHistograms.GetElementName( h );
+	}
+
+	ThinkHistogram_t& histogram = s_ThinkHistograms.Element( h );
+	histogram.nThinks++;
+	histogram.flTotalMs += flMs;
+	histogram.flMaxMs = MAX( histogram.flMaxMs, flMs );
+
+	int bucket = 0;
+	for ( float flEdge = 0.008f; bucket < THINK_HISTOGRAM_BUCKETS - 1 && flMs >= flEdge; flEdge *= 2.0f ) {
+		bucket++;
+	}
+	histogram.nBuckets[ bucket ]++;
+}
+
+static int __cdecl ThinkHistogramCompare( ThinkHistogram_t* const* lhs, ThinkHistogram_t* const* rhs ) {
+	if ( ( *lhs )->flTotalMs == ( *rhs )->flTotalMs )
+		return 0;
+	return ( ( *lhs )->flTotalMs < ( *rhs )->flTotalMs ) ? 1 : -1;
+}
+
+CON_COMMAND( think_histogram_print, "Prints the think times recorded with think_histogram, most expensive classnames first. Usage: think_histogram_print [classnames]" ) {
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nMax = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[ 1 ] ) ) : 20;
+
+	CUtlVector<ThinkHistogram_t*> sorted;
+	FOR_EACH_DICT( s_ThinkHistograms, it ) {
+		sorted.AddToTail( &s_ThinkHistograms[ it ] );
+	}
+	sorted.Sort( ThinkHistogramCompare );
+
+	Msg( "%-32s %8s %10s %8s %8s  counts: <8us <16 <32 <64 <128 <256 <512 <1ms <2 <4 <8 >=8ms\n", "classname", "thinks", "total ms", "avg us", "max ms" );
+	for ( int i = 0; i < sorted.Count() && i < nMax; i++ ) {
+		const ThinkHistogram_t* pHistogram = sorted[ i ];
+
+		char szBuckets[ 256 ];
+		szBuckets[ 0 ] = 0;
+		for ( int j = 0; j < THINK_HISTOGRAM_BUCKETS; j++ ) {
+			V_strncat( szBuckets, CFmtStr( " %d", pHistogram->nBuckets[ j ] ), sizeof( szBuckets ) );
+		}
+
+		Msg( "%-32s %8d %10.3f %8.2f %8.3f %s\n", pHistogram->pszClassname, pHistogram->nThinks, pHistogram->flTotalMs,
+			 1000.0 * pHistogram->flTotalMs / pHistogram->nThinks, pHistogram->flMaxMs, szBuckets );
+	}
+}
+
+CON_COMMAND( think_histogram_reset, "Discards the think times recorded with think_histogram" ) {
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	s_ThinkHistograms.Purge();
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Called when it's time for a physically moved objects (plats, doors, etc.)
 //			to run its game code.
@@ -808,11 +891,22 @@ void CBaseEntity::PhysicsDispatchThink( BASEPTR thinkFunc ) {
 		startTime = engine->Time();
 	}
 
+	bool bRecordTime = think_histogram.GetBool();
+	CFastTimer timer;
+	if ( bRecordTime ) {
+		timer.Start();
+	}
+
 	if ( thinkFunc ) {
 		MDLCACHE_CRITICAL_SECTION();
 		( this->*thinkFunc )();
 	}
 
+	if ( bRecordTime ) {
+		timer.End();
+		RecordThinkTime( GetClassname(), timer.GetDuration().GetMillisecondsF() );
+	}
+
 	if ( thinkLimit ) {
 		// calculate running time of the AI in milliseconds
 		float time = ( engine->Time() - startTime ) * 1000.0f;
@@ -1772,6 +1866,14 @@ void Physics_RunThinkFunctions( bool simulating ) {
 		}
 	} else {
 		UTIL_DisableRemoveImmediate();
+
+		// Players run their usercmds together, so their movement can use the job pool;
+		// Physics_SimulateEntity() then skips them as already simulated this tick
+		if ( sv_parallel_player_movement.GetBool() ) {
+			gpGlobals->curtime = starttime;
+			PlayerMove()->RunParallelPlayerCommands();
+		}
+
 		int listMax = SimThink_ListCount();
 		listMax = MAX( listMax, 1 );
 		auto** list = static_cast<CBaseEntity**>( stackalloc( sizeof( CBaseEntity* ) * listMax ) );
@@ -69,6 +69,9 @@
 #include "dt_utlvector_send.h"
 #include "vote_controller.h"
 #include "ai_speech.h"
+#include "serverbenchmark_base.h"
+#include "movehelper_server.h"
+#include "tier1/callqueue.h"
 
 #if defined USES_ECON_ITEMS
 #include "econ_wearable.h"
@@ -661,6 +664,8 @@ void CBasePlayer::UpdateOnRemove( void )
 		GetTeam()->RemovePlayer( this );
 	}
 
+	RecipientFilter_FlushMulticastCache();
+
 	// Chain at end to mimic destructor unwind order
 	BaseClass::UpdateOnRemove();
 }
@@ -3185,12 +3190,11 @@ void CBasePlayer::RunNullCommand( void )
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Note, don't chain to BaseClass::PhysicsSimulate
+// Purpose: Gathers the usercmds to run this frame. Returns false if the player
+//			doesn't run any this frame.
 //-----------------------------------------------------------------------------
-void CBasePlayer::PhysicsSimulate( void )
+bool CBasePlayer::BeginPhysicsSimulate( PlayerSimulation_t &sim )
 {
-	VPROF_BUDGET( "CBasePlayer::PhysicsSimulate", VPROF_BUDGETGROUP_PLAYER );
-
 	// If we've got a moveparent, we must simulate that first.
 	CBaseEntity *pMoveParent = GetMoveParent();
 	if (pMoveParent)
@@ -3201,7 +3205,7 @@ void CBasePlayer::PhysicsSimulate( void )
 	// Make sure not to simulate this guy twice per frame
 	if ( m_nSimulationTick == gpGlobals->tickcount )
 	{
-		return;
+		return false;
 	}
 	
 	m_nSimulationTick = gpGlobals->tickcount;
@@ -3222,18 +3226,19 @@ void CBasePlayer::PhysicsSimulate( void )
 		Assert ( GetCommandContextCount() == 0 );
 		RunNullCommand();
 		RemoveAllCommandContexts();
-		return;
+		return false;
 	}
 
 	// Store off true server timestamps
-	float savetime		= gpGlobals->curtime;
-	float saveframetime = gpGlobals->frametime;
+	sim.m_flSaveTime		= gpGlobals->curtime;
+	sim.m_flSaveFrameTime	= gpGlobals->frametime;
 
 	int command_context_count = GetCommandContextCount();
 	
 
 	// Build a list of all available commands
-	CUtlVector< CUserCmd >	vecAvailCommands;
+	CUtlVector< CUserCmd >	&vecAvailCommands = sim.m_Commands;
+	vecAvailCommands.RemoveAll();
 
 	// Contexts go from oldest to newest
 	for ( int context_number = 0; context_number < command_context_count; context_number++ )
@@ -3310,7 +3315,7 @@ void CBasePlayer::PhysicsSimulate( void )
 		RemoveAllCommandContexts();
 	}
 
-	float vphysicsArrivalTime = TICK_INTERVAL;
+	sim.m_flVPhysicsArrivalTime = TICK_INTERVAL;
 
 #if IsDebug()
 	if ( sv_player_net_suppress_usercommands.GetBool() )
@@ -3335,38 +3340,59 @@ void CBasePlayer::PhysicsSimulate( void )
 		m_flMovementTimeForUserCmdProcessingRemaining = FLT_MAX;
 	}
 
-	// Now run the commands
+	sim.m_nCommandsToRun = commandsToRun;
 	if ( commandsToRun > 0 )
 	{
-		m_flLastUserCommandTime = savetime;
+		m_flLastUserCommandTime = sim.m_flSaveTime;
+	}
 
-		MoveHelperServer()->SetHost( this );
+	return true;
+}
 
-		// Suppress predicted events, etc.
-		if ( IsPredictingWeapons() )
-		{
-			IPredictionSystem::SuppressHostEvents( this );
-		}
+//-----------------------------------------------------------------------------
+// Purpose: Makes this player the host of the commands run next
+//-----------------------------------------------------------------------------
+void CBasePlayer::StartCommandHost( void )
+{
+	MoveHelperServer()->SetHost( this );
 
-		for ( int i = 0; i < commandsToRun; ++i )
-		{
-			PlayerRunCommand( &vecAvailCommands[ i ], MoveHelperServer() );
+	// Suppress predicted events, etc.
+	if ( IsPredictingWeapons() )
+	{
+		IPredictionSystem::SuppressHostEvents( this );
+	}
+}
 
-			// Update our vphysics object.
-			if ( m_pPhysicsController )
-			{
-				VPROF( "CBasePlayer::PhysicsSimulate-UpdateVPhysicsPosition" );
-				// If simulating at 2 * TICK_INTERVAL, add an extra TICK_INTERVAL to position arrival computation
-				UpdateVPhysicsPosition( m_vNewVPhysicsPosition, m_vNewVPhysicsVelocity, vphysicsArrivalTime );
-				vphysicsArrivalTime += TICK_INTERVAL;
-			}
-		}
+void CBasePlayer::StopCommandHost( void )
+{
+	// Always reset after running commands
+	IPredictionSystem::SuppressHostEvents( NULL );
 
-		// Always reset after running commands
-		IPredictionSystem::SuppressHostEvents( NULL );
+	MoveHelperServer()->SetHost( NULL );
+}
 
-		MoveHelperServer()->SetHost( NULL );
+//-----------------------------------------------------------------------------
+// Purpose: Called after each usercmd has run
+//-----------------------------------------------------------------------------
+void CBasePlayer::FinishSimulatedCommand( PlayerSimulation_t &sim )
+{
+	// Update our vphysics object.
+	if ( m_pPhysicsController )
+	{
+		VPROF( "CBasePlayer::PhysicsSimulate-UpdateVPhysicsPosition" );
+		// If simulating at 2 * TICK_INTERVAL, add an extra TICK_INTERVAL to position arrival computation
+		UpdateVPhysicsPosition( m_vNewVPhysicsPosition, m_vNewVPhysicsVelocity, sim.m_flVPhysicsArrivalTime );
+		sim.m_flVPhysicsArrivalTime += TICK_INTERVAL;
+	}
+}
 
+//-----------------------------------------------------------------------------
+// Purpose: Records the simulation and restores the true server clock
+//-----------------------------------------------------------------------------
+void CBasePlayer::EndPhysicsSimulate( PlayerSimulation_t &sim )
+{
+	if ( sim.m_nCommandsToRun > 0 )
+	{
 		// Copy in final origin from simulation
 		CPlayerSimInfo *pi = NULL;
 		if ( m_vecPlayerSimInfo.Count() > 0 )
@@ -3375,15 +3401,43 @@ void CBasePlayer::PhysicsSimulate( void )
 			pi->m_flTime = Plat_FloatTime();
 			pi->m_vecAbsOrigin = GetAbsOrigin();
 			pi->m_flGameSimulationTime = gpGlobals->curtime;
-			pi->m_nNumCmds = commandsToRun;
+			pi->m_nNumCmds = sim.m_nCommandsToRun;
 		}
 	}
 
 	// Restore the true server clock
 	// FIXME:  Should this occur after simulation of children so
 	//  that they are in the timespace of the player?
-	gpGlobals->curtime		= savetime;
-	gpGlobals->frametime	= saveframetime;	
+	gpGlobals->curtime		= sim.m_flSaveTime;
+	gpGlobals->frametime	= sim.m_flSaveFrameTime;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Note, don't chain to BaseClass::PhysicsSimulate
+//-----------------------------------------------------------------------------
+void CBasePlayer::PhysicsSimulate( void )
+{
+	VPROF_BUDGET( "CBasePlayer::PhysicsSimulate", VPROF_BUDGETGROUP_PLAYER );
+
+	PlayerSimulation_t sim;
+	if ( !BeginPhysicsSimulate( sim ) )
+		return;
+
+	// Now run the commands
+	if ( sim.m_nCommandsToRun > 0 )
+	{
+		StartCommandHost();
+
+		for ( int i = 0; i < sim.m_nCommandsToRun; ++i )
+		{
+			PlayerRunCommand( &sim.m_Commands[ i ], MoveHelperServer() );
+			FinishSimulatedCommand( sim );
+		}
+
+		StopCommandHost();
+	}
+
+	EndPhysicsSimulate( sim );
 
 // 	// Kick the player if they haven't sent a user command in awhile in order to prevent clients
 // 	// from using packet-level manipulation to mess with gamestate.  Not sending usercommands seems
@@ -3657,6 +3711,8 @@ ConVar xc_crouch_debounce( "xc_crouch_debounce", "0", FCVAR_NONE );
 //-----------------------------------------------------------------------------
 void CBasePlayer::PlayerRunCommand(CUserCmd *ucmd, IMoveHelper *moveHelper)
 {
+	SERVER_BENCHMARK_SECTION( BENCHMARK_SECTION_MOVEMENT );
+
 	m_touchedPhysObject = false;
 
 	if ( pl.fixangle == FIXANGLE_NONE)
@@ -4348,6 +4404,25 @@ void CBasePlayer::SetSuitUpdate(const char *name, int fgroup, int iNoRepeatTime)
 
 }
 
+static void DeferredPlayStepSound( CBasePlayer *pPlayer, Vector vecOrigin, surfacedata_t *psurface, float fvol, bool force )
+{
+	pPlayer->PlayStepSound( vecOrigin, psurface, fvol, force );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Movement on a worker thread plays its footsteps once it's committed
+// Output : true if the footstep was queued and shouldn't be played now
+//-----------------------------------------------------------------------------
+bool CBasePlayer::DeferStepSound( const Vector &vecOrigin, surfacedata_t *psurface, float fvol, bool force )
+{
+	CCallQueue *pDeferredCalls = GetDeferredMovementCallQueue();
+	if ( !pDeferredCalls )
+		return false;
+
+	pDeferredCalls->QueueCall( &DeferredPlayStepSound, this, vecOrigin, psurface, fvol, force );
+	return true;
+}
+
 //=========================================================
 // UpdatePlayerSound - updates the position of the player's
 // reserved sound slot in the sound list.
@@ -4892,6 +4967,8 @@ void CBasePlayer::InitialSpawn( void )
 {
 	m_iConnected = PlayerConnected;
 	gamestats->Event_PlayerConnected( this );
+
+	RecipientFilter_FlushMulticastCache();
 }
 
 //-----------------------------------------------------------------------------
@@ -6855,6 +6932,14 @@ void CBasePlayer::UpdateClientData( void )
 
 void CBasePlayer::RumbleEffect( unsigned char index, unsigned char rumbleData, unsigned char rumbleFlags )
 {
+	// Movement on a worker thread sends this once it's committed
+	CCallQueue *pDeferredCalls = GetDeferredMovementCallQueue();
+	if ( pDeferredCalls )
+	{
+		pDeferredCalls->QueueCall( this, &CBasePlayer::RumbleEffect, index, rumbleData, rumbleFlags );
+		return;
+	}
+
 	if( !IsAlive() )
 		return;
 
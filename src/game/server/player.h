@@ -61,6 +61,15 @@ public:
 	float m_flServerFrameTime;
 	Vector m_vecAbsOrigin;
 };
+
+// The usercmds a player runs this frame, and the server clock to restore afterwards
+struct PlayerSimulation_t {
+	CUtlVector<CUserCmd> m_Commands;
+	int m_nCommandsToRun;
+	float m_flSaveTime;
+	float m_flSaveFrameTime;
+	float m_flVPhysicsArrivalTime;
+};
 //-----------------------------------------------------------------------------
 // Forward declarations:
 //-----------------------------------------------------------------------------
@@ -295,6 +304,13 @@ public:
 	// Physics simulation (player executes it's usercmd's here)
 	virtual void PhysicsSimulate( void );
 
+	// The stages of PhysicsSimulate, so CPlayerMove can interleave the commands of several players
+	bool BeginPhysicsSimulate( PlayerSimulation_t& sim );
+	void StartCommandHost( void );
+	void StopCommandHost( void );
+	void FinishSimulatedCommand( PlayerSimulation_t& sim );
+	void EndPhysicsSimulate( PlayerSimulation_t& sim );
+
 	// Forces processing of usercmds (e.g., even if game is paused, etc.)
 	void ForceSimulation();
 
@@ -426,6 +442,7 @@ public:
 	void UpdatePlayerSound( void );
 	virtual void UpdateStepSound( surfacedata_t* psurface, const Vector& vecOrigin, const Vector& vecVelocity );
 	virtual void PlayStepSound( Vector& vecOrigin, surfacedata_t* psurface, float fvol, bool force );
+	bool DeferStepSound( const Vector& vecOrigin, surfacedata_t* psurface, float fvol, bool force );
 	virtual const char* GetOverrideStepSound( const char* pszBaseStepSoundName ) { return pszBaseStepSoundName; }
 	virtual void GetStepSoundVelocities( float* velwalk, float* velrun );
 	virtual void SetStepSoundTime( stepsoundtimes_t iStepSoundTime, bool bWalking );
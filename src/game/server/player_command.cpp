@@ -8,12 +8,18 @@
 #include "player.h"
 #include "usercmd.h"
 #include "igamemovement.h"
+#include "gamemovement.h"
+#include "movevars_shared.h"
 #include "mathlib/mathlib.h"
 #include "client.h"
 #include "player_command.h"
 #include "movehelper_server.h"
 #include "iservervehicle.h"
 #include "tier0/vprof.h"
+#include "datacache/imdlcache.h"
+#include "collisionutils.h"
+#include "vstdlib/jobthread.h"
+#include "serverbenchmark_base.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -24,12 +30,129 @@ extern ConVar sv_noclipduringpause;
 
 ConVar sv_maxusrcmdprocessticks_warning( "sv_maxusrcmdprocessticks_warning", "-1", FCVAR_NONE, "Print a warning when user commands get dropped due to insufficient usrcmd ticks allocated, number of seconds to throttle, negative disabled" );
 static ConVar sv_maxusrcmdprocessticks_holdaim( "sv_maxusrcmdprocessticks_holdaim", "1", FCVAR_CHEAT, "Hold client aim for multiple server sim ticks when client-issued usrcmd contains multiple actions (0: off; 1: hold this server tick; 2+: hold multiple ticks)" );
+ConVar sv_parallel_player_movement( "sv_parallel_player_movement", "0", FCVAR_NONE, "Run the movement of players that can't reach each other this tick on the job pool" );
+static ConVar sv_parallel_player_movement_margin( "sv_parallel_player_movement_margin", "16", FCVAR_NONE, "Extra distance added to the swept bounds used to decide which players can move in parallel" );
+
+//-----------------------------------------------------------------------------
+// A player's usercmds for the frame, and the command of theirs that has been
+// run up to its movement
+//-----------------------------------------------------------------------------
+struct PlayerMoveSlot_t
+{
+	PlayerSimulation_t	sim;
+	CBasePlayer			*pPlayer;
+
+	CMoveData			*pMove;
+	IGameMovement		*pGameMovement;
+	IMoveHelperDeferred	*pDeferredHelper;
+
+	CUserCmd			cmd;
+	IMoveHelper			*pHelper;
+	float				flCurTime;
+	float				flFrameTime;
+	Vector				vecSweptMins;
+	Vector				vecSweptMaxs;
+	bool				bStaged;
+	bool				bParallel;
+	bool				bMoved;
+};
 
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
 CPlayerMove::CPlayerMove( void )
 {
+	m_pStagingSlot = NULL;
+}
+
+CPlayerMove::~CPlayerMove( void )
+{
+	FreeMoveSlots();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Move data and game movement for the players moving in parallel
+//-----------------------------------------------------------------------------
+CMoveData *CPlayerMove::CreateMoveData( void )
+{
+	return new CMoveData;
+}
+
+void CPlayerMove::DestroyMoveData( CMoveData *move )
+{
+	delete move;
+}
+
+IGameMovement *CPlayerMove::CreateGameMovement( void )
+{
+	return new CGameMovement;
+}
+
+void CPlayerMove::FreeMoveSlots( void )
+{
+	for ( int i = 0; i < m_MoveSlots.Count(); i++ )
+	{
+		PlayerMoveSlot_t *pSlot = m_MoveSlots[i];
+		if ( !pSlot )
+			continue;
+
+		DestroyMoveData( pSlot->pMove );
+		delete pSlot->pGameMovement;
+		DestroyDeferredMoveHelper( pSlot->pDeferredHelper );
+		delete pSlot;
+	}
+	m_MoveSlots.Purge();
+}
+
+PlayerMoveSlot_t *CPlayerMove::GetMoveSlot( int iPlayerIndex )
+{
+	while ( m_MoveSlots.Count() < iPlayerIndex )
+	{
+		m_MoveSlots.AddToTail( NULL );
+	}
+
+	PlayerMoveSlot_t *&pSlot = m_MoveSlots[ iPlayerIndex - 1 ];
+	if ( !pSlot )
+	{
+		pSlot = new PlayerMoveSlot_t;
+		pSlot->pPlayer = NULL;
+		pSlot->pMove = CreateMoveData();
+		pSlot->pGameMovement = CreateGameMovement();
+		pSlot->pDeferredHelper = CreateDeferredMoveHelper();
+		pSlot->pHelper = NULL;
+		pSlot->bStaged = false;
+		pSlot->bParallel = false;
+		pSlot->bMoved = false;
+	}
+	return pSlot;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Movement touches nothing but the player and its move data, and
+//			reports everything else through the move helper. Anything that can
+//			move the player with or onto another entity stays on the main thread.
+//-----------------------------------------------------------------------------
+bool CPlayerMove::CanMoveInParallel( CBasePlayer *player, CMoveData *move )
+{
+	if ( player->GetVehicle() || player->GetMoveParent() )
+		return false;
+
+	if ( player->GetMoveType() != MOVETYPE_WALK )
+		return false;
+
+	// ProcessMovement scales gpGlobals->frametime for lagged movement
+	if ( player->GetLaggedMovementValue() != 1.0f )
+		return false;
+
+	// CheckFalling() needs the fall damage applied, and to know whether the player survived
+	// it, before it carries on with the landing. Anyone who could land hard this command
+	// moves serially. Movement runs at most a couple of ticks of gravity per command.
+	float flGravity = ( player->GetGravity() ? player->GetGravity() : 1.0f ) * GetCurrentGravity();
+	float flFallSpeed = MAX( player->m_Local.m_flFallVelocity, -move->m_vecVelocity.z ) + flGravity * TICK_INTERVAL * 2.0f;
+	if ( flFallSpeed > PLAYER_MAX_SAFE_FALL_SPEED )
+		return false;
+
+	return true;
 }
 
 //-----------------------------------------------------------------------------
@@ -313,6 +436,37 @@ void CommentarySystem_PePlayerRunCommand( CBasePlayer *player, CUserCmd *ucmd );
 // Output : void CPlayerMove::RunCommand
 //-----------------------------------------------------------------------------
 void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper )
+{
+	PlayerMoveSlot_t *pSlot = m_pStagingSlot;
+	if ( pSlot && pSlot->pPlayer == player )
+	{
+		// RunParallelPlayerCommands runs the movement, and the rest of the command, later
+		m_pStagingSlot = NULL;
+		pSlot->bStaged = StartRunCommand( player, ucmd, moveHelper, pSlot->pMove, pSlot->pGameMovement );
+		if ( pSlot->bStaged )
+		{
+			pSlot->cmd = *ucmd;
+			pSlot->pHelper = moveHelper;
+			pSlot->flCurTime = gpGlobals->curtime;
+			pSlot->flFrameTime = gpGlobals->frametime;
+			player->m_pCurrentCommand = &pSlot->cmd;
+		}
+		return;
+	}
+
+	if ( !StartRunCommand( player, ucmd, moveHelper, g_pMoveData, g_pGameMovement ) )
+		return;
+
+	RunMovement( player, g_pMoveData, g_pGameMovement );
+
+	FinishRunCommand( player, ucmd, moveHelper, g_pMoveData, g_pGameMovement );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the command up to the movement itself. Returns false if the
+//			command is ignored.
+//-----------------------------------------------------------------------------
+bool CPlayerMove::StartRunCommand( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper, CMoveData *move, IGameMovement *pGameMovement )
 {
 	const float playerCurTime = player->m_nTickBase * TICK_INTERVAL; 
 	const float playerFrameTime = player->m_bGamePaused ? 0 : TICK_INTERVAL;
@@ -331,7 +485,7 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 				Warning( "sv_maxusrcmdprocessticks_warning at server tick %u: Ignored client %s usrcmd (%.6f < %.6f)!\n", gpGlobals->tickcount, player->GetPlayerName(), flTimeAllowedForProcessing, playerFrameTime );
 			}
 		}
-		return; // Don't process this command
+		return false; // Don't process this command
 	}
 
 	StartCommand( player, ucmd );
@@ -371,7 +525,7 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 	}
 	*/
 
-	g_pGameMovement->StartTrackPredictionErrors( player );
+	pGameMovement->StartTrackPredictionErrors( player );
 
 	CommentarySystem_PePlayerRunCommand( player, ucmd );
 
@@ -406,7 +560,7 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 
 	CheckMovingGround( player, TICK_INTERVAL );
 
-	g_pMoveData->m_vecOldAngles = player->pl.v_angle;
+	move->m_vecOldAngles = player->pl.v_angle;
 
 	// Copy from command to player unless game .dll has set angle using fixangle
 	if ( player->pl.fixangle == FIXANGLE_NONE )
@@ -425,23 +579,50 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 	RunThink( player, TICK_INTERVAL );
 
 	// Setup input.
-	SetupMove( player, ucmd, moveHelper, g_pMoveData );
+	SetupMove( player, ucmd, moveHelper, move );
+
+	return true;
+}
 
-	// Let the game do the movement.
+//-----------------------------------------------------------------------------
+// Purpose: Let the game do the movement
+//-----------------------------------------------------------------------------
+void CPlayerMove::RunMovement( CBasePlayer *player, CMoveData *move, IGameMovement *pGameMovement )
+{
+	IServerVehicle *pVehicle = player->GetVehicle();
 	if ( !pVehicle )
 	{
 		VPROF( "g_pGameMovement->ProcessMovement()" );
-		Assert( g_pGameMovement );
-		g_pGameMovement->ProcessMovement( player, g_pMoveData );
+		Assert( pGameMovement );
+		pGameMovement->ProcessMovement( player, move );
 	}
 	else
 	{
 		VPROF( "pVehicle->ProcessMovement()" );
-		pVehicle->ProcessMovement( player, g_pMoveData );
+		pVehicle->ProcessMovement( player, move );
 	}
-			
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the rest of the command once the player has moved
+//-----------------------------------------------------------------------------
+void CPlayerMove::FinishRunCommand( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper, CMoveData *move, IGameMovement *pGameMovement )
+{
+	// Other players may have started their commands since this one was
+	player->m_pCurrentCommand = ucmd;
+	CBaseEntity::SetPredictionRandomSeed( ucmd );
+	CBaseEntity::SetPredictionPlayer( player );
+
 	// Copy output
-	FinishMove( player, ucmd, g_pMoveData );
+	FinishMove( player, ucmd, move );
+
+	// PostThink reads the movement's outputs from the shared move data
+	if ( move != g_pMoveData )
+	{
+		g_pMoveData->m_outStepHeight = move->m_outStepHeight;
+		g_pMoveData->m_outWishVel = move->m_outWishVel;
+		g_pMoveData->m_outJumpVel = move->m_outJumpVel;
+	}
 
 	// If we have to restore the view angle then do so right now
 	if ( !player->IsBot() && ( gpGlobals->tickcount - player->GetLockViewanglesTickNumber() < sv_maxusrcmdprocessticks_holdaim.GetInt() ) )
@@ -456,7 +637,7 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 
 	RunPostThink( player );
 
-	g_pGameMovement->FinishTrackPredictionErrors( player );
+	pGameMovement->FinishTrackPredictionErrors( player );
 
 	FinishCommand( player );
 
@@ -466,3 +647,178 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 		player->m_nTickBase++;
 	}
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: Job: moves one player, with side effects queued on its deferred
+//			move helper until the commit
+//-----------------------------------------------------------------------------
+void CPlayerMove::RunParallelMovement( PlayerMoveSlot_t *&pSlot )
+{
+	pSlot->pDeferredHelper->BeginDeferring( pSlot->pPlayer );
+	RunMovement( pSlot->pPlayer, pSlot->pMove, pSlot->pGameMovement );
+	pSlot->pDeferredHelper->EndDeferring();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Replaces Physics_SimulateEntity() for the players. Each player's
+//			commands run in rounds, one command per player per round. In a
+//			round everyone's command runs up to its movement on this thread,
+//			in player order. The movement of players that can move in parallel
+//			and whose swept bounds overlap nobody else's then runs on the job
+//			pool. Finally the commands are finished in player order, replaying
+//			the queued sounds, touches and ground changes, and running the rest
+//			serially.
+//-----------------------------------------------------------------------------
+void CPlayerMove::RunParallelPlayerCommands( void )
+{
+	VPROF_BUDGET( "CPlayerMove::RunParallelPlayerCommands", VPROF_BUDGETGROUP_PLAYER );
+	SERVER_BENCHMARK_SECTION( BENCHMARK_SECTION_MOVEMENT );
+	MDLCACHE_CRITICAL_SECTION();
+
+	const float flStartTime = gpGlobals->curtime;
+
+	CUtlVectorFixedGrowable< PlayerMoveSlot_t *, MAX_PLAYERS > players;
+	int nRounds = 0;
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( !pPlayer || !pPlayer->edict() )
+			continue;
+
+		// Always reset clock to real sv.time
+		gpGlobals->curtime = flStartTime;
+
+		PlayerMoveSlot_t *pSlot = GetMoveSlot( i );
+		if ( !pPlayer->BeginPhysicsSimulate( pSlot->sim ) )
+			continue;
+
+		pSlot->pPlayer = pPlayer;
+		pSlot->flCurTime = gpGlobals->curtime;
+		players.AddToTail( pSlot );
+		nRounds = MAX( nRounds, pSlot->sim.m_nCommandsToRun );
+	}
+
+	CUtlVectorFixedGrowable< PlayerMoveSlot_t *, MAX_PLAYERS > staged;
+	CUtlVectorFixedGrowable< PlayerMoveSlot_t *, MAX_PLAYERS > batch;
+	for ( int nRound = 0; nRound < nRounds; nRound++ )
+	{
+		staged.RemoveAll();
+
+		for ( int i = 0; i < players.Count(); i++ )
+		{
+			PlayerMoveSlot_t *pSlot = players[i];
+			if ( nRound >= pSlot->sim.m_nCommandsToRun )
+				continue;
+
+			CBasePlayer *pPlayer = pSlot->pPlayer;
+			pSlot->bStaged = false;
+
+			pPlayer->StartCommandHost();
+			m_pStagingSlot = pSlot;
+			pPlayer->PlayerRunCommand( &pSlot->sim.m_Commands[ nRound ], MoveHelperServer() );
+			m_pStagingSlot = NULL;
+			pPlayer->StopCommandHost();
+
+			if ( pSlot->bStaged )
+			{
+				staged.AddToTail( pSlot );
+			}
+			else
+			{
+				pPlayer->FinishSimulatedCommand( pSlot->sim );
+			}
+		}
+
+		// Bound how far each player can get this command, padded by a step and the margin
+		const float flMargin = sv_stepsize.GetFloat() + sv_parallel_player_movement_margin.GetFloat();
+		for ( int i = 0; i < staged.Count(); i++ )
+		{
+			PlayerMoveSlot_t *pSlot = staged[i];
+			CBasePlayer *pPlayer = pSlot->pPlayer;
+
+			float flSpeed = pSlot->pMove->m_vecVelocity.Length() + pPlayer->GetBaseVelocity().Length() + pPlayer->GetPlayerMaxSpeed();
+			float flReach = flSpeed * pSlot->flFrameTime * 2.0f + flMargin;
+			Vector vecReach( flReach, flReach, flReach );
+
+			pSlot->vecSweptMins = pPlayer->GetAbsOrigin() + VEC_HULL_MIN - vecReach;
+			pSlot->vecSweptMaxs = pPlayer->GetAbsOrigin() + VEC_HULL_MAX + vecReach;
+			pSlot->bParallel = CanMoveInParallel( pPlayer, pSlot->pMove );
+			pSlot->bMoved = false;
+		}
+
+		// Players that could touch each other move one after the other
+		for ( int i = 0; i < staged.Count(); i++ )
+		{
+			for ( int j = i + 1; j < staged.Count(); j++ )
+			{
+				if ( IsBoxIntersectingBox( staged[i]->vecSweptMins, staged[i]->vecSweptMaxs, staged[j]->vecSweptMins, staged[j]->vecSweptMaxs ) )
+				{
+					staged[i]->bParallel = false;
+					staged[j]->bParallel = false;
+				}
+			}
+		}
+
+		// Movement reads the clock from gpGlobals, so each job batch shares one
+		for ( int i = 0; i < staged.Count(); i++ )
+		{
+			PlayerMoveSlot_t *pFirst = staged[i];
+			if ( !pFirst->bParallel || pFirst->bMoved )
+				continue;
+
+			batch.RemoveAll();
+			for ( int j = i; j < staged.Count(); j++ )
+			{
+				PlayerMoveSlot_t *pSlot = staged[j];
+				if ( pSlot->bParallel && !pSlot->bMoved && pSlot->flCurTime == pFirst->flCurTime && pSlot->flFrameTime == pFirst->flFrameTime )
+				{
+					pSlot->bMoved = true;
+					batch.AddToTail( pSlot );
+				}
+			}
+
+			// Network state changes on worker threads can't touch the shared change info
+			for ( int j = 0; j < batch.Count(); j++ )
+			{
+				batch[j]->pPlayer->edict()->StateChanged();
+			}
+
+			gpGlobals->curtime = pFirst->flCurTime;
+			gpGlobals->frametime = pFirst->flFrameTime;
+			ParallelProcess( "CPlayerMove::RunParallelMovement", batch.Base(), batch.Count(), this, &CPlayerMove::RunParallelMovement );
+		}
+
+		for ( int i = 0; i < staged.Count(); i++ )
+		{
+			PlayerMoveSlot_t *pSlot = staged[i];
+			CBasePlayer *pPlayer = pSlot->pPlayer;
+
+			pPlayer->StartCommandHost();
+			gpGlobals->curtime = pSlot->flCurTime;
+			gpGlobals->frametime = pSlot->flFrameTime;
+
+			if ( pSlot->bParallel )
+			{
+				pSlot->pDeferredHelper->CommitDeferredCalls();
+			}
+			else
+			{
+				RunMovement( pPlayer, pSlot->pMove, pSlot->pGameMovement );
+			}
+
+			FinishRunCommand( pPlayer, &pSlot->cmd, pSlot->pHelper, pSlot->pMove, pSlot->pGameMovement );
+			pPlayer->StopCommandHost();
+			pPlayer->FinishSimulatedCommand( pSlot->sim );
+		}
+	}
+
+	for ( int i = 0; i < players.Count(); i++ )
+	{
+		PlayerMoveSlot_t *pSlot = players[i];
+		gpGlobals->curtime = pSlot->flCurTime;
+		pSlot->pPlayer->EndPhysicsSimulate( pSlot->sim );
+		pSlot->pPlayer = NULL;
+	}
+
+	gpGlobals->curtime = flStartTime;
+}
@@ -15,8 +15,10 @@
 
 
 class IMoveHelper;
+class IGameMovement;
 class CMoveData;
 class CBasePlayer;
+struct PlayerMoveSlot_t;
 
 //-----------------------------------------------------------------------------
 // Purpose: Server side player movement
@@ -28,13 +30,28 @@ public:
 	
 	// Construction/destruction
 					CPlayerMove( void );
-	virtual			~CPlayerMove( void ) {}
+	virtual			~CPlayerMove( void );
 
 	// Public interfaces:
 	// Run a movement command from the player
 	void			RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper );
 
+	// Run this frame's usercmds for all players, moving the ones that can't reach
+	// each other at the same time (sv_parallel_player_movement)
+	void			RunParallelPlayerCommands( void );
+
 protected:
+	// Each player moving in parallel gets its own move data and game movement
+	virtual CMoveData		*CreateMoveData( void );
+	virtual void			DestroyMoveData( CMoveData *move );
+	virtual IGameMovement	*CreateGameMovement( void );
+
+	// Can this player's movement for the current command run off the main thread?
+	virtual bool	CanMoveInParallel( CBasePlayer *player, CMoveData *move );
+
+	// Derived classes that override CreateMoveData must call this from their destructor
+	void			FreeMoveSlots( void );
+
 	// Prepare for running movement
 	virtual void	SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *pHelper, CMoveData *move );
 
@@ -52,6 +69,18 @@ protected:
 	void			RunPreThink( CBasePlayer *player );
 	void			RunThink (CBasePlayer *ent, double frametime );
 	void			RunPostThink( CBasePlayer *player );
+
+private:
+	// The stages of RunCommand: everything before the movement, the movement, and everything after
+	bool			StartRunCommand( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper, CMoveData *move, IGameMovement *pGameMovement );
+	void			RunMovement( CBasePlayer *player, CMoveData *move, IGameMovement *pGameMovement );
+	void			FinishRunCommand( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper, CMoveData *move, IGameMovement *pGameMovement );
+
+	PlayerMoveSlot_t *GetMoveSlot( int iPlayerIndex );
+	void			RunParallelMovement( PlayerMoveSlot_t *&pSlot );
+
+	CUtlVector<PlayerMoveSlot_t *> m_MoveSlots;
+	PlayerMoveSlot_t *m_pStagingSlot;		// RunCommand stops after SetupMove for this slot's player
 };
 
 
@@ -60,5 +89,7 @@ protected:
 //-----------------------------------------------------------------------------
 CPlayerMove *PlayerMove();
 
+extern ConVar sv_parallel_player_movement;
+
 
 #endif // PLAYER_COMMAND_H
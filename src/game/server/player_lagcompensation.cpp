@@ -10,8 +10,8 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
+#include "mathlib/ssemath.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -19,6 +19,7 @@
 
 #define LC_NONE				0
 #define LC_ALIVE			(1<<0)
+#define LC_PARENTED			(1<<1)	// origin is relative to a move parent
 
 #define LC_ORIGIN_CHANGED	(1<<8)
 #define LC_ANGLES_CHANGED	(1<<9)
@@ -37,6 +38,10 @@ ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show
 
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_DEVELOPMENTONLY, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
 
+ConVar sv_unlag_cull( "sv_unlag_cull", "0", 0, "Don't backtrack players whose history is nowhere near the shooter's aim. Players outside sv_unlag_cull_cone are then not lag compensated" );
+ConVar sv_unlag_cull_cone( "sv_unlag_cull_cone", "15", 0, "Half angle in degrees around the shooter's aim that a backtracked player must be within, for spread and recoil" );
+ConVar sv_unlag_cull_bloat( "sv_unlag_cull_bloat", "48", 0, "Units added around a backtracked player's bounds before testing it against the shooter's aim, for hitboxes outside the bounds and melee hulls" );
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -114,6 +119,139 @@ public:
 	float					m_masterCycle;
 };
 
+struct LagAnimRecord
+{
+	LagAnimRecord()
+	{
+		m_masterSequence = 0;
+		m_masterCycle = 0;
+	}
+
+	LayerRecord				m_layerRecords[MAX_LAYER_RECORDS];
+	int						m_masterSequence;
+	float					m_masterCycle;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: History of one player, newest first, in a ring buffer with one
+//			array per field. Finding the record for a time only reads the
+//			times, flags and origins.
+//-----------------------------------------------------------------------------
+class CLagTrack
+{
+public:
+	CLagTrack()
+	{
+		m_nHead = 0;
+		m_nCount = 0;
+		m_nMask = 0;
+	}
+
+	int		Count() const				{ return m_nCount; }
+	int		Slot( int iAge ) const		{ return ( m_nHead - iAge ) & m_nMask; }	// age 0 is the newest record
+	int		AddToHead();
+	void	RemoveTail()				{ Assert( m_nCount > 0 ); m_nCount--; }
+	void	RemoveAll()					{ m_nCount = 0; }
+	void	Purge();
+
+	CUtlVector< float >			m_flSimulationTime;
+	CUtlVector< int >			m_fFlags;
+	CUtlVector< Vector >		m_vecOrigin;
+	CUtlVector< QAngle >		m_vecAngles;
+	CUtlVector< Vector >		m_vecMinsPreScaled;
+	CUtlVector< Vector >		m_vecMaxsPreScaled;
+	CUtlVector< LagAnimRecord >	m_Animation;
+
+private:
+	int		m_nHead;
+	int		m_nCount;
+	int		m_nMask;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the slot for a new newest record, dropping the oldest
+//			record if the buffer is full
+//-----------------------------------------------------------------------------
+int CLagTrack::AddToHead()
+{
+	if ( !m_nMask )
+	{
+		// Records expire on a whole second boundary past sv_maxunlag, so keep
+		// two seconds of ticks at sv_maxunlag's limit
+		int nCapacity = SmallestPowerOfTwoGreaterOrEqual( TIME_TO_TICKS( 2.0f ) + 2 );
+		m_flSimulationTime.SetCount( nCapacity );
+		m_fFlags.SetCount( nCapacity );
+		m_vecOrigin.SetCount( nCapacity );
+		m_vecAngles.SetCount( nCapacity );
+		m_vecMinsPreScaled.SetCount( nCapacity );
+		m_vecMaxsPreScaled.SetCount( nCapacity );
+		m_Animation.SetCount( nCapacity );
+		m_nMask = nCapacity - 1;
+		m_nHead = 0;
+	}
+
+	m_nHead = ( m_nHead + 1 ) & m_nMask;
+	if ( m_nCount <= m_nMask )
+	{
+		m_nCount++;
+	}
+	return m_nHead;
+}
+
+void CLagTrack::Purge()
+{
+	m_flSimulationTime.Purge();
+	m_fFlags.Purge();
+	m_vecOrigin.Purge();
+	m_vecAngles.Purge();
+	m_vecMinsPreScaled.Purge();
+	m_vecMaxsPreScaled.Purge();
+	m_Animation.Purge();
+	m_nHead = 0;
+	m_nCount = 0;
+	m_nMask = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The records a player will be moved back between
+//-----------------------------------------------------------------------------
+struct LagTarget
+{
+	CBasePlayer	*m_pPlayer;
+	int			m_iRecord;		// slot of the newest record at or before the target time
+	int			m_iPrevRecord;	// slot of the record after it, or -1
+	float		m_flFrac;		// from m_iRecord towards m_iPrevRecord
+	bool		m_bCulled;		// the shot can't reach it, so leave it where it is
+};
+
+// Backtracked origin and bounds of every target, one array per component
+// so four targets are interpolated and culled at once
+#define LAG_BATCH_SIZE ( ( MAX_PLAYERS + 3 ) & ~3 )
+
+enum
+{
+	LAG_BATCH_ORIGIN_X,
+	LAG_BATCH_ORIGIN_Y,
+	LAG_BATCH_ORIGIN_Z,
+	LAG_BATCH_MINS_X,
+	LAG_BATCH_MINS_Y,
+	LAG_BATCH_MINS_Z,
+	LAG_BATCH_MAXS_X,
+	LAG_BATCH_MAXS_Y,
+	LAG_BATCH_MAXS_Z,
+
+	LAG_BATCH_COMPONENTS
+};
+
+struct LagBatch
+{
+	ALIGN16 float m_flFrac[ LAG_BATCH_SIZE ];
+	ALIGN16 float m_From[ LAG_BATCH_COMPONENTS ][ LAG_BATCH_SIZE ];		// the record at or before the target time
+	ALIGN16 float m_To[ LAG_BATCH_COMPONENTS ][ LAG_BATCH_SIZE ];		// the record after it
+	ALIGN16 float m_Result[ LAG_BATCH_COMPONENTS ][ LAG_BATCH_SIZE ];
+	ALIGN16 float m_Current[ LAG_BATCH_COMPONENTS ][ LAG_BATCH_SIZE ];	// where the player is now
+};
+
 
 //
 // Try to take the player from his current origin to vWantedPos.
@@ -178,12 +316,12 @@ public:
 	// IServerSystem stuff
 	virtual void Shutdown()
 	{
-		ClearHistory();
+		PurgeHistory();
 	}
 
 	virtual void LevelShutdownPostEntity()
 	{
-		ClearHistory();
+		PurgeHistory();
 	}
 
 	// called after entities think
@@ -199,15 +337,30 @@ public:
 
 private:
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
+	bool			FindBacktrackRecords( CBasePlayer *pPlayer, float flTargetTime, LagTarget *pTarget );
+	void			InterpolateTargets( int nTargets );
+	void			CullTargets( CBasePlayer *pShooter, CUserCmd *cmd, int nTargets );
+	bool			IsParentedTarget( const LagTarget &target ) const;
+	void			ApplyBacktrack( const LagTarget &target, float flTargetTime, Vector org, const Vector &minsPreScaled, const Vector &maxsPreScaled );
 
 	void ClearHistory()
+	{
+		for ( int i=0; i<MAX_PLAYERS; i++ )
+			m_PlayerTrack[i].RemoveAll();
+	}
+
+	void PurgeHistory()
 	{
 		for ( int i=0; i<MAX_PLAYERS; i++ )
 			m_PlayerTrack[i].Purge();
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a ring of lag records for each player
+	CLagTrack				m_PlayerTrack[ MAX_PLAYERS ];
+
+	// Scratchpad for the players being moved back by StartLagCompensation
+	LagTarget				m_Targets[ MAX_PLAYERS ];
+	LagBatch				m_Batch;
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -250,74 +403,67 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CLagTrack *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
-			if ( track->Count() > 0 )
-			{
-				track->RemoveAll();
-			}
-
+			track->RemoveAll();
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
-
 		// remove tail records that are too old
-		int tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+		while ( track->Count() > 0 )
 		{
-			LagRecord &tail = track->Element( tailIndex );
-
 			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
+			if ( track->m_flSimulationTime[ track->Slot( track->Count() - 1 ) ] >= flDeadtime )
 				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+
+			track->RemoveTail();
 		}
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
 			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
+			if ( track->m_flSimulationTime[ track->Slot( 0 ) ] >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
 		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		int slot = track->AddToHead();
 
-		record.m_fFlags = 0;
+		track->m_fFlags[slot] = 0;
 		if ( pPlayer->IsAlive() )
 		{
-			record.m_fFlags |= LC_ALIVE;
+			track->m_fFlags[slot] |= LC_ALIVE;
 		}
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMinsPreScaled	= pPlayer->CollisionProp()->OBBMinsPreScaled();
-		record.m_vecMaxsPreScaled	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		if ( pPlayer->GetMoveParent() )
+		{
+			track->m_fFlags[slot] |= LC_PARENTED;
+		}
 
+		track->m_flSimulationTime[slot]	= pPlayer->GetSimulationTime();
+		track->m_vecAngles[slot]		= pPlayer->GetLocalAngles();
+		track->m_vecOrigin[slot]		= pPlayer->GetLocalOrigin();
+		track->m_vecMinsPreScaled[slot]	= pPlayer->CollisionProp()->OBBMinsPreScaled();
+		track->m_vecMaxsPreScaled[slot]	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+
+		LagAnimRecord &animation = track->m_Animation[slot];
 		int layerCount = pPlayer->GetNumAnimOverlays();
 		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 		{
 			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
 			if( currentLayer )
 			{
-				record.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-				record.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-				record.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-				record.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+				animation.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+				animation.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+				animation.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+				animation.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
 			}
 		}
-		record.m_masterSequence = pPlayer->GetSequence();
-		record.m_masterCycle = pPlayer->GetCycle();
+		animation.m_masterSequence = pPlayer->GetSequence();
+		animation.m_masterCycle = pPlayer->GetCycle();
 	}
 
 	//Clear the current player.
@@ -394,6 +540,9 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
 	
+	float flTargetTime = TICKS_TO_TIME( targettick );
+	int nTargets = 0;
+
 	// Iterate all active players
 	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
@@ -415,109 +564,311 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		if ( !player->WantsLagCompensationOnEntity( pPlayer, cmd, pEntityTransmitBits ) )
 			continue;
 
-		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		if ( FindBacktrackRecords( pPlayer, flTargetTime, &m_Targets[nTargets] ) )
+		{
+			nTargets++;
+		}
+	}
+
+	if ( !nTargets )
+		return;
+
+	// Work out where everyone goes, then only move the ones the shot can reach
+	InterpolateTargets( nTargets );
+
+	if ( sv_unlag_cull.GetBool() )
+	{
+		CullTargets( player, cmd, nTargets );
+	}
+
+	// Move other players back in time
+	for ( int i = 0; i < nTargets; i++ )
+	{
+		if ( m_Targets[i].m_bCulled )
+			continue;
+
+		Vector org( m_Batch.m_Result[LAG_BATCH_ORIGIN_X][i], m_Batch.m_Result[LAG_BATCH_ORIGIN_Y][i], m_Batch.m_Result[LAG_BATCH_ORIGIN_Z][i] );
+		Vector minsPreScaled( m_Batch.m_Result[LAG_BATCH_MINS_X][i], m_Batch.m_Result[LAG_BATCH_MINS_Y][i], m_Batch.m_Result[LAG_BATCH_MINS_Z][i] );
+		Vector maxsPreScaled( m_Batch.m_Result[LAG_BATCH_MAXS_X][i], m_Batch.m_Result[LAG_BATCH_MAXS_Y][i], m_Batch.m_Result[LAG_BATCH_MAXS_Z][i] );
+
+		ApplyBacktrack( m_Targets[i], flTargetTime, org, minsPreScaled, maxsPreScaled );
 	}
 }
 
-void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
+//-----------------------------------------------------------------------------
+// Purpose: Finds the records to move a player back between for flTargetTime.
+//			Returns false if the player's history can't be trusted that far.
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::FindBacktrackRecords( CBasePlayer *pPlayer, float flTargetTime, LagTarget *pTarget )
 {
-	Vector org;
-	Vector minsPreScaled;
-	Vector maxsPreScaled;
-	QAngle ang;
-
-	VPROF_BUDGET( "BacktrackPlayer", "CLagCompensationManager" );
+	VPROF_BUDGET( "FindBacktrackRecords", "CLagCompensationManager" );
 	int pl_index = pPlayer->entindex() - 1;
 
 	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	CLagTrack *track = &m_PlayerTrack[ pl_index ];
 
 	// check if we have at leat one entry
 	if ( track->Count() <= 0 )
-		return;
-
-	int curr = track->Head();
+		return false;
 
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+	int prevRecord = -1;
+	int record = -1;
 
 	Vector prevOrg = pPlayer->GetLocalOrigin();
 	
 	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	for ( int age = 0; age < track->Count(); age++ )
 	{
 		// remember last record
 		prevRecord = record;
 
 		// get next record
-		record = &track->Element( curr );
+		record = track->Slot( age );
 
-		if ( !(record->m_fFlags & LC_ALIVE) )
+		if ( !(track->m_fFlags[record] & LC_ALIVE) )
 		{
 			// player most be alive, lost track
-			return;
+			return false;
 		}
 
-		Vector delta = record->m_vecOrigin - prevOrg;
+		Vector delta = track->m_vecOrigin[record] - prevOrg;
 		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
 		{
 			// lost track, too much difference
-			return; 
+			return false; 
 		}
 
 		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
+		if ( track->m_flSimulationTime[record] <= flTargetTime )
 			break; // hurra, stop
 
-		prevOrg = record->m_vecOrigin;
+		prevOrg = track->m_vecOrigin[record];
+	}
+
+	float frac = 0.0f;
+	if ( prevRecord != -1 && 
+		 (track->m_flSimulationTime[record] < flTargetTime) &&
+		 (track->m_flSimulationTime[record] < track->m_flSimulationTime[prevRecord]) )
+	{
+		// we didn't find the exact time but have a valid previous record
+		// so interpolate between these two records;
 
-		// go one step back
-		curr = track->Next( curr );
+		Assert( flTargetTime < track->m_flSimulationTime[prevRecord] );
+
+		// calc fraction between both records
+		frac = ( flTargetTime - track->m_flSimulationTime[record] ) / 
+			( track->m_flSimulationTime[prevRecord] - track->m_flSimulationTime[record] );
+
+		Assert( frac > 0 && frac < 1 ); // should never extrapolate
 	}
 
-	Assert( record );
+	pTarget->m_pPlayer = pPlayer;
+	pTarget->m_iRecord = record;
+	pTarget->m_iPrevRecord = prevRecord;
+	pTarget->m_flFrac = frac;
+	pTarget->m_bCulled = false;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves one player back in time, outside of a batch
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
+{
+	VPROF_BUDGET( "BacktrackPlayer", "CLagCompensationManager" );
 
-	if ( !record )
+	LagTarget target;
+	if ( !FindBacktrackRecords( pPlayer, flTargetTime, &target ) )
+		return;
+
+	CLagTrack *track = &m_PlayerTrack[ pPlayer->entindex() - 1 ];
+	int record = target.m_iRecord;
+
+	if ( target.m_flFrac > 0.0f )
 	{
-		if ( sv_unlag_debug.GetBool() )
+		int prevRecord = target.m_iPrevRecord;
+		ApplyBacktrack( target, flTargetTime,
+			Lerp( target.m_flFrac, track->m_vecOrigin[record], track->m_vecOrigin[prevRecord] ),
+			Lerp( target.m_flFrac, track->m_vecMinsPreScaled[record], track->m_vecMinsPreScaled[prevRecord] ),
+			Lerp( target.m_flFrac, track->m_vecMaxsPreScaled[record], track->m_vecMaxsPreScaled[prevRecord] ) );
+	}
+	else
+	{
+		// we found the exact record or no other record to interpolate with
+		ApplyBacktrack( target, flTargetTime, track->m_vecOrigin[record], track->m_vecMinsPreScaled[record], track->m_vecMaxsPreScaled[record] );
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+static inline void SetBatchVector( float (*pComponents)[ LAG_BATCH_SIZE ], int iFirstComponent, int iTarget, const Vector &v )
+{
+	pComponents[iFirstComponent][iTarget] = v.x;
+	pComponents[iFirstComponent + 1][iTarget] = v.y;
+	pComponents[iFirstComponent + 2][iTarget] = v.z;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Interpolates the origin and bounds of every target four at a time,
+//			the same way Lerp() would one at a time
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::InterpolateTargets( int nTargets )
+{
+	VPROF_BUDGET( "InterpolateTargets", "CLagCompensationManager" );
+
+	for ( int i = 0; i < nTargets; i++ )
+	{
+		const LagTarget &target = m_Targets[i];
+		CBasePlayer *pPlayer = target.m_pPlayer;
+		CLagTrack *track = &m_PlayerTrack[ pPlayer->entindex() - 1 ];
+
+		// Not interpolating is interpolating a record with itself
+		int from = target.m_iRecord;
+		int to = ( target.m_flFrac > 0.0f ) ? target.m_iPrevRecord : from;
+
+		m_Batch.m_flFrac[i] = target.m_flFrac;
+		SetBatchVector( m_Batch.m_From, LAG_BATCH_ORIGIN_X, i, track->m_vecOrigin[from] );
+		SetBatchVector( m_Batch.m_From, LAG_BATCH_MINS_X, i, track->m_vecMinsPreScaled[from] );
+		SetBatchVector( m_Batch.m_From, LAG_BATCH_MAXS_X, i, track->m_vecMaxsPreScaled[from] );
+		SetBatchVector( m_Batch.m_To, LAG_BATCH_ORIGIN_X, i, track->m_vecOrigin[to] );
+		SetBatchVector( m_Batch.m_To, LAG_BATCH_MINS_X, i, track->m_vecMinsPreScaled[to] );
+		SetBatchVector( m_Batch.m_To, LAG_BATCH_MAXS_X, i, track->m_vecMaxsPreScaled[to] );
+		SetBatchVector( m_Batch.m_Current, LAG_BATCH_ORIGIN_X, i, pPlayer->GetLocalOrigin() );
+		SetBatchVector( m_Batch.m_Current, LAG_BATCH_MINS_X, i, pPlayer->CollisionProp()->OBBMinsPreScaled() );
+		SetBatchVector( m_Batch.m_Current, LAG_BATCH_MAXS_X, i, pPlayer->CollisionProp()->OBBMaxsPreScaled() );
+	}
+
+	// Fill out the last group of four
+	int nPadded = ( nTargets + 3 ) & ~3;
+	for ( int i = nTargets; i < nPadded; i++ )
+	{
+		m_Batch.m_flFrac[i] = 0.0f;
+		for ( int c = 0; c < LAG_BATCH_COMPONENTS; c++ )
 		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
+			m_Batch.m_From[c][i] = m_Batch.m_To[c][i] = m_Batch.m_Current[c][i] = 0.0f;
 		}
+	}
 
-		return; // that should never happen
+	for ( int i = 0; i < nPadded; i += 4 )
+	{
+		fltx4 frac = LoadAlignedSIMD( &m_Batch.m_flFrac[i] );
+		for ( int c = 0; c < LAG_BATCH_COMPONENTS; c++ )
+		{
+			fltx4 from = LoadAlignedSIMD( &m_Batch.m_From[c][i] );
+			fltx4 to = LoadAlignedSIMD( &m_Batch.m_To[c][i] );
+			StoreAlignedSIMD( &m_Batch.m_Result[c][i], AddSIMD( from, MulSIMD( SubSIMD( to, from ), frac ) ) );
+		}
 	}
+}
 
-	float frac = 0.0f;
-	if ( prevRecord && 
-		 (record->m_flSimulationTime < flTargetTime) &&
-		 (record->m_flSimulationTime < prevRecord->m_flSimulationTime) )
+//-----------------------------------------------------------------------------
+// Purpose: True if the target's current or recorded origin is relative to a
+//			move parent rather than in world space
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::IsParentedTarget( const LagTarget &target ) const
+{
+	if ( target.m_pPlayer->GetMoveParent() )
+		return true;
+
+	const CLagTrack *track = &m_PlayerTrack[ target.m_pPlayer->entindex() - 1 ];
+	if ( track->m_fFlags[ target.m_iRecord ] & LC_PARENTED )
+		return true;
+
+	return ( target.m_iPrevRecord != -1 ) && ( track->m_fFlags[ target.m_iPrevRecord ] & LC_PARENTED );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Marks the targets the shooter can't hit wherever they are between
+//			now and their backtracked position. Each target is tested as a
+//			sphere around both boxes against a cone around the aim, widened
+//			by sv_unlag_cull_bloat. The history holds local origins, so
+//			players that are or were riding a move parent are never culled.
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::CullTargets( CBasePlayer *pShooter, CUserCmd *cmd, int nTargets )
+{
+	VPROF_BUDGET( "CullTargets", "CLagCompensationManager" );
+
+	Vector vecEye = pShooter->Weapon_ShootPosition();
+	Vector vecAim;
+	AngleVectors( cmd->viewangles, &vecAim );
+
+	FourVectors eye, aim;
+	eye.DuplicateVector( vecEye );
+	aim.DuplicateVector( vecAim );
+
+	fltx4 tanCone = ReplicateX4( tanf( DEG2RAD( clamp( sv_unlag_cull_cone.GetFloat(), 0.0f, 89.0f ) ) ) );
+	fltx4 bloat = ReplicateX4( MAX( sv_unlag_cull_bloat.GetFloat(), 0.0f ) );
+	fltx4 half = ReplicateX4( 0.5f );
+
+	for ( int i = 0; i < nTargets; i += 4 )
 	{
-		// we didn't find the exact time but have a valid previous record
-		// so interpolate between these two records;
+		FourVectors center, extent;
+		for ( int axis = 0; axis < 3; axis++ )
+		{
+			fltx4 backOrigin = LoadAlignedSIMD( &m_Batch.m_Result[LAG_BATCH_ORIGIN_X + axis][i] );
+			fltx4 backMins = AddSIMD( backOrigin, LoadAlignedSIMD( &m_Batch.m_Result[LAG_BATCH_MINS_X + axis][i] ) );
+			fltx4 backMaxs = AddSIMD( backOrigin, LoadAlignedSIMD( &m_Batch.m_Result[LAG_BATCH_MAXS_X + axis][i] ) );
 
-		Assert( prevRecord->m_flSimulationTime > record->m_flSimulationTime );
-		Assert( flTargetTime < prevRecord->m_flSimulationTime );
+			fltx4 curOrigin = LoadAlignedSIMD( &m_Batch.m_Current[LAG_BATCH_ORIGIN_X + axis][i] );
+			fltx4 curMins = AddSIMD( curOrigin, LoadAlignedSIMD( &m_Batch.m_Current[LAG_BATCH_MINS_X + axis][i] ) );
+			fltx4 curMaxs = AddSIMD( curOrigin, LoadAlignedSIMD( &m_Batch.m_Current[LAG_BATCH_MAXS_X + axis][i] ) );
 
-		// calc fraction between both records
-		frac = ( flTargetTime - record->m_flSimulationTime ) / 
-			( prevRecord->m_flSimulationTime - record->m_flSimulationTime );
+			// sv_unlag_fixstuck can leave a player anywhere in between
+			fltx4 mins = MinSIMD( backMins, curMins );
+			fltx4 maxs = MaxSIMD( backMaxs, curMaxs );
 
-		Assert( frac > 0 && frac < 1 ); // should never extrapolate
+			center[axis] = MulSIMD( AddSIMD( mins, maxs ), half );
+			extent[axis] = MulSIMD( SubSIMD( maxs, mins ), half );
+		}
+
+		fltx4 radius = AddSIMD( SqrtSIMD( extent * extent ), bloat );
+
+		center -= eye;
+		fltx4 along = center * aim;
+		fltx4 perpSqr = MaxSIMD( Four_Zeros, SubSIMD( center * center, MulSIMD( along, along ) ) );
+		fltx4 reach = MaddSIMD( MaxSIMD( along, Four_Zeros ), tanCone, radius );
+
+		// Within the cone, and not entirely behind the shooter
+		fltx4 keep = AndSIMD( CmpLeSIMD( perpSqr, MulSIMD( reach, reach ) ), CmpGeSIMD( AddSIMD( along, radius ), Four_Zeros ) );
+		int keepMask = TestSignSIMD( keep );
+
+		for ( int lane = 0; lane < 4 && i + lane < nTargets; lane++ )
+		{
+			LagTarget &target = m_Targets[i + lane];
+			target.m_bCulled = !( keepMask & ( 1 << lane ) );
+
+			if ( target.m_bCulled && IsParentedTarget( target ) )
+			{
+				target.m_bCulled = false;
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves a player to org and the target's recorded angles, bounds and
+//			animation, remembering what to restore
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::ApplyBacktrack( const LagTarget &target, float flTargetTime, Vector org, const Vector &minsPreScaled, const Vector &maxsPreScaled )
+{
+	VPROF_BUDGET( "ApplyBacktrack", "CLagCompensationManager" );
 
-		ang				= Lerp( frac, record->m_vecAngles, prevRecord->m_vecAngles );
-		org				= Lerp( frac, record->m_vecOrigin, prevRecord->m_vecOrigin );
-		minsPreScaled	= Lerp( frac, record->m_vecMinsPreScaled, prevRecord->m_vecMinsPreScaled );
-		maxsPreScaled	= Lerp( frac, record->m_vecMaxsPreScaled, prevRecord->m_vecMaxsPreScaled );
+	CBasePlayer *pPlayer = target.m_pPlayer;
+	int pl_index = pPlayer->entindex() - 1;
+	CLagTrack *track = &m_PlayerTrack[ pl_index ];
+
+	float frac = target.m_flFrac;
+	LagAnimRecord *record = &track->m_Animation[ target.m_iRecord ];
+	LagAnimRecord *prevRecord = ( target.m_iPrevRecord != -1 ) ? &track->m_Animation[ target.m_iPrevRecord ] : NULL;
+
+	QAngle ang;
+	if ( frac > 0.0f )
+	{
+		ang = Lerp( frac, track->m_vecAngles[ target.m_iRecord ], track->m_vecAngles[ target.m_iPrevRecord ] );
 	}
 	else
 	{
-		// we found the exact record or no other record to interpolate with
-		// just copy these values since they are the best we have
-		org				= record->m_vecOrigin;
-		ang				= record->m_vecAngles;
-		minsPreScaled	= record->m_vecMinsPreScaled;
-		maxsPreScaled	= record->m_vecMaxsPreScaled;
+		ang = track->m_vecAngles[ target.m_iRecord ];
 	}
 
 	// See if this is still a valid position for us to teleport to
@@ -9,12 +9,177 @@
 #include "recipientfilter.h"
 #include "team.h"
 #include "ipredictionsystem.h"
+#include "tier1/utlhashtable.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 static IPredictionSystem g_RecipientFilterPredictionSystem;
 
+ConVar sv_multicast_cache( "sv_multicast_cache", "1", 0, "Reuse the players found in the PVS/PAS of a cluster until the tick ends or a player's ear changes cluster" );
+
+//-----------------------------------------------------------------------------
+// Purpose: Remembers which players the engine found in the PVS or PAS of a
+//			point, by the point's cluster and area, until the next tick. The
+//			engine tests the cluster and area of every client's ear against the
+//			point each time it's asked, and explosions, impacts and sounds ask
+//			many times a tick for points close together.
+//
+//			The answers also depend on where the players' ears are, which moves
+//			during the tick as commands run and players teleport or respawn, so
+//			every lookup checks whether any ear has changed cluster or area
+//			since the answers were cached.
+//-----------------------------------------------------------------------------
+class CMulticastRecipientCache : public CAutoGameSystem
+{
+public:
+	CMulticastRecipientCache()
+	 :	CAutoGameSystem( "CMulticastRecipientCache" ),
+		m_nTick( -1 )
+	{
+		for ( int i = 0; i < ABSOLUTE_PLAYER_LIMIT; i++ )
+		{
+			m_Listeners[i].bPresent = false;
+		}
+	}
+
+	void GetRecipients( bool usepas, const Vector &origin, CBitVec< ABSOLUTE_PLAYER_LIMIT > &playerbits );
+	void Flush();
+
+	// CAutoGameSystem
+	virtual void LevelShutdownPostEntity() { Flush(); }
+
+private:
+	bool UpdateListeners();
+
+	struct Listener_t
+	{
+		bool bPresent;
+		Vector vecEar;
+		int cluster;
+		int area;
+	};
+
+	CUtlHashtable< uint32, CBitVec< ABSOLUTE_PLAYER_LIMIT > > m_Recipients;
+	Listener_t m_Listeners[ ABSOLUTE_PLAYER_LIMIT ];
+	int m_nTick;
+	CThreadFastMutex m_Mutex;
+};
+
+static CMulticastRecipientCache g_MulticastRecipientCache;
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the existing players in the PVS or PAS of the point
+//-----------------------------------------------------------------------------
+static void DetermineMulticastRecipients( bool usepas, const Vector &origin, CBitVec< ABSOLUTE_PLAYER_LIMIT > &playerbits )
+{
+	engine->Message_DetermineMulticastRecipients( usepas, origin, playerbits );
+
+	for ( int index = playerbits.FindNextSetBit( 0 ); index > -1; index = playerbits.FindNextSetBit( index + 1 ) )
+	{
+		if ( !UTIL_PlayerByIndex( index + 1 ) )
+		{
+			playerbits.Clear( index );
+		}
+	}
+}
+
+void CMulticastRecipientCache::GetRecipients( bool usepas, const Vector &origin, CBitVec< ABSOLUTE_PLAYER_LIMIT > &playerbits )
+{
+	if ( !sv_multicast_cache.GetBool() )
+	{
+		DetermineMulticastRecipients( usepas, origin, playerbits );
+		return;
+	}
+
+	// The engine only looks at the point's cluster and area
+	uint32 key = ( (uint32)engine->GetClusterForOrigin( origin ) << 10 ) | ( ( engine->GetArea( origin ) & 0x1FF ) << 1 ) | ( usepas ? 1 : 0 );
+
+	AUTO_LOCK( m_Mutex );
+
+	if ( m_nTick != gpGlobals->tickcount )
+	{
+		m_Recipients.RemoveAll();
+		m_nTick = gpGlobals->tickcount;
+	}
+
+	if ( UpdateListeners() )
+	{
+		m_Recipients.RemoveAll();
+	}
+
+	UtlHashHandle_t h = m_Recipients.Find( key );
+	if ( h == m_Recipients.InvalidHandle() )
+	{
+		DetermineMulticastRecipients( usepas, origin, playerbits );
+		m_Recipients.Insert( key, playerbits );
+		return;
+	}
+
+	playerbits = m_Recipients.Element( h );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Tracks the cluster and area of every player's ear. Returns true if
+//			a player has come, gone, or moved into another cluster or area
+//			since the last call. Only ears that have moved are looked up.
+//-----------------------------------------------------------------------------
+bool CMulticastRecipientCache::UpdateListeners()
+{
+	bool bChanged = false;
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		Listener_t &listener = m_Listeners[i - 1];
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( !pPlayer )
+		{
+			bChanged |= listener.bPresent;
+			listener.bPresent = false;
+			continue;
+		}
+
+		// What the engine gets from CServerGameClients::ClientEarPosition()
+		Vector vecEar = pPlayer->EarPosition();
+		if ( listener.bPresent && vecEar == listener.vecEar )
+			continue;
+
+		int cluster = engine->GetClusterForOrigin( vecEar );
+		int area = engine->GetArea( vecEar );
+		if ( !listener.bPresent || cluster != listener.cluster || area != listener.area )
+		{
+			bChanged = true;
+		}
+
+		listener.bPresent = true;
+		listener.vecEar = vecEar;
+		listener.cluster = cluster;
+		listener.area = area;
+	}
+	return bChanged;
+}
+
+void CMulticastRecipientCache::Flush()
+{
+	AUTO_LOCK( m_Mutex );
+	m_Recipients.RemoveAll();
+	m_nTick = -1;
+}
+
+void RecipientFilter_FlushMulticastCache()
+{
+	g_MulticastRecipientCache.Flush();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Number of set bits
+//-----------------------------------------------------------------------------
+static inline int CountBits( uint32 n )
+{
+	n = n - ( ( n >> 1 ) & 0x55555555 );
+	n = ( n & 0x33333333 ) + ( ( n >> 2 ) & 0x33333333 );
+	return ( ( ( n + ( n >> 4 ) ) & 0x0F0F0F0F ) * 0x01010101 ) >> 24;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -39,11 +204,8 @@ void CRecipientFilter::CopyFrom( const CRecipientFilter& src )
 	m_bUsingPredictionRules = src.IsUsingPredictionRules();
 	m_bIgnorePredictionCull = src.IgnorePredictionCull();
 
-	int c = src.GetRecipientCount();
-	for ( int i = 0; i < c; ++i )
-	{
-		m_Recipients.AddToTail( src.GetRecipientIndex( i ) );
-	}
+	m_RecipientBits.Or( src.m_RecipientBits, &m_RecipientBits );
+	m_nRecipients = -1;
 }
 
 //-----------------------------------------------------------------------------
@@ -53,7 +215,8 @@ void CRecipientFilter::Reset( void )
 {
 	m_bReliable			= false;
 	m_bInitMessage		= false;
-	m_Recipients.RemoveAll();
+	m_RecipientBits.ClearAll();
+	m_nRecipients = 0;
 	m_bUsingPredictionRules = false;
 	m_bIgnorePredictionCull = false;
 }
@@ -70,7 +233,11 @@ bool CRecipientFilter::IsReliable( void ) const
 
 int CRecipientFilter::GetRecipientCount( void ) const
 {
-	return m_Recipients.Size();
+	if ( m_nRecipients < 0 )
+	{
+		UpdateRecipientList();
+	}
+	return m_nRecipients;
 }
 
 int	CRecipientFilter::GetRecipientIndex( int slot ) const
@@ -78,12 +245,37 @@ int	CRecipientFilter::GetRecipientIndex( int slot ) const
 	if ( slot < 0 || slot >= GetRecipientCount() )
 		return -1;
 
-	return m_Recipients[ slot ];
+	return m_RecipientList[ slot ];
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Lists the player indices in m_RecipientBits, in order
+//-----------------------------------------------------------------------------
+void CRecipientFilter::UpdateRecipientList( void ) const
+{
+	int nRecipients = 0;
+	for ( int i = 0; i < m_RecipientBits.GetNumDWords(); i++ )
+	{
+		uint32 bits = m_RecipientBits.GetDWord( i );
+		if ( !bits )
+			continue;
+
+		int nBits = CountBits( bits );
+		for ( int bit = 0; nBits; bit++ )
+		{
+			if ( bits & ( 1u << bit ) )
+			{
+				m_RecipientList[ nRecipients++ ] = ( i << 5 ) + bit + 1;
+				nBits--;
+			}
+		}
+	}
+	m_nRecipients = nRecipients;
 }
 
 void CRecipientFilter::AddAllPlayers( void )
 {
-	m_Recipients.RemoveAll();
+	RemoveAllRecipients();
 
 	int i;
 	for ( i = 1; i <= gpGlobals->maxClients; i++ )
@@ -106,6 +298,7 @@ void CRecipientFilter::AddRecipient( const CBasePlayer *player )
 		return;
 
 	int index = player->entindex();
+	Assert( index >= 1 && index <= ABSOLUTE_PLAYER_LIMIT );
 
 	// If we're predicting and this is not the first time we've predicted this sound
 	//  then don't send it to the local player again.
@@ -119,15 +312,17 @@ void CRecipientFilter::AddRecipient( const CBasePlayer *player )
 	}
 
 	// Already in list
-	if ( m_Recipients.Find( index ) != m_Recipients.InvalidIndex() )
+	if ( m_RecipientBits.IsBitSet( index - 1 ) )
 		return;
 
-	m_Recipients.AddToTail( index );
+	m_RecipientBits.Set( index - 1 );
+	m_nRecipients = -1;
 }
 
 void CRecipientFilter::RemoveAllRecipients( void )
 {
-	m_Recipients.RemoveAll();
+	m_RecipientBits.ClearAll();
+	m_nRecipients = 0;
 }
 
 void CRecipientFilter::RemoveRecipient( CBasePlayer *player )
@@ -135,10 +330,7 @@ void CRecipientFilter::RemoveRecipient( CBasePlayer *player )
 	Assert( player );
 	if ( player )
 	{
-		int index = player->entindex();
-
-		// Remove it if it's in the list
-		m_Recipients.FindAndRemove( index );
+		RemoveRecipientByPlayerIndex( player->entindex() );
 	}
 }
 
@@ -146,7 +338,11 @@ void CRecipientFilter::RemoveRecipientByPlayerIndex( int playerindex )
 {
 	Assert( playerindex >= 1 && playerindex <= ABSOLUTE_PLAYER_LIMIT );
 
-	m_Recipients.FindAndRemove( playerindex );
+	if ( m_RecipientBits.IsBitSet( playerindex - 1 ) )
+	{
+		m_RecipientBits.Clear( playerindex - 1 );
+		m_nRecipients = -1;
+	}
 }
 
 void CRecipientFilter::AddRecipientsByTeam( CTeam *team )
@@ -231,6 +427,25 @@ void CRecipientFilter::RemovePlayersFromBitMask( CBitVec< ABSOLUTE_PLAYER_LIMIT
 	}
 }
 
+void CRecipientFilter::AddPlayerBits( const CBitVec< ABSOLUTE_PLAYER_LIMIT >& playerbits )
+{
+	CBasePlayer *pSuppressHost = NULL;
+	if ( m_bUsingPredictionRules )
+	{
+		pSuppressHost = ToBasePlayer( (CBaseEntity*)g_RecipientFilterPredictionSystem.GetSuppressHost() );
+	}
+
+	// Like AddRecipient(), leave the suppressed host in if it was already in
+	bool bKeepHost = pSuppressHost && m_RecipientBits.IsBitSet( pSuppressHost->entindex() - 1 );
+
+	m_RecipientBits.Or( playerbits, &m_RecipientBits );
+	if ( pSuppressHost && !bKeepHost )
+	{
+		m_RecipientBits.Clear( pSuppressHost->entindex() - 1 );
+	}
+	m_nRecipients = -1;
+}
+
 void CRecipientFilter::AddRecipientsByPVS( const Vector& origin )
 {
 	if ( gpGlobals->maxClients == 1 )
@@ -240,8 +455,8 @@ void CRecipientFilter::AddRecipientsByPVS( const Vector& origin )
 	else
 	{
 		CBitVec< ABSOLUTE_PLAYER_LIMIT > playerbits;
-		engine->Message_DetermineMulticastRecipients( false, origin, playerbits );
-		AddPlayersFromBitMask( playerbits );
+		g_MulticastRecipientCache.GetRecipients( false, origin, playerbits );
+		AddPlayerBits( playerbits );
 	}
 }
 
@@ -249,13 +464,15 @@ void CRecipientFilter::RemoveRecipientsByPVS( const Vector& origin )
 {
 	if ( gpGlobals->maxClients == 1 )
 	{
-		m_Recipients.RemoveAll();
+		RemoveAllRecipients();
 	}
 	else
 	{
-		CBitVec< ABSOLUTE_PLAYER_LIMIT > playerbits;
-		engine->Message_DetermineMulticastRecipients( false, origin, playerbits );
-		RemovePlayersFromBitMask( playerbits );
+		CBitVec< ABSOLUTE_PLAYER_LIMIT > playerbits, keepbits;
+		g_MulticastRecipientCache.GetRecipients( false, origin, playerbits );
+		playerbits.Not( &keepbits );
+		m_RecipientBits.And( keepbits, &m_RecipientBits );
+		m_nRecipients = -1;
 	}
 }
 
@@ -270,8 +487,8 @@ void CRecipientFilter::AddRecipientsByPAS( const Vector& origin )
 	else
 	{
 		CBitVec< ABSOLUTE_PLAYER_LIMIT > playerbits;
-		engine->Message_DetermineMulticastRecipients( true, origin, playerbits );
-		AddPlayersFromBitMask( playerbits );
+		g_MulticastRecipientCache.GetRecipients( true, origin, playerbits );
+		AddPlayerBits( playerbits );
 	}
 }
 
@@ -56,9 +56,19 @@ public:
 	void RemovePlayersFromBitMask( CBitVec<ABSOLUTE_PLAYER_LIMIT>& playerbits );
 
 private:
+	// Adds players known to exist, skipping the suppressed host under prediction rules
+	void AddPlayerBits( const CBitVec<ABSOLUTE_PLAYER_LIMIT>& playerbits );
+	void UpdateRecipientList() const;
+
 	bool m_bReliable;
 	bool m_bInitMessage;
-	CUtlVector<int> m_Recipients;
+
+	// Indexed by player index - 1
+	CBitVec<ABSOLUTE_PLAYER_LIMIT> m_RecipientBits;
+
+	// m_RecipientBits as a list of player indices, for GetRecipientIndex(). -1 when it needs rebuilding
+	mutable int m_nRecipients;
+	mutable unsigned char m_RecipientList[ ABSOLUTE_PLAYER_LIMIT ];
 
 	// If using prediction rules, the filter itself suppresses local player
 	bool m_bUsingPredictionRules;
@@ -67,6 +77,10 @@ private:
 	bool m_bIgnorePredictionCull;
 };
 
+// Forgets which players could see or hear the points filtered by PVS/PAS this tick.
+// Call when players come or go.
+void RecipientFilter_FlushMulticastCache();
+
 //-----------------------------------------------------------------------------
 // Purpose: Simple class to create a filter for a single player ( unreliable )
 //-----------------------------------------------------------------------------
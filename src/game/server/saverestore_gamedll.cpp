@@ -12,6 +12,91 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+//-----------------------------------------------------------------------------
+// Purpose: sets one keyfield of a typedescript data block from its text value
+// Input  : *pObject - pointer to the struct or class holding the field
+//			*pField - the field to set
+//			char *szValue - value to set the variable to
+// Output : Returns true if the field was set, false if its type can't be set from a key.
+//-----------------------------------------------------------------------------
+bool ParseKeyvalueField( void *pObject, typedescription_t *pField, const char *szValue )
+{
+	int fieldOffset = pField->fieldOffset[ TD_OFFSET_NORMAL ];
+
+	switch( pField->fieldType )
+	{
+	case FIELD_MODELNAME:
+	case FIELD_SOUNDNAME:
+	case FIELD_STRING:
+		(*(string_t *)((char *)pObject + fieldOffset)) = AllocPooledString( szValue );
+		return true;
+
+	case FIELD_TIME:
+	case FIELD_FLOAT:
+		(*(float *)((char *)pObject + fieldOffset)) = atof( szValue );
+		return true;
+
+	case FIELD_BOOLEAN:
+		(*(bool *)((char *)pObject + fieldOffset)) = (bool)(atoi( szValue ) != 0);
+		return true;
+
+	case FIELD_CHARACTER:
+		(*(char *)((char *)pObject + fieldOffset)) = (char)atoi( szValue );
+		return true;
+
+	case FIELD_SHORT:
+		(*(short *)((char *)pObject + fieldOffset)) = (short)atoi( szValue );
+		return true;
+
+	case FIELD_INTEGER:
+	case FIELD_TICK:
+		(*(int *)((char *)pObject + fieldOffset)) = atoi( szValue );
+		return true;
+
+	case FIELD_POSITION_VECTOR:
+	case FIELD_VECTOR:
+		UTIL_StringToVector( (float *)((char *)pObject + fieldOffset), szValue );
+		return true;
+
+	case FIELD_VMATRIX:
+	case FIELD_VMATRIX_WORLDSPACE:
+		UTIL_StringToFloatArray( (float *)((char *)pObject + fieldOffset), 16, szValue );
+		return true;
+
+	case FIELD_MATRIX3X4_WORLDSPACE:
+		UTIL_StringToFloatArray( (float *)((char *)pObject + fieldOffset), 12, szValue );
+		return true;
+
+	case FIELD_COLOR32:
+		UTIL_StringToColor32( reinterpret_cast<Color&>( *((char*)pObject + fieldOffset) ), szValue );
+		return true;
+
+	case FIELD_CUSTOM:
+	{
+		SaveRestoreFieldInfo_t fieldInfo =
+		{
+			(char *)pObject + fieldOffset,
+			pObject,
+			pField
+		};
+		pField->pSaveRestoreOps->Parse( fieldInfo, szValue );
+		return true;
+	}
+
+	default:
+	case FIELD_INTERVAL: // Fixme, could write this if needed
+	case FIELD_CLASSPTR:
+	case FIELD_MODELINDEX:
+	case FIELD_MATERIALINDEX:
+	case FIELD_EDICT:
+		Warning( "Bad field in entity!!\n" );
+		Assert(0);
+		break;
+	}
+
+	return false;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: iterates through a typedescript data block, so it can insert key/value data into the block
 // Input  : *pObject - pointer to the struct or class the data is to be insterted into
@@ -45,80 +130,53 @@ bool ParseKeyvalue( void *pObject, typedescription_t *pFields, int iNumFields, c
 
 		if ( (pField->flags & FTYPEDESC_KEY) && !stricmp(pField->externalName, szKeyName) )
 		{
-			switch( pField->fieldType )
-			{
-			case FIELD_MODELNAME:
-			case FIELD_SOUNDNAME:
-			case FIELD_STRING:
-				(*(string_t *)((char *)pObject + fieldOffset)) = AllocPooledString( szValue );
-				return true;
-
-			case FIELD_TIME:
-			case FIELD_FLOAT:
-				(*(float *)((char *)pObject + fieldOffset)) = atof( szValue );
-				return true;
-
-			case FIELD_BOOLEAN:
-				(*(bool *)((char *)pObject + fieldOffset)) = (bool)(atoi( szValue ) != 0);
-				return true;
-
-			case FIELD_CHARACTER:
-				(*(char *)((char *)pObject + fieldOffset)) = (char)atoi( szValue );
-				return true;
-
-			case FIELD_SHORT:
-				(*(short *)((char *)pObject + fieldOffset)) = (short)atoi( szValue );
-				return true;
-
-			case FIELD_INTEGER:
-			case FIELD_TICK:
-				(*(int *)((char *)pObject + fieldOffset)) = atoi( szValue );
-				return true;
-
-			case FIELD_POSITION_VECTOR:
-			case FIELD_VECTOR:
-				UTIL_StringToVector( (float *)((char *)pObject + fieldOffset), szValue );
+			if ( ParseKeyvalueField( pObject, pField, szValue ) )
 				return true;
+		}
+	}
 
-			case FIELD_VMATRIX:
-			case FIELD_VMATRIX_WORLDSPACE:
-				UTIL_StringToFloatArray( (float *)((char *)pObject + fieldOffset), 16, szValue );
-				return true;
+	return false;
+}
 
-			case FIELD_MATRIX3X4_WORLDSPACE:
-				UTIL_StringToFloatArray( (float *)((char *)pObject + fieldOffset), 12, szValue );
-				return true;
 
-			case FIELD_COLOR32:
-				UTIL_StringToColor32( reinterpret_cast<Color&>( *((char*)pObject + fieldOffset) ), szValue );
-				return true;
+//-----------------------------------------------------------------------------
+// Purpose: finds the keyfield ParseKeyvalue() would set for a key, searching the
+//			same fields in the same order
+// Input  : *pFields - description of the data
+//			iNumFields - number of fields contained in pFields
+//			char *szKeyName - name of the variable to look for
+//			*pObjectOffset - receives the offset of the (embedded) object holding the field
+// Output : Returns the field, or NULL if no keyfield has the name.
+//-----------------------------------------------------------------------------
+typedescription_t *FindKeyvalueField( typedescription_t *pFields, int iNumFields, const char *szKeyName, int *pObjectOffset )
+{
+	for ( int i = 0; i < iNumFields; i++ )
+	{
+		typedescription_t *pField = &pFields[i];
 
-			case FIELD_CUSTOM:
+		// Check the nested classes, but only if they aren't in array form.
+		if ((pField->fieldType == FIELD_EMBEDDED) && (pField->fieldSize == 1))
+		{
+			for ( datamap_t *dmap = pField->td; dmap != NULL; dmap = dmap->baseMap )
 			{
-				SaveRestoreFieldInfo_t fieldInfo =
+				int nEmbeddedOffset = 0;
+				typedescription_t *pEmbeddedField = FindKeyvalueField( dmap->dataDesc, dmap->dataNumFields, szKeyName, &nEmbeddedOffset );
+				if ( pEmbeddedField )
 				{
-					(char *)pObject + fieldOffset,
-					pObject,
-					pField
-				};
-				pField->pSaveRestoreOps->Parse( fieldInfo, szValue );
-				return true;
+					*pObjectOffset = pField->fieldOffset[ TD_OFFSET_NORMAL ] + nEmbeddedOffset;
+					return pEmbeddedField;
+				}
 			}
+		}
 
-			default:
-			case FIELD_INTERVAL: // Fixme, could write this if needed
-			case FIELD_CLASSPTR:
-			case FIELD_MODELINDEX:
-			case FIELD_MATERIALINDEX:
-			case FIELD_EDICT:
-				Warning( "Bad field in entity!!\n" );
-				Assert(0);
-				break;
-			}
+		if ( (pField->flags & FTYPEDESC_KEY) && !stricmp(pField->externalName, szKeyName) )
+		{
+			*pObjectOffset = 0;
+			return pField;
 		}
 	}
 
-	return false;
+	return NULL;
 }
 
 
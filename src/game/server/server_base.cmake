@@ -115,6 +115,8 @@ set( SERVER_BASE_SOURCE_FILES
 	"${SERVER_BASE_DIR}/AI_ResponseSystem.h"
 	"${SERVER_BASE_DIR}/ai_route.cpp"
 	"${SERVER_BASE_DIR}/ai_route.h"
+	"${SERVER_BASE_DIR}/ai_routecache.cpp"
+	"${SERVER_BASE_DIR}/ai_routecache.h"
 	"${SERVER_BASE_DIR}/ai_routedist.h"
 	"${SERVER_BASE_DIR}/ai_saverestore.cpp"
 	"${SERVER_BASE_DIR}/ai_saverestore.h"
@@ -238,6 +240,8 @@ set( SERVER_BASE_SOURCE_FILES
 	"${SERVER_BASE_DIR}/entityinput.h"
 	"${SERVER_BASE_DIR}/entitylist.cpp"
 	"${SERVER_BASE_DIR}/entitylist.h"
+	"${SERVER_BASE_DIR}/entitysoa.cpp"
+	"${SERVER_BASE_DIR}/entitysoa.h"
 	"${SRCDIR}/game/shared/entitylist_base.cpp"
 	"${SERVER_BASE_DIR}/entityoutput.h"
 	"${SERVER_BASE_DIR}/EntityParticleTrail.cpp"
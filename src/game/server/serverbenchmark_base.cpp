@@ -9,6 +9,14 @@
 #include "props.h"
 #include "filesystem.h"
 #include "tier0/icommandline.h"
+#include "tier1/datacodec.h"
+#include "tier1/utlbufferview.h"
+#include "tier1/CommandBuffer.h"
+#include "tier1/fmtstr.h"
+#include "tier0/fasttimer.h"
+#include "vstdlib/jobthread.h"
+#include "bspfile.h"
+#include "KeyValues.h"
 
 
 // Server benchmark. Only works on specified maps.
@@ -21,12 +29,56 @@
 static ConVar sv_benchmark_numticks( "sv_benchmark_numticks", "3300", 0, "If > 0, then it only runs the benchmark for this # of ticks." );
 static ConVar sv_benchmark_autovprofrecord( "sv_benchmark_autovprofrecord", "0", 0, "If running a benchmark and this is set, it will record a vprof file over the duration of the benchmark with filename benchmark.vprof." );
 
-static float s_flBenchmarkStartWaitSeconds = 3;	// Wait this many seconds after level load before starting the benchmark.
+// What the benchmark does. The defaults can be overridden by a scenario file given with
+// -sv_benchmark_scenario, e.g.
+//
+// "ServerBenchmark"
+// {
+//		"seed"						"0"
+//		"ticks"						"3300"
+//		"bots"						"22"
+//		"random_entity_slots"		"200"
+//		"random_entities_min"		"5"
+//		"random_entities_max"		"20"
+//		"random_entity_interval"	"33"
+//		"output"					"sv_benchmark_results.json"
+// }
+struct ServerBenchmarkScenario_t
+{
+	ServerBenchmarkScenario_t()
+	{
+		m_nSeed = 0;
+		m_nTicks = 0;
+		m_flStartWaitSeconds = 3;
+		m_nBotsToCreate = 22;
+		m_nBotCreateInterval = 50;
+		m_nPhysicsObjects = 100;
+		m_nRandomEntitySlots = 0;
+		m_nRandomEntitiesMin = 0;
+		m_nRandomEntitiesMax = 0;
+		m_nRandomEntityInterval = 33;
+		V_strncpy( m_szOutputFile, "sv_benchmark_results.json", sizeof( m_szOutputFile ) );
+	}
+
+	int m_nSeed;					// Random seed used once the benchmark starts running.
+	int m_nTicks;					// Run for this many ticks, or sv_benchmark_numticks if 0.
+	float m_flStartWaitSeconds;		// Wait this many seconds after level load before starting the benchmark.
+	int m_nBotsToCreate;			// Create this many bots.
+	int m_nBotCreateInterval;		// Create a bot every N ticks.
+	int m_nPhysicsObjects;			// Create this many physics objects.
+	int m_nRandomEntitySlots;		// Slots for Test_InitRandomEntitySpawner, 0 to spawn no random entities.
+	int m_nRandomEntitiesMin;		// Test_SpawnRandomEntities arguments,
+	int m_nRandomEntitiesMax;
+	int m_nRandomEntityInterval;	// run every N ticks.
+	char m_szOutputFile[MAX_PATH];	// JSON report
+};
 
-static int s_nBenchmarkBotsToCreate = 22;		// Create this many bots.
-static int s_nBenchmarkBotCreateInterval = 50;	// Create a bot every N ticks.
+extern void Test_InitRandomEntitySpawner( const CCommand &args );
+extern void Test_SpawnRandomEntities( const CCommand &args );
 
-static int s_nBenchmarkPhysicsObjects = 100;	// Create this many physics objects.
+static const char *s_pszBenchmarkSectionNames[NUM_BENCHMARK_SECTIONS + 1] = { "think", "physics", "movement", "networking", "other" };
+#define BENCHMARK_SECTION_OTHER NUM_BENCHMARK_SECTIONS
+#define MAX_BENCHMARK_SECTION_DEPTH 8
 
 
 static double Benchmark_ValidTime()
@@ -49,6 +101,8 @@ public:
 	CServerBenchmark()
 	{
 		m_BenchmarkState = BENCHMARKSTATE_NOT_RUNNING;
+		m_bHaveTickStart = false;
+		m_nSectionDepth = 0;
 		
 		// The benchmark should always have the same seed and do exactly the same thing on the same ticks.
 		m_RandomStream.SetSeed( 1111 ); 
@@ -58,7 +112,50 @@ public:
 	{
 		bool bBenchmark = (CommandLine()->FindParm( "-sv_benchmark" ) != 0);
 
-		return InternalStartBenchmark( bBenchmark, s_flBenchmarkStartWaitSeconds );
+		int nBenchmarkMode = 0;
+		if ( bBenchmark )
+		{
+			// -sv_benchmark_exit is the headless mode the dedicated launcher's -benchmark sets up
+			nBenchmarkMode = ( CommandLine()->FindParm( "-sv_benchmark_exit" ) != 0 ) ? 2 : 1;
+			LoadScenario( CommandLine()->ParmValue( "-sv_benchmark_scenario", "" ) );
+		}
+
+		return InternalStartBenchmark( nBenchmarkMode, m_Scenario.m_flStartWaitSeconds );
+	}
+
+	void LoadScenario( const char *pszFile )
+	{
+		m_Scenario = ServerBenchmarkScenario_t();
+		if ( !pszFile[0] )
+			return;
+
+		KeyValues *pKV = new KeyValues( "ServerBenchmark" );
+		if ( !pKV->LoadFromFile( filesystem, pszFile, "GAME" ) )
+		{
+			Warning( "Unable to load benchmark scenario %s, using the default one.\n", pszFile );
+			pKV->deleteThis();
+			return;
+		}
+
+		m_Scenario.m_nSeed = pKV->GetInt( "seed", m_Scenario.m_nSeed );
+		m_Scenario.m_nTicks = pKV->GetInt( "ticks", m_Scenario.m_nTicks );
+		m_Scenario.m_flStartWaitSeconds = pKV->GetFloat( "warmup_seconds", m_Scenario.m_flStartWaitSeconds );
+		m_Scenario.m_nBotsToCreate = pKV->GetInt( "bots", m_Scenario.m_nBotsToCreate );
+		m_Scenario.m_nBotCreateInterval = MAX( 1, pKV->GetInt( "bot_interval", m_Scenario.m_nBotCreateInterval ) );
+		m_Scenario.m_nPhysicsObjects = pKV->GetInt( "physics_props", m_Scenario.m_nPhysicsObjects );
+		m_Scenario.m_nRandomEntitySlots = pKV->GetInt( "random_entity_slots", m_Scenario.m_nRandomEntitySlots );
+		m_Scenario.m_nRandomEntitiesMin = pKV->GetInt( "random_entities_min", m_Scenario.m_nRandomEntitiesMin );
+		m_Scenario.m_nRandomEntitiesMax = MAX( m_Scenario.m_nRandomEntitiesMin, pKV->GetInt( "random_entities_max", m_Scenario.m_nRandomEntitiesMax ) );
+		m_Scenario.m_nRandomEntityInterval = MAX( 1, pKV->GetInt( "random_entity_interval", m_Scenario.m_nRandomEntityInterval ) );
+		V_strncpy( m_Scenario.m_szOutputFile, pKV->GetString( "output", m_Scenario.m_szOutputFile ), sizeof( m_Scenario.m_szOutputFile ) );
+		pKV->deleteThis();
+
+		Msg( "Loaded benchmark scenario %s\n", pszFile );
+	}
+
+	int GetNumTicks()
+	{
+		return ( m_Scenario.m_nTicks > 0 ) ? m_Scenario.m_nTicks : sv_benchmark_numticks.GetInt();
 	}
 
 	// nBenchmarkMode: 0 = no benchmark
@@ -88,6 +185,14 @@ public:
 		m_nBotsCreated = 0;
 		m_nStartWaitCounter = -1;
 
+		m_TickTimes.Purge();
+		for ( int i = 0; i <= NUM_BENCHMARK_SECTIONS; i++ )
+		{
+			m_SectionTimes[i].Purge();
+		}
+		m_bHaveTickStart = false;
+		m_nSectionDepth = 0;
+
 		// Setup the benchmark environment.
 		engine->SetDedicatedServerBenchmarkMode( true );	// Run 1 tick per frame and ignore all timing stuff.
 
@@ -124,16 +229,24 @@ public:
 
 				StartVProfRecord();
 
-				RandomSeed( 0 );
-				m_RandomStream.SetSeed( 0 );
+				RandomSeed( m_Scenario.m_nSeed );
+				m_RandomStream.SetSeed( m_Scenario.m_nSeed );
+
+				if ( m_Scenario.m_nRandomEntitySlots > 0 )
+				{
+					CCommand args;
+					args.Tokenize( CFmtStr( "Test_InitRandomEntitySpawner %d", m_Scenario.m_nRandomEntitySlots ) );
+					Test_InitRandomEntitySpawner( args );
+				}
 			}
 		}
 
 		int nTicksRunSoFar = gpGlobals->tickcount - m_nBenchmarkStartTick;
 		UpdateBenchmarkCounter();
+		RecordTick();
 	
 		// Are we finished with the benchmark?
-		if ( nTicksRunSoFar >= sv_benchmark_numticks.GetInt() )
+		if ( nTicksRunSoFar >= GetNumTicks() )
 		{
 			EndVProfRecord();
 			OutputResults();
@@ -144,9 +257,79 @@ public:
 		// Ok, update whatever we're doing in the benchmark.
 		UpdatePlayerCreation();
 		UpdateVPhysicsObjects();
+		UpdateRandomEntities();
 		CServerBenchmarkHook::s_pBenchmarkHook->UpdateBenchmark();
 	}
 
+	void UpdateRandomEntities()
+	{
+		if ( m_Scenario.m_nRandomEntitySlots <= 0 || ( GetTickOffset() % m_Scenario.m_nRandomEntityInterval ) != 0 )
+			return;
+
+		CCommand args;
+		args.Tokenize( CFmtStr( "Test_SpawnRandomEntities %d %d", m_Scenario.m_nRandomEntitiesMin, m_Scenario.m_nRandomEntitiesMax ) );
+		Test_SpawnRandomEntities( args );
+	}
+
+	// Called once per tick; closes the tick that just ended.
+	void RecordTick()
+	{
+		CCycleCount now;
+		now.Sample();
+
+		if ( m_bHaveTickStart )
+		{
+			CCycleCount elapsed;
+			CCycleCount::Sub( now, m_TickStart, elapsed );
+			float flTickMs = elapsed.GetMillisecondsF();
+			m_TickTimes.AddToTail( flTickMs );
+
+			float flOtherMs = flTickMs;
+			for ( int i = 0; i < NUM_BENCHMARK_SECTIONS; i++ )
+			{
+				m_SectionTimes[i].AddToTail( m_flTickSectionMs[i] );
+				flOtherMs -= m_flTickSectionMs[i];
+			}
+			m_SectionTimes[BENCHMARK_SECTION_OTHER].AddToTail( MAX( flOtherMs, 0.0f ) );
+		}
+
+		V_memset( m_flTickSectionMs, 0, sizeof( m_flTickSectionMs ) );
+		m_TickStart = now;
+		m_bHaveTickStart = true;
+	}
+
+	virtual void EnterSection( EBenchmarkSection_t nSection )
+	{
+		if ( m_nSectionDepth < MAX_BENCHMARK_SECTION_DEPTH )
+		{
+			m_SectionStack[m_nSectionDepth].m_nSection = nSection;
+			m_SectionStack[m_nSectionDepth].m_Start.Sample();
+		}
+		m_nSectionDepth++;
+	}
+
+	virtual void ExitSection()
+	{
+		if ( m_nSectionDepth <= 0 )
+			return;
+
+		m_nSectionDepth--;
+		if ( m_nSectionDepth >= MAX_BENCHMARK_SECTION_DEPTH )
+			return;
+
+		CCycleCount now, elapsed;
+		now.Sample();
+		CCycleCount::Sub( now, m_SectionStack[m_nSectionDepth].m_Start, elapsed );
+		float flMs = elapsed.GetMillisecondsF();
+
+		// Keep times exclusive by taking this section out of the one it ran inside
+		m_flTickSectionMs[m_SectionStack[m_nSectionDepth].m_nSection] += flMs;
+		if ( m_nSectionDepth > 0 )
+		{
+			m_flTickSectionMs[m_SectionStack[m_nSectionDepth - 1].m_nSection] -= flMs;
+		}
+	}
+
 	void StartVProfRecord()
 	{
 		if ( sv_benchmark_autovprofrecord.GetInt() )
@@ -201,14 +384,17 @@ public:
 
 	void UpdateVPhysicsObjects()
 	{
-		int nPhysicsObjectInterval = sv_benchmark_numticks.GetInt() / s_nBenchmarkPhysicsObjects;
+		if ( m_Scenario.m_nPhysicsObjects <= 0 )
+			return;
+
+		int nPhysicsObjectInterval = MAX( 1, GetNumTicks() / m_Scenario.m_nPhysicsObjects );
 
 		int nNextSpawnTick = m_nLastPhysicsObjectTick + nPhysicsObjectInterval;
 		if ( GetTickOffset() >= nNextSpawnTick )
 		{
 			m_nLastPhysicsObjectTick = nNextSpawnTick;
 			
-			if ( m_PhysicsObjects.Count() < s_nBenchmarkPhysicsObjects )
+			if ( m_PhysicsObjects.Count() < m_Scenario.m_nPhysicsObjects )
 			{
 				// Find a bot to spawn it from.
 				CUtlVector<CBasePlayer*> curPlayers;
@@ -247,7 +433,7 @@ public:
 		}
 
 		// Give them all a boost periodically.
-		int nPhysicsForceInterval = sv_benchmark_numticks.GetInt() / 20;
+		int nPhysicsForceInterval = MAX( 1, GetNumTicks() / 20 );
 
 		int nNextForceTick = m_nLastPhysicsForceTick + nPhysicsForceInterval;
 		if ( GetTickOffset() >= nNextForceTick )
@@ -288,7 +474,7 @@ public:
 		if ( (flCurTime - m_flLastBenchmarkCounterUpdate) > 3.0f )
 		{
 			m_flLastBenchmarkCounterUpdate = flCurTime;
-			Msg( "Benchmark: %d%% complete.\n", ((gpGlobals->tickcount - m_nBenchmarkStartTick) * 100) / sv_benchmark_numticks.GetInt() );
+			Msg( "Benchmark: %d%% complete.\n", ((gpGlobals->tickcount - m_nBenchmarkStartTick) * 100) / MAX( 1, GetNumTicks() ) );
 		}
 	}
 
@@ -313,13 +499,13 @@ public:
 
 	void UpdatePlayerCreation()
 	{
-		if ( m_nBotsCreated >= s_nBenchmarkBotsToCreate )
+		if ( m_nBotsCreated >= m_Scenario.m_nBotsToCreate )
 			return;
 
 		// Spawn the player.
 		int nTicksRunSoFar = gpGlobals->tickcount - m_nBenchmarkStartTick;
 
-		if ( (nTicksRunSoFar % s_nBenchmarkBotCreateInterval) == 0 )
+		if ( (nTicksRunSoFar % m_Scenario.m_nBotCreateInterval) == 0 )
 		{
 			CServerBenchmarkHook::s_pBenchmarkHook->CreateBot();
 			++m_nBotsCreated;
@@ -330,12 +516,107 @@ public:
 	{
 		float flRunTime = Benchmark_ValidTime() - m_fl_ValidTime_BenchmarkStartTime;
 
+		int nTicks = GetNumTicks();
+		int nCRC = CalculateBenchmarkCRC();
+
+		TimeStats_t tickStats;
+		ComputeTimeStats( m_TickTimes, &tickStats );
+
 		Warning( "------------------ SERVER BENCHMARK RESULTS ------------------\n" );
 		Warning( "Total time          : %.2f seconds\n", flRunTime );
-		Warning( "Num ticks simulated : %d\n", sv_benchmark_numticks.GetInt() );
-		Warning( "Ticks per second    : %.2f\n", sv_benchmark_numticks.GetInt() / flRunTime );
-		Warning( "Benchmark CRC       : %d\n", CalculateBenchmarkCRC() );
+		Warning( "Num ticks simulated : %d\n", nTicks );
+		Warning( "Ticks per second    : %.2f\n", nTicks / flRunTime );
+		Warning( "Tick time (ms)      : p50 %.3f  p99 %.3f  max %.3f\n", tickStats.m_flP50, tickStats.m_flP99, tickStats.m_flMax );
+		for ( int i = 0; i <= NUM_BENCHMARK_SECTIONS; i++ )
+		{
+			TimeStats_t sectionStats;
+			ComputeTimeStats( m_SectionTimes[i], &sectionStats );
+			Warning( "  %-18s: p50 %.3f  p99 %.3f  max %.3f  total %.1f\n", s_pszBenchmarkSectionNames[i], sectionStats.m_flP50, sectionStats.m_flP99, sectionStats.m_flMax, sectionStats.m_flTotal );
+		}
+		Warning( "Benchmark CRC       : %d\n", nCRC );
 		Warning( "--------------------------------------------------------------\n" );
+
+		WriteJSONResults( flRunTime, nTicks, nCRC );
+	}
+
+	struct TimeStats_t
+	{
+		float m_flMean;
+		float m_flP50;
+		float m_flP99;
+		float m_flMax;
+		float m_flTotal;
+	};
+
+	static int __cdecl FloatCompare( const float *lhs, const float *rhs )
+	{
+		return ( *lhs < *rhs ) ? -1 : ( ( *lhs > *rhs ) ? 1 : 0 );
+	}
+
+	static void ComputeTimeStats( const CUtlVector<float> &times, TimeStats_t *pStats )
+	{
+		V_memset( pStats, 0, sizeof( *pStats ) );
+		if ( !times.Count() )
+			return;
+
+		CUtlVector<float> sorted;
+		sorted.CopyArray( times.Base(), times.Count() );
+		sorted.Sort( FloatCompare );
+
+		for ( int i = 0; i < sorted.Count(); i++ )
+		{
+			pStats->m_flTotal += sorted[i];
+		}
+
+		// Nearest rank percentiles
+		int nLast = sorted.Count() - 1;
+		pStats->m_flMean = pStats->m_flTotal / sorted.Count();
+		pStats->m_flP50 = sorted[ clamp( (int)ceil( 0.50 * sorted.Count() ) - 1, 0, nLast ) ];
+		pStats->m_flP99 = sorted[ clamp( (int)ceil( 0.99 * sorted.Count() ) - 1, 0, nLast ) ];
+		pStats->m_flMax = sorted[ nLast ];
+	}
+
+	static void WriteJSONTimeStats( FileHandle_t fh, const char *pszName, const CUtlVector<float> &times, bool bLast )
+	{
+		TimeStats_t stats;
+		ComputeTimeStats( times, &stats );
+		filesystem->FPrintf( fh, "\t\t\"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"total\": %.3f }%s\n",
+			pszName, stats.m_flMean, stats.m_flP50, stats.m_flP99, stats.m_flMax, stats.m_flTotal, bLast ? "" : "," );
+	}
+
+	void WriteJSONResults( float flRunTime, int nTicks, int nCRC )
+	{
+		FileHandle_t fh = filesystem->Open( m_Scenario.m_szOutputFile, "wt", "DEFAULT_WRITE_PATH" );
+		if ( !fh )
+		{
+			Warning( "Unable to write benchmark results to %s\n", m_Scenario.m_szOutputFile );
+			return;
+		}
+
+		filesystem->FPrintf( fh, "{\n" );
+		filesystem->FPrintf( fh, "\t\"map\": \"%s\",\n", STRING( gpGlobals->mapname ) );
+		filesystem->FPrintf( fh, "\t\"seed\": %d,\n", m_Scenario.m_nSeed );
+		filesystem->FPrintf( fh, "\t\"ticks\": %d,\n", nTicks );
+		filesystem->FPrintf( fh, "\t\"tick_interval\": %f,\n", gpGlobals->interval_per_tick );
+		filesystem->FPrintf( fh, "\t\"bots\": %d,\n", m_nBotsCreated );
+		filesystem->FPrintf( fh, "\t\"physics_props\": %d,\n", m_PhysicsObjects.Count() );
+		filesystem->FPrintf( fh, "\t\"random_entity_slots\": %d,\n", m_Scenario.m_nRandomEntitySlots );
+		filesystem->FPrintf( fh, "\t\"total_seconds\": %.3f,\n", flRunTime );
+		filesystem->FPrintf( fh, "\t\"ticks_per_second\": %.2f,\n", nTicks / flRunTime );
+		filesystem->FPrintf( fh, "\t\"crc\": %d,\n", nCRC );
+		filesystem->FPrintf( fh, "\t\"tick_ms\": {\n" );
+		WriteJSONTimeStats( fh, "all", m_TickTimes, true );
+		filesystem->FPrintf( fh, "\t},\n" );
+		filesystem->FPrintf( fh, "\t\"section_ms\": {\n" );
+		for ( int i = 0; i <= NUM_BENCHMARK_SECTIONS; i++ )
+		{
+			WriteJSONTimeStats( fh, s_pszBenchmarkSectionNames[i], m_SectionTimes[i], i == NUM_BENCHMARK_SECTIONS );
+		}
+		filesystem->FPrintf( fh, "\t}\n" );
+		filesystem->FPrintf( fh, "}\n" );
+		filesystem->Close( fh );
+
+		Msg( "Wrote benchmark results to %s\n", m_Scenario.m_szOutputFile );
 	}
 
 	int CalculateBenchmarkCRC()
@@ -395,6 +676,23 @@ private:
 	int m_nBenchmarkMode;
 
 	CUniformRandomStream m_RandomStream;
+
+	ServerBenchmarkScenario_t m_Scenario;
+
+	// Per tick timings, in milliseconds
+	CUtlVector<float> m_TickTimes;
+	CUtlVector<float> m_SectionTimes[NUM_BENCHMARK_SECTIONS + 1];
+	float m_flTickSectionMs[NUM_BENCHMARK_SECTIONS];
+	CCycleCount m_TickStart;
+	bool m_bHaveTickStart;
+
+	struct SectionFrame_t
+	{
+		EBenchmarkSection_t m_nSection;
+		CCycleCount m_Start;
+	};
+	SectionFrame_t m_SectionStack[MAX_BENCHMARK_SECTION_DEPTH];
+	int m_nSectionDepth;
 };
 
 static CServerBenchmark g_ServerBenchmark;
@@ -408,6 +706,152 @@ CON_COMMAND( sv_benchmark_force_start, "Force start the benchmark. This is only
 	g_ServerBenchmark.InternalStartBenchmark( 1, 1 );
 }
 
+CON_COMMAND( sv_benchmark_codecs, "Compare the tier1 compression codecs on the lumps of the current map. Usage: sv_benchmark_codecs [iterations]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nIterations = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 4;
+
+	char szMapFile[MAX_PATH];
+	Q_snprintf( szMapFile, sizeof( szMapFile ), "maps/%s.bsp", STRING( gpGlobals->mapname ) );
+
+	CUtlBufferView buf;
+	if ( !filesystem->ReadFileView( szMapFile, "GAME", buf ) || buf.TellPut() < (int)sizeof( dheader_t ) )
+	{
+		Warning( "sv_benchmark_codecs: unable to read %s\n", szMapFile );
+		return;
+	}
+
+	const dheader_t *pHeader = (const dheader_t *)buf.Base();
+	Msg( "Codec benchmark on %s (%d bytes, %d iterations)\n", szMapFile, buf.TellPut(), nIterations );
+
+	for ( int i = 0; i < HEADER_LUMPS; ++i )
+	{
+		const lump_t &lump = pHeader->lumps[i];
+
+		// Tiny lumps only measure call overhead
+		if ( lump.filelen < 16 * 1024 || lump.fileofs + lump.filelen > buf.TellPut() )
+			continue;
+
+		char szLabel[32];
+		Q_snprintf( szLabel, sizeof( szLabel ), "lump %d%s", i, lump.uncompressedSize ? " (lzma)" : "" );
+		DataCodec_Benchmark( szLabel, (const byte *)buf.Base() + lump.fileofs, lump.filelen, nIterations );
+	}
+
+	DataCodec_Benchmark( "whole map", buf.Base(), buf.TellPut(), nIterations );
+}
+
+
+struct CommandBufferBenchItem_t
+{
+	CCommandBuffer *m_pBuffer;
+	const char *m_pszLine;
+};
+
+static void SubmitBenchCommand( CommandBufferBenchItem_t &item )
+{
+	item.m_pBuffer->AddCommandThreadSafe( item.m_pszLine );
+}
+
+CON_COMMAND( sv_benchmark_commandbuffer, "Compare text and thread submitted command buffer processing with and without cached command lookup. Usage: sv_benchmark_commandbuffer [commands]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int nCommands = ( args.ArgC() > 1 ) ? MAX( atoi( args[1] ), 1 ) : 20000;
+
+	// Lines in the shape of a big config: a registered name and a value
+	CUtlVector<CUtlString> lines;
+	lines.EnsureCapacity( nCommands );
+	const ConCommandBase *pFirst = g_pCVar->GetCommands();
+	const ConCommandBase *pCommand = pFirst;
+	for ( int i = 0; i < nCommands && pCommand; ++i )
+	{
+		lines.AddToTail( CUtlString( CFmtStr( "%s %d", pCommand->GetName(), i ) ) );
+		pCommand = pCommand->GetNext() ? pCommand->GetNext() : pFirst;
+	}
+	nCommands = lines.Count();
+	Msg( "Command buffer benchmark: %d commands\n", nCommands );
+
+	CFastTimer timer;
+	int nFound = 0;
+
+	// Text path: AddText on this thread in chunks the args buffer can hold, tokenize and look up every line
+	{
+		CCommandBuffer buffer;
+		timer.Start();
+		for ( int i = 0; i < nCommands; )
+		{
+			for ( ; i < nCommands && buffer.AddText( lines[i] ); ++i )
+			{
+			}
+
+			buffer.BeginProcessingCommands( 1 );
+			while ( buffer.DequeueNextCommand() )
+			{
+				nFound += g_pCVar->FindCommandBase( buffer.ArgV()[0] ) ? 1 : 0;
+			}
+			buffer.EndProcessingCommands();
+		}
+		timer.End();
+		Msg( "  text, uncached lookup   : %8.2f ms (%d found)\n", timer.GetDuration().GetMillisecondsF(), nFound );
+	}
+
+	// Threaded path: tokenized on the job threads, one drain, cached lookup
+	{
+		CCommandBuffer buffer;
+		CUtlVector<CommandBufferBenchItem_t> items;
+		items.SetCount( nCommands );
+		for ( int i = 0; i < nCommands; ++i )
+		{
+			items[i].m_pBuffer = &buffer;
+			items[i].m_pszLine = lines[i];
+		}
+
+		nFound = 0;
+		timer.Start();
+		ParallelProcess( "sv_benchmark_commandbuffer", items.Base(), items.Count(), &SubmitBenchCommand );
+		CFastTimer submitTimer = timer;
+		submitTimer.End();
+
+		buffer.BeginProcessingCommands( 1 );
+		while ( buffer.DequeueNextCommand() )
+		{
+			nFound += buffer.FindCurrentCommandBase() ? 1 : 0;
+		}
+		buffer.EndProcessingCommands();
+		timer.End();
+		Msg( "  threaded, cached lookup : %8.2f ms (%.2f ms submitting, %d found)\n",
+			timer.GetDuration().GetMillisecondsF(), submitTimer.GetDuration().GetMillisecondsF(), nFound );
+	}
+
+	// Budgeted passes over the same commands
+	{
+		CCommandBuffer buffer;
+		buffer.SetProcessingBudget( 1.0f );
+		for ( int i = 0; i < nCommands; ++i )
+		{
+			buffer.AddCommandThreadSafe( lines[i] );
+		}
+
+		int nPasses = 0;
+		timer.Start();
+		do
+		{
+			buffer.BeginProcessingCommands( 1 );
+			while ( buffer.DequeueNextCommand() )
+			{
+				buffer.FindCurrentCommandBase();
+			}
+			buffer.EndProcessingCommands();
+			++nPasses;
+		} while ( buffer.WasProcessingBudgetExceeded() );
+		timer.End();
+		Msg( "  1 ms budget             : %8.2f ms over %d passes\n", timer.GetDuration().GetMillisecondsF(), nPasses );
+	}
+}
+
 
 // ---------------------------------------------------------------------------------------------- //
 // CServerBenchmarkHook implementation.
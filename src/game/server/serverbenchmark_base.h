@@ -6,6 +6,17 @@
 #pragma once
 
 
+// Parts of the server frame timed separately while a benchmark runs. Times are
+// exclusive: movement run from inside an entity think isn't counted as think.
+enum EBenchmarkSection_t {
+	BENCHMARK_SECTION_THINK,
+	BENCHMARK_SECTION_PHYSICS,
+	BENCHMARK_SECTION_MOVEMENT,
+	BENCHMARK_SECTION_NETWORKING,
+
+	NUM_BENCHMARK_SECTIONS
+};
+
 // The base server code calls into this.
 class IServerBenchmark {
 public:
@@ -20,11 +31,38 @@ public:
 	virtual int RandomInt( int nMin, int nMax ) = 0;
 	virtual float RandomFloat( float flMin, float flMax ) = 0;
 	virtual int GetTickOffset() = 0;
+
+	// Use SERVER_BENCHMARK_SECTION rather than calling these directly.
+	virtual void EnterSection( EBenchmarkSection_t nSection ) = 0;
+	virtual void ExitSection() = 0;
 };
 
 extern IServerBenchmark* g_pServerBenchmark;
 
 
+// Times the rest of the scope into a benchmark section, on the main thread only.
+class CServerBenchmarkSectionScope {
+public:
+	CServerBenchmarkSectionScope( EBenchmarkSection_t nSection ) {
+		m_bActive = g_pServerBenchmark->IsBenchmarkRunning() && ThreadInMainThread();
+		if ( m_bActive ) {
+			g_pServerBenchmark->EnterSection( nSection );
+		}
+	}
+
+	~CServerBenchmarkSectionScope() {
+		if ( m_bActive ) {
+			g_pServerBenchmark->ExitSection();
+		}
+	}
+
+private:
+	bool m_bActive;
+};
+
+#define SERVER_BENCHMARK_SECTION( nSection ) CServerBenchmarkSectionScope serverBenchmarkSection( nSection )
+
+
 //
 // Each game can derive from this to hook into the server benchmark.
 //
@@ -9,6 +9,9 @@
 #include "soundent.h"
 #include "game.h"
 #include "world.h"
+#include "ai_basenpc.h"
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -21,6 +24,10 @@
 #define SOUNDLISTTYPE_FREE		1
 #define SOUNDLISTTYPE_ACTIVE	2
 
+// Width of a cell of the active sound hash. Cells are columns; height is ignored.
+#define SOUND_HASH_CELL_SIZE	512.0f
+
+ConVar ai_sound_hash( "ai_sound_hash", "1", 0, "Find the sounds an NPC might hear through a spatial hash of the active sounds rather than walking the whole list" );
 
 
 LINK_ENTITY_TO_CLASS( soundent, CSoundEnt );
@@ -224,6 +231,7 @@ void CSoundEnt::ShutdownSoundEnt()
 //-----------------------------------------------------------------------------
 CSoundEnt::CSoundEnt()
 {
+	m_bSoundHashValid = false;
 }
 
 CSoundEnt::~CSoundEnt()
@@ -238,6 +246,7 @@ void CSoundEnt::Spawn( void )
 {
 	SetSolid( SOLID_NONE );
 	Initialize();
+	InvalidateSoundHash();
 
 	SetNextThink( gpGlobals->curtime + 1 );
 }
@@ -253,6 +262,7 @@ void CSoundEnt::OnRestore()
 		UTIL_Remove( g_pSoundEnt );
 	}
 	g_pSoundEnt = this;
+	InvalidateSoundHash();
 }
 
 
@@ -385,6 +395,8 @@ void CSoundEnt::FreeSound ( int iSound, int iPrevious )
 	// make iSound the head of the Free list.
 	g_pSoundEnt->m_SoundPool[ iSound ].m_iNext = g_pSoundEnt->m_iFreeSound;
 	g_pSoundEnt->m_iFreeSound = iSound;
+
+	g_pSoundEnt->InvalidateSoundHash();
 }
 
 //=========================================================
@@ -415,6 +427,8 @@ int CSoundEnt::IAllocSound( void )
 
 	m_iActiveSound = iNewSound;// now make the new sound the top of the active list. You're done.
 
+	InvalidateSoundHash();
+
 #if IsDebug()
 	m_SoundPool[ iNewSound ].m_iMyIndex = iNewSound;
 #endif
@@ -465,6 +479,9 @@ void CSoundEnt::InsertSound ( int iType, const Vector &vecOrigin, int iVolume, f
 	pSound->m_hTarget.Set( pSoundTarget );
 	pSound->m_ownerChannelIndex = soundChannelIndex;
 
+	// An existing sound on the channel may have moved
+	g_pSoundEnt->InvalidateSoundHash();
+
 	// Keep track of whether this sound had an owner when it was made. If the sound has a long duration,
 	// the owner could disappear by the time someone hears this sound, so we have to look at this boolean
 	// and throw out sounds who have a NULL owner but this field set to true. (sjb) 12/2/2005
@@ -681,6 +698,32 @@ CSound*	CSoundEnt::GetLoudestSoundOfType( int iType, const Vector &vecEarPositio
 	float flDist;
 	CSound *pSound;
 
+	if ( iType != SOUND_NONE )
+	{
+		// Only sounds whose volume reaches the ear can win
+		int sounds[ MAX_WORLD_SOUNDS_MP ];
+		int nSounds = GetSoundsInRange( iType, vecEarPosition, 1.0f, sounds );
+		for ( int i = 0; i < nSounds; i++ )
+		{
+			pSound = &g_pSoundEnt->m_SoundPool[ sounds[i] ];
+
+			if ( pSound->m_iType == iType && pSound->ValidateOwner() )
+			{
+				flDist = ( pSound->GetSoundOrigin() - vecEarPosition ).Length();
+
+				if ( flDist <= pSound->m_iVolume && flDist < flBestDist )
+				{
+					pLoudestSound = pSound;
+
+					iBestSound = sounds[i];
+					flBestDist = flDist;
+				}
+			}
+		}
+
+		return pLoudestSound;
+	}
+
 	iThisSound = ActiveList();
 
 	while ( iThisSound != SOUNDLIST_EMPTY )
@@ -709,6 +752,331 @@ CSound*	CSoundEnt::GetLoudestSoundOfType( int iType, const Vector &vecEarPositio
 	return pLoudestSound;
 }
 
+//-----------------------------------------------------------------------------
+// Spatial hash of the active sounds
+//-----------------------------------------------------------------------------
+static inline int SoundHashCoord( float flCoord )
+{
+	return (int)floorf( flCoord * ( 1.0f / SOUND_HASH_CELL_SIZE ) );
+}
+
+static inline unsigned int SoundHashBucket( int x, int y )
+{
+	return ( (unsigned int)x * 73856093u ) ^ ( (unsigned int)y * 19349663u );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Files every active sound under the cell its origin is in. Client
+//			sounds are kept aside: players move and resize them in place every
+//			frame without going through InsertSound().
+//-----------------------------------------------------------------------------
+void CSoundEnt::BuildSoundHash()
+{
+	m_nSoundCells = 0;
+	m_nMaxHashedVolume = 0;
+	m_nUnhashedSounds = 0;
+	for ( int i = 0; i < SOUND_HASH_BUCKETS; i++ )
+	{
+		m_iCellBuckets[i] = -1;
+	}
+
+	int nOrder = 0;
+	for ( int iSound = m_iActiveSound; iSound != SOUNDLIST_EMPTY; iSound = m_SoundPool[ iSound ].m_iNext )
+	{
+		CSound &sound = m_SoundPool[ iSound ];
+		m_iActiveOrder[ iSound ] = nOrder++;
+
+		if ( sound.m_bNoExpirationTime )
+		{
+			m_iUnhashedSounds[ m_nUnhashedSounds++ ] = iSound;
+			continue;
+		}
+
+		int x = SoundHashCoord( sound.m_vecOrigin.x );
+		int y = SoundHashCoord( sound.m_vecOrigin.y );
+		unsigned int nBucket = SoundHashBucket( x, y ) & ( SOUND_HASH_BUCKETS - 1 );
+
+		int iCell = m_iCellBuckets[ nBucket ];
+		while ( iCell != -1 && ( m_SoundCells[ iCell ].m_x != x || m_SoundCells[ iCell ].m_y != y ) )
+		{
+			iCell = m_SoundCells[ iCell ].m_iNextCell;
+		}
+
+		if ( iCell == -1 )
+		{
+			iCell = m_nSoundCells++;
+			SoundCell_t &newCell = m_SoundCells[ iCell ];
+			newCell.m_x = x;
+			newCell.m_y = y;
+			newCell.m_iFirstSound = SOUNDLIST_EMPTY;
+			newCell.m_nTypes = 0;
+			newCell.m_nMaxVolume = 0;
+			newCell.m_iNextCell = m_iCellBuckets[ nBucket ];
+			m_iCellBuckets[ nBucket ] = iCell;
+		}
+
+		// Listen() squares the hearing distance, so a negative volume carries as far as a positive one
+		int nVolume = abs( sound.m_iVolume );
+
+		SoundCell_t &cell = m_SoundCells[ iCell ];
+		m_iNextSoundInCell[ iSound ] = cell.m_iFirstSound;
+		cell.m_iFirstSound = iSound;
+		cell.m_nTypes |= sound.m_iType;
+		cell.m_nMaxVolume = MAX( cell.m_nMaxVolume, nVolume );
+		m_nMaxHashedVolume = MAX( m_nMaxHashedVolume, nVolume );
+	}
+
+	m_bSoundHashValid = true;
+}
+
+//-----------------------------------------------------------------------------
+
+int CSoundEnt::GatherSoundsInRange( int iSoundMask, const Vector &vecEarPosition, float flHearingSensitivity, int *pSounds )
+{
+	if ( !m_bSoundHashValid )
+	{
+		BuildSoundHash();
+	}
+
+	float flScale = fabsf( flHearingSensitivity );
+	float flReach = m_nMaxHashedVolume * flScale;
+
+	int x0 = SoundHashCoord( vecEarPosition.x - flReach );
+	int x1 = SoundHashCoord( vecEarPosition.x + flReach );
+	int y0 = SoundHashCoord( vecEarPosition.y - flReach );
+	int y1 = SoundHashCoord( vecEarPosition.y + flReach );
+
+	// Look up the cells around the ear, unless there are fewer cells in use than that
+	int cells[ MAX_WORLD_SOUNDS_MP ];
+	int nCells = 0;
+	if ( (int64)( x1 - x0 + 1 ) * ( y1 - y0 + 1 ) <= m_nSoundCells )
+	{
+		for ( int x = x0; x <= x1; x++ )
+		{
+			for ( int y = y0; y <= y1; y++ )
+			{
+				int iCell = m_iCellBuckets[ SoundHashBucket( x, y ) & ( SOUND_HASH_BUCKETS - 1 ) ];
+				while ( iCell != -1 && ( m_SoundCells[ iCell ].m_x != x || m_SoundCells[ iCell ].m_y != y ) )
+				{
+					iCell = m_SoundCells[ iCell ].m_iNextCell;
+				}
+
+				if ( iCell != -1 )
+				{
+					cells[ nCells++ ] = iCell;
+				}
+			}
+		}
+	}
+	else
+	{
+		for ( int iCell = 0; iCell < m_nSoundCells; iCell++ )
+		{
+			cells[ nCells++ ] = iCell;
+		}
+	}
+
+	int nSounds = 0;
+	for ( int i = 0; i < nCells; i++ )
+	{
+		const SoundCell_t &cell = m_SoundCells[ cells[i] ];
+		if ( !( cell.m_nTypes & iSoundMask ) )
+			continue;
+
+		// Skip the cell if its loudest sound can't reach the ear from the nearest point of the cell
+		float flMinX = cell.m_x * SOUND_HASH_CELL_SIZE;
+		float flMinY = cell.m_y * SOUND_HASH_CELL_SIZE;
+		float dx = MAX( 0.0f, MAX( flMinX - vecEarPosition.x, vecEarPosition.x - ( flMinX + SOUND_HASH_CELL_SIZE ) ) );
+		float dy = MAX( 0.0f, MAX( flMinY - vecEarPosition.y, vecEarPosition.y - ( flMinY + SOUND_HASH_CELL_SIZE ) ) );
+		float flCellReach = cell.m_nMaxVolume * flScale;
+		if ( dx * dx + dy * dy > flCellReach * flCellReach )
+			continue;
+
+		for ( int iSound = cell.m_iFirstSound; iSound != SOUNDLIST_EMPTY; iSound = m_iNextSoundInCell[ iSound ] )
+		{
+			if ( m_SoundPool[ iSound ].m_iType & iSoundMask )
+			{
+				pSounds[ nSounds++ ] = iSound;
+			}
+		}
+	}
+
+	for ( int i = 0; i < m_nUnhashedSounds; i++ )
+	{
+		if ( m_SoundPool[ m_iUnhashedSounds[i] ].m_iType & iSoundMask )
+		{
+			pSounds[ nSounds++ ] = m_iUnhashedSounds[i];
+		}
+	}
+
+	// Callers build their lists in active list order, as walking the list did
+	for ( int i = 1; i < nSounds; i++ )
+	{
+		int iSound = pSounds[i];
+		int j = i - 1;
+		for ( ; j >= 0 && m_iActiveOrder[ pSounds[j] ] > m_iActiveOrder[ iSound ]; j-- )
+		{
+			pSounds[j + 1] = pSounds[j];
+		}
+		pSounds[j + 1] = iSound;
+	}
+
+	return nSounds;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The sounds of a type in iSoundMask that may be loud enough to reach
+//			vecEarPosition, in active list order
+//-----------------------------------------------------------------------------
+int CSoundEnt::GetSoundsInRange( int iSoundMask, const Vector &vecEarPosition, float flHearingSensitivity, int *pSounds )
+{
+	if ( !g_pSoundEnt )
+		return 0;
+
+	if ( ai_sound_hash.GetBool() )
+		return g_pSoundEnt->GatherSoundsInRange( iSoundMask, vecEarPosition, flHearingSensitivity, pSounds );
+
+	int nSounds = 0;
+	for ( int iSound = g_pSoundEnt->m_iActiveSound; iSound != SOUNDLIST_EMPTY; iSound = g_pSoundEnt->m_SoundPool[ iSound ].m_iNext )
+	{
+		if ( g_pSoundEnt->m_SoundPool[ iSound ].m_iType & iSoundMask )
+		{
+			pSounds[ nSounds++ ] = iSound;
+		}
+	}
+	return nSounds;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times finding the sounds a crowd of listeners hears, walking the
+//			active list and then through the spatial hash. The listeners are
+//			the NPCs on the map, made up to the count at random spots, and the
+//			free sound slots are filled with sounds for the duration.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( ai_benchmark_listen, "Times finding audible sounds with and without the sound hash. Usage: ai_benchmark_listen [listeners] [ticks]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( CSoundEnt::ActiveList() == SOUNDLIST_EMPTY && CSoundEnt::FreeList() == SOUNDLIST_EMPTY )
+	{
+		Msg( "ai_benchmark_listen needs a map with a sound entity\n" );
+		return;
+	}
+
+	int nListeners = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1, 4096 ) : 100;
+	int nTicks = ( args.ArgC() > 2 ) ? MAX( 1, atoi( args[2] ) ) : 200;
+
+	CUniformRandomStream random;
+	random.SetSeed( 0x50e7d );
+
+	// Listeners spread over the area the NPCs are in, or the middle of the map
+	Vector vecMins( -4096, -4096, -256 ), vecMaxs( 4096, 4096, 256 );
+	CUtlVector<Vector> ears;
+	for ( int i = 0; i < g_AI_Manager.NumAIs() && ears.Count() < nListeners; i++ )
+	{
+		CAI_BaseNPC *pNPC = g_AI_Manager.AccessAIs()[i];
+		if ( pNPC && pNPC->IsAlive() )
+		{
+			if ( !ears.Count() )
+			{
+				vecMins = vecMaxs = pNPC->EarPosition();
+			}
+			ears.AddToTail( pNPC->EarPosition() );
+			VectorMin( vecMins, pNPC->EarPosition(), vecMins );
+			VectorMax( vecMaxs, pNPC->EarPosition(), vecMaxs );
+		}
+	}
+
+	int nNPCs = ears.Count();
+	vecMins -= Vector( 1024, 1024, 128 );
+	vecMaxs += Vector( 1024, 1024, 128 );
+
+	while ( ears.Count() < nListeners )
+	{
+		ears.AddToTail( Vector( random.RandomFloat( vecMins.x, vecMaxs.x ), random.RandomFloat( vecMins.y, vecMaxs.y ), random.RandomFloat( vecMins.z, vecMaxs.z ) ) );
+	}
+
+	static const int s_SoundTypes[] = { SOUND_COMBAT, SOUND_COMBAT | SOUND_CONTEXT_GUNFIRE, SOUND_WORLD, SOUND_DANGER, SOUND_BULLET_IMPACT, SOUND_PHYSICS_DANGER, SOUND_CARCASS, SOUND_MEAT };
+	static const int s_Interests[] = { SOUND_COMBAT | SOUND_WORLD | SOUND_PLAYER | SOUND_DANGER, SOUND_COMBAT | SOUND_WORLD | SOUND_BULLET_IMPACT, SOUND_CARCASS | SOUND_MEAT | SOUND_DANGER };
+
+	// New sounds go on the head of the active list, so the benchmark's are the first nAdded
+	int nAdded = 0;
+	while ( CSoundEnt::FreeList() != SOUNDLIST_EMPTY )
+	{
+		Vector vecOrigin( random.RandomFloat( vecMins.x, vecMaxs.x ), random.RandomFloat( vecMins.y, vecMaxs.y ), random.RandomFloat( vecMins.z, vecMaxs.z ) );
+		CSoundEnt::InsertSound( s_SoundTypes[ random.RandomInt( 0, ARRAYSIZE( s_SoundTypes ) - 1 ) ], vecOrigin, random.RandomInt( 128, 1500 ), 1.0f );
+		nAdded++;
+	}
+
+	int nActive = 0;
+	for ( int iSound = CSoundEnt::ActiveList(); iSound != SOUNDLIST_EMPTY; iSound = CSoundEnt::SoundPointerForIndex( iSound )->NextSound() )
+	{
+		nActive++;
+	}
+	const bool bWasHashed = ai_sound_hash.GetBool();
+	double flTime[2] = { 0, 0 };
+	int nHeard[2] = { 0, 0 };
+	int nCandidates[2] = { 0, 0 };
+
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		ai_sound_hash.SetValue( pass );
+		CUniformRandomStream tickRandom;
+		tickRandom.SetSeed( 0x71c );
+
+		CFastTimer timer;
+		timer.Start();
+		for ( int iTick = 0; iTick < nTicks; iTick++ )
+		{
+			// Replace one sound a tick, as a fight does, so the hash is rebuilt every tick
+			if ( nAdded )
+			{
+				CSoundEnt::FreeSound( CSoundEnt::ActiveList(), SOUNDLIST_EMPTY );
+				Vector vecOrigin( tickRandom.RandomFloat( vecMins.x, vecMaxs.x ), tickRandom.RandomFloat( vecMins.y, vecMaxs.y ), tickRandom.RandomFloat( vecMins.z, vecMaxs.z ) );
+				CSoundEnt::InsertSound( s_SoundTypes[ tickRandom.RandomInt( 0, ARRAYSIZE( s_SoundTypes ) - 1 ) ], vecOrigin, tickRandom.RandomInt( 128, 1500 ), 1.0f );
+			}
+
+			for ( int i = 0; i < ears.Count(); i++ )
+			{
+				int sounds[ MAX_WORLD_SOUNDS_MP ];
+				int nSounds = CSoundEnt::GetSoundsInRange( s_Interests[ i % ARRAYSIZE( s_Interests ) ], ears[i], 1.0f, sounds );
+				nCandidates[pass] += nSounds;
+
+				// The distance test of CAI_Senses::CanHearSound()
+				for ( int j = 0; j < nSounds; j++ )
+				{
+					CSound *pSound = CSoundEnt::SoundPointerForIndex( sounds[j] );
+					float flHearDistanceSq = pSound->Volume();
+					flHearDistanceSq *= flHearDistanceSq;
+					if ( pSound->GetSoundOrigin().DistToSqr( ears[i] ) <= flHearDistanceSq )
+					{
+						nHeard[pass]++;
+					}
+				}
+			}
+		}
+		timer.End();
+		flTime[pass] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	ai_sound_hash.SetValue( bWasHashed );
+
+	for ( int i = 0; i < nAdded; i++ )
+	{
+		CSoundEnt::FreeSound( CSoundEnt::ActiveList(), SOUNDLIST_EMPTY );
+	}
+
+	int nQueries = nTicks * ears.Count();
+	Msg( "Listen benchmark: %d listeners (%d NPCs), %d active sounds, %d ticks\n", ears.Count(), nNPCs, nActive, nTicks );
+	Msg( "  active list: %8.3f ms total, %6.3f us per listen, %5.1f sounds tested, %d heard\n", flTime[0], 1000.0 * flTime[0] / nQueries, (float)nCandidates[0] / nQueries, nHeard[0] );
+	Msg( "  sound hash:  %8.3f ms total, %6.3f us per listen, %5.1f sounds tested, %d heard\n", flTime[1], 1000.0 * flTime[1] / nQueries, (float)nCandidates[1] / nQueries, nHeard[1] );
+	if ( nHeard[0] != nHeard[1] )
+	{
+		Warning( "  the sound hash missed or added sounds!\n" );
+	}
+}
+
 
 //-----------------------------------------------------------------------------
 // Purpose: Inserts an AI sound into the world sound list.
@@ -216,16 +216,47 @@ public:
 	static CSound* GetLoudestSoundOfType( int iType, const Vector& vecEarPosition );
 	static int ClientSoundIndex( edict_t* pClient );
 
+	// Fills pSounds (room for MAX_WORLD_SOUNDS_MP) with the sounds of a type in iSoundMask that could be
+	// loud enough to reach vecEarPosition, in active list order. Callers still test the distance.
+	static int GetSoundsInRange( int iSoundMask, const Vector& vecEarPosition, float flHearingSensitivity, int* pSounds );
+
 	bool IsEmpty( void );
 	int ISoundsInList( int iListType );
 	int IAllocSound( void );
 	int FindOrAllocateSound( CBaseEntity* pOwner, int soundChannelIndex );
 
 private:
+	// Spatial hash of the active sounds, rebuilt the first time it's needed after the lists change
+	enum {
+		SOUND_HASH_BUCKETS = 256
+	};
+
+	struct SoundCell_t {
+		int m_x, m_y;
+		int m_iFirstSound;
+		int m_nTypes;     // every type bit of the sounds in the cell
+		int m_nMaxVolume; // so the loudest can reach the ear
+		int m_iNextCell;  // in the same bucket
+	};
+
+	void InvalidateSoundHash() { m_bSoundHashValid = false; }
+	void BuildSoundHash();
+	int GatherSoundsInRange( int iSoundMask, const Vector& vecEarPosition, float flHearingSensitivity, int* pSounds );
+
 	int m_iFreeSound;       // index of the first sound in the free sound list
 	int m_iActiveSound;     // indes of the first sound in the active sound list
 	int m_cLastActiveSounds;// keeps track of the number of active sounds at the last update. (for diagnostic work)
 	CSound m_SoundPool[ MAX_WORLD_SOUNDS_MP ];
+
+	bool m_bSoundHashValid;
+	int m_nSoundCells;
+	int m_nMaxHashedVolume;
+	SoundCell_t m_SoundCells[ MAX_WORLD_SOUNDS_MP ];
+	int m_iCellBuckets[ SOUND_HASH_BUCKETS ];
+	int m_iNextSoundInCell[ MAX_WORLD_SOUNDS_MP ];
+	int m_iActiveOrder[ MAX_WORLD_SOUNDS_MP ];  // position of each sound in the active list
+	int m_nUnhashedSounds;                      // client sounds, which players move every frame
+	int m_iUnhashedSounds[ MAX_WORLD_SOUNDS_MP ];
 };
 
 
@@ -2717,7 +2717,7 @@ void CAI_ChangeTarget::InputActivate( inputdata_t &inputdata )
 
 	while ((pTarget = gEntList.FindEntityByName( pTarget, m_target, NULL, inputdata.pActivator, inputdata.pCaller )) != NULL)
 	{
-		pTarget->m_target = m_iszNewTarget;
+		pTarget->SetEntityTarget( m_iszNewTarget );
 		CAI_BaseNPC *pNPC = pTarget->MyNPCPointer( );
 		if (pNPC)
 		{
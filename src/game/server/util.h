@@ -103,6 +103,7 @@ public:
 	virtual IServerNetworkable* Create( const char* pClassName ) = 0;
 	virtual void Destroy( IServerNetworkable * pNetworkable ) = 0;
 	virtual size_t GetEntitySize() = 0;
+	virtual datamap_t* GetDataDescMap() = 0;
 };
 
 template<class T>
@@ -126,6 +127,13 @@ public:
 	virtual size_t GetEntitySize() {
 		return sizeof( T );
 	}
+
+	// The datamap the entities this makes will return from GetDataDescMap()
+	virtual datamap_t* GetDataDescMap() {
+		datamap_t* pDataMap;
+		DataMapAccess( (T*) nullptr, &pDataMap );
+		return pDataMap;
+	}
 };
 
 #define LINK_ENTITY_TO_CLASS( mapClassName, DLLClassName ) \
@@ -29,6 +29,7 @@
 	#include "player_pickup.h"
 	#include "waterbullet.h"
 	#include "func_break.h"
+	#include "mapentities.h"
 
 #ifdef HL2MP
 	#include "te_hl2mp_shotgun_shot.h"
@@ -61,6 +62,7 @@ ConVar hl2_episodic( "hl2_episodic", "0", FCVAR_REPLICATED );
 #ifdef GAME_DLL
 	ConVar ent_debugkeys( "ent_debugkeys", "" );
 	extern bool ParseKeyvalue( void *pObject, typedescription_t *pFields, int iNumFields, const char *szKeyName, const char *szValue );
+	extern bool ParseKeyvalueField( void *pObject, typedescription_t *pField, const char *szValue );
 	extern bool ExtractKeyvalue( void *pObject, typedescription_t *pFields, int iNumFields, const char *szKeyName, char *szValue, int iMaxLen );
 #endif
 
@@ -438,17 +440,35 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 	
 	if ( FStrEq( szKeyName, "targetname" ) )
 	{
-		m_iName = AllocPooledString( szValue );
+		SetName( AllocPooledString( szValue ) );
 		return true;
 	}
 
 	// loop through the data description, and try and place the keys in
 	if ( !*ent_debugkeys.GetString() )
 	{
+		// Keys from the map data arrive with their field already found
+		const MapEntityKeyField_t *pResolved = MapEntity_GetResolvedKeyField( this, szKeyName );
+		if ( pResolved )
+		{
+			if ( !pResolved->m_pField )
+				return false;
+
+			if ( ::ParseKeyvalueField( (char *)this + pResolved->m_nObjectOffset, pResolved->m_pField, szValue ) )
+			{
+				gEntList.UpdateEntityStrings( this );
+				return true;
+			}
+		}
+
 		for ( datamap_t *dmap = GetDataDescMap(); dmap != NULL; dmap = dmap->baseMap )
 		{
 			if ( ::ParseKeyvalue(this, dmap->dataDesc, dmap->dataNumFields, szKeyName, szValue) )
+			{
+				// "classname" and "target" are keyfields, keep the entity list's indices current
+				gEntList.UpdateEntityStrings( this );
 				return true;
+			}
 		}
 	}
 	else
@@ -478,7 +498,8 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 			{
 				if ( printKeyHits )
 					Msg( "(%s) key: %-16s value: %s\n", debugName, szKeyName, szValue );
-				
+
+				gEntList.UpdateEntityStrings( this );
 				return true;
 			}
 		}
@@ -1426,6 +1447,14 @@ void CBaseEntity::InvalidatePhysicsRecursive( int nChangeFlags )
 	
 	int nDirtyFlags = 0;
 
+#ifndef CLIENT_DLL
+	// Abs origin and velocity are about to be recomputed, the mirrored copies along with them
+	if ( nChangeFlags & ( POSITION_CHANGED | ANGLES_CHANGED | VELOCITY_CHANGED ) )
+	{
+		MarkSOADirty();
+	}
+#endif
+
 	if ( nChangeFlags & VELOCITY_CHANGED )
 	{
 		nDirtyFlags |= EFL_DIRTY_ABSVELOCITY;
@@ -670,6 +670,11 @@ void CBasePlayer::PlayStepSound( Vector &vecOrigin, surfacedata_t *psurface, flo
 	if ( gpGlobals->maxClients > 1 && !sv_footsteps.GetFloat() )
 		return;
 
+#if !defined( CLIENT_DLL )
+	if ( DeferStepSound( vecOrigin, psurface, fvol, force ) )
+		return;
+#endif
+
 #if defined( CLIENT_DLL )
 	// during prediction play footstep sounds only once
 	if ( prediction->InPrediction() && !prediction->IsFirstTimePredicted() )
@@ -606,6 +606,8 @@ void DrawDispCollPlane( CBaseTrace *pTrace )
 }
 #endif
 
+void CreateStuckTable( void );
+
 //-----------------------------------------------------------------------------
 // Purpose: Constructs GameMovement interface
 //-----------------------------------------------------------------------------
@@ -618,6 +620,9 @@ CGameMovement::CGameMovement( void )
 	mv					= NULL;
 
 	memset( m_flStuckCheckTime, 0, sizeof(m_flStuckCheckTime) );
+
+	// The table is shared, so build it before any movement can run on a worker thread
+	CreateStuckTable();
 }
 
 //-----------------------------------------------------------------------------
@@ -1131,7 +1136,12 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 
 	//!!HACK HACK: Adrian - slow down all player movement by this factor.
 	//!!Blame Yahn for this one.
-	gpGlobals->frametime *= pPlayer->GetLaggedMovementValue();
+	// Only write the global when it changes, movement can run on several threads at once.
+	bool bLaggedMovement = ( pPlayer->GetLaggedMovementValue() != 1.0f );
+	if ( bLaggedMovement )
+	{
+		gpGlobals->frametime *= pPlayer->GetLaggedMovementValue();
+	}
 
 	ResetGetPointContentsCache();
 
@@ -1161,7 +1171,10 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 	// CheckV( player->CurrentCommandNumber(), "EndPos", mv->GetAbsOrigin() );
 
 	//This is probably not needed, but just in case.
-	gpGlobals->frametime = flStoreFrametime;
+	if ( bLaggedMovement )
+	{
+		gpGlobals->frametime = flStoreFrametime;
+	}
 
 // 	player = NULL;
 }
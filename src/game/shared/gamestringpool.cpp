@@ -7,7 +7,7 @@
 
 #include "cbase.h"
 
-#include "utlhashtable.h"
+#include "tier0/threadtools.h"
 #ifndef GC
 #include "igamesystem.h"
 #endif
@@ -16,8 +16,236 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+#define GAMESTRING_SHARD_BITS		6
+#define GAMESTRING_SHARD_COUNT		( 1 << GAMESTRING_SHARD_BITS )
+#define GAMESTRING_INITIAL_SLOTS	64			// per shard, a power of two
+#define GAMESTRING_ARENA_BLOCK		( 16 * 1024 )
+
+//-----------------------------------------------------------------------------
+// Purpose: FNV-1a, measuring the string on the way
+//-----------------------------------------------------------------------------
+static inline uint32 HashGameString( const char *pszValue, int *pLength )
+{
+	uint32 nHash = 2166136261u;
+	const char *p = pszValue;
+	while ( *p )
+	{
+		nHash = ( nHash ^ (uint8)*p++ ) * 16777619u;
+	}
+	*pLength = p - pszValue;
+	return nHash;
+}
+
+static inline uint32 HashGameStringKey( const void *pKey )
+{
+	uint32 nHash = (uint32)(uintp)pKey ^ (uint32)( (uint64)(uintp)pKey >> 32 );
+	nHash = ( nHash ^ ( nHash >> 16 ) ) * 0x85ebca6b;
+	nHash = ( nHash ^ ( nHash >> 13 ) ) * 0xc2b2ae35;
+	return nHash ^ ( nHash >> 16 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: An open addressed table, half full at most. A slot is published by
+//			writing its key last, so a lookup that sees the key sees the rest.
+//-----------------------------------------------------------------------------
+struct GameStringSlot_t
+{
+	const void * volatile pKey;		// the pooled string itself, or the pointer it was allocated by
+	const char *pString;
+	uint32 nHash;
+};
+
+struct GameStringSlots_t
+{
+	GameStringSlots_t *pRetired;	// the table this one replaced, still readable until the pool is freed
+	uint32 nMask;
+	GameStringSlot_t slots[1];
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: One shard of the pool. Lookups never lock; inserts take the
+//			shard's mutex. A full table is replaced with a bigger one rather
+//			than grown in place, so a lookup still walking the old table is
+//			unaffected.
+//-----------------------------------------------------------------------------
+class CGameStringShard
+{
+public:
+	CGameStringShard()
+	{
+		m_pTable = NULL;
+		m_nCount = 0;
+		m_pBlock = NULL;
+		m_nBlockUsed = GAMESTRING_ARENA_BLOCK;
+		m_nStringBytes = 0;
+		m_nArenaBytes = 0;
+	}
+
+	const char *Find( uint32 nHash, const void *pKey, bool bByPointer ) const
+	{
+		GameStringSlots_t *pTable = m_pTable;
+		ThreadMemoryBarrier();
+		if ( !pTable )
+			return NULL;
+
+		for ( uint32 i = nHash & pTable->nMask; ; i = ( i + 1 ) & pTable->nMask )
+		{
+			const GameStringSlot_t &slot = pTable->slots[i];
+			const void *pSlotKey = slot.pKey;
+			ThreadMemoryBarrier();
+			if ( !pSlotKey )
+				return NULL;
+
+			if ( slot.nHash == nHash && ( bByPointer ? ( pSlotKey == pKey ) : !V_strcmp( (const char *)pSlotKey, (const char *)pKey ) ) )
+				return slot.pString;
+		}
+	}
+
+	// Caller holds m_Mutex, and has checked the key isn't there
+	void Insert( uint32 nHash, const void *pKey, const char *pString )
+	{
+		if ( !m_pTable || ( m_nCount + 1 ) * 2 > (int)( m_pTable->nMask + 1 ) )
+		{
+			Grow();
+		}
+
+		GameStringSlot_t *pSlot = FindFreeSlot( m_pTable, nHash );
+		pSlot->pString = pString;
+		pSlot->nHash = nHash;
+		ThreadMemoryBarrier();
+		pSlot->pKey = pKey;
+		m_nCount++;
+	}
+
+	// Caller holds m_Mutex
+	const char *CopyString( const char *pszValue, int nLength )
+	{
+		int nSize = nLength + 1;
+		char *pCopy;
+		if ( nSize > GAMESTRING_ARENA_BLOCK / 4 )
+		{
+			// Big strings get a block to themselves so they don't waste the rest of one
+			pCopy = (char *)malloc( nSize );
+			m_Blocks.AddToTail( pCopy );
+			m_nArenaBytes += nSize;
+		}
+		else
+		{
+			if ( m_nBlockUsed + nSize > GAMESTRING_ARENA_BLOCK )
+			{
+				m_pBlock = (char *)malloc( GAMESTRING_ARENA_BLOCK );
+				m_Blocks.AddToTail( m_pBlock );
+				m_nBlockUsed = 0;
+				m_nArenaBytes += GAMESTRING_ARENA_BLOCK;
+			}
+			pCopy = m_pBlock + m_nBlockUsed;
+			m_nBlockUsed += nSize;
+		}
+
+		memcpy( pCopy, pszValue, nSize );
+		m_nStringBytes += nSize;
+		return pCopy;
+	}
+
+	// Nothing else may be using the shard
+	void FreeAll()
+	{
+		GameStringSlots_t *pTable = m_pTable;
+		while ( pTable )
+		{
+			GameStringSlots_t *pRetired = pTable->pRetired;
+			free( pTable );
+			pTable = pRetired;
+		}
+		m_pTable = NULL;
+		m_nCount = 0;
+
+		for ( int i = 0; i < m_Blocks.Count(); i++ )
+		{
+			free( m_Blocks[i] );
+		}
+		m_Blocks.Purge();
+		m_pBlock = NULL;
+		m_nBlockUsed = GAMESTRING_ARENA_BLOCK;
+		m_nStringBytes = 0;
+		m_nArenaBytes = 0;
+	}
+
+	template < typename FUNCTOR >
+	void ForEachString( FUNCTOR &func ) const
+	{
+		if ( !m_pTable )
+			return;
+
+		for ( uint32 i = 0; i <= m_pTable->nMask; i++ )
+		{
+			if ( m_pTable->slots[i].pKey )
+			{
+				func( m_pTable->slots[i].pString );
+			}
+		}
+	}
+
+	int Count() const				{ return m_nCount; }
+	int StringBytes() const			{ return m_nStringBytes; }
+	int ArenaBytes() const			{ return m_nArenaBytes; }
+	int TableSlots() const			{ return m_pTable ? m_pTable->nMask + 1 : 0; }
+
+	CThreadFastMutex m_Mutex;
+
+private:
+	static GameStringSlot_t *FindFreeSlot( GameStringSlots_t *pTable, uint32 nHash )
+	{
+		uint32 i = nHash & pTable->nMask;
+		while ( pTable->slots[i].pKey )
+		{
+			i = ( i + 1 ) & pTable->nMask;
+		}
+		return &pTable->slots[i];
+	}
+
+	void Grow()
+	{
+		uint32 nSlots = m_pTable ? ( m_pTable->nMask + 1 ) * 2 : GAMESTRING_INITIAL_SLOTS;
+		size_t nBytes = sizeof( GameStringSlots_t ) + ( nSlots - 1 ) * sizeof( GameStringSlot_t );
+		GameStringSlots_t *pTable = (GameStringSlots_t *)malloc( nBytes );
+		memset( pTable, 0, nBytes );
+		pTable->nMask = nSlots - 1;
+		pTable->pRetired = m_pTable;
+
+		if ( m_pTable )
+		{
+			for ( uint32 i = 0; i <= m_pTable->nMask; i++ )
+			{
+				const GameStringSlot_t &slot = m_pTable->slots[i];
+				if ( !slot.pKey )
+					continue;
+
+				GameStringSlot_t *pSlot = FindFreeSlot( pTable, slot.nHash );
+				pSlot->pString = slot.pString;
+				pSlot->nHash = slot.nHash;
+				pSlot->pKey = slot.pKey;
+			}
+		}
+
+		// Publish the table only once it's filled in
+		ThreadMemoryBarrier();
+		m_pTable = pTable;
+	}
+
+	GameStringSlots_t * volatile m_pTable;
+	int m_nCount;
+
+	CUtlVector<char *> m_Blocks;
+	char *m_pBlock;
+	int m_nBlockUsed;
+	int m_nStringBytes;
+	int m_nArenaBytes;
+};
+
 //-----------------------------------------------------------------------------
-// Purpose: The actual storage for pooled per-level strings
+// Purpose: The actual storage for pooled per-level strings. Safe to use from
+//			any thread; only freeing it at level shutdown must be exclusive.
 //-----------------------------------------------------------------------------
 #ifdef GC
 class CGameStringPool
@@ -26,39 +254,52 @@ class CGameStringPool : public CBaseGameSystem
 #endif
 {
 	virtual char const *Name() { return "CGameStringPool"; }
-	virtual void LevelShutdownPostEntity() { FreeAll(); }
+	virtual void LevelShutdownPostEntity()
+	{
+		int nStrings = 0, nStringBytes = 0, nArenaBytes = 0;
+		GetStats( &nStrings, &nStringBytes, &nArenaBytes );
+		DevMsg( 2, "Game string pool: %d unique strings, %d bytes of strings in %d bytes of arena\n", nStrings, nStringBytes, nArenaBytes );
+
+		FreeAll();
+	}
 
 	void FreeAll()
 	{
-#if 0 && IsDebug()
-		m_Strings.DbgCheckIntegrity();
-		m_KeyLookupCache.DbgCheckIntegrity();
-#endif
-		m_Strings.Purge();
-		m_KeyLookupCache.Purge();
+		for ( int i = 0; i < GAMESTRING_SHARD_COUNT; i++ )
+		{
+			m_Strings[i].FreeAll();
+			m_KeyLookupCache[i].FreeAll();
+		}
 	}
 
-	CUtlHashtable<CUtlConstString> m_Strings;
-	CUtlHashtable<const void*, const char*> m_KeyLookupCache;
+	// Top bits pick the shard, low bits the slot within it
+	static int ShardIndex( uint32 nHash )	{ return nHash >> ( 32 - GAMESTRING_SHARD_BITS ); }
 
-public:
+	CGameStringShard m_Strings[GAMESTRING_SHARD_COUNT];
+	CGameStringShard m_KeyLookupCache[GAMESTRING_SHARD_COUNT];
 
-	CGameStringPool() : m_Strings(256) { }
+public:
 
 	~CGameStringPool() { FreeAll(); }
 
 	void Dump( void )
 	{
-		CUtlVector<const char*> strings( 0, m_Strings.Count() );
-		for (UtlHashHandle_t i = m_Strings.FirstHandle(); i != m_Strings.InvalidHandle(); i = m_Strings.NextHandle(i))
+		CUtlVector<const char*> strings;
+		struct StringCollector_t
+		{
+			CUtlVector<const char*> *pStrings;
+			void operator()( const char *pszString ) { pStrings->AddToTail( pszString ); }
+		} collector = { &strings };
+
+		for ( int i = 0; i < GAMESTRING_SHARD_COUNT; i++ )
 		{
-			strings.AddToTail( strings[i] );
+			m_Strings[i].ForEachString( collector );
 		}
 		struct _Local {
 			static int __cdecl F(const char * const *a, const char * const *b) { return strcmp(*a, *b); }
 		};
 		strings.Sort( _Local::F );
-		
+
 		for ( int i = 0; i < strings.Count(); ++i )
 		{
 			DevMsg( "  %d (0x%p) : %s\n", i, strings[i], strings[i] );
@@ -67,25 +308,87 @@ public:
 		DevMsg( "Size:  %d items\n", strings.Count() );
 	}
 
+	void GetStats( int *pStrings, int *pStringBytes, int *pArenaBytes, int *pBusiestShard = NULL )
+	{
+		int nBusiest = 0;
+		for ( int i = 0; i < GAMESTRING_SHARD_COUNT; i++ )
+		{
+			*pStrings += m_Strings[i].Count();
+			*pStringBytes += m_Strings[i].StringBytes();
+			*pArenaBytes += m_Strings[i].ArenaBytes();
+			nBusiest = MAX( nBusiest, m_Strings[i].Count() );
+		}
+		if ( pBusiestShard )
+		{
+			*pBusiestShard = nBusiest;
+		}
+	}
+
+	void PrintStats( void )
+	{
+		int nStrings = 0, nStringBytes = 0, nArenaBytes = 0, nBusiest = 0;
+		GetStats( &nStrings, &nStringBytes, &nArenaBytes, &nBusiest );
+
+		int nKeys = 0, nTableBytes = 0;
+		for ( int i = 0; i < GAMESTRING_SHARD_COUNT; i++ )
+		{
+			nKeys += m_KeyLookupCache[i].Count();
+			nTableBytes += ( m_Strings[i].TableSlots() + m_KeyLookupCache[i].TableSlots() ) * sizeof( GameStringSlot_t );
+		}
+
+		Msg( "Game string pool (%s):\n", STRING( gpGlobals->mapname ) );
+		Msg( "  unique strings:  %d (%d bytes, %.1f average)\n", nStrings, nStringBytes, nStrings ? (float)nStringBytes / nStrings : 0.0f );
+		Msg( "  arena:           %d bytes\n", nArenaBytes );
+		Msg( "  hash tables:     %d bytes, %d shards, busiest holds %d strings\n", nTableBytes, GAMESTRING_SHARD_COUNT, nBusiest );
+		Msg( "  constant keys:   %d\n", nKeys );
+	}
+
 	const char *Find(const char *string)
 	{
-		UtlHashHandle_t i = m_Strings.Find( string );
-		return i == m_Strings.InvalidHandle() ? NULL : m_Strings[ i ].Get();
+		int nLength;
+		uint32 nHash = HashGameString( string, &nLength );
+		return m_Strings[ ShardIndex( nHash ) ].Find( nHash, string, false );
 	}
 
 	const char *Allocate(const char *string)
 	{
-		return m_Strings[ m_Strings.Insert( string ) ].Get();
+		int nLength;
+		uint32 nHash = HashGameString( string, &nLength );
+		CGameStringShard &shard = m_Strings[ ShardIndex( nHash ) ];
+
+		const char *pPooled = shard.Find( nHash, string, false );
+		if ( pPooled )
+			return pPooled;
+
+		AUTO_LOCK( shard.m_Mutex );
+
+		// Someone may have added it since we looked
+		pPooled = shard.Find( nHash, string, false );
+		if ( !pPooled )
+		{
+			pPooled = shard.CopyString( string, nLength );
+			shard.Insert( nHash, pPooled, pPooled );
+		}
+		return pPooled;
 	}
 
 	const char *AllocateWithKey(const char *string, const void* key)
 	{
-		const char * &cached = m_KeyLookupCache[ m_KeyLookupCache.Insert( key, NULL ) ];
-		if (cached == NULL)
+		uint32 nHash = HashGameStringKey( key );
+		CGameStringShard &shard = m_KeyLookupCache[ ShardIndex( nHash ) ];
+
+		const char *pPooled = shard.Find( nHash, key, true );
+		if ( pPooled )
+			return pPooled;
+
+		pPooled = Allocate( string );
+
+		AUTO_LOCK( shard.m_Mutex );
+		if ( !shard.Find( nHash, key, true ) )
 		{
-			cached = Allocate( string );
+			shard.Insert( nHash, key, pPooled );
 		}
-		return cached;
+		return pPooled;
 	}
 };
 
@@ -125,7 +428,7 @@ string_t FindPooledString( const char *pszValue )
 
 #if !defined(CLIENT_DLL) && !defined( GC )
 //------------------------------------------------------------------------------
-// Purpose: 
+// Purpose:
 //------------------------------------------------------------------------------
 void CC_DumpGameStringTable( void )
 {
@@ -135,4 +438,13 @@ void CC_DumpGameStringTable( void )
 	g_GameStringPool.Dump();
 }
 static ConCommand dumpgamestringtable("dumpgamestringtable", CC_DumpGameStringTable, "Dump the contents of the game string table to the console.", FCVAR_CHEAT);
+
+void CC_GameStringTableStats( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_GameStringPool.PrintStats();
+}
+static ConCommand gamestringtable_stats("gamestringtable_stats", CC_GameStringTableStats, "Print the number of unique game strings and the memory they use on this map.");
 #endif
@@ -12,6 +12,7 @@
 class CHLMoveData : public CMoveData {
 public:
 	bool m_bIsSprinting;
+	Vector m_vecSaveOrigin;		// server: where the move started, for the travel stats
 };
 
 class CFuncLadder;
@@ -73,6 +73,11 @@ void CHL2MP_Player::PlayStepSound( Vector &vecOrigin, surfacedata_t *psurface, f
 	if ( gpGlobals->maxClients > 1 && !sv_footsteps.GetFloat() )
 		return;
 
+#if !defined( CLIENT_DLL )
+	if ( DeferStepSound( vecOrigin, psurface, fvol, force ) )
+		return;
+#endif
+
 #if defined( CLIENT_DLL )
 	// during prediction play footstep sounds only once
 	if ( !prediction->IsFirstTimePredicted() )
@@ -48,7 +48,13 @@ typedef CBaseHandle EntityHandle_t;
 abstract_class IMoveHelper {
 public:
 	// Call this to set the singleton
-	static IMoveHelper* GetSingleton() { return sm_pSingleton; }
+	static IMoveHelper* GetSingleton() {
+		IMoveHelper* pThreadHelper = sm_pThreadSingleton;
+		return pThreadHelper ? pThreadHelper : sm_pSingleton;
+	}
+
+	// Player movement run on a worker thread uses its own helper while it runs
+	static void SetThreadSingleton( IMoveHelper* pMoveHelper ) { sm_pThreadSingleton = pMoveHelper; }
 
 	// Methods associated with a particular entity
 	virtual char const* GetName( EntityHandle_t handle ) const = 0;
@@ -85,6 +91,7 @@ protected:
 
 	// The global instance
 	static IMoveHelper* sm_pSingleton;
+	static CTHREADLOCALPTR( IMoveHelper ) sm_pThreadSingleton;
 };
 
 //-----------------------------------------------------------------------------
@@ -92,7 +99,8 @@ protected:
 //-----------------------------------------------------------------------------
 
 #define IMPLEMENT_MOVEHELPER() \
-	IMoveHelper* IMoveHelper::sm_pSingleton = 0
+	IMoveHelper* IMoveHelper::sm_pSingleton = 0; \
+	CTHREADLOCALPTR( IMoveHelper ) IMoveHelper::sm_pThreadSingleton
 
 //-----------------------------------------------------------------------------
 // Call this to set the singleton
@@ -23,6 +23,10 @@
 	#include "portal_util_shared.h"
 #endif
 
+#ifdef GAME_DLL
+	#include "movehelper_server.h"
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -2122,17 +2126,17 @@ bool CBaseEntity::PhysicsRunSpecificThink( int nContextIndex, BASEPTR thinkFunc
 	return ( !IsMarkedForDeletion() );
 }
 
-void CBaseEntity::SetGroundEntity( CBaseEntity *ground )
+//-----------------------------------------------------------------------------
+// Purpose: Tells the old and new ground entities about a ground change
+//-----------------------------------------------------------------------------
+static void PhysicsGroundChanged( CBaseEntity *pEntity, CBaseEntity *oldGround, CBaseEntity *ground )
 {
-	if ( m_hGroundEntity.Get() == ground )
-		return;
-
 #ifdef GAME_DLL
 	// this can happen in-between updates to the held object controller (physcannon, +USE)
 	// so trap it here and release held objects when they become player ground
-	if ( ground && IsPlayer() && ground->GetMoveType()== MOVETYPE_VPHYSICS )
+	if ( ground && pEntity->IsPlayer() && ground->GetMoveType()== MOVETYPE_VPHYSICS )
 	{
-		CBasePlayer *pPlayer = ToBasePlayer(this);
+		CBasePlayer *pPlayer = ToBasePlayer(pEntity);
 		IPhysicsObject *pPhysGround = ground->VPhysicsGetObject();
 		if ( pPhysGround && pPlayer )
 		{
@@ -2144,24 +2148,44 @@ void CBaseEntity::SetGroundEntity( CBaseEntity *ground )
 	}
 #endif
 
-	CBaseEntity *oldGround = m_hGroundEntity;
-	m_hGroundEntity = ground;
-
 	// Just starting to touch
 	if ( !oldGround && ground )
 	{
-		ground->AddEntityToGroundList( this );
+		ground->AddEntityToGroundList( pEntity );
 	}
 	// Just stopping touching
 	else if ( oldGround && !ground )
 	{
-		PhysicsNotifyOtherOfGroundRemoval( this, oldGround );
+		CBaseEntity::PhysicsNotifyOtherOfGroundRemoval( pEntity, oldGround );
 	}
 	// Changing out to new ground entity
 	else
 	{
-		PhysicsNotifyOtherOfGroundRemoval( this, oldGround );
-		ground->AddEntityToGroundList( this );
+		CBaseEntity::PhysicsNotifyOtherOfGroundRemoval( pEntity, oldGround );
+		ground->AddEntityToGroundList( pEntity );
+	}
+}
+
+void CBaseEntity::SetGroundEntity( CBaseEntity *ground )
+{
+	if ( m_hGroundEntity.Get() == ground )
+		return;
+
+	CBaseEntity *oldGround = m_hGroundEntity;
+	m_hGroundEntity = ground;
+
+#ifdef GAME_DLL
+	// Player movement on a worker thread only moves the handle, the ground lists
+	// are shared with everything else standing on the same entity
+	CCallQueue *pDeferredCalls = GetDeferredMovementCallQueue();
+	if ( pDeferredCalls )
+	{
+		pDeferredCalls->QueueCall( &PhysicsGroundChanged, this, oldGround, ground );
+	}
+	else
+#endif
+	{
+		PhysicsGroundChanged( this, oldGround, ground );
 	}
 
 	// HACK/PARANOID:  This is redundant with the code above, but in case we get out of sync groundlist entries ever, 
@@ -7,7 +7,10 @@
 //=============================================================================//
 #include "cbase.h"
 #include "querycache.h"
+#include "tier0/fasttimer.h"
 #include "tier0/vprof.h"
+#include "tier1/mempool.h"
+#include "tier1/utlhashtable.h"
 #include "tier1/utlintrusivelist.h"
 #include "datacache/imdlcache.h"
 #include "vstdlib/jobthread.h"
@@ -227,8 +230,12 @@ static void PostUpdateQueryCache()
 }
 
 
+static void UpdateRayQueries();
+
 void UpdateQueryCache( void )
 {
+	UpdateRayQueries();
+
 	// parallel process all hash chains
 	QueryCacheUpdateRecord_t workList[N_WAYS_TO_SPLIT_CACHE_UPDATE];
 	int nCurEntry = 0;
@@ -250,8 +257,12 @@ void UpdateQueryCache( void )
 	}
 }
 
+static void PurgeRayQueries();
+
 void InvalidateQueryCache( void )
 {
+	PurgeRayQueries();
+
 	s_VictimList.RemoveAll();
 	for( int i = 0; i < ARRAYSIZE( s_HashChains); i++ )
 		s_HashChains[i].RemoveAll();
@@ -323,6 +334,206 @@ bool IsLineOfSightBetweenTwoEntitiesClear( CBaseEntity *pSrcEntity,
 }
 
 
+//-----------------------------------------------------------------------------
+// Asynchronous ray queries
+//-----------------------------------------------------------------------------
+
+ConVar sv_async_rayqueries( "sv_async_rayqueries", "1", FCVAR_CHEAT, "Batch ray queries such as NPC sight and trace them on the job pool at the start of the next frame" );
+ConVar sv_async_rayquery_lifetime( "sv_async_rayquery_lifetime", "0.2", FCVAR_CHEAT, "Seconds an asynchronous ray query result stays usable" );
+
+#define RAYQUERY_EXPIRE_TIME 2.0f// forget queries that haven't been submitted for this long
+
+struct RayQueryKey_t
+{
+	int m_nType;
+	unsigned long m_hRequester;
+	unsigned long m_hTarget;
+	unsigned int m_nTraceMask;
+	int m_nCollisionGroup;
+	int m_nFilter;
+
+	bool operator==( const RayQueryKey_t &other ) const
+	{
+		return ( m_nType == other.m_nType && m_hRequester == other.m_hRequester && m_hTarget == other.m_hTarget &&
+				 m_nTraceMask == other.m_nTraceMask && m_nCollisionGroup == other.m_nCollisionGroup && m_nFilter == other.m_nFilter );
+	}
+};
+
+struct RayQueryKeyHash_t
+{
+	unsigned int operator()( const RayQueryKey_t &key ) const
+	{
+		unsigned int hash = Mix32HashFunctor()( key.m_hRequester );
+		hash = hash * 31 + Mix32HashFunctor()( key.m_hTarget );
+		hash = hash * 31 + Mix32HashFunctor()( key.m_nTraceMask );
+		return hash * 31 + Mix32HashFunctor()( ( key.m_nType << 24 ) ^ ( key.m_nFilter << 16 ) ^ key.m_nCollisionGroup );
+	}
+};
+
+struct RayQuery_t
+{
+	RayQueryKey_t m_Key;
+	EHANDLE m_hRequester;
+	EHANDLE m_hTarget;
+	Vector m_vecStart;
+	Vector m_vecEnd;
+	float m_flLastSubmitTime;
+	bool m_bPending;
+	bool m_bHasResult;
+	RayQueryResult_t m_Result;
+
+	// resolved on the main thread before the batch is traced
+	CBaseEntity *m_pRequester;
+	CBaseEntity *m_pTarget;
+};
+
+struct RayQueryStats_t
+{
+	int m_nSubmitted;
+	int m_nAnswered;
+	int m_nTraced;
+};
+
+static CUtlHashtable<RayQueryKey_t, RayQuery_t *, RayQueryKeyHash_t> s_RayQueries;
+static CClassMemoryPool<RayQuery_t> s_RayQueryPool( 256 );
+static CUtlVector<RayQuery_t *> s_PendingRayQueries;
+
+static RayQueryStats_t s_RayQueryStats[NUM_RAYQUERY_TYPES];
+static const char *s_pszRayQueryTypeNames[NUM_RAYQUERY_TYPES] = { "npc sight", "generic" };
+static int s_nRayQueryBatches = 0;
+static double s_flRayQueryBatchTime = 0;
+
+bool SubmitRayQuery( ERayQueryType_t nType, CBaseEntity *pRequester, CBaseEntity *pTarget,
+					 const Vector &vecStart, const Vector &vecEnd, unsigned int nTraceMask,
+					 int nCollisionGroup, ERayQueryFilter_t nFilter, RayQueryResult_t *pResult )
+{
+	if ( !sv_async_rayqueries.GetBool() || !pRequester )
+		return false;
+
+	RayQueryKey_t key;
+	key.m_nType = nType;
+	key.m_hRequester = pRequester->GetRefEHandle().ToInt();
+	key.m_hTarget = pTarget ? pTarget->GetRefEHandle().ToInt() : INVALID_EHANDLE_INDEX;
+	key.m_nTraceMask = nTraceMask;
+	key.m_nCollisionGroup = nCollisionGroup;
+	key.m_nFilter = nFilter;
+
+	RayQuery_t *pQuery;
+	UtlHashHandle_t h = s_RayQueries.Find( key );
+	if ( h == s_RayQueries.InvalidHandle() )
+	{
+		pQuery = s_RayQueryPool.Alloc();
+		pQuery->m_Key = key;
+		pQuery->m_hRequester = pRequester;
+		pQuery->m_hTarget = pTarget;
+		pQuery->m_bPending = false;
+		pQuery->m_bHasResult = false;
+		s_RayQueries.Insert( key, pQuery );
+	}
+	else
+	{
+		pQuery = s_RayQueries.Element( h );
+	}
+
+	// Trace from where things are now at the start of the next frame
+	pQuery->m_vecStart = vecStart;
+	pQuery->m_vecEnd = vecEnd;
+	pQuery->m_flLastSubmitTime = gpGlobals->curtime;
+	if ( !pQuery->m_bPending )
+	{
+		pQuery->m_bPending = true;
+		s_PendingRayQueries.AddToTail( pQuery );
+	}
+
+	s_RayQueryStats[nType].m_nSubmitted++;
+
+	if ( !pQuery->m_bHasResult || gpGlobals->curtime - pQuery->m_Result.m_flTraceTime > sv_async_rayquery_lifetime.GetFloat() )
+		return false;
+
+	*pResult = pQuery->m_Result;
+	s_RayQueryStats[nType].m_nAnswered++;
+	return true;
+}
+
+static void ProcessRayQuery( RayQuery_t *&pQuery )
+{
+	trace_t tr;
+	if ( pQuery->m_Key.m_nFilter == RAYQUERY_FILTER_LOS )
+	{
+		CTraceFilterLOS filter( pQuery->m_pRequester, pQuery->m_Key.m_nCollisionGroup, pQuery->m_pTarget );
+		UTIL_TraceLine( pQuery->m_vecStart, pQuery->m_vecEnd, pQuery->m_Key.m_nTraceMask, &filter, &tr );
+	}
+	else
+	{
+		CTraceFilterSimple filter( pQuery->m_pRequester, pQuery->m_Key.m_nCollisionGroup );
+		UTIL_TraceLine( pQuery->m_vecStart, pQuery->m_vecEnd, pQuery->m_Key.m_nTraceMask, &filter, &tr );
+	}
+
+	pQuery->m_Result.m_flFraction = tr.fraction;
+	pQuery->m_Result.m_bStartSolid = tr.startsolid;
+	pQuery->m_Result.m_hHitEntity = tr.m_pEnt;
+	pQuery->m_Result.m_flTraceTime = gpGlobals->curtime;
+	pQuery->m_bHasResult = true;
+}
+
+static void UpdateRayQueries()
+{
+	// Forget the queries nobody has asked for in a while
+	CUtlVector<RayQueryKey_t> expired;
+	FOR_EACH_HASHTABLE( s_RayQueries, it )
+	{
+		RayQuery_t *pQuery = s_RayQueries.Element( it );
+		if ( !pQuery->m_bPending && gpGlobals->curtime - pQuery->m_flLastSubmitTime > RAYQUERY_EXPIRE_TIME )
+		{
+			expired.AddToTail( pQuery->m_Key );
+			s_RayQueryPool.Free( pQuery );
+		}
+	}
+	for ( int i = 0; i < expired.Count(); i++ )
+	{
+		s_RayQueries.Remove( expired[i] );
+	}
+
+	// Skip the queries whose entities have gone away since they were submitted
+	int nQueries = 0;
+	for ( int i = 0; i < s_PendingRayQueries.Count(); i++ )
+	{
+		RayQuery_t *pQuery = s_PendingRayQueries[i];
+		pQuery->m_bPending = false;
+		pQuery->m_pRequester = pQuery->m_hRequester.Get();
+		pQuery->m_pTarget = pQuery->m_hTarget.Get();
+		if ( !pQuery->m_pRequester || ( pQuery->m_Key.m_hTarget != INVALID_EHANDLE_INDEX && !pQuery->m_pTarget ) )
+			continue;
+
+		s_RayQueryStats[pQuery->m_Key.m_nType].m_nTraced++;
+		s_PendingRayQueries[nQueries++] = pQuery;
+	}
+
+	if ( nQueries )
+	{
+		CFastTimer timer;
+		timer.Start();
+		ParallelProcess( "ProcessRayQuery", s_PendingRayQueries.Base(), nQueries, ProcessRayQuery, PreUpdateQueryCache, PostUpdateQueryCache );
+		timer.End();
+
+		s_nRayQueryBatches++;
+		s_flRayQueryBatchTime += timer.GetDuration().GetMillisecondsF();
+	}
+
+	s_PendingRayQueries.RemoveAll();
+}
+
+static void PurgeRayQueries()
+{
+	FOR_EACH_HASHTABLE( s_RayQueries, it )
+	{
+		s_RayQueryPool.Free( s_RayQueries.Element( it ) );
+	}
+	s_RayQueries.Purge();
+	s_PendingRayQueries.Purge();
+}
+
+
 #if defined( CLIENT_DLL )
 CON_COMMAND_F( cl_querycache_stats, "Display status of the query cache (client only)", FCVAR_CHEAT )
 #else
@@ -337,6 +548,16 @@ CON_COMMAND( sv_querycache_stats, "Display status of the query cache (client onl
 	Warning( "%d queries, %d misses (%d free) suc spec = %d wasted spec=%d\n",
 			 s_nNumCacheQueries, s_nNumCacheMisses, s_VictimList.Count(),
 			 s_SuccessfulSpeculatives, s_WastedSpeculativeUpdates );
+
+	Warning( "%d ray queries, %d batches, %.3f ms per batch\n", s_RayQueries.Count(), s_nRayQueryBatches,
+			 s_nRayQueryBatches ? s_flRayQueryBatchTime / s_nRayQueryBatches : 0.0 );
+	for( int i = 0; i < NUM_RAYQUERY_TYPES; i++ )
+	{
+		const RayQueryStats_t &stats = s_RayQueryStats[i];
+		Warning( "  %-10s %d submitted, %d answered from the last batch (%.1f%%), %d traced\n", s_pszRayQueryTypeNames[i],
+				 stats.m_nSubmitted, stats.m_nAnswered, stats.m_nSubmitted ? 100.0f * stats.m_nAnswered / stats.m_nSubmitted : 0.0f,
+				 stats.m_nTraced );
+	}
 }
 
 
@@ -77,6 +77,39 @@ bool IsLineOfSightBetweenTwoEntitiesClear( CBaseEntity* pSrcEntity,
 										   float flMinimumUpdateInterval = 0.2 );
 
 
+// Asynchronous ray queries
+//
+// A ray query is identified by its type and the two entities it's about, and may be
+// submitted again with new end points every time it's needed. Queries submitted during
+// a frame are traced together on the job pool at the start of the next one, in
+// UpdateQueryCache(). Submitting returns the result of the last trace made for the
+// query, if it isn't too old.
+
+enum ERayQueryType_t {
+	RAYQUERY_NPC_SIGHT,// CAI_Senses line of sight
+	RAYQUERY_GENERIC,
+
+	NUM_RAYQUERY_TYPES
+};
+
+enum ERayQueryFilter_t {
+	RAYQUERY_FILTER_SIMPLE,// CTraceFilterSimple, skipping the requester
+	RAYQUERY_FILTER_LOS,// CTraceFilterLOS, skipping the requester
+};
+
+struct RayQueryResult_t {
+	float m_flFraction;
+	bool m_bStartSolid;
+	EHANDLE m_hHitEntity;
+	float m_flTraceTime;// curtime when traced
+};
+
+// Returns true and fills in pResult if a recent enough result is available; otherwise
+// the caller should trace for itself this time
+bool SubmitRayQuery( ERayQueryType_t nType, CBaseEntity* pRequester, CBaseEntity* pTarget,
+					 const Vector& vecStart, const Vector& vecEnd, unsigned int nTraceMask,
+					 int nCollisionGroup, ERayQueryFilter_t nFilter, RayQueryResult_t* pResult );
+
 // call during main loop for threaded update of the query cache
 void UpdateQueryCache();
 
@@ -24,6 +24,7 @@
 #include "vphysics/object_hash.h"
 #include "datacache/imdlcache.h"
 #include "tier0/vprof.h"
+#include "tier1/utlhashtable.h"
 
 #if !defined( CLIENT_DLL )
 
@@ -54,6 +55,8 @@ void AddRestoredEntity( C_BaseEntity *pEntity );
 
 static_assert( sizeof(EHandlePlaceholder_t) == sizeof(EHANDLE) );
 
+static ConVar save_plans( "save_plans", "1", FCVAR_NONE, "Save and empty datamap fields through precompiled per-datamap plans" );
+
 //-----------------------------------------------------------------------------
 
 static int gSizes[FIELD_TYPECOUNT] = 
@@ -182,6 +185,186 @@ inputfunc_t *UTIL_FunctionFromName( datamap_t *pMap, const char *pName )
 	return NULL;
 }
 
+//-----------------------------------------------------------------------------
+//
+// Save/restore plans
+//
+// A plan is a datamap level's saved fields in order, worked out once. Plain
+// fields (numbers, vectors and the like, saved as they are in memory) that
+// sit next to each other in memory are grouped into runs, so a run of empty
+// fields is skipped with one test when saving and cleared with one memset
+// before restoring. Each field also remembers its symbol in the current save,
+// which saves hashing the field name each time the field is written.
+//
+// The save format is unchanged: every field still gets its own header, since
+// restore matches fields by name.
+//
+//-----------------------------------------------------------------------------
+
+#define SAVE_PLAN_MIN_FIELDS	4		// smaller lists, often built on the stack by the container ops, aren't worth a plan
+
+struct SaveRestorePlanField_t
+{
+	typedescription_t *pField;
+	int		nOffset;
+	int		nPlainBytes;		// size of a plain field, 0 if the field goes through WriteField()
+	int		nSaveRunFields;		// on the first field of a run of adjacent plain fields, the fields in the run
+	int		nSaveRunBytes;
+	int		nEmptyRunFields;	// on the first field of a run of adjacent fields restore clears to the same byte
+	int		nEmptyRunBytes;
+	int		nEmptyValue;
+	unsigned short symbol;		// symbol of the field name in the save it was last written to
+};
+
+class CSaveRestorePlan
+{
+public:
+	void Init( typedescription_t *pFields, int fieldCount );
+	bool Matches( const typedescription_t *pFields, int fieldCount ) const
+	{
+		return ( fieldCount == m_FieldsCopy.Count() && !memcmp( pFields, m_FieldsCopy.Base(), fieldCount * sizeof(typedescription_t) ) );
+	}
+
+	CUtlVector<SaveRestorePlanField_t> m_Fields;
+
+private:
+	CUtlVector<typedescription_t> m_FieldsCopy;	// to catch a different list reusing the same memory
+};
+
+static CUtlHashtable< const typedescription_t *, CSaveRestorePlan *, PointerHashFunctor, PointerEqualFunctor > g_SaveRestorePlans;
+
+//-------------------------------------
+
+static bool IsPlainSaveField( const typedescription_t *pField )
+{
+	if ( pField->fieldSizeInBytes != pField->fieldSize * gSizes[pField->fieldType] )
+		return false;
+
+	switch ( pField->fieldType )
+	{
+	case FIELD_FLOAT:
+	case FIELD_VECTOR:
+	case FIELD_QUATERNION:
+	case FIELD_INTEGER:
+	case FIELD_BOOLEAN:
+	case FIELD_SHORT:
+	case FIELD_CHARACTER:
+	case FIELD_COLOR32:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Restore clears these with a memset, see CRestore::EmptyField()
+static bool IsPlainEmptyField( const typedescription_t *pField )
+{
+	if ( pField->fieldType == FIELD_CUSTOM || pField->fieldType == FIELD_EMBEDDED || ( pField->flags & FTYPEDESC_GLOBAL ) )
+		return false;
+
+	return ( pField->fieldSizeInBytes == pField->fieldSize * gSizes[pField->fieldType] );
+}
+
+//-------------------------------------
+
+void CSaveRestorePlan::Init( typedescription_t *pFields, int fieldCount )
+{
+	m_FieldsCopy.CopyArray( pFields, fieldCount );
+	m_Fields.RemoveAll();
+
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pField = &pFields[i];
+		if ( !( pField->flags & FTYPEDESC_SAVE ) || pField->fieldType == FIELD_VOID )
+			continue;
+
+		SaveRestorePlanField_t &field = m_Fields[ m_Fields.AddToTail() ];
+		field.pField = pField;
+		field.nOffset = pField->fieldOffset[ TD_OFFSET_NORMAL ];
+		field.nPlainBytes = IsPlainSaveField( pField ) ? pField->fieldSize * gSizes[pField->fieldType] : 0;
+		field.nSaveRunFields = 0;
+		field.nSaveRunBytes = 0;
+		field.nEmptyRunFields = 0;
+		field.nEmptyRunBytes = 0;
+		field.nEmptyValue = ( pField->fieldType != FIELD_EHANDLE ) ? 0 : 0xFF;
+		field.symbol = 0xFFFF;
+	}
+
+	// Group adjacent fields into runs, keeping the datamap order
+	int iSaveRun = -1;
+	int iEmptyRun = -1;
+	for ( int i = 0; i < m_Fields.Count(); i++ )
+	{
+		SaveRestorePlanField_t &field = m_Fields[i];
+
+		if ( field.nPlainBytes )
+		{
+			if ( iSaveRun >= 0 && m_Fields[iSaveRun].nOffset + m_Fields[iSaveRun].nSaveRunBytes == field.nOffset )
+			{
+				m_Fields[iSaveRun].nSaveRunFields++;
+				m_Fields[iSaveRun].nSaveRunBytes += field.nPlainBytes;
+			}
+			else
+			{
+				iSaveRun = i;
+				field.nSaveRunFields = 1;
+				field.nSaveRunBytes = field.nPlainBytes;
+			}
+		}
+		else
+		{
+			iSaveRun = -1;
+		}
+
+		if ( IsPlainEmptyField( field.pField ) )
+		{
+			int nBytes = field.pField->fieldSizeInBytes;
+			if ( iEmptyRun >= 0 && m_Fields[iEmptyRun].nEmptyValue == field.nEmptyValue &&
+				 m_Fields[iEmptyRun].nOffset + m_Fields[iEmptyRun].nEmptyRunBytes == field.nOffset )
+			{
+				m_Fields[iEmptyRun].nEmptyRunFields++;
+				m_Fields[iEmptyRun].nEmptyRunBytes += nBytes;
+			}
+			else
+			{
+				iEmptyRun = i;
+				field.nEmptyRunFields = 1;
+				field.nEmptyRunBytes = nBytes;
+			}
+		}
+		else
+		{
+			iEmptyRun = -1;
+		}
+	}
+}
+
+//-------------------------------------
+
+static CSaveRestorePlan *GetSaveRestorePlan( typedescription_t *pFields, int fieldCount )
+{
+	if ( fieldCount < SAVE_PLAN_MIN_FIELDS || !save_plans.GetBool() )
+		return NULL;
+
+	UtlHashHandle_t h = g_SaveRestorePlans.Find( pFields );
+	CSaveRestorePlan *pPlan;
+	if ( h != g_SaveRestorePlans.InvalidHandle() )
+	{
+		pPlan = g_SaveRestorePlans.Element( h );
+		if ( pPlan->Matches( pFields, fieldCount ) )
+			return pPlan;
+	}
+	else
+	{
+		pPlan = new CSaveRestorePlan;
+		g_SaveRestorePlans.Insert( pFields, pPlan );
+	}
+
+	pPlan->Init( pFields, fieldCount );
+	return pPlan;
+}
+
 //-----------------------------------------------------------------------------
 //
 // CSave
@@ -201,20 +384,32 @@ CSave::CSave( CSaveRestoreData *pdata )
 
 //-------------------------------------
 
-inline int CSave::DataEmpty( const char *pdata, int size )
+static inline bool IsMemoryZero( const char *pData, int nBytes )
 {
-	if ( size != 4 )
+	// A word at a time while there are whole words left
+	while ( nBytes >= (int)sizeof(uint64) )
 	{
-		const char *pLimit = pdata + size;
-		while ( pdata < pLimit )
-		{
-			if ( *pdata++ )
-				return 0;
-		}
-		return 1;
+		uint64 word;
+		memcpy( &word, pData, sizeof(word) );
+		if ( word )
+			return false;
+		pData += sizeof(uint64);
+		nBytes -= sizeof(uint64);
 	}
 
-	return ( *((int *)pdata) == 0 );
+	while ( nBytes-- > 0 )
+	{
+		if ( *pData++ )
+			return false;
+	}
+	return true;
+}
+
+//-------------------------------------
+
+inline int CSave::DataEmpty( const char *pdata, int size )
+{
+	return IsMemoryZero( pdata, size );
 }
 
 //-----------------------------------------------------------------------------
@@ -823,17 +1018,25 @@ int CSave::WriteFields( const char *pname, const void *pBaseData, datamap_t *pRo
 
 	count = 0;
 
-	for ( int i = 0; i < fieldCount; i++ )
+	CSaveRestorePlan *pPlan = GetSaveRestorePlan( pFields, fieldCount );
+	if ( pPlan )
 	{
-		pTest = &pFields[ i ];
-		void *pOutputData = ( (char *)pBaseData + pTest->fieldOffset[ TD_OFFSET_NORMAL ] );
-			
-		if ( !ShouldSaveField( pOutputData, pTest ) )
-			continue;
+		count = WritePlannedFields( pname, pBaseData, pRootMap, pPlan );
+	}
+	else
+	{
+		for ( int i = 0; i < fieldCount; i++ )
+		{
+			pTest = &pFields[ i ];
+			void *pOutputData = ( (char *)pBaseData + pTest->fieldOffset[ TD_OFFSET_NORMAL ] );
+				
+			if ( !ShouldSaveField( pOutputData, pTest ) )
+				continue;
 
-		if ( !WriteField( pname, pOutputData, pRootMap, pTest ) )
-			break;
-		count++;
+			if ( !WriteField( pname, pOutputData, pRootMap, pTest ) )
+				break;
+			count++;
+		}
 	}
 
 	int iCurPos = m_pData->GetCurPos();
@@ -846,6 +1049,86 @@ int CSave::WriteFields( const char *pname, const void *pBaseData, datamap_t *pRo
 	return 1;
 }
 
+//-------------------------------------
+// Purpose: WriteFields() through a plan. Writes the same records in the same
+//			order, returns the number written.
+
+int CSave::WritePlannedFields( const char *pname, const void *pBaseData, datamap_t *pRootMap, CSaveRestorePlan *pPlan )
+{
+	int count = 0;
+	int i = 0;
+	while ( i < pPlan->m_Fields.Count() )
+	{
+		SaveRestorePlanField_t &field = pPlan->m_Fields[i];
+		char *pFieldData = (char *)pBaseData + field.nOffset;
+
+		if ( field.nSaveRunFields )
+		{
+			int iEnd = i + field.nSaveRunFields;
+
+			// Most plain fields are empty, so test the whole run first
+			if ( IsMemoryZero( pFieldData, field.nSaveRunBytes ) )
+			{
+				i = iEnd;
+				continue;
+			}
+
+			for ( ; i < iEnd; i++ )
+			{
+				SaveRestorePlanField_t &runField = pPlan->m_Fields[i];
+				char *pRunData = (char *)pBaseData + runField.nOffset;
+				if ( IsMemoryZero( pRunData, runField.nPlainBytes ) )
+					continue;
+
+#if IsDebug()
+				Log( pname, (fieldtype_t)runField.pField->fieldType, pRunData, runField.pField->fieldSize );
+#endif
+				WritePlainField( runField, pRunData );
+				count++;
+			}
+			continue;
+		}
+
+		i++;
+
+		if ( !ShouldSaveField( pFieldData, field.pField ) )
+			continue;
+
+		if ( !WriteField( pname, pFieldData, pRootMap, field.pField ) )
+			break;
+		count++;
+	}
+
+	return count;
+}
+
+//-------------------------------------
+// Purpose: Writes a plain field's header and data as one block
+
+void CSave::WritePlainField( SaveRestorePlanField_t &field, const char *pData )
+{
+	const char *pszName = field.pField->fieldName;
+	if ( field.symbol >= m_pData->SizeSymbolTable() || m_pData->StringFromSymbol( field.symbol ) != pszName )
+	{
+		field.symbol = m_pData->FindCreateSymbol( pszName );
+	}
+
+	const int MAX_BLOCK_DATA = 256;
+	if ( field.nPlainBytes > MAX_BLOCK_DATA )
+	{
+		BufferField( pszName, field.nPlainBytes, pData );
+		return;
+	}
+
+	char block[ 2 * sizeof(short) + MAX_BLOCK_DATA ];
+	short shortSize = field.nPlainBytes;
+	short hashvalue = field.symbol;
+	memcpy( block, &shortSize, sizeof(short) );
+	memcpy( block + sizeof(short), &hashvalue, sizeof(short) );
+	memcpy( block + 2 * sizeof(short), pData, field.nPlainBytes );
+	BufferData( block, 2 * sizeof(short) + field.nPlainBytes );
+}
+
 //-------------------------------------
 // Purpose: Recursively saves all the classes in an object, in reverse order (top down)
 // Output : int 0 on failure, 1 on success
@@ -1529,54 +1812,80 @@ bool CRestore::ShouldEmptyField( typedescription_t *pField )
 
 void CRestore::EmptyFields( void *pBaseData, typedescription_t *pFields, int fieldCount )
 {
-	int i;
-	for ( i = 0; i < fieldCount; i++ )
+	CSaveRestorePlan *pPlan = GetSaveRestorePlan( pFields, fieldCount );
+	if ( pPlan )
 	{
-		typedescription_t *pField = &pFields[i];
-		if ( !ShouldEmptyField( pField ) )
-			continue;
-
-		void *pFieldData = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
-		switch( pField->fieldType )
+		int i = 0;
+		while ( i < pPlan->m_Fields.Count() )
 		{
-		case FIELD_CUSTOM:
+			SaveRestorePlanField_t &field = pPlan->m_Fields[i];
+			if ( field.nEmptyRunFields )
 			{
-				SaveRestoreFieldInfo_t fieldInfo =
-				{
-					pFieldData,
-					pBaseData,
-					pField
-				};
-				pField->pSaveRestoreOps->MakeEmpty( fieldInfo );
+				memset( (char *)pBaseData + field.nOffset, field.nEmptyValue, field.nEmptyRunBytes );
+				i += field.nEmptyRunFields;
 			}
-			break;
+			else
+			{
+				EmptyField( pBaseData, field.pField );
+				i++;
+			}
+		}
+		return;
+	}
 
-		case FIELD_EMBEDDED:
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		EmptyField( pBaseData, &pFields[i] );
+	}
+}
+
+//-------------------------------------
+
+void CRestore::EmptyField( void *pBaseData, typedescription_t *pField )
+{
+	if ( !ShouldEmptyField( pField ) )
+		return;
+
+	void *pFieldData = (char *)pBaseData + pField->fieldOffset[ TD_OFFSET_NORMAL ];
+	switch( pField->fieldType )
+	{
+	case FIELD_CUSTOM:
+		{
+			SaveRestoreFieldInfo_t fieldInfo =
 			{
-				if ( (pField->flags & FTYPEDESC_PTR) && !*((void **)pFieldData) )
-					break;
+				pFieldData,
+				pBaseData,
+				pField
+			};
+			pField->pSaveRestoreOps->MakeEmpty( fieldInfo );
+		}
+		break;
 
-				int nFieldCount = pField->fieldSize;
-				char *pFieldMemory = (char *)( ( !(pField->flags & FTYPEDESC_PTR) ) ? pFieldData : *((void **)pFieldData) );
-				while ( --nFieldCount >= 0 )
-				{
-					EmptyFields( pFieldMemory, pField->td->dataDesc, pField->td->dataNumFields );
-					pFieldMemory += pField->fieldSizeInBytes;
-				}
-			}
-			break;
+	case FIELD_EMBEDDED:
+		{
+			if ( (pField->flags & FTYPEDESC_PTR) && !*((void **)pFieldData) )
+				break;
 
-		default:
-			// NOTE: If you hit this assertion, you've got a bug where you're using 
-			// the wrong field type for your field
-			if ( pField->fieldSizeInBytes != pField->fieldSize * gSizes[pField->fieldType] )
+			int nFieldCount = pField->fieldSize;
+			char *pFieldMemory = (char *)( ( !(pField->flags & FTYPEDESC_PTR) ) ? pFieldData : *((void **)pFieldData) );
+			while ( --nFieldCount >= 0 )
 			{
-				Warning("WARNING! Field %s is using the wrong FIELD_ type!\nFix this or you'll see a crash.\n", pField->fieldName );
-				Assert( 0 );
+				EmptyFields( pFieldMemory, pField->td->dataDesc, pField->td->dataNumFields );
+				pFieldMemory += pField->fieldSizeInBytes;
 			}
-			memset( pFieldData, (pField->fieldType != FIELD_EHANDLE) ? 0 : 0xFF, pField->fieldSize * gSizes[pField->fieldType] );
-			break;
 		}
+		break;
+
+	default:
+		// NOTE: If you hit this assertion, you've got a bug where you're using 
+		// the wrong field type for your field
+		if ( pField->fieldSizeInBytes != pField->fieldSize * gSizes[pField->fieldType] )
+		{
+			Warning("WARNING! Field %s is using the wrong FIELD_ type!\nFix this or you'll see a crash.\n", pField->fieldName );
+			Assert( 0 );
+		}
+		memset( pFieldData, (pField->fieldType != FIELD_EHANDLE) ? 0 : 0xFF, pField->fieldSize * gSizes[pField->fieldType] );
+		break;
 	}
 }
 
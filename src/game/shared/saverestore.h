@@ -28,6 +28,8 @@ struct edict_t;
 struct datamap_t;
 class CBaseEntity;
 struct interval_t;
+class CSaveRestorePlan;
+struct SaveRestorePlanField_t;
 
 //-----------------------------------------------------------------------------
 //
@@ -160,6 +162,9 @@ private:
 	int				CountFieldsToSave( const void *pBaseData, typedescription_t *pFields, int fieldCount );
 	bool			ShouldSaveField( const void *pData, typedescription_t *pField );
 
+	int				WritePlannedFields( const char *pname, const void *pBaseData, datamap_t *pRootMap, CSaveRestorePlan *pPlan );
+	void			WritePlainField( SaveRestorePlanField_t &field, const char *pData );
+
 	//---------------------------------
 	// Game info methods
 	//
@@ -276,6 +281,7 @@ private:
 	int				DoReadAll( void *pLeafObject, datamap_t *pLeafMap, datamap_t *pCurMap );
 	
 	typedescription_t *FindField( const char *pszFieldName, typedescription_t *pFields, int fieldCount, int *pIterator );
+	void			EmptyField( void *pBaseData, typedescription_t *pField );
 	void			ReadField( const SaveRestoreRecordHeader_t &header, void *pDest, datamap_t *pRootMap, typedescription_t *pField );
 	
 	void 			ReadBasicField( const SaveRestoreRecordHeader_t &header, void *pDest, datamap_t *pRootMap, typedescription_t *pField );
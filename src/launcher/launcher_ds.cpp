@@ -41,10 +41,10 @@ public:
 		puts( text );
 	}
 
-	[[noreturn]] void RunServer() override {
-		// Main Server loop
-		for ( ;; )
-			g_pDedicatedServerApi->RunFrame();
+	void RunServer() override {
+		// Main Server loop, until the server quits (e.g. at the end of a -benchmark run)
+		while ( g_pDedicatedServerApi->RunFrame() ) {
+		}
 	}
 };
 
@@ -215,6 +215,16 @@ int CLauncherDS::Main() {
 	s_modInfo.m_pInitialGame = "hl2";
 	s_modInfo.m_pInitialMod = g_szGameInfoDir;
 
+	// -benchmark [scenario]: run the server benchmark headless, write the results and quit
+	if ( CommandLine()->FindParm( "-benchmark" ) ) {
+		CommandLine()->AppendParm( "-sv_benchmark", nullptr );
+		CommandLine()->AppendParm( "-sv_benchmark_exit", nullptr );
+
+		const char* scenario = CommandLine()->ParmValue( "-benchmark", "" );
+		if ( scenario[0] && scenario[0] != '-' && scenario[0] != '+' )
+			CommandLine()->AppendParm( "-sv_benchmark_scenario", scenario );
+	}
+
 	g_pDedicatedServerApi->ModInit( s_modInfo );
 
 	return 0;
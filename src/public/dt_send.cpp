@@ -12,6 +12,9 @@
 #include "mathlib/vector.h"
 #include "tier0/dbg.h"
 #include "dt_utlvector_common.h"
+#include "tier0/threadtools.h"
+#include "tier1/strtools.h"
+#include "tier1/utlhashtable.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -871,4 +874,193 @@ void SendTable::Construct( SendProp *pProps, int nProps, const char *pNetTableNa
 	m_bHasPropsEncodedAgainstCurrentTickCount = false;
 }
 
+
+// ---------------------------------------------------------------------- //
+// CSendTablePropMap
+// ---------------------------------------------------------------------- //
+static CUtlHashtable<SendTable *, CSendTablePropMap *> s_SendTablePropMaps;
+static CThreadFastMutex s_SendTablePropMapMutex;
+
+
+static void SendTable_GatherExcludeProps( SendTable *pTable, CUtlVector<const SendProp*> &excludes )
+{
+	for ( int i = 0; i < pTable->GetNumProps(); i++ )
+	{
+		SendProp *pProp = pTable->GetProp( i );
+		if ( pProp->IsExcludeProp() )
+		{
+			excludes.AddToTail( pProp );
+		}
+		else if ( pProp->GetType() == DPT_DataTable && pProp->GetDataTable() )
+		{
+			SendTable_GatherExcludeProps( pProp->GetDataTable(), excludes );
+		}
+	}
+}
+
+
+static bool SendTable_IsPropExcluded( const SendTable *pTable, const SendProp *pProp, const CUtlVector<const SendProp*> &excludes )
+{
+	for ( int i = 0; i < excludes.Count(); i++ )
+	{
+		if ( Q_stricmp( excludes[i]->GetExcludeDTName(), pTable->GetName() ) == 0 &&
+			 Q_stricmp( excludes[i]->GetName(), pProp->GetName() ) == 0 )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+const CSendTablePropMap* CSendTablePropMap::Get( SendTable *pTable )
+{
+	AUTO_LOCK( s_SendTablePropMapMutex );
+
+	UtlHashHandle_t h = s_SendTablePropMaps.Find( pTable );
+	if ( h != s_SendTablePropMaps.InvalidHandle() )
+		return s_SendTablePropMaps.Element( h );
+
+	CSendTablePropMap *pMap = new CSendTablePropMap( pTable );
+	s_SendTablePropMaps.Insert( pTable, pMap );
+	return pMap;
+}
+
+
+CSendTablePropMap::CSendTablePropMap( SendTable *pTable )
+{
+	CUtlVector<const SendProp*> excludes;
+	SendTable_GatherExcludeProps( pTable, excludes );
+
+	CUtlVector<Key_t> keys;
+	AddTable( pTable, 0, excludes, keys );
+
+	keys.Sort( []( const Key_t *a, const Key_t *b ) { return a->m_nOffset - b->m_nOffset; } );
+	m_KeyOffsets.EnsureCapacity( keys.Count() );
+	m_KeyProps.EnsureCapacity( keys.Count() );
+	for ( int i = 0; i < keys.Count(); i++ )
+	{
+		m_KeyOffsets.AddToTail( keys[i].m_nOffset );
+		m_KeyProps.AddToTail( keys[i].m_iProp );
+	}
+
+	m_UnmappedProps.SetCount( ( m_Props.Count() + 31 ) / 32 );
+	V_memset( m_UnmappedProps.Base(), 0, m_UnmappedProps.Count() * sizeof( uint32 ) );
+	for ( int i = 0; i < m_Props.Count(); i++ )
+	{
+		if ( m_Props[i].m_nOffset < 0 )
+		{
+			m_UnmappedProps[i >> 5] |= ( 1u << ( i & 31 ) );
+		}
+	}
+}
+
+
+void CSendTablePropMap::AddTable( SendTable *pTable, int nStructOffset, const CUtlVector<const SendProp*> &excludes, CUtlVector<Key_t> &keys )
+{
+	for ( int i = 0; i < pTable->GetNumProps(); i++ )
+	{
+		SendProp *pProp = pTable->GetProp( i );
+		if ( pProp->IsExcludeProp() || SendTable_IsPropExcluded( pTable, pProp, excludes ) )
+			continue;
+
+		if ( pProp->GetType() == DPT_DataTable )
+		{
+			if ( !pProp->GetDataTable() )
+				continue;
+
+			// Only the default proxies are known to hand their table the variable at the prop's
+			// offset. Anything under other proxies can't be matched to an offset.
+			int nChildOffset = -1;
+			SendTableProxyFn proxy = pProp->GetDataTableProxyFn();
+			if ( nStructOffset >= 0 && ( proxy == SendProxy_DataTableToDataTable || proxy == SendProxy_SendLocalDataTable ) )
+			{
+				nChildOffset = nStructOffset + pProp->GetOffset();
+			}
+
+			AddTable( pProp->GetDataTable(), nChildOffset, excludes, keys );
+			continue;
+		}
+
+		// An array's element prop precedes it, and is sent as part of it
+		if ( pProp->IsInsideArray() || ( i + 1 < pTable->GetNumProps() && pTable->GetProp( i + 1 )->GetType() == DPT_Array ) )
+			continue;
+
+		const SendProp *pElementProp = pProp;
+		if ( pProp->GetType() == DPT_Array )
+		{
+			// The engine only links the element prop once it has initialized the table
+			pElementProp = pProp->GetArrayProp() ? pProp->GetArrayProp() : ( i > 0 ? pTable->GetProp( i - 1 ) : NULL );
+			if ( !pElementProp )
+				continue;
+		}
+
+		// SENDINFO_VECTORELEM offsets are negative until the engine initializes the table
+		int nVarOffset = abs( pElementProp->GetOffset() );
+		bool bVectorElem = ( pElementProp->GetOffset() < 0 || ( pElementProp->GetFlags() & SPROP_IS_A_VECTOR_ELEM ) );
+
+		int iProp = m_Props.AddToTail();
+		Prop_t &prop = m_Props[iProp];
+		prop.m_pProp = pProp;
+		prop.m_pElementProp = pElementProp;
+		prop.m_nStructOffset = nStructOffset;
+
+		// Offset 0 is the object's vtable, so a prop there computes its value in its proxy
+		prop.m_nOffset = ( nStructOffset >= 0 && nStructOffset + nVarOffset > 0 ) ? nStructOffset + nVarOffset : -1;
+		if ( prop.m_nOffset < 0 )
+			continue;
+
+		Key_t key = { prop.m_nOffset, (unsigned short)iProp };
+		keys.AddToTail( key );
+
+		if ( pProp->GetType() == DPT_Array )
+		{
+			// Networkvar arrays report the element that changed
+			for ( int iElement = 1; iElement < pProp->GetNumElements() && pProp->GetElementStride() > 0; iElement++ )
+			{
+				key.m_nOffset = prop.m_nOffset + iElement * pProp->GetElementStride();
+				keys.AddToTail( key );
+			}
+		}
+		else if ( bVectorElem )
+		{
+			// Networked vectors report the start of the vector, whichever component changed.
+			// The element index is in the name SENDINFO_VECTORELEM gives the prop, "m_vec[1]".
+			const char *pBracket = strrchr( pProp->GetName(), '[' );
+			int iComponent = pBracket ? atoi( pBracket + 1 ) : 0;
+			if ( iComponent > 0 && iComponent < 3 && prop.m_nOffset - iComponent * (int)sizeof( float ) > 0 )
+			{
+				key.m_nOffset = prop.m_nOffset - iComponent * (int)sizeof( float );
+				keys.AddToTail( key );
+			}
+		}
+	}
+}
+
+
+bool CSendTablePropMap::FindPropsForOffset( int varOffset, const unsigned short **ppProps, int *pnProps ) const
+{
+	// Lower bound of the offset
+	int lo = 0, hi = m_KeyOffsets.Count();
+	while ( lo < hi )
+	{
+		int mid = ( lo + hi ) >> 1;
+		if ( m_KeyOffsets[mid] < varOffset )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	int end = lo;
+	while ( end < m_KeyOffsets.Count() && m_KeyOffsets[end] == varOffset )
+		end++;
+
+	if ( end == lo )
+		return false;
+
+	*ppProps = m_KeyProps.Base() + lo;
+	*pnProps = end - lo;
+	return true;
+}
+
 #endif
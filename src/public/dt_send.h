@@ -10,6 +10,7 @@
 #include "const.h"
 #include "dt_common.h"
 #include "tier0/dbg.h"
+#include "tier1/utlvector.h"
 
 
 // ------------------------------------------------------------------------ //
@@ -471,6 +472,92 @@ inline void SendTable::SetHasPropsEncodedAgainstTickcount( bool bState ) {
 	m_bHasPropsEncodedAgainstCurrentTickCount = bState;
 }
 
+
+// -------------------------------------------------------------------------------------------------------------- //
+// CSendTablePropMap.
+// -------------------------------------------------------------------------------------------------------------- //
+
+// Numbers the props a SendTable sends (its own, and those of the datatables under it, minus excluded
+// ones) and maps the offset of each networked variable to the props that send it. Networkvar setters
+// use this to record which props they changed, so the props that didn't change can be skipped.
+//
+// The numbering is the game DLL's, in table order. It isn't the engine's flattened prop order.
+class CSendTablePropMap {
+public:
+	// Builds the map for the table the first time it's asked for. Thread safe.
+	static const CSendTablePropMap* Get( SendTable* pTable );
+
+	int GetNumProps() const;
+	int GetNumPropWords() const;// Size of a bit array with a bit for each prop, in uint32s.
+
+	const SendProp* GetProp( int iProp ) const;
+	const SendProp* GetElementProp( int iProp ) const;// The prop each element of a DPT_Array is sent with.
+
+	// Offsets from the start of the object of the struct given to the prop's proxy, and of
+	// the prop's variable. -1 if the prop's datatable proxy doesn't reach it by offset.
+	int GetStructOffset( int iProp ) const;
+	int GetPropOffset( int iProp ) const;
+
+	// Finds the props sending the variable at this offset. Returns false if no prop sends it by
+	// offset, in which case any prop could have changed.
+	bool FindPropsForOffset( int varOffset, const unsigned short** ppProps, int* pnProps ) const;
+
+	// Props that aren't sent from a variable at a known offset, which have to be treated as
+	// changed whenever anything in the object changes. GetNumPropWords() long.
+	const uint32* GetUnmappedProps() const;
+
+private:
+	CSendTablePropMap( SendTable* pTable );
+
+	struct Key_t {
+		int m_nOffset;
+		unsigned short m_iProp;
+	};
+
+	void AddTable( SendTable* pTable, int nStructOffset, const CUtlVector<const SendProp*>& excludes, CUtlVector<Key_t>& keys );
+
+	struct Prop_t {
+		const SendProp* m_pProp;
+		const SendProp* m_pElementProp;
+		int m_nStructOffset;
+		int m_nOffset;
+	};
+
+	CUtlVector<Prop_t> m_Props;
+	CUtlVector<int> m_KeyOffsets;// Sorted, with the prop sending each variable at the same index in m_KeyProps
+	CUtlVector<unsigned short> m_KeyProps;
+	CUtlVector<uint32> m_UnmappedProps;
+};
+
+
+inline int CSendTablePropMap::GetNumProps() const {
+	return m_Props.Count();
+}
+
+inline int CSendTablePropMap::GetNumPropWords() const {
+	return m_UnmappedProps.Count();
+}
+
+inline const SendProp* CSendTablePropMap::GetProp( int iProp ) const {
+	return m_Props[ iProp ].m_pProp;
+}
+
+inline const SendProp* CSendTablePropMap::GetElementProp( int iProp ) const {
+	return m_Props[ iProp ].m_pElementProp;
+}
+
+inline int CSendTablePropMap::GetStructOffset( int iProp ) const {
+	return m_Props[ iProp ].m_nStructOffset;
+}
+
+inline int CSendTablePropMap::GetPropOffset( int iProp ) const {
+	return m_Props[ iProp ].m_nOffset;
+}
+
+inline const uint32* CSendTablePropMap::GetUnmappedProps() const {
+	return m_UnmappedProps.Base();
+}
+
 // ------------------------------------------------------------------------------------------------------ //
 // Use BEGIN_SEND_TABLE if you want to declare a SendTable and have it inherit all the properties from
 // its base class. There are two requirements for this to work:
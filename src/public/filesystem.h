@@ -22,6 +22,7 @@
 //-----------------------------------------------------------------------------
 
 class CUtlBuffer;
+class CUtlBufferView;
 class KeyValues;
 class IFileList;
 class IThreadPool;
@@ -496,7 +497,7 @@ public:
 // Main file system interface
 //-----------------------------------------------------------------------------
 
-#define FILESYSTEM_INTERFACE_VERSION "VFileSystem022"
+#define FILESYSTEM_INTERFACE_VERSION "VFileSystem023"
 
 abstract_class IFileSystem : public IAppSystem, public IBaseFileSystem {
 public:
@@ -881,6 +882,11 @@ public:
 	bool GetCaseCorrectFullPath( const char* pFullPath, OUT_Z_ARRAY char( &pDest )[ maxLenInChars ] ) {
 		return GetCaseCorrectFullPath_Ptr( pFullPath, pDest, (int) maxLenInChars );
 	}
+
+	// Like ReadFile, but hands out a read-only view of the file contents instead of copying them into a buffer.
+	// Files on disk are memory mapped where possible, anything else is read once into refcounted memory.
+	// The view (and any slice of it) keeps the data alive on its own.
+	virtual bool ReadFileView( const char* pFileName, const char* pPath, CUtlBufferView& view, int nMaxBytes = 0, int nStartingByte = 0, int nFlags = 0 ) = 0;
 };
 
 //-----------------------------------------------------------------------------
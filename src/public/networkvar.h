@@ -572,6 +572,32 @@ private:
 	virtual void NetworkStateChanged_##name( void* pVar ) {}
 
 
+// Variants which also call mirrorFn() on the owning class every time the variable changes, whether
+// or not it is transmitted. Used to keep side copies of a variable up to date; note that mirrorFn
+// runs *before* the new value is stored, so it can only flag the copy as stale.
+#define CNetworkVarMirrored( type, name, mirrorFn )                                              \
+	void NetworkStateChangedMirrored_##name( void* pVar ) { mirrorFn(); NetworkStateChanged( pVar ); } \
+	NETWORK_VAR_START( type, name )                                                              \
+	NETWORK_VAR_END( type, name, CNetworkVarBase, NetworkStateChangedMirrored_##name )
+
+#define CNetworkVectorMirrored( name, mirrorFn )                                                  \
+	void NetworkStateChangedMirrored_##name( void* pVar ) { mirrorFn(); NetworkStateChanged( pVar ); } \
+	CNetworkVectorInternal( Vector, name, NetworkStateChangedMirrored_##name )
+
+#define CNetworkVarForDerivedMirrored( type, name, mirrorFn )                                              \
+	virtual void NetworkStateChanged_##name() {}                                                           \
+	virtual void NetworkStateChanged_##name( void* pVar ) {}                                               \
+	void NetworkStateChangedMirrored_##name( void* pVar ) { mirrorFn(); NetworkStateChanged_##name( pVar ); } \
+	NETWORK_VAR_START( type, name )                                                                        \
+	NETWORK_VAR_END( type, name, CNetworkVarBase, NetworkStateChangedMirrored_##name )
+
+#define CNetworkVectorForDerivedMirrored( name, mirrorFn )                                                  \
+	virtual void NetworkStateChanged_##name() {}                                                           \
+	virtual void NetworkStateChanged_##name( void* pVar ) {}                                               \
+	void NetworkStateChangedMirrored_##name( void* pVar ) { mirrorFn(); NetworkStateChanged_##name( pVar ); } \
+	CNetworkVectorInternal( Vector, name, NetworkStateChangedMirrored_##name )
+
+
 // Vectors + some convenient helper functions.
 #define CNetworkVector( name ) CNetworkVectorInternal( Vector, name, NetworkStateChanged )
 #define CNetworkQAngle( name ) CNetworkVectorInternal( QAngle, name, NetworkStateChanged )
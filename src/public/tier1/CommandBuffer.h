@@ -9,6 +9,9 @@
 #pragma once
 #include "tier1/convar.h"
 #include "tier1/utllinkedlist.h"
+#include "tier1/utlsymbol.h"
+#include "tier1/utlvector.h"
+#include "tier0/tslist.h"
 
 
 //-----------------------------------------------------------------------------
@@ -39,6 +42,12 @@ public:
 	// Inserts text into the command buffer
 	bool AddText( const char* pText, int nTickDelay = 0 );
 
+	// Queues a single command from any thread. The text is tokenized on the calling thread and
+	// the result is picked up by the next BeginProcessingCommands, in submission order per thread.
+	// Neither 'wait' nor ';' separated lists are handled here, use AddText for those.
+	bool AddCommandThreadSafe( const char* pCommand, int nTickDelay = 0 );
+	void AddTokenizedCommandThreadSafe( const CCommand& command, int nTickDelay = 0 );
+
 	// Used to iterate over all commands appropriate for the current time
 	void BeginProcessingCommands( int nDeltaTicks );
 	bool DequeueNextCommand();
@@ -53,6 +62,18 @@ public:
 	// Are we in the middle of processing commands?
 	bool IsProcessingCommands();
 
+	// Limits the wall time spent dequeuing commands in one Begin/EndProcessingCommands pass.
+	// Commands left over when the budget runs out stay queued, in order, for the next pass.
+	// At least one command is always dequeued. 0 means no limit.
+	void SetProcessingBudget( float flMilliseconds );
+	bool WasProcessingBudgetExceeded() const { return m_bBudgetExceeded; }
+
+	// Looks up the ConCommandBase named by argv0 of the current command, through a cache of
+	// previous lookups. The cache is dropped at the start of a pass when ConVar_GetRegistrationSerial
+	// has changed; call InvalidateCommandCache when another module registers or unregisters commands.
+	ConCommandBase* FindCurrentCommandBase();
+	void InvalidateCommandCache();
+
 	// Delays all queued commands to execute at a later time
 	void DelayAllQueuedCommands( int nTickDelay );
 
@@ -81,12 +102,25 @@ private:
 		ARGS_BUFFER_LENGTH = 8192,
 	};
 
+	// A command submitted from another thread, already tokenized
+	struct TSLIST_NODE_ALIGN QueuedCommand_t : public TSLNodeBase_t {
+		int m_nTickDelay;
+		CCommand m_Command;
+	} TSLIST_NODE_ALIGN_POST;
+
 	struct Command_t {
 		int m_nTick;
 		int m_nFirstArgS;
 		int m_nBufferSize;
+		QueuedCommand_t* m_pTokenized;// Set instead of the args buffer range for thread submitted commands
 	};
 
+	QueuedCommand_t* AllocQueuedCommand();
+	void FreeQueuedCommand( QueuedCommand_t* pQueued );
+
+	// Moves commands submitted by other threads into the main queue
+	void DrainQueuedCommands();
+
 	// Insert a command into the command queue at the appropriate time
 	void InsertCommandAtAppropriateTime( int hCommand );
 
@@ -117,6 +151,20 @@ private:
 	int m_nMaxArgSBufferLength;
 	bool m_bIsProcessingCommands;
 	bool m_bWaitEnabled;
+	bool m_bBudgetExceeded;
+
+	// Lock free inbox for other threads, drained on the main thread. Nodes are recycled through the free list.
+	CTSSimpleList<QueuedCommand_t> m_QueuedCommands;
+	CTSSimpleList<QueuedCommand_t> m_FreeQueuedCommands;
+
+	float m_flBudgetSeconds;
+	double m_flProcessingStartTime;
+	int m_nDequeuedThisPass;
+
+	// argv0 -> command, indexed by symbol. NULL entries cache misses.
+	CUtlSymbolTable m_CommandNames;
+	CUtlVector<ConCommandBase*> m_CommandCache;
+	int m_nCommandCacheSerial;
 
 	// NOTE: This is here to avoid the pointers returned by DequeueNextCommand
 	// to become invalid by calling AddText. Is there a way we can avoid the memcpy?
@@ -161,6 +161,9 @@ class CCommand {
 public:
 	CCommand();
 	CCommand( int nArgC, const char** ppArgV );
+	// Copies keep their own argv, so a tokenized command can be handed between threads without re-parsing
+	CCommand( const CCommand& other );
+	CCommand& operator=( const CCommand& other );
 	bool Tokenize( const char* pCommand, characterset_t* pBreakSet = nullptr );
 	void Reset();
 
@@ -550,6 +553,9 @@ const char* ConVarRef::GetDefault() const {
 void ConVar_Register( int nCVarFlag = 0, IConCommandBaseAccessor* pAccessor = nullptr );
 void ConVar_Unregister();
 
+// Changes whenever a command is registered or unregistered through this module's tier1
+int ConVar_GetRegistrationSerial();
+
 
 //-----------------------------------------------------------------------------
 // Utility methods
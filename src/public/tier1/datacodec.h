@@ -0,0 +1,187 @@
+//===========================================================================//
+//
+// Purpose: Unified compression codec layer for engine and game code.
+//
+//  Wraps the tier1 LZMA decoder and the vendored Snappy behind a single
+//  interface, adds CUtlBuffer adapters, an incremental decoding stream and
+//  a block container whose blocks can be decompressed on the thread pool.
+//
+//===========================================================================//
+#pragma once
+
+#include "tier0/platform.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlvector.h"
+
+class CLZMAStream;
+
+
+//-----------------------------------------------------------------------------
+// Supported codecs
+//-----------------------------------------------------------------------------
+enum DataCodec_t
+{
+	DATACODEC_NONE = 0,
+	DATACODEC_LZMA,
+	DATACODEC_SNAPPY,
+
+	DATACODEC_COUNT,
+};
+
+//-----------------------------------------------------------------------------
+// Compression levels, zstd style: low levels favour speed, high levels size.
+// The level is mapped onto the fastest codec that can encode in this module,
+// see DataCodec_ChooseForLevel.
+//-----------------------------------------------------------------------------
+enum
+{
+	DATACODEC_LEVEL_FASTEST = 1,
+	DATACODEC_LEVEL_DEFAULT = 3,
+	DATACODEC_LEVEL_SMALLEST = 9,
+};
+
+#define SNAPPY_ID				(('P'<<24)|('N'<<16)|('S'<<8)|('S'))
+#define DATACODEC_BLOCK_ID		(('K'<<24)|('L'<<16)|('B'<<8)|('C'))
+
+// Payloads at or above this size are decompressed block-parallel
+#define DATACODEC_PARALLEL_THRESHOLD	( 256 * 1024 )
+// Default uncompressed size of one block in a block container
+#define DATACODEC_DEFAULT_BLOCK_SIZE	( 256 * 1024 )
+
+#pragma pack(1)
+// Framing for snappy payloads, mirrors LzmaHeader
+struct SnappyHeader
+{
+	unsigned int	id;
+	unsigned int	actualSize;		// always little endian
+	unsigned int	snappySize;		// always little endian
+};
+
+// A block container is this header, followed by numBlocks little endian
+// unsigned ints holding the framed size of each block, followed by the blocks.
+// Every block is a self contained LZMA or Snappy frame of at most blockSize
+// uncompressed bytes.
+struct DataCodecBlockHeader
+{
+	unsigned int	id;
+	unsigned int	actualSize;		// always little endian
+	unsigned int	blockSize;		// always little endian
+	unsigned int	numBlocks;		// always little endian
+};
+#pragma pack()
+
+
+//-----------------------------------------------------------------------------
+// A single codec. Implementations are stateless and safe to call from any thread.
+//-----------------------------------------------------------------------------
+abstract_class IDataCodec
+{
+public:
+	virtual DataCodec_t		GetType() const = 0;
+	virtual const char		*GetName() const = 0;
+
+	// Encoding. Compress returns the framed output size, or 0 on failure.
+	virtual bool			CanCompress() const = 0;
+	virtual unsigned int	GetMaxCompressedSize( unsigned int nInputSize ) const = 0;
+	virtual unsigned int	Compress( const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize ) = 0;
+
+	// Decoding of a single frame.
+	virtual bool			IsCompressed( const void *pInput, unsigned int nInputSize ) const = 0;
+	virtual unsigned int	GetActualSize( const void *pInput, unsigned int nInputSize ) const = 0;
+	// Size of the whole frame, header included, or 0 if not yet known
+	virtual unsigned int	GetFrameSize( const void *pInput, unsigned int nInputSize ) const = 0;
+	// Returns the uncompressed size, or 0 on failure
+	virtual unsigned int	Uncompress( const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize ) = 0;
+};
+
+
+//-----------------------------------------------------------------------------
+// Codec registry
+//-----------------------------------------------------------------------------
+IDataCodec		*DataCodec_Get( DataCodec_t type );
+IDataCodec		*DataCodec_Find( const char *pName );
+DataCodec_t		DataCodec_ChooseForLevel( int nLevel );
+
+// tier1 only carries the LZMA decoder. Tools that link the full LZMA SDK
+// (see lzma/lzma.h) can register LZMA_Compress here to enable encoding.
+typedef unsigned char *( *LZMACompressFunc_t )( unsigned char *pInput, unsigned int nInputSize, unsigned int *pOutputSize );
+void			DataCodec_SetLZMAEncoder( LZMACompressFunc_t pfnCompress );
+
+
+//-----------------------------------------------------------------------------
+// Framed data helpers. These understand LZMA frames, Snappy frames and
+// block containers, and dispatch on the id in the header.
+//-----------------------------------------------------------------------------
+DataCodec_t		DataCodec_Detect( const void *pInput, unsigned int nInputSize );
+bool			DataCodec_IsCompressed( const void *pInput, unsigned int nInputSize );
+unsigned int	DataCodec_GetActualSize( const void *pInput, unsigned int nInputSize );
+
+// Compresses into a single frame, or into a block container when nBlockSize
+// is non-zero and the input spans more than one block. Returns the output size.
+unsigned int	DataCodec_GetMaxCompressedSize( DataCodec_t type, unsigned int nInputSize, unsigned int nBlockSize = 0 );
+unsigned int	DataCodec_Compress( DataCodec_t type, const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize, unsigned int nBlockSize = 0 );
+
+// Decompresses any framed data. Block containers above DATACODEC_PARALLEL_THRESHOLD
+// are decoded in parallel on the thread pool unless bAllowParallel is false.
+unsigned int	DataCodec_Uncompress( const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize, bool bAllowParallel = true );
+
+// CUtlBuffer adapters. Consume the readable region of input (get to put) and
+// append to output.
+bool			DataCodec_CompressBuffer( CUtlBuffer &input, CUtlBuffer &output, DataCodec_t type, unsigned int nBlockSize = 0 );
+bool			DataCodec_UncompressBuffer( CUtlBuffer &input, CUtlBuffer &output, bool bAllowParallel = true );
+
+// Times every codec on the given data and prints a summary line per codec
+void			DataCodec_Benchmark( const char *pLabel, const void *pData, unsigned int nSize, int nIterations = 4 );
+
+
+//-----------------------------------------------------------------------------
+// Incremental decoder for framed data arriving in pieces (network, async file
+// reads). LZMA frames are decoded as bytes arrive, Snappy frames and block
+// container blocks as soon as each is complete.
+//-----------------------------------------------------------------------------
+class CDataCodecStream
+{
+public:
+	CDataCodecStream();
+	~CDataCodecStream();
+
+	void Reset();
+
+	// Consumes as much of input (from its get position) as possible, appending
+	// uncompressed data to output. Returns false on corrupt data.
+	bool Read( CUtlBuffer &input, CUtlBuffer &output );
+
+	bool IsFinished() const;
+	DataCodec_t GetType() const { return m_Type; }
+
+	// Uncompressed bytes yet to be produced. Returns false if not yet known.
+	bool GetExpectedBytesRemaining( unsigned int &nBytesRemaining ) const;
+
+private:
+	enum State_t
+	{
+		STATE_HEADER,
+		STATE_LZMA,
+		STATE_FRAME,
+		STATE_BLOCK_TABLE,
+		STATE_BLOCKS,
+		STATE_DONE,
+		STATE_ERROR,
+	};
+
+	bool ReadLZMA( CUtlBuffer &input, CUtlBuffer &output );
+	bool ReadFrames( CUtlBuffer &input, CUtlBuffer &output );
+	bool Buffer( CUtlBuffer &input, unsigned int nWanted );
+
+	CLZMAStream		*m_pLZMA;
+	CUtlBuffer		m_Pending;
+
+	CUtlVector< unsigned int > m_BlockSizes;
+	int				m_nCurrentBlock;
+
+	unsigned int	m_nActualSize;
+	unsigned int	m_nBytesWritten;
+
+	DataCodec_t		m_Type;
+	State_t			m_State;
+};
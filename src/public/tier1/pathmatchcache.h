@@ -0,0 +1,51 @@
+//===========================================================================//
+//
+// Purpose: Case-folded directory cache used to resolve paths case
+//          insensitively on case-sensitive file systems.
+//
+//  Directory listings are read once and kept keyed by their on-disk path,
+//  each with an inotify watch that drops the listing when the directory
+//  changes. Directories that could not be watched expire after a couple of
+//  seconds instead. Shared by the pathmatch --wrap layer and the plain
+//  file system driver.
+//
+//===========================================================================//
+#pragma once
+#include "tier0/platform.h"
+#if defined( UTF8_PATHMATCH )
+	#include <string>
+#endif
+
+#if defined( PLATFORM_LINUX )
+	enum PathMatchResult_t {
+		kPathMatchUnchanged,  // path exists as given
+		kPathMatchChanged,    // a differently cased path was written to the output buffer
+		kPathMatchFailed,     // no match, or the output buffer is too small
+	};
+
+	struct PathMatchStats_t {
+		uint64 m_nLookups;        // calls to PathMatch_Resolve
+		uint64 m_nExactHits;      // path existed as given
+		uint64 m_nCacheHits;      // resolved from cached listings only
+		uint64 m_nSlowPath;       // lookups that had to read at least one directory
+		uint64 m_nDirScans;       // directories read from disk
+		uint64 m_nFailures;       // lookups with no match
+		uint64 m_nInvalidations;  // listings dropped due to inotify events or expiry
+		uint64 m_nCachedDirs;     // directories currently cached
+	};
+
+	// Resolves pPath against the file system case insensitively.
+	// If bAllowBasenameMismatch is set, the last component may not exist (e.g. when creating a file).
+	PathMatchResult_t PathMatch_Resolve( const char* pPath, char* pOut, size_t nOutLen, bool bAllowBasenameMismatch );
+
+	// Drops the listing of a single directory, or the whole cache if pDirectory is null.
+	void PathMatch_Invalidate( const char* pDirectory = nullptr );
+
+	void PathMatch_GetStats( PathMatchStats_t& stats );
+	void PathMatch_ResetStats();
+
+	#if defined( UTF8_PATHMATCH )
+		// Full Unicode case fold of a file name, used as the cache key instead of the ASCII one. Lives in pathmatch.cpp.
+		std::string PathMatch_FoldUTF8( const char* pName, size_t nLen );
+	#endif
+#endif
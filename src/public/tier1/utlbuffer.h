@@ -94,6 +94,15 @@ CUtlCharConversion* GetNoEscCharConversion();
 	SetOverflowFuncs( static_cast<UtlBufferOverflowFunc_t>( _get ), static_cast<UtlBufferOverflowFunc_t>( _put ) )
 
 
+//-----------------------------------------------------------------------------
+// A memory range for scatter/gather reads and writes, see PutV and GetV
+//-----------------------------------------------------------------------------
+struct UtlBufferVec_t {
+	void* m_pBase;
+	int m_nSize;
+};
+
+
 //-----------------------------------------------------------------------------
 // Command parsing..
 //-----------------------------------------------------------------------------
@@ -185,6 +194,8 @@ public:
 	}
 
 	void Get( void* pMem, int size );
+	// Scatters the next bytes over several memory ranges; reads nothing if they don't all fit
+	void GetV( const UtlBufferVec_t* pVecs, int nCount );
 	void GetLine( char* pLine, int nMaxChars = 0 );
 
 	// Used for getting objects that have a byteswap datadesc defined
@@ -261,6 +272,8 @@ public:
 	void PutDouble( double d );
 	void PutString( const char* pString );
 	void Put( const void* pMem, int size );
+	// Gathers several memory ranges with a single capacity check and null termination
+	void PutV( const UtlBufferVec_t* pVecs, int nCount );
 
 	// Used for putting objects that have a byteswap datadesc defined
 	template<typename T>
@@ -0,0 +1,76 @@
+//===========================================================================//
+//
+// Purpose: Non-owning, read-only CUtlBuffer views over shared memory.
+//
+//  A CUtlBufferView reads memory it does not own (a mapped file, a pack
+//  entry, a region of another buffer) without copying it. The memory is kept
+//  alive by an optional IRefCounted owner which every view and sub-slice of
+//  it holds a reference to, so slices can outlive the view they came from.
+//
+//===========================================================================//
+#pragma once
+#include "tier1/refcount.h"
+#include "tier1/utlbuffer.h"
+
+
+//-----------------------------------------------------------------------------
+// Refcounted block of memory, either heap allocated or released through a
+// callback (munmap, pack entry release, ...). Starts with a single reference.
+//-----------------------------------------------------------------------------
+class CUtlRefCountedMemory : public CRefCounted1<IRefCounted, CRefCountServiceMT> {
+public:
+	typedef void ( *FreeFunc_t )( void* pMemory, int nSize, void* pContext );
+
+	// Allocates nSize bytes on the heap
+	static CUtlRefCountedMemory* Allocate( int nSize );
+	// Wraps existing memory, pfnFree (if any) is called on the final release
+	static CUtlRefCountedMemory* Wrap( void* pMemory, int nSize, FreeFunc_t pfnFree, void* pContext = nullptr );
+
+	void* Base() const { return m_pMemory; }
+	int Size() const { return m_nSize; }
+
+private:
+	CUtlRefCountedMemory( void* pMemory, int nSize, FreeFunc_t pfnFree, void* pContext );
+	~CUtlRefCountedMemory() override;
+
+	void* m_pMemory;
+	int m_nSize;
+	FreeFunc_t m_pfnFree;
+	void* m_pContext;
+};
+
+
+//-----------------------------------------------------------------------------
+// Read-only CUtlBuffer over memory kept alive by an owner. All put operations
+// fail, as they do on any READ_ONLY buffer; everything else behaves like a
+// regular buffer whose max put is the end of the view.
+//-----------------------------------------------------------------------------
+class CUtlBufferView : public CUtlBuffer {
+public:
+	CUtlBufferView();
+	CUtlBufferView( const void* pMemory, int nSize, IRefCounted* pOwner = nullptr, int nFlags = 0 );
+	// Views the readable region (get to put) of a buffer; the buffer must outlive the view unless pOwner keeps its memory alive
+	explicit CUtlBufferView( const CUtlBuffer& buf, IRefCounted* pOwner = nullptr );
+	// Views all of a refcounted block
+	explicit CUtlBufferView( CUtlRefCountedMemory* pMemory, int nFlags = 0 );
+	CUtlBufferView( const CUtlBufferView& other );
+	CUtlBufferView& operator=( const CUtlBufferView& other );
+	~CUtlBufferView();
+
+	// Points the view at new memory, adding a reference to pOwner and releasing the previous one
+	void SetView( const void* pMemory, int nSize, IRefCounted* pOwner = nullptr, int nFlags = 0 );
+	void ResetView();
+
+	// Returns a view of [nOffset, nOffset + nSize) relative to the start of this view, sharing the owner.
+	// The range is clamped to the view.
+	CUtlBufferView Slice( int nOffset, int nSize ) const;
+
+	// Returns a view of the next nSize bytes and advances the get pointer past them.
+	// Returns false, leaving the get pointer alone, if there aren't enough bytes left.
+	bool SliceGet( CUtlBufferView& out, int nSize );
+
+	IRefCounted* GetOwner() const { return m_pOwner; }
+
+private:
+	IRefCounted* m_pOwner;
+};
@@ -139,6 +139,10 @@ public:
 
 	~CSOAContainer( void );
 
+	// the container owns its data, use MoveDataFrom to hand it to another one
+	CSOAContainer( const CSOAContainer& ) = delete;
+	CSOAContainer& operator=( const CSOAContainer& ) = delete;
+
 	// easy constructor for 2d using varargs. call like
 	// #define ATTR_RED 0
 	// #define ATTR_GREEN 1
@@ -228,7 +232,8 @@ public:
 		Assert( nZ < m_nSlices );
 		Assert( m_nDataType[ nAttributeIdx ] != ATTRDATATYPE_NONE );
 		Assert( m_nDataType[ nAttributeIdx ] != ATTRDATATYPE_4V );
-		return reinterpret_cast<T*>( m_pAttributePtrs[ nAttributeIdx ] + nX * sizeof( float ) + nY * m_nRowStrideInBytes[ nAttributeIdx ] + nZ * m_nSliceStrideInBytes[ nAttributeIdx ] );
+		Assert( 4 * sizeof( T ) == m_nStrideInBytes[ nAttributeIdx ] );
+		return reinterpret_cast<T*>( m_pAttributePtrs[ nAttributeIdx ] + nX * sizeof( T ) + nY * m_nRowStrideInBytes[ nAttributeIdx ] + nZ * m_nSliceStrideInBytes[ nAttributeIdx ] );
 	}
 
 	ALWAYS_INLINE size_t ItemByteStride( int nAttributeIdx ) const {
@@ -244,11 +249,8 @@ public:
 	void CopyAttrToAttr( int nSrcAttributeIndex, int nDestAttributeIndex );
 
 	// move all the data from one csoacontainer to another, leaving the source empty.
-	// this is just a pointer copy.
-	ALWAYS_INLINE void MoveDataFrom( CSOAContainer other ) {
-		( *this ) = other;
-		other.Init();
-	}
+	// this is just a pointer copy. whatever this container held before is freed.
+	void MoveDataFrom( CSOAContainer& other );
 
 
 	void AllocateData( int nNCols, int nNRows, int nSlices = 1 );// actually allocate the memory and set the pointers up
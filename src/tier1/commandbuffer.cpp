@@ -10,6 +10,8 @@
 #include "tier1/CommandBuffer.h"
 #include "tier1/utlbuffer.h"
 #include "tier1/strtools.h"
+#include "icvar.h"
+#include "tier0/platform.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -36,11 +38,34 @@ CCommandBuffer::CCommandBuffer( ) : m_Commands( 32, 32 )
 	m_nLastTickToProcess = -1;
 	m_nArgSBufferSize = 0;
 	m_bIsProcessingCommands = false;
+	m_bWaitEnabled = true;
+	m_bBudgetExceeded = false;
 	m_nMaxArgSBufferLength = ARGS_BUFFER_LENGTH;
+	m_flBudgetSeconds = 0.0f;
+	m_flProcessingStartTime = 0.0;
+	m_nDequeuedThisPass = 0;
+	m_nCommandCacheSerial = ConVar_GetRegistrationSerial();
 }
 
 CCommandBuffer::~CCommandBuffer()
 {
+	for ( int i = m_Commands.Head(); i != m_Commands.InvalidIndex(); i = m_Commands.Next(i) )
+	{
+		if ( m_Commands[i].m_pTokenized )
+		{
+			delete m_Commands[i].m_pTokenized;
+		}
+	}
+
+	QueuedCommand_t *pQueued;
+	while ( ( pQueued = m_QueuedCommands.Pop() ) != NULL )
+	{
+		delete pQueued;
+	}
+	while ( ( pQueued = m_FreeQueuedCommands.Pop() ) != NULL )
+	{
+		delete pQueued;
+	}
 }
 
 
@@ -94,14 +119,16 @@ bool CCommandBuffer::ParseArgV0( CUtlBuffer &buf, char *pArgV0, int nMaxLen, con
 //-----------------------------------------------------------------------------
 void CCommandBuffer::InsertCommandAtAppropriateTime( int hCommand )
 {
+	// Walk back from the tail: new commands almost always belong at the end,
+	// so a big batch doesn't rescan the whole queue for every insert
 	int i;
 	Command_t &command = m_Commands[hCommand];
-	for ( i = m_Commands.Head(); i != m_Commands.InvalidIndex(); i = m_Commands.Next(i) )
+	for ( i = m_Commands.Tail(); i != m_Commands.InvalidIndex(); i = m_Commands.Previous(i) )
 	{
-		if ( m_Commands[i].m_nTick > command.m_nTick )
+		if ( m_Commands[i].m_nTick <= command.m_nTick )
 			break;
 	}
-	m_Commands.LinkBefore( i, hCommand );
+	m_Commands.LinkAfter( i, hCommand );
 }
 
 
@@ -142,6 +169,7 @@ bool CCommandBuffer::InsertCommand( const char *pArgS, int nCommandSize, int nTi
 	command.m_nTick = nTick;
 	command.m_nFirstArgS = m_nArgSBufferSize;
 	command.m_nBufferSize = nCommandSize;
+	command.m_pTokenized = NULL;
 
 	m_nArgSBufferSize += nCommandSize;
 
@@ -247,6 +275,126 @@ bool CCommandBuffer::AddText( const char *pText, int nTickDelay )
 }
 
 
+//-----------------------------------------------------------------------------
+// Thread safe command submission
+//-----------------------------------------------------------------------------
+CCommandBuffer::QueuedCommand_t *CCommandBuffer::AllocQueuedCommand()
+{
+	QueuedCommand_t *pQueued = m_FreeQueuedCommands.Pop();
+	if ( !pQueued )
+	{
+		MEM_ALLOC_CREDIT();
+		pQueued = new QueuedCommand_t;
+	}
+	return pQueued;
+}
+
+void CCommandBuffer::FreeQueuedCommand( QueuedCommand_t *pQueued )
+{
+	m_FreeQueuedCommands.Push( pQueued );
+}
+
+bool CCommandBuffer::AddCommandThreadSafe( const char *pCommand, int nTickDelay )
+{
+	Assert( nTickDelay >= 0 );
+
+	QueuedCommand_t *pQueued = AllocQueuedCommand();
+	if ( !pQueued->m_Command.Tokenize( pCommand ) || pQueued->m_Command.ArgC() == 0 )
+	{
+		FreeQueuedCommand( pQueued );
+		return false;
+	}
+
+	pQueued->m_nTickDelay = nTickDelay;
+	m_QueuedCommands.Push( pQueued );
+	return true;
+}
+
+void CCommandBuffer::AddTokenizedCommandThreadSafe( const CCommand &command, int nTickDelay )
+{
+	Assert( nTickDelay >= 0 );
+	if ( command.ArgC() == 0 )
+		return;
+
+	QueuedCommand_t *pQueued = AllocQueuedCommand();
+	pQueued->m_Command = command;
+	pQueued->m_nTickDelay = nTickDelay;
+	m_QueuedCommands.Push( pQueued );
+}
+
+
+//-----------------------------------------------------------------------------
+// Moves commands submitted by other threads into the main queue
+//-----------------------------------------------------------------------------
+void CCommandBuffer::DrainQueuedCommands()
+{
+	// Take the whole list in one exchange; it comes out newest first
+	QueuedCommand_t *pNewest = (QueuedCommand_t *)m_QueuedCommands.Detach();
+	if ( !pNewest )
+		return;
+
+	QueuedCommand_t *pOldest = NULL;
+	while ( pNewest )
+	{
+		QueuedCommand_t *pNext = (QueuedCommand_t *)pNewest->Next;
+		pNewest->Next = pOldest;
+		pOldest = pNewest;
+		pNewest = pNext;
+	}
+
+	while ( pOldest )
+	{
+		QueuedCommand_t *pNext = (QueuedCommand_t *)pOldest->Next;
+
+		int hCommand = m_Commands.Alloc();
+		Command_t &command = m_Commands[hCommand];
+		command.m_nTick = m_nCurrentTick + pOldest->m_nTickDelay;
+		command.m_nFirstArgS = 0;
+		command.m_nBufferSize = 0;
+		command.m_pTokenized = pOldest;
+		InsertCommandAtAppropriateTime( hCommand );
+
+		pOldest = pNext;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Limits the time spent dequeuing commands per processing pass
+//-----------------------------------------------------------------------------
+void CCommandBuffer::SetProcessingBudget( float flMilliseconds )
+{
+	m_flBudgetSeconds = MAX( flMilliseconds, 0.0f ) * 0.001f;
+}
+
+
+//-----------------------------------------------------------------------------
+// Cached lookup of the current command
+//-----------------------------------------------------------------------------
+ConCommandBase *CCommandBuffer::FindCurrentCommandBase()
+{
+	if ( m_CurrentCommand.ArgC() == 0 || !g_pCVar )
+		return NULL;
+
+	// Symbols are only ever added here, so a new name is always the next id
+	CUtlSymbol sym = m_CommandNames.AddString( m_CurrentCommand[0] );
+	if ( sym >= m_CommandCache.Count() )
+	{
+		Assert( sym == m_CommandCache.Count() );
+		m_CommandCache.AddToTail( g_pCVar->FindCommandBase( m_CurrentCommand[0] ) );
+	}
+
+	return m_CommandCache[sym];
+}
+
+void CCommandBuffer::InvalidateCommandCache()
+{
+	m_CommandNames.RemoveAll();
+	m_CommandCache.RemoveAll();
+	m_nCommandCacheSerial = ConVar_GetRegistrationSerial();
+}
+
+
 //-----------------------------------------------------------------------------
 // Are we in the middle of processing commands?
 //-----------------------------------------------------------------------------
@@ -280,7 +428,18 @@ void CCommandBuffer::BeginProcessingCommands( int nDeltaTicks )
 		return;
 
 	Assert( !m_bIsProcessingCommands );
+	DrainQueuedCommands();
+
+	// Commands may have been registered or unregistered since the last pass
+	if ( m_nCommandCacheSerial != ConVar_GetRegistrationSerial() )
+	{
+		InvalidateCommandCache();
+	}
+
 	m_bIsProcessingCommands = true;
+	m_bBudgetExceeded = false;
+	m_nDequeuedThisPass = 0;
+	m_flProcessingStartTime = Plat_FloatTime();
 	m_nLastTickToProcess = m_nCurrentTick + nDeltaTicks - 1;
 
 	// Necessary to insert commands while commands are being processed
@@ -304,12 +463,25 @@ bool CCommandBuffer::DequeueNextCommand( )
 	if ( command.m_nTick > m_nLastTickToProcess )
 		return false;
 
+	if ( m_flBudgetSeconds > 0.0f && m_nDequeuedThisPass > 0 &&
+		 Plat_FloatTime() - m_flProcessingStartTime > m_flBudgetSeconds )
+	{
+		m_bBudgetExceeded = true;
+		return false;
+	}
+	++m_nDequeuedThisPass;
+
 	m_nCurrentTick = command.m_nTick;
 
 	// Copy the current command into a temp buffer
 	// NOTE: This is here to avoid the pointers returned by DequeueNextCommand
 	// to become invalid by calling AddText. Is there a way we can avoid the memcpy?
-	if ( command.m_nBufferSize > 0 )
+	if ( command.m_pTokenized )
+	{
+		m_CurrentCommand = command.m_pTokenized->m_Command;
+		FreeQueuedCommand( command.m_pTokenized );
+	}
+	else if ( command.m_nBufferSize > 0 )
 	{
 		m_CurrentCommand.Tokenize( &m_pArgSBuffer[command.m_nFirstArgS] );
 	}
@@ -389,14 +561,24 @@ void CCommandBuffer::EndProcessingCommands()
 		return;
 	}
 
-	while ( i != m_Commands.InvalidIndex() )
+	// Commands deferred by the processing budget keep their place at the head of the queue
+	while ( !m_bBudgetExceeded && i != m_Commands.InvalidIndex() )
 	{
 		if ( m_Commands[i].m_nTick >= m_nCurrentTick )
 			break;
 
 		AssertMsgOnce( false, "CCommandBuffer::EndProcessingCommands() called before all appropriate commands were dequeued.\n" );
-		int nNext = i;
-		Msg( "Warning: Skipping command %s\n", &m_pArgSBuffer[ m_Commands[i].m_nFirstArgS ] );
+		int nNext = m_Commands.Next( i );
+		Command_t &command = m_Commands[i];
+		if ( command.m_pTokenized )
+		{
+			Msg( "Warning: Skipping command %s\n", command.m_pTokenized->m_Command.GetCommandString() );
+			FreeQueuedCommand( command.m_pTokenized );
+		}
+		else
+		{
+			Msg( "Warning: Skipping command %s\n", &m_pArgSBuffer[ command.m_nFirstArgS ] );
+		}
 		m_Commands.Remove( i );
 		i = nNext;
 	}
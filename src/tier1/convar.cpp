@@ -16,6 +16,7 @@
 #include "tier1/strtools.h"
 #include "tier1/tier1.h"
 #include "tier1/utlbuffer.h"
+#include <atomic>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -35,6 +36,7 @@ IConCommandBaseAccessor* ConCommandBase::s_pAccessor = nullptr;
 static int s_nCVarFlag = 0;
 static int s_nDLLIdentifier = -1;// A unique identifier indicating which DLL this convar came from
 static bool s_bRegistered = false;
+static std::atomic<int> s_nRegistrationSerial{ 0 };// Bumped whenever this module registers or unregisters a command
 
 class CDefaultAccessor : public IConCommandBaseAccessor {
 public:
@@ -75,6 +77,10 @@ void ConVar_Register( int nCVarFlag, IConCommandBaseAccessor* pAccessor ) {
 	ConCommandBase::s_pConCommandBases = nullptr;
 }
 
+int ConVar_GetRegistrationSerial() {
+	return s_nRegistrationSerial.load( std::memory_order_acquire );
+}
+
 void ConVar_Unregister() {
 	if ( not g_pCVar or not s_bRegistered ) {
 		return;
@@ -82,6 +88,7 @@ void ConVar_Unregister() {
 
 	Assert( s_nDLLIdentifier >= 0 );
 	g_pCVar->UnregisterConCommands( s_nDLLIdentifier );
+	++s_nRegistrationSerial;
 	s_nDLLIdentifier = -1;
 	s_bRegistered = false;
 }
@@ -170,12 +177,14 @@ void ConCommandBase::CreateBase( const char* pName, const char* pHelpString /*=
 void ConCommandBase::Init() {
 	if ( s_pAccessor ) {
 		s_pAccessor->RegisterConCommandBase( this );
+		++s_nRegistrationSerial;
 	}
 }
 
 void ConCommandBase::Shutdown() {
 	if ( g_pCVar ) {
 		g_pCVar->UnregisterConCommand( this );
+		++s_nRegistrationSerial;
 	}
 }
 
@@ -271,30 +280,27 @@ bool ConCommandBase::IsRegistered() const {
 //-----------------------------------------------------------------------------
 // Global methods
 //-----------------------------------------------------------------------------
-static characterset_t s_BreakSet;
-static bool s_bBuiltBreakSet = false;
+// Built on first use; function-local statics are initialized exactly once, even across threads
+static characterset_t* BreakSet() {
+	static characterset_t s_BreakSet = [] {
+		characterset_t set;
+		CharacterSetBuild( &set, "{}()':" );
+		return set;
+	}();
+	return &s_BreakSet;
+}
 
 
 //-----------------------------------------------------------------------------
 // Tokenizer class
 //-----------------------------------------------------------------------------
 CCommand::CCommand() {
-	if ( not s_bBuiltBreakSet ) {
-		s_bBuiltBreakSet = true;
-		CharacterSetBuild( &s_BreakSet, "{}()':" );
-	}
-
 	Reset();
 }
 
 CCommand::CCommand( int nArgC, const char** ppArgV ) {
 	Assert( nArgC > 0 );
 
-	if ( not s_bBuiltBreakSet ) {
-		s_bBuiltBreakSet = true;
-		CharacterSetBuild( &s_BreakSet, "{}()':" );
-	}
-
 	Reset();
 
 	char* pBuf = m_pArgvBuffer;
@@ -325,6 +331,34 @@ CCommand::CCommand( int nArgC, const char** ppArgV ) {
 	}
 }
 
+CCommand::CCommand( const CCommand& other ) {
+	*this = other;
+}
+
+CCommand& CCommand::operator=( const CCommand& other ) {
+	if ( this == &other ) {
+		return *this;
+	}
+
+	Reset();
+	if ( other.m_nArgc == 0 ) {
+		return *this;
+	}
+
+	// Only copy the used part of the buffers, then point argv back into our own copy
+	const char* pLastArg = other.m_ppArgv[ other.m_nArgc - 1 ];
+	const int nArgvSize = static_cast<int>( pLastArg - other.m_pArgvBuffer ) + Q_strlen( pLastArg ) + 1;
+	memcpy( m_pArgvBuffer, other.m_pArgvBuffer, nArgvSize );
+	memcpy( m_pArgSBuffer, other.m_pArgSBuffer, sizeof( m_pArgSBuffer ) );
+
+	m_nArgc = other.m_nArgc;
+	m_nArgv0Size = other.m_nArgv0Size;
+	for ( int i = 0; i < m_nArgc; ++i ) {
+		m_ppArgv[ i ] = m_pArgvBuffer + ( other.m_ppArgv[ i ] - other.m_pArgvBuffer );
+	}
+	return *this;
+}
+
 void CCommand::Reset() {
 	m_nArgc = 0;
 	m_nArgv0Size = 0;
@@ -332,7 +366,7 @@ void CCommand::Reset() {
 }
 
 characterset_t* CCommand::DefaultBreakSet() {
-	return &s_BreakSet;
+	return BreakSet();
 }
 
 bool CCommand::Tokenize( const char* pCommand, characterset_t* pBreakSet ) {
@@ -343,7 +377,7 @@ bool CCommand::Tokenize( const char* pCommand, characterset_t* pBreakSet ) {
 
 	// Use default break set
 	if ( not pBreakSet ) {
-		pBreakSet = &s_BreakSet;
+		pBreakSet = BreakSet();
 	}
 
 	// Copy the current command into a temp buffer
@@ -0,0 +1,810 @@
+//===========================================================================//
+//
+// Purpose: Unified compression codec layer for engine and game code.
+//
+//===========================================================================//
+
+#include "tier0/platform.h"
+#include "tier0/basetypes.h"
+#include "tier0/dbg.h"
+#include "tier0/fasttimer.h"
+#include "tier1/datacodec.h"
+#include "tier1/lzmaDecoder.h"
+#include "tier1/snappy.h"
+#include "tier1/strtools.h"
+#include "vstdlib/jobthread.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static LZMACompressFunc_t s_pfnLZMACompress = NULL;
+
+// Largest block table a container may declare, 16MB worth of block sizes
+#define DATACODEC_MAX_BLOCKS	( 4 * 1024 * 1024 )
+
+//-----------------------------------------------------------------------------
+// LZMA, decode only unless an encoder has been registered
+//-----------------------------------------------------------------------------
+class CLZMADataCodec : public IDataCodec
+{
+public:
+	virtual DataCodec_t GetType() const { return DATACODEC_LZMA; }
+	virtual const char *GetName() const { return "lzma"; }
+
+	virtual bool CanCompress() const
+	{
+		return s_pfnLZMACompress != NULL;
+	}
+
+	virtual unsigned int GetMaxCompressedSize( unsigned int nInputSize ) const
+	{
+		// LZMA can expand incompressible data by a small amount
+		return nInputSize + nInputSize / 3 + 128 + sizeof( LzmaHeader );
+	}
+
+	virtual unsigned int Compress( const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize )
+	{
+		if ( !s_pfnLZMACompress )
+			return 0;
+
+		unsigned int nCompressedSize = 0;
+		unsigned char *pCompressed = s_pfnLZMACompress( (unsigned char *)pInput, nInputSize, &nCompressedSize );
+		if ( !pCompressed )
+			return 0;
+
+		// The encoder's lzma_header_t matches LzmaHeader
+		if ( nCompressedSize > nOutputSize || !CLZMA::IsCompressed( pCompressed ) )
+		{
+			free( pCompressed );
+			return 0;
+		}
+
+		V_memcpy( pOutput, pCompressed, nCompressedSize );
+		free( pCompressed );
+		return nCompressedSize;
+	}
+
+	virtual bool IsCompressed( const void *pInput, unsigned int nInputSize ) const
+	{
+		return nInputSize >= sizeof( LzmaHeader ) && CLZMA::IsCompressed( (unsigned char *)pInput );
+	}
+
+	virtual unsigned int GetActualSize( const void *pInput, unsigned int nInputSize ) const
+	{
+		if ( nInputSize < sizeof( LzmaHeader ) )
+			return 0;
+		return CLZMA::GetActualSize( (unsigned char *)pInput );
+	}
+
+	virtual unsigned int GetFrameSize( const void *pInput, unsigned int nInputSize ) const
+	{
+		if ( !IsCompressed( pInput, nInputSize ) )
+			return 0;
+		return LittleLong( ( (const LzmaHeader *)pInput )->lzmaSize ) + sizeof( LzmaHeader );
+	}
+
+	virtual unsigned int Uncompress( const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize )
+	{
+		unsigned int nFrameSize = GetFrameSize( pInput, nInputSize );
+		if ( !nFrameSize || nFrameSize > nInputSize || GetActualSize( pInput, nInputSize ) > nOutputSize )
+			return 0;
+		return CLZMA::Uncompress( (unsigned char *)pInput, (unsigned char *)pOutput );
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Snappy, framed with SnappyHeader
+//-----------------------------------------------------------------------------
+class CSnappyDataCodec : public IDataCodec
+{
+public:
+	virtual DataCodec_t GetType() const { return DATACODEC_SNAPPY; }
+	virtual const char *GetName() const { return "snappy"; }
+	virtual bool CanCompress() const { return true; }
+
+	virtual unsigned int GetMaxCompressedSize( unsigned int nInputSize ) const
+	{
+		return snappy::MaxCompressedLength( nInputSize ) + sizeof( SnappyHeader );
+	}
+
+	virtual unsigned int Compress( const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize )
+	{
+		if ( nOutputSize < GetMaxCompressedSize( nInputSize ) )
+			return 0;
+
+		size_t nSnappySize = 0;
+		snappy::RawCompress( (const char *)pInput, nInputSize, (char *)pOutput + sizeof( SnappyHeader ), &nSnappySize );
+
+		SnappyHeader *pHeader = (SnappyHeader *)pOutput;
+		pHeader->id = SNAPPY_ID;
+		pHeader->actualSize = LittleLong( nInputSize );
+		pHeader->snappySize = LittleLong( (unsigned int)nSnappySize );
+		return nSnappySize + sizeof( SnappyHeader );
+	}
+
+	virtual bool IsCompressed( const void *pInput, unsigned int nInputSize ) const
+	{
+		return nInputSize >= sizeof( SnappyHeader ) && ( (const SnappyHeader *)pInput )->id == SNAPPY_ID;
+	}
+
+	virtual unsigned int GetActualSize( const void *pInput, unsigned int nInputSize ) const
+	{
+		if ( !IsCompressed( pInput, nInputSize ) )
+			return 0;
+		return LittleLong( ( (const SnappyHeader *)pInput )->actualSize );
+	}
+
+	virtual unsigned int GetFrameSize( const void *pInput, unsigned int nInputSize ) const
+	{
+		if ( !IsCompressed( pInput, nInputSize ) )
+			return 0;
+		return LittleLong( ( (const SnappyHeader *)pInput )->snappySize ) + sizeof( SnappyHeader );
+	}
+
+	virtual unsigned int Uncompress( const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize )
+	{
+		unsigned int nFrameSize = GetFrameSize( pInput, nInputSize );
+		unsigned int nActualSize = GetActualSize( pInput, nInputSize );
+		if ( !nFrameSize || nFrameSize > nInputSize || nActualSize > nOutputSize )
+			return 0;
+
+		const char *pSnappy = (const char *)pInput + sizeof( SnappyHeader );
+		size_t nSnappySize = nFrameSize - sizeof( SnappyHeader );
+
+		size_t nDecodedSize = 0;
+		if ( !snappy::GetUncompressedLength( pSnappy, nSnappySize, &nDecodedSize ) || nDecodedSize != nActualSize )
+		{
+			Warning( "Snappy Decompression failed (bad length)\n" );
+			return 0;
+		}
+
+		if ( !snappy::RawUncompress( pSnappy, nSnappySize, (char *)pOutput ) )
+		{
+			Warning( "Snappy Decompression failed\n" );
+			return 0;
+		}
+		return nActualSize;
+	}
+};
+
+static CLZMADataCodec s_LZMACodec;
+static CSnappyDataCodec s_SnappyCodec;
+
+static IDataCodec *s_pCodecs[ DATACODEC_COUNT ] =
+{
+	NULL,
+	&s_LZMACodec,
+	&s_SnappyCodec,
+};
+
+
+//-----------------------------------------------------------------------------
+// Registry
+//-----------------------------------------------------------------------------
+IDataCodec *DataCodec_Get( DataCodec_t type )
+{
+	if ( type <= DATACODEC_NONE || type >= DATACODEC_COUNT )
+		return NULL;
+	return s_pCodecs[ type ];
+}
+
+IDataCodec *DataCodec_Find( const char *pName )
+{
+	for ( int i = DATACODEC_NONE + 1; i < DATACODEC_COUNT; ++i )
+	{
+		if ( !V_stricmp( s_pCodecs[ i ]->GetName(), pName ) )
+			return s_pCodecs[ i ];
+	}
+	return NULL;
+}
+
+DataCodec_t DataCodec_ChooseForLevel( int nLevel )
+{
+	// Only the top levels are worth LZMA's encode cost, and only when we can encode it
+	if ( nLevel >= DATACODEC_LEVEL_SMALLEST && s_LZMACodec.CanCompress() )
+		return DATACODEC_LZMA;
+	return DATACODEC_SNAPPY;
+}
+
+void DataCodec_SetLZMAEncoder( LZMACompressFunc_t pfnCompress )
+{
+	s_pfnLZMACompress = pfnCompress;
+}
+
+
+//-----------------------------------------------------------------------------
+// Framed data helpers
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+// The header comes from untrusted data, make sure its block count is the one
+// the sizes call for and small enough to allocate a table for
+//-----------------------------------------------------------------------------
+static bool IsValidBlockHeader( const DataCodecBlockHeader *pHeader )
+{
+	unsigned int nActualSize = LittleLong( pHeader->actualSize );
+	unsigned int nBlockSize = LittleLong( pHeader->blockSize );
+	unsigned int nBlocks = LittleLong( pHeader->numBlocks );
+	if ( !nBlockSize || nBlocks > DATACODEC_MAX_BLOCKS )
+		return false;
+
+	return nBlocks == nActualSize / nBlockSize + ( ( nActualSize % nBlockSize ) ? 1 : 0 );
+}
+
+//-----------------------------------------------------------------------------
+// The largest frame any codec produces for nActualSize bytes
+//-----------------------------------------------------------------------------
+static unsigned int GetMaxFrameSize( unsigned int nActualSize )
+{
+	unsigned int nMaxSize = 0;
+	for ( int i = DATACODEC_NONE + 1; i < DATACODEC_COUNT; ++i )
+	{
+		unsigned int nSize = s_pCodecs[ i ]->GetMaxCompressedSize( nActualSize );
+		if ( nSize < nActualSize )
+		{
+			// the estimate wrapped around
+			return 0xFFFFFFFF;
+		}
+		nMaxSize = MAX( nMaxSize, nSize );
+	}
+	return nMaxSize;
+}
+
+static const DataCodecBlockHeader *GetBlockHeader( const void *pInput, unsigned int nInputSize )
+{
+	if ( nInputSize < sizeof( DataCodecBlockHeader ) )
+		return NULL;
+
+	const DataCodecBlockHeader *pHeader = (const DataCodecBlockHeader *)pInput;
+	if ( pHeader->id != DATACODEC_BLOCK_ID || !IsValidBlockHeader( pHeader ) )
+		return NULL;
+
+	unsigned int nBlocks = LittleLong( pHeader->numBlocks );
+	if ( nBlocks > ( nInputSize - sizeof( DataCodecBlockHeader ) ) / sizeof( unsigned int ) )
+		return NULL;
+	return pHeader;
+}
+
+static IDataCodec *DetectFrameCodec( const void *pInput, unsigned int nInputSize )
+{
+	for ( int i = DATACODEC_NONE + 1; i < DATACODEC_COUNT; ++i )
+	{
+		if ( s_pCodecs[ i ]->IsCompressed( pInput, nInputSize ) )
+			return s_pCodecs[ i ];
+	}
+	return NULL;
+}
+
+DataCodec_t DataCodec_Detect( const void *pInput, unsigned int nInputSize )
+{
+	const DataCodecBlockHeader *pBlockHeader = GetBlockHeader( pInput, nInputSize );
+	if ( pBlockHeader )
+	{
+		// Report the codec of the first block
+		unsigned int nTableSize = LittleLong( pBlockHeader->numBlocks ) * sizeof( unsigned int );
+		pInput = (const byte *)pInput + sizeof( DataCodecBlockHeader ) + nTableSize;
+		nInputSize -= sizeof( DataCodecBlockHeader ) + nTableSize;
+	}
+
+	IDataCodec *pCodec = DetectFrameCodec( pInput, nInputSize );
+	return pCodec ? pCodec->GetType() : DATACODEC_NONE;
+}
+
+bool DataCodec_IsCompressed( const void *pInput, unsigned int nInputSize )
+{
+	return GetBlockHeader( pInput, nInputSize ) != NULL || DetectFrameCodec( pInput, nInputSize ) != NULL;
+}
+
+unsigned int DataCodec_GetActualSize( const void *pInput, unsigned int nInputSize )
+{
+	const DataCodecBlockHeader *pBlockHeader = GetBlockHeader( pInput, nInputSize );
+	if ( pBlockHeader )
+		return LittleLong( pBlockHeader->actualSize );
+
+	IDataCodec *pCodec = DetectFrameCodec( pInput, nInputSize );
+	return pCodec ? pCodec->GetActualSize( pInput, nInputSize ) : 0;
+}
+
+unsigned int DataCodec_GetMaxCompressedSize( DataCodec_t type, unsigned int nInputSize, unsigned int nBlockSize )
+{
+	IDataCodec *pCodec = DataCodec_Get( type );
+	if ( !pCodec )
+		return 0;
+
+	if ( !nBlockSize || nInputSize <= nBlockSize )
+		return pCodec->GetMaxCompressedSize( nInputSize );
+
+	unsigned int nBlocks = ( nInputSize + nBlockSize - 1 ) / nBlockSize;
+	return sizeof( DataCodecBlockHeader ) + nBlocks * ( sizeof( unsigned int ) + pCodec->GetMaxCompressedSize( nBlockSize ) );
+}
+
+unsigned int DataCodec_Compress( DataCodec_t type, const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize, unsigned int nBlockSize )
+{
+	IDataCodec *pCodec = DataCodec_Get( type );
+	if ( !pCodec || !pCodec->CanCompress() )
+		return 0;
+
+	if ( !nBlockSize || nInputSize <= nBlockSize )
+		return pCodec->Compress( pInput, nInputSize, pOutput, nOutputSize );
+
+	unsigned int nBlocks = ( nInputSize + nBlockSize - 1 ) / nBlockSize;
+	unsigned int nHeaderSize = sizeof( DataCodecBlockHeader ) + nBlocks * sizeof( unsigned int );
+	if ( nOutputSize < nHeaderSize )
+		return 0;
+
+	DataCodecBlockHeader *pHeader = (DataCodecBlockHeader *)pOutput;
+	pHeader->id = DATACODEC_BLOCK_ID;
+	pHeader->actualSize = LittleLong( nInputSize );
+	pHeader->blockSize = LittleLong( nBlockSize );
+	pHeader->numBlocks = LittleLong( nBlocks );
+
+	unsigned int *pBlockSizes = (unsigned int *)( pHeader + 1 );
+	unsigned int nOutputPos = nHeaderSize;
+	for ( unsigned int i = 0; i < nBlocks; ++i )
+	{
+		unsigned int nOffset = i * nBlockSize;
+		unsigned int nSize = MIN( nBlockSize, nInputSize - nOffset );
+		unsigned int nCompressed = pCodec->Compress( (const byte *)pInput + nOffset, nSize, (byte *)pOutput + nOutputPos, nOutputSize - nOutputPos );
+		if ( !nCompressed )
+			return 0;
+
+		pBlockSizes[ i ] = LittleLong( nCompressed );
+		nOutputPos += nCompressed;
+	}
+
+	return nOutputPos;
+}
+
+
+//-----------------------------------------------------------------------------
+// Block-parallel decompression
+//-----------------------------------------------------------------------------
+struct DataCodecBlockJob_t
+{
+	const byte		*m_pInput;
+	unsigned int	m_nInputSize;
+	byte			*m_pOutput;
+	unsigned int	m_nOutputSize;
+	unsigned int	m_nResult;
+};
+
+static void UncompressBlock( DataCodecBlockJob_t &job )
+{
+	IDataCodec *pCodec = DetectFrameCodec( job.m_pInput, job.m_nInputSize );
+	job.m_nResult = pCodec ? pCodec->Uncompress( job.m_pInput, job.m_nInputSize, job.m_pOutput, job.m_nOutputSize ) : 0;
+}
+
+static unsigned int UncompressBlocks( const DataCodecBlockHeader *pHeader, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize, bool bAllowParallel )
+{
+	unsigned int nActualSize = LittleLong( pHeader->actualSize );
+	unsigned int nBlockSize = LittleLong( pHeader->blockSize );
+	unsigned int nBlocks = LittleLong( pHeader->numBlocks );
+	if ( nActualSize > nOutputSize || !IsValidBlockHeader( pHeader ) )
+		return 0;
+
+	const unsigned int *pBlockSizes = (const unsigned int *)( pHeader + 1 );
+	unsigned int nInputPos = sizeof( DataCodecBlockHeader ) + nBlocks * sizeof( unsigned int );
+
+	CUtlVector< DataCodecBlockJob_t > jobs;
+	jobs.SetCount( nBlocks );
+	for ( unsigned int i = 0; i < nBlocks; ++i )
+	{
+		unsigned int nFrameSize = LittleLong( pBlockSizes[ i ] );
+		if ( nFrameSize > nInputSize - nInputPos )
+			return 0;
+
+		DataCodecBlockJob_t &job = jobs[ i ];
+		job.m_pInput = (const byte *)pHeader + nInputPos;
+		job.m_nInputSize = nFrameSize;
+		job.m_pOutput = (byte *)pOutput + i * nBlockSize;
+		job.m_nOutputSize = MIN( nBlockSize, nActualSize - i * nBlockSize );
+		job.m_nResult = 0;
+		nInputPos += nFrameSize;
+	}
+
+	if ( bAllowParallel && nBlocks > 1 && nActualSize >= DATACODEC_PARALLEL_THRESHOLD )
+	{
+		ParallelProcess( "DataCodec_Uncompress", jobs.Base(), jobs.Count(), &UncompressBlock );
+	}
+	else
+	{
+		for ( int i = 0; i < jobs.Count(); ++i )
+		{
+			UncompressBlock( jobs[ i ] );
+		}
+	}
+
+	for ( int i = 0; i < jobs.Count(); ++i )
+	{
+		if ( jobs[ i ].m_nResult != jobs[ i ].m_nOutputSize )
+		{
+			Warning( "DataCodec: block %d failed to decompress\n", i );
+			return 0;
+		}
+	}
+
+	return nActualSize;
+}
+
+unsigned int DataCodec_Uncompress( const void *pInput, unsigned int nInputSize, void *pOutput, unsigned int nOutputSize, bool bAllowParallel )
+{
+	const DataCodecBlockHeader *pBlockHeader = GetBlockHeader( pInput, nInputSize );
+	if ( pBlockHeader )
+		return UncompressBlocks( pBlockHeader, nInputSize, pOutput, nOutputSize, bAllowParallel );
+
+	IDataCodec *pCodec = DetectFrameCodec( pInput, nInputSize );
+	return pCodec ? pCodec->Uncompress( pInput, nInputSize, pOutput, nOutputSize ) : 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// CUtlBuffer adapters
+//-----------------------------------------------------------------------------
+bool DataCodec_CompressBuffer( CUtlBuffer &input, CUtlBuffer &output, DataCodec_t type, unsigned int nBlockSize )
+{
+	unsigned int nInputSize = input.TellPut() - input.TellGet();
+	unsigned int nMaxSize = DataCodec_GetMaxCompressedSize( type, nInputSize, nBlockSize );
+	if ( !nMaxSize )
+		return false;
+
+	output.EnsureCapacity( output.TellPut() + nMaxSize );
+	unsigned int nCompressed = DataCodec_Compress( type, input.PeekGet(), nInputSize, output.PeekPut(), nMaxSize, nBlockSize );
+	if ( !nCompressed )
+		return false;
+
+	input.SeekGet( CUtlBuffer::SEEK_CURRENT, nInputSize );
+	output.SeekPut( CUtlBuffer::SEEK_CURRENT, nCompressed );
+	return true;
+}
+
+bool DataCodec_UncompressBuffer( CUtlBuffer &input, CUtlBuffer &output, bool bAllowParallel )
+{
+	unsigned int nInputSize = input.TellPut() - input.TellGet();
+	unsigned int nActualSize = DataCodec_GetActualSize( input.PeekGet(), nInputSize );
+	if ( !nActualSize )
+		return false;
+
+	output.EnsureCapacity( output.TellPut() + nActualSize );
+	if ( DataCodec_Uncompress( input.PeekGet(), nInputSize, output.PeekPut(), nActualSize, bAllowParallel ) != nActualSize )
+		return false;
+
+	input.SeekGet( CUtlBuffer::SEEK_CURRENT, nInputSize );
+	output.SeekPut( CUtlBuffer::SEEK_CURRENT, nActualSize );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Benchmark
+//-----------------------------------------------------------------------------
+static float MegabytesPerSecond( unsigned int nBytes, int nIterations, const CCycleCount &duration )
+{
+	double flSeconds = duration.GetSeconds();
+	if ( flSeconds <= 0.0 )
+		return 0.0f;
+	return (float)( ( (double)nBytes * nIterations ) / ( 1024.0 * 1024.0 ) / flSeconds );
+}
+
+void DataCodec_Benchmark( const char *pLabel, const void *pData, unsigned int nSize, int nIterations )
+{
+	if ( !nSize || nIterations <= 0 )
+		return;
+
+	CUtlMemory< byte > decoded( 0, nSize );
+	for ( int i = DATACODEC_NONE + 1; i < DATACODEC_COUNT; ++i )
+	{
+		IDataCodec *pCodec = s_pCodecs[ i ];
+
+		// Data that is already framed by this codec (LZMA lumps) is only timed for decoding
+		bool bPreCompressed = pCodec->IsCompressed( pData, nSize );
+		if ( !bPreCompressed && !pCodec->CanCompress() )
+		{
+			Msg( "%-24s %-8s encoder not available\n", pLabel, pCodec->GetName() );
+			continue;
+		}
+
+		CUtlMemory< byte > compressed;
+		unsigned int nCompressed = nSize;
+		unsigned int nActualSize = nSize;
+		CCycleCount compressTime;
+		compressTime.Init();
+
+		if ( bPreCompressed )
+		{
+			nActualSize = pCodec->GetActualSize( pData, nSize );
+			compressed.EnsureCapacity( nSize );
+			V_memcpy( compressed.Base(), pData, nSize );
+		}
+		else
+		{
+			unsigned int nMaxSize = DataCodec_GetMaxCompressedSize( pCodec->GetType(), nSize, DATACODEC_DEFAULT_BLOCK_SIZE );
+			compressed.EnsureCapacity( nMaxSize );
+
+			CFastTimer timer;
+			timer.Start();
+			for ( int iter = 0; iter < nIterations; ++iter )
+			{
+				nCompressed = DataCodec_Compress( pCodec->GetType(), pData, nSize, compressed.Base(), nMaxSize, DATACODEC_DEFAULT_BLOCK_SIZE );
+			}
+			timer.End();
+			compressTime = timer.GetDuration();
+
+			if ( !nCompressed )
+			{
+				Msg( "%-24s %-8s compression failed\n", pLabel, pCodec->GetName() );
+				continue;
+			}
+		}
+
+		decoded.EnsureCapacity( nActualSize );
+
+		CCycleCount decodeTimes[ 2 ];
+		for ( int nParallel = 0; nParallel < 2; ++nParallel )
+		{
+			CFastTimer timer;
+			timer.Start();
+			for ( int iter = 0; iter < nIterations; ++iter )
+			{
+				DataCodec_Uncompress( compressed.Base(), nCompressed, decoded.Base(), nActualSize, nParallel != 0 );
+			}
+			timer.End();
+			decodeTimes[ nParallel ] = timer.GetDuration();
+		}
+
+		Msg( "%-24s %-8s %9u -> %9u (%5.1f%%)  enc %8.1f MB/s  dec %8.1f MB/s  dec-mt %8.1f MB/s\n",
+			pLabel, pCodec->GetName(), nActualSize, nCompressed, 100.0f * nCompressed / MAX( nActualSize, 1u ),
+			MegabytesPerSecond( nActualSize, nIterations, compressTime ),
+			MegabytesPerSecond( nActualSize, nIterations, decodeTimes[ 0 ] ),
+			MegabytesPerSecond( nActualSize, nIterations, decodeTimes[ 1 ] ) );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Incremental decoding
+//-----------------------------------------------------------------------------
+CDataCodecStream::CDataCodecStream()
+	: m_pLZMA( NULL )
+{
+	Reset();
+}
+
+CDataCodecStream::~CDataCodecStream()
+{
+	delete m_pLZMA;
+}
+
+void CDataCodecStream::Reset()
+{
+	delete m_pLZMA;
+	m_pLZMA = NULL;
+	m_Pending.Purge();
+	m_BlockSizes.Purge();
+	m_nCurrentBlock = 0;
+	m_nActualSize = 0;
+	m_nBytesWritten = 0;
+	m_Type = DATACODEC_NONE;
+	m_State = STATE_HEADER;
+}
+
+bool CDataCodecStream::IsFinished() const
+{
+	return m_State == STATE_DONE;
+}
+
+bool CDataCodecStream::GetExpectedBytesRemaining( unsigned int &nBytesRemaining ) const
+{
+	if ( m_State == STATE_HEADER || m_State == STATE_ERROR )
+		return false;
+
+	nBytesRemaining = m_nActualSize - m_nBytesWritten;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Moves bytes from input into m_Pending until it holds nWanted bytes
+//-----------------------------------------------------------------------------
+bool CDataCodecStream::Buffer( CUtlBuffer &input, unsigned int nWanted )
+{
+	unsigned int nHave = m_Pending.TellPut();
+	if ( nHave >= nWanted )
+		return true;
+
+	int nCopy = MIN( (int)( nWanted - nHave ), input.GetBytesRemaining() );
+	if ( nCopy > 0 )
+	{
+		m_Pending.Put( input.PeekGet(), nCopy );
+		input.SeekGet( CUtlBuffer::SEEK_CURRENT, nCopy );
+	}
+	return (unsigned int)m_Pending.TellPut() >= nWanted;
+}
+
+bool CDataCodecStream::Read( CUtlBuffer &input, CUtlBuffer &output )
+{
+	if ( m_State == STATE_HEADER )
+	{
+		if ( !Buffer( input, sizeof( unsigned int ) ) )
+			return true;
+
+		unsigned int nId = *(const unsigned int *)m_Pending.Base();
+		unsigned int nHeaderSize;
+		if ( nId == LZMA_ID )
+		{
+			nHeaderSize = sizeof( LzmaHeader );
+		}
+		else if ( nId == SNAPPY_ID )
+		{
+			nHeaderSize = sizeof( SnappyHeader );
+		}
+		else if ( nId == DATACODEC_BLOCK_ID )
+		{
+			nHeaderSize = sizeof( DataCodecBlockHeader );
+		}
+		else
+		{
+			Warning( "DataCodec stream: unrecognized data\n" );
+			m_State = STATE_ERROR;
+			return false;
+		}
+
+		if ( !Buffer( input, nHeaderSize ) )
+			return true;
+
+		if ( nId == DATACODEC_BLOCK_ID )
+		{
+			const DataCodecBlockHeader *pHeader = (const DataCodecBlockHeader *)m_Pending.Base();
+			if ( !IsValidBlockHeader( pHeader ) )
+			{
+				Warning( "DataCodec stream: bad block table\n" );
+				m_State = STATE_ERROR;
+				return false;
+			}
+
+			m_nActualSize = LittleLong( pHeader->actualSize );
+			m_BlockSizes.SetCount( LittleLong( pHeader->numBlocks ) );
+			m_State = STATE_BLOCK_TABLE;
+		}
+		else
+		{
+			IDataCodec *pCodec = DetectFrameCodec( m_Pending.Base(), m_Pending.TellPut() );
+			m_Type = pCodec->GetType();
+			m_nActualSize = pCodec->GetActualSize( m_Pending.Base(), m_Pending.TellPut() );
+
+			if ( m_Type == DATACODEC_LZMA )
+			{
+				// Hand the header to the LZMA stream, it decodes as bytes arrive from here on
+				m_pLZMA = new CLZMAStream();
+				unsigned int nRead, nWritten;
+				if ( !m_pLZMA->Read( (unsigned char *)m_Pending.Base(), m_Pending.TellPut(), NULL, 0, nRead, nWritten ) || nRead != (unsigned int)m_Pending.TellPut() )
+				{
+					m_State = STATE_ERROR;
+					return false;
+				}
+				m_Pending.Purge();
+				m_State = STATE_LZMA;
+			}
+			else
+			{
+				m_State = STATE_FRAME;
+			}
+		}
+	}
+
+	if ( m_State == STATE_LZMA )
+		return ReadLZMA( input, output );
+
+	return ReadFrames( input, output );
+}
+
+bool CDataCodecStream::ReadLZMA( CUtlBuffer &input, CUtlBuffer &output )
+{
+	unsigned int nRemaining = m_nActualSize - m_nBytesWritten;
+	if ( !nRemaining )
+	{
+		m_State = STATE_DONE;
+		return true;
+	}
+
+	output.EnsureCapacity( output.TellPut() + nRemaining );
+
+	unsigned int nRead, nWritten;
+	if ( !m_pLZMA->Read( (unsigned char *)input.PeekGet(), input.GetBytesRemaining(), (unsigned char *)output.PeekPut(), nRemaining, nRead, nWritten ) )
+	{
+		Warning( "DataCodec stream: LZMA decoding failed\n" );
+		m_State = STATE_ERROR;
+		return false;
+	}
+
+	input.SeekGet( CUtlBuffer::SEEK_CURRENT, nRead );
+	output.SeekPut( CUtlBuffer::SEEK_CURRENT, nWritten );
+	m_nBytesWritten += nWritten;
+
+	if ( m_nBytesWritten == m_nActualSize )
+	{
+		m_State = STATE_DONE;
+	}
+	return true;
+}
+
+bool CDataCodecStream::ReadFrames( CUtlBuffer &input, CUtlBuffer &output )
+{
+	if ( m_State == STATE_BLOCK_TABLE )
+	{
+		unsigned int nTableEnd = sizeof( DataCodecBlockHeader ) + m_BlockSizes.Count() * sizeof( unsigned int );
+		if ( !Buffer( input, nTableEnd ) )
+			return true;
+
+		// Every block holds at most blockSize bytes, so its frame can't be larger than any codec makes that
+		const DataCodecBlockHeader *pHeader = (const DataCodecBlockHeader *)m_Pending.Base();
+		unsigned int nMaxFrameSize = GetMaxFrameSize( LittleLong( pHeader->blockSize ) );
+
+		const unsigned int *pSizes = (const unsigned int *)( pHeader + 1 );
+		for ( int i = 0; i < m_BlockSizes.Count(); ++i )
+		{
+			m_BlockSizes[ i ] = LittleLong( pSizes[ i ] );
+			if ( !m_BlockSizes[ i ] || m_BlockSizes[ i ] > nMaxFrameSize )
+			{
+				Warning( "DataCodec stream: bad block table\n" );
+				m_State = STATE_ERROR;
+				return false;
+			}
+		}
+
+		m_Pending.Purge();
+		m_State = STATE_BLOCKS;
+	}
+
+	while ( m_State == STATE_FRAME || m_State == STATE_BLOCKS )
+	{
+		unsigned int nFrameSize;
+		if ( m_State == STATE_BLOCKS )
+		{
+			if ( m_nCurrentBlock == m_BlockSizes.Count() )
+			{
+				m_State = ( m_nBytesWritten == m_nActualSize ) ? STATE_DONE : STATE_ERROR;
+				break;
+			}
+			nFrameSize = m_BlockSizes[ m_nCurrentBlock ];
+		}
+		else
+		{
+			nFrameSize = DataCodec_Get( m_Type )->GetFrameSize( m_Pending.Base(), m_Pending.TellPut() );
+		}
+
+		if ( !Buffer( input, nFrameSize ) )
+			return true;
+
+		unsigned int nFrameActual = DataCodec_GetActualSize( m_Pending.Base(), nFrameSize );
+		if ( m_nBytesWritten + nFrameActual > m_nActualSize )
+		{
+			m_State = STATE_ERROR;
+			break;
+		}
+
+		output.EnsureCapacity( output.TellPut() + nFrameActual );
+		if ( nFrameActual && DataCodec_Uncompress( m_Pending.Base(), nFrameSize, output.PeekPut(), nFrameActual, false ) != nFrameActual )
+		{
+			m_State = STATE_ERROR;
+			break;
+		}
+
+		output.SeekPut( CUtlBuffer::SEEK_CURRENT, nFrameActual );
+		m_nBytesWritten += nFrameActual;
+		m_Pending.Clear();
+
+		if ( m_State == STATE_FRAME )
+		{
+			m_State = STATE_DONE;
+		}
+		else
+		{
+			++m_nCurrentBlock;
+		}
+	}
+
+	if ( m_State == STATE_ERROR )
+	{
+		Warning( "DataCodec stream: decoding failed\n" );
+		return false;
+	}
+	return true;
+}
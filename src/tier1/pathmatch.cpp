@@ -51,16 +51,10 @@
 	#include <sys/mount.h>
 	#include <fcntl.h>
 	#include <utime.h>
-	#include <map>
-	#include <string>
+	#include <iterator>
 	#include <ctime>
-
-	// Enable to do pathmatch caching. Beware: this code isn't threadsafe.
-	// #define DO_PATHMATCH_CACHE
-
-	#ifdef UTF8_PATHMATCH
-		#define strcasecmp utf8casecmp
-	#endif
+	#include <string>
+	#include "tier1/pathmatchcache.h"
 
 	static bool s_bShowDiag;
 	#define DEBUG_MSG( ... ) if ( s_bShowDiag ) fprintf( stderr, ## __VA_ARGS__ )
@@ -74,7 +68,6 @@
 
 	// Needed by pathmatch code
 	extern "C" int __real_access( const char* pathname, int mode );
-	extern "C" DIR* __real_opendir( const char* name );
 
 
 	// UTF-8 work from PhysicsFS: http://icculus.org/physfs/
@@ -287,81 +280,20 @@
 		return retval;
 	}
 
-	[[gnu::always_inline]]
-	static inline int utf8casecmp_loop( const uint32_t* folded1, const uint32_t* folded2 ) {
-		while ( true ) {
-			const uint32_t ch1 = *folded1++;
-			const uint32_t ch2 = *folded2++;
-			if ( ch1 < ch2 ) {
-				return -1;
-			}
-			if ( ch1 > ch2 ) {
-				return 1;
-			}
-			if ( ch1 == 0 ) {
-				return 0;  // complete match.
-			}
-		}
-	}
-
 	#if defined( UTF8_PATHMATCH )
-		static int utf8casecmp( const char* str1, const char* str2 ) {
-			uint32_t* folded1 = fold_utf8( str1 );
-			uint32_t* folded2 = fold_utf8( str2 );
-			const int retval = utf8casecmp_loop( folded1, folded2 );
-			delete[] folded1;
-			delete[] folded2;
-			return retval;
-		}
-	#endif
-
-	// Simple object to help make sure a DIR* from opendir
-	// gets closed when it goes out of scope.
-	class CDirPtr {
-	public:
-		CDirPtr() = default;
-		CDirPtr( DIR* pDir ) : m_pDir( pDir ) {}
-		~CDirPtr() { Close(); }
-
-		void operator=( DIR* pDir ) {
-			Close();
-			m_pDir = pDir;
-		}
-
-		operator DIR*() { return m_pDir; }
-		operator bool() { return m_pDir != nullptr; }
-
-	private:
-		void Close() {
-			if ( m_pDir ) {
-				closedir( m_pDir );
+		std::string PathMatch_FoldUTF8( const char* pName, size_t nLen ) {
+			const std::string name( pName, nLen );
+			uint32_t* folded = fold_utf8( name.c_str() );
+			size_t count = 0;
+			while ( folded[ count ] ) {
+				count++;
 			}
+			// the folded codepoints themselves are the key, two names match when their folds are equal
+			std::string key( reinterpret_cast<const char*>( folded ), count * sizeof( uint32_t ) );
+			delete[] folded;
+			return key;
 		}
-
-		DIR* m_pDir{};
-	};
-
-	// Object used to temporarily slice a path into a smaller components
-	// and then repair it when going out of scope. Typically used as an unnamed
-	// temp object that is a parameter to a function.
-	class CDirTrimmer {
-	public:
-		CDirTrimmer( char* pPath, size_t nTrimIdx ) {
-			m_pPath = pPath;
-			m_idx = nTrimIdx;
-			m_c = m_pPath[ nTrimIdx ];
-			m_pPath[ nTrimIdx ] = '\0';
-		}
-		~CDirTrimmer() { m_pPath[ m_idx ] = m_c; }
-
-		operator const char*() const { return m_pPath; }
-
-	private:
-		size_t m_idx;
-		char* m_pPath;
-		char m_c;
-	};
-
+	#endif
 
 	enum PathMod_t {
 		kPathUnchanged,
@@ -370,108 +302,6 @@
 		kPathFailed,
 	};
 
-	static bool Descend( char* pPath, size_t nStartIdx, bool bAllowBasenameMismatch, size_t nLevel = 0 ) {
-		DEBUG_MSG( "(%zu) Descend: %s, (%s), %s\n", nLevel, pPath, pPath + nStartIdx, bAllowBasenameMismatch ? "true" : "false " );
-		// We assume up through nStartIdx is valid and matching
-		size_t nNextSlash = nStartIdx + 1;
-
-		// path might be a dir
-		if ( pPath[ nNextSlash ] == '\0' ) {
-			return true;
-		}
-
-		bool bIsDir = false;// is the new component a directory for certain?
-		while ( pPath[ nNextSlash ] != '\0' && pPath[ nNextSlash ] != '/' ) {
-			nNextSlash++;
-		}
-
-		// Modify the pPath string
-		if ( pPath[ nNextSlash ] == '/' ) {
-			bIsDir = true;
-		}
-
-		// See if we have an immediate match
-		if ( __real_access( CDirTrimmer( pPath, nNextSlash ), F_OK ) == 0 ) {
-			if ( !bIsDir ) {
-				return true;
-			}
-
-			if ( Descend( pPath, nNextSlash, bAllowBasenameMismatch, nLevel + 1 ) ) {
-				return true;
-			}
-		}
-
-		// Start enumerating dirents
-		CDirPtr spDir;
-		if ( nStartIdx ) {
-			// we have a path
-			spDir = __real_opendir( CDirTrimmer( pPath, nStartIdx ) );
-			nStartIdx++;
-		} else {
-			// we either start at root or cwd
-			auto pRoot = ".";
-			if ( *pPath == '/' ) {
-				pRoot = "/";
-				nStartIdx++;
-			}
-			spDir = __real_opendir( pRoot );
-		}
-
-		errno = 0;
-		dirent* pEntry = spDir ? readdir( spDir ) : nullptr;
-		char* pszComponent = pPath + nStartIdx;
-		const size_t cbComponent = nNextSlash - nStartIdx;
-		while ( pEntry ) {
-			DEBUG_MSG( "\t(%zu) comparing %s with %s\n", nLevel, pEntry->d_name, (const char*) CDirTrimmer( pszComponent, cbComponent ) );
-
-			// the candidate must match the target, but not be a case-identical match (we would
-			// have looked there in the short-circuit code above, so don't look again)
-			bool bMatches = strcasecmp( CDirTrimmer( pszComponent, cbComponent ), pEntry->d_name ) == 0 &&
-							strcmp( CDirTrimmer( pszComponent, cbComponent ), pEntry->d_name ) != 0;
-
-			if ( bMatches ) {
-				const char* pSrc = pEntry->d_name;
-				char* pDst = &pPath[ nStartIdx ];
-				// found a match; copy it in.
-				while ( *pSrc && ( *pSrc != '/' ) ) {
-					*pDst++ = *pSrc++;
-				}
-
-				if ( !bIsDir ) {
-					return true;
-				}
-
-				if ( Descend( pPath, nNextSlash, bAllowBasenameMismatch, nLevel + 1 ) ) {
-					return true;
-				}
-
-				// If descend fails, try more directories
-			}
-			pEntry = readdir( spDir );
-		}
-
-		if ( bIsDir ) {
-			DEBUG_MSG( "(%zu) readdir failed to find '%s' in '%s'\n", nLevel, (const char*) CDirTrimmer( pszComponent, cbComponent ), (const char*) CDirTrimmer( pPath, nStartIdx ) );
-		}
-
-		// Sometimes it's ok for the filename portion to not match
-		// since we might be opening for write.  Note that if
-		// the filename matches case insensitive, that will be
-		// preferred over preserving the input name
-		if ( !bIsDir && bAllowBasenameMismatch ) {
-			return true;
-		}
-
-		return false;
-	}
-
-	#ifdef DO_PATHMATCH_CACHE
-		typedef std::map<std::string, std::pair<std::string, time_t>> resultCache_t;
-		typedef std::map<std::string, std::pair<std::string, time_t>>::iterator resultCacheItr_t;
-		static resultCache_t resultCache;
-		static const int k_cMaxCacheLifetimeSeconds = 2;
-	#endif
-
 	PathMod_t pathmatch( const char* pszIn, char** ppszOut, bool bAllowBasenameMismatch, char* pszOutBuf, size_t OutBufLen ) {
 		// Path matching can be very expensive, and the cost is unpredictable because it
 		// depends on how many files are in directories on a user's machine. Therefore
@@ -488,118 +318,38 @@
 
 		*ppszOut = nullptr;
 
-		if ( __real_access( pszIn, F_OK ) == 0 ) {
-			return kPathUnchanged;
+		if ( s_pszDbgPathMatch && strcasestr( s_pszDbgPathMatch, pszIn ) ) {
+			DEBUG_MSG( "Breaking '%s' in '%s'\n", pszIn, s_pszDbgPathMatch );
+			DEBUG_BREAK();
 		}
 
-		#ifdef DO_PATHMATCH_CACHE
-			resultCacheItr_t cachedResult = resultCache.find( pszIn );
-			if ( cachedResult != resultCache.end() ) {
-				unsigned int age = time( nullptr ) - cachedResult->second.second;
-				const char* pszResult = cachedResult->second.first.c_str();
-				if ( pszResult[ 0 ] != '\0' || age <= k_cMaxCacheLifetimeSeconds ) {
-					if ( pszResult[ 0 ] != '\0' ) {
-						*ppszOut = strdup( pszResult );
-						DEBUG_MSG( "Cached '%s' -> '%s'\n", pszIn, *ppszOut );
-						return kPathChanged;
-					} else {
-						DEBUG_MSG( "Cached '%s' -> kPathFailed\n", pszIn );
-						return kPathFailed;
-					}
-				} else if ( age <= k_cMaxCacheLifetimeSeconds ) {
-					DEBUG_MSG( "Rechecking '%s' - cache is %u seconds old\n", pszIn, age );
-				}
-			}
-		#endif// DO_PATHMATCH_CACHE
-
-		char* pPath;
-		if ( strlen( pszIn ) >= OutBufLen ) {
-			pPath = strdup( pszIn );
-		} else {
-			strncpy( pszOutBuf, pszIn, OutBufLen );
-			pPath = pszOutBuf;
-		}
-
-		if ( pPath ) {
-			// I believe this code is broken. I'm guessing someone wanted to avoid lowercasing
-			//	the path before the steam directory - but it's actually skipping lowercasing
-			//	whenever steam is found anywhere - including the filename. For example,
-			//	  /home/mikesart/valvesrc/console/l4d2/game/left4dead2_dlc1/particles/steam_fx.pcf
-			//	winds up only having the "steam_fx.pcf" portion lowercased.
-			#ifdef NEVER
-				// optimization, if the path contained steam somewhere
-				// assume the path up through the component with 'steam' in
-				// is valid (because we almost certainly obtained it
-				// progamatically
-				char* p = strcasestr( pPath, "steam" );
-				if ( p ) {
-					while ( p > pPath ) {
-						if ( p[ -1 ] == '/' )
-							break;
-						p--;
-					}
-
-					if ( ( p == pPath + 1 ) && ( *pPath != '/' ) )
-						p = pPath;
-				} else {
-					p = pPath;
-				}
-			#else
-				char* p = pPath;
-			#endif
-
-			// Try the lower casing of the remaining path
-			char* pBasename = p;
-			while ( *p ) {
-				if ( *p == '/' ) {
-					pBasename = p + 1;
-				}
-
-				*p = static_cast<char>( tolower( *p ) );
-				p++;
-			}
-			if ( __real_access( pPath, F_OK ) == 0 ) {
-				*ppszOut = pPath;
-				DEBUG_MSG( "Lowered '%s' -> '%s'\n", pszIn, pPath );
-				return kPathLowered;
-			}
+		// Directory listings are cached and invalidated through inotify, so only
+		// the first lookup in a directory pays for the readdir scan.
+		char* pPath = pszOutBuf;
+		size_t nPathLen = OutBufLen;
+		if ( strlen( pszIn ) + 1 > OutBufLen ) {
+			nPathLen = strlen( pszIn ) + 1;
+			pPath = static_cast<char*>( malloc( nPathLen ) );
+		}
 
-			// path didn't match lowered successfully, restore the basename
-			// if bAllowBasenameMismatch was true
-			if ( bAllowBasenameMismatch ) {
-				const char* pSrc = pszIn + ( pBasename - pPath );
-				while ( *pBasename ) {
-					*pBasename++ = *pSrc++;
+		switch ( PathMatch_Resolve( pszIn, pPath, nPathLen, bAllowBasenameMismatch ) ) {
+			case kPathMatchUnchanged:
+				if ( pPath != pszOutBuf ) {
+					free( pPath );
 				}
-			}
-
-			if ( s_pszDbgPathMatch && strcasestr( s_pszDbgPathMatch, pszIn ) ) {
-				DEBUG_MSG( "Breaking '%s' in '%s'\n", pszIn, s_pszDbgPathMatch );
-				DEBUG_BREAK();
-			}
-
-			bool bSuccess = Descend( pPath, 0, bAllowBasenameMismatch );
-			if ( bSuccess ) {
+				return kPathUnchanged;
+			case kPathMatchChanged:
 				*ppszOut = pPath;
 				DEBUG_MSG( "Matched '%s' -> '%s'\n", pszIn, pPath );
-			} else {
-				DEBUG_MSG( "Unmatched %s\n", pszIn );
-			}
-
-			#ifndef DO_PATHMATCH_CACHE
-				return bSuccess ? kPathChanged : kPathFailed;
-			#else
-				time_t now = time( nullptr );
-				if ( bSuccess ) {
-					resultCache[ pszIn ] = std::make_pair( *ppszOut, now );
-					return kPathChanged;
-				} else {
-					resultCache[ pszIn ] = std::make_pair( "", now );
-					return kPathFailed;
+				return kPathChanged;
+			case kPathMatchFailed:
+			default:
+				if ( pPath != pszOutBuf ) {
+					free( pPath );
 				}
-			#endif
+				DEBUG_MSG( "Unmatched %s\n", pszIn );
+				return kPathFailed;
 		}
-		return kPathFailed;
 	}
 
 	// Wrapper object that manages the 'typical' usage cases of pathmatch()
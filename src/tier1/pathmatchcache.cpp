@@ -0,0 +1,367 @@
+//===========================================================================//
+//
+// Purpose: Case-folded directory cache used to resolve paths case
+//          insensitively on case-sensitive file systems.
+//
+//===========================================================================//
+// NOTE: This file is linked into binaries built with the pathmatch `--wrap`
+// flags, so it must only use libc entry points that are *not* wrapped there
+// (faccessat/openat/fdopendir instead of access/open/opendir), or it would
+// recurse into itself.
+
+#if defined( PLATFORM_LINUX )
+	#include <atomic>
+	#include <cctype>
+	#include <cerrno>
+	#include <cstring>
+	#include <ctime>
+	#include <mutex>
+	#include <shared_mutex>
+	#include <string>
+	#include <unordered_map>
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/inotify.h>
+	#include <sys/ioctl.h>
+	#include <unistd.h>
+	#include "tier1/pathmatchcache.h"
+
+	namespace {
+		// Listings of directories we could not put a watch on are only trusted for this long
+		constexpr time_t k_cUnwatchedLifetimeSeconds = 2;
+		constexpr uint32_t k_fWatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+		struct CachedDir {
+			std::unordered_map<std::string, std::string> m_Entries;  // folded name -> on-disk name
+			int m_iWatch{ -1 };
+			time_t m_ReadTime{ 0 };
+		};
+
+		std::shared_mutex s_Mutex;
+		std::unordered_map<std::string, CachedDir> s_Dirs;  // on-disk directory path -> listing
+		std::unordered_map<int, std::string> s_Watches;     // inotify watch -> on-disk directory path
+		int s_iNotifyFd{ -2 };                              // -2: not yet initialized, -1: unavailable
+
+		std::atomic<uint64> s_nLookups{ 0 };
+		std::atomic<uint64> s_nExactHits{ 0 };
+		std::atomic<uint64> s_nCacheHits{ 0 };
+		std::atomic<uint64> s_nSlowPath{ 0 };
+		std::atomic<uint64> s_nDirScans{ 0 };
+		std::atomic<uint64> s_nFailures{ 0 };
+		std::atomic<uint64> s_nInvalidations{ 0 };
+
+		auto Fold( const char* pName, size_t nLen ) -> std::string {
+			#if defined( UTF8_PATHMATCH )
+				return PathMatch_FoldUTF8( pName, nLen );
+			#else
+				std::string folded( pName, nLen );
+				for ( auto& c : folded ) {
+					c = static_cast<char>( tolower( static_cast<unsigned char>( c ) ) );
+				}
+				return folded;
+			#endif
+		}
+
+		// Must be called with the unique lock held
+		auto DropDir( const std::string& pDir ) -> void {
+			const auto it{ s_Dirs.find( pDir ) };
+			if ( it == s_Dirs.end() ) {
+				return;
+			}
+
+			if ( it->second.m_iWatch >= 0 ) {
+				s_Watches.erase( it->second.m_iWatch );
+				inotify_rm_watch( s_iNotifyFd, it->second.m_iWatch );
+			}
+			s_Dirs.erase( it );
+			s_nInvalidations += 1;
+		}
+
+		// Must be called with the unique lock held
+		auto PumpNotifications() -> void {
+			if ( s_iNotifyFd == -2 ) {
+				s_iNotifyFd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+			}
+			if ( s_iNotifyFd < 0 ) {
+				return;
+			}
+
+			alignas( inotify_event ) char buffer[ 4096 ];
+			while ( true ) {
+				const auto count{ read( s_iNotifyFd, buffer, sizeof( buffer ) ) };
+				if ( count <= 0 ) {
+					break;
+				}
+
+				for ( auto offset{ 0 }; offset < count; ) {
+					const auto* event{ reinterpret_cast<const inotify_event*>( buffer + offset ) };
+					offset += static_cast<int>( sizeof( inotify_event ) + event->len );
+
+					if ( event->mask & IN_Q_OVERFLOW ) {
+						// we lost events, nothing we hold can be trusted anymore
+						while ( !s_Dirs.empty() ) {
+							DropDir( s_Dirs.begin()->first );
+						}
+						continue;
+					}
+
+					const auto it{ s_Watches.find( event->wd ) };
+					if ( it != s_Watches.end() ) {
+						DropDir( std::string{ it->second } );
+					}
+				}
+			}
+		}
+
+		// Returns the listing of an on-disk directory, reading it if needed. Must be called with the unique lock held.
+		auto ReadDir( const std::string& pDir ) -> const CachedDir* {
+			const int fd{ openat( AT_FDCWD, pDir.empty() ? "." : pDir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC ) };
+			if ( fd < 0 ) {
+				return nullptr;
+			}
+			DIR* dir{ fdopendir( fd ) };
+			if ( dir == nullptr ) {
+				close( fd );
+				return nullptr;
+			}
+
+			s_nDirScans += 1;
+
+			CachedDir listing;
+			for ( const auto* entry{ readdir( dir ) }; entry != nullptr; entry = readdir( dir ) ) {
+				// keep the first spelling in case several entries only differ by case
+				listing.m_Entries.emplace( Fold( entry->d_name, strlen( entry->d_name ) ), entry->d_name );
+			}
+			closedir( dir );
+
+			listing.m_ReadTime = time( nullptr );
+			if ( s_iNotifyFd >= 0 ) {
+				listing.m_iWatch = inotify_add_watch( s_iNotifyFd, pDir.empty() ? "." : pDir.c_str(), k_fWatchMask );
+				if ( listing.m_iWatch >= 0 ) {
+					// watching the same inode through another path returns the existing watch, drop the old listing
+					const auto it{ s_Watches.find( listing.m_iWatch ) };
+					if ( it != s_Watches.end() && it->second != pDir ) {
+						s_Dirs.erase( it->second );
+					}
+					s_Watches[ listing.m_iWatch ] = pDir;
+				}
+			}
+
+			return &( s_Dirs[ pDir ] = std::move( listing ) );
+		}
+
+		// Returns a cached listing, or nullptr if it has to be read
+		auto FindDir( const std::string& pDir, time_t pNow ) -> const CachedDir* {
+			const auto it{ s_Dirs.find( pDir ) };
+			if ( it == s_Dirs.end() ) {
+				return nullptr;
+			}
+			if ( it->second.m_iWatch < 0 && pNow - it->second.m_ReadTime > k_cUnwatchedLifetimeSeconds ) {
+				return nullptr;
+			}
+			return &it->second;
+		}
+
+		// Working directory with a trailing slash, prefixed to relative paths so a chdir doesn't serve stale listings.
+		// Empty if pPath is absolute, or if the working directory can't be read.
+		auto BaseFor( const char* pPath ) -> std::string {
+			std::string base;
+			if ( pPath[ 0 ] != '/' ) {
+				char cwd[ 4096 ];
+				if ( getcwd( cwd, sizeof( cwd ) ) != nullptr ) {
+					base = cwd;
+					if ( base.back() != '/' ) {
+						base += '/';
+					}
+				}
+			}
+			return base;
+		}
+
+		enum class WalkResult {
+			Matched,
+			Failed,
+			NeedsRead,
+		};
+
+		// True if inotify may have events we haven't pumped, so watched listings can't be trusted to be current. Must be called with a lock held.
+		auto NotificationsPending() -> bool {
+			if ( s_iNotifyFd < 0 ) {
+				return false;
+			}
+			int pending{ 0 };
+			return ioctl( s_iNotifyFd, FIONREAD, &pending ) != 0 || pending > 0;
+		}
+
+		// Walks the path component by component through the cached listings.
+		// Listings are keyed by absolute path; pBase is the working directory (with a trailing slash) for relative paths, empty otherwise.
+		// When bCanRead is false no directory is read, and NeedsRead is returned when a listing is missing, or when it lacks
+		// the name and isn't known to be current (unwatched, or a notification for it may still be pending).
+		// When it's true, a cached listing that lacks the name is read again unless inotify keeps it current.
+		auto Walk( const char* pPath, const std::string& pBase, std::string& pResult, bool pAllowBasenameMismatch, bool pCanRead, bool pTrustWatched ) -> WalkResult {
+			const time_t now{ time( nullptr ) };
+			pResult.clear();
+
+			const char* component{ pPath };
+			if ( *component == '/' ) {
+				pResult = "/";
+				component += 1;
+			}
+
+			while ( *component != '\0' ) {
+				const char* end{ strchr( component, '/' ) };
+				const size_t length{ end ? static_cast<size_t>( end - component ) : strlen( component ) };
+				const bool isLast{ end == nullptr || end[ 1 ] == '\0' };
+
+				if ( length == 0 || ( length == 1 && component[ 0 ] == '.' ) || ( length == 2 && component[ 0 ] == '.' && component[ 1 ] == '.' ) ) {
+					// empty, `.` and `..` components are passed through as-is
+					pResult.append( component, length );
+				} else {
+					// directory we're looking in, without the trailing slash
+					std::string directory{ pBase + pResult };
+					if ( directory.size() > 1 && directory.back() == '/' ) {
+						directory.pop_back();
+					}
+
+					const CachedDir* listing{ FindDir( directory, now ) };
+					bool fresh{ false };
+					if ( listing == nullptr ) {
+						if ( !pCanRead ) {
+							return WalkResult::NeedsRead;
+						}
+						DropDir( directory );
+						listing = ReadDir( directory );
+						fresh = true;
+					}
+
+					const std::string name{ component, length };
+					const std::string folded{ Fold( component, length ) };
+					const auto find{ [ & ]( const CachedDir* pListing ) -> const char* {
+						if ( pListing == nullptr ) {
+							return nullptr;
+						}
+						const auto it{ pListing->m_Entries.find( folded ) };
+						return it != pListing->m_Entries.end() ? it->second.c_str() : nullptr;
+					} };
+
+					const char* match{ find( listing ) };
+					if ( match == nullptr && !fresh ) {
+						if ( !pCanRead ) {
+							// a watched listing without the name is a cached miss
+							if ( listing->m_iWatch < 0 || !pTrustWatched ) {
+								return WalkResult::NeedsRead;
+							}
+						} else if ( listing->m_iWatch < 0 ) {
+							DropDir( directory );
+							listing = ReadDir( directory );
+							match = find( listing );
+						}
+					}
+
+					if ( match != nullptr ) {
+						pResult += match;
+					} else if ( isLast && pAllowBasenameMismatch ) {
+						pResult += name;
+					} else {
+						return WalkResult::Failed;
+					}
+				}
+
+				if ( end == nullptr ) {
+					break;
+				}
+				pResult += '/';
+				component = end + 1;
+			}
+
+			return WalkResult::Matched;
+		}
+	}
+
+	PathMatchResult_t PathMatch_Resolve( const char* pPath, char* pOut, size_t nOutLen, bool bAllowBasenameMismatch ) {
+		s_nLookups += 1;
+
+		if ( faccessat( AT_FDCWD, pPath, F_OK, 0 ) == 0 ) {
+			s_nExactHits += 1;
+			return kPathMatchUnchanged;
+		}
+
+		const std::string base{ BaseFor( pPath ) };
+		std::string result;
+		auto walk{ WalkResult::NeedsRead };
+
+		// fast path: everything we need is cached and nothing changed on disk
+		{
+			std::unique_lock lock{ s_Mutex, std::try_to_lock };
+			if ( lock.owns_lock() ) {
+				PumpNotifications();
+			}
+		}
+		{
+			std::shared_lock lock{ s_Mutex };
+			walk = Walk( pPath, base, result, bAllowBasenameMismatch, false, !NotificationsPending() );
+		}
+
+		if ( walk == WalkResult::Matched ) {
+			s_nCacheHits += 1;
+		} else if ( walk == WalkResult::NeedsRead ) {
+			// slow path: read the listings we're missing
+			std::unique_lock lock{ s_Mutex };
+			PumpNotifications();
+			s_nSlowPath += 1;
+			walk = Walk( pPath, base, result, bAllowBasenameMismatch, true, true );
+		}
+
+		if ( walk != WalkResult::Matched || result.size() + 1 > nOutLen ) {
+			s_nFailures += 1;
+			return kPathMatchFailed;
+		}
+
+		if ( result == pPath ) {
+			return kPathMatchUnchanged;
+		}
+
+		memcpy( pOut, result.c_str(), result.size() + 1 );
+		return kPathMatchChanged;
+	}
+
+	void PathMatch_Invalidate( const char* pDirectory ) {
+		std::unique_lock lock{ s_Mutex };
+
+		if ( pDirectory == nullptr ) {
+			while ( !s_Dirs.empty() ) {
+				DropDir( s_Dirs.begin()->first );
+			}
+			return;
+		}
+
+		std::string directory{ BaseFor( pDirectory ) + pDirectory };
+		if ( directory.size() > 1 && directory.back() == '/' ) {
+			directory.pop_back();
+		}
+		DropDir( directory );
+	}
+
+	void PathMatch_GetStats( PathMatchStats_t& stats ) {
+		stats.m_nLookups = s_nLookups;
+		stats.m_nExactHits = s_nExactHits;
+		stats.m_nCacheHits = s_nCacheHits;
+		stats.m_nSlowPath = s_nSlowPath;
+		stats.m_nDirScans = s_nDirScans;
+		stats.m_nFailures = s_nFailures;
+		stats.m_nInvalidations = s_nInvalidations;
+
+		std::shared_lock lock{ s_Mutex };
+		stats.m_nCachedDirs = s_Dirs.size();
+	}
+
+	void PathMatch_ResetStats() {
+		s_nLookups = 0;
+		s_nExactHits = 0;
+		s_nCacheHits = 0;
+		s_nSlowPath = 0;
+		s_nDirScans = 0;
+		s_nFailures = 0;
+		s_nInvalidations = 0;
+	}
+#endif
@@ -12,6 +12,7 @@ set( TIER1_SOURCE_FILES
 	"${TIER1_DIR}/checksum_sha1.cpp"
 	"${TIER1_DIR}/commandbuffer.cpp"
 	"${TIER1_DIR}/convar.cpp"
+	"${TIER1_DIR}/datacodec.cpp"
 	"${TIER1_DIR}/datamanager.cpp"
 	"${TIER1_DIR}/diff.cpp"
 	"${TIER1_DIR}/generichash.cpp"
@@ -41,10 +42,13 @@ set( TIER1_SOURCE_FILES
 	"${TIER1_DIR}/sparsematrix.cpp"
 	"${TIER1_DIR}/utlbuffer.cpp"
 	"${TIER1_DIR}/utlbufferutil.cpp"
+	"${TIER1_DIR}/utlbufferview.cpp"
+	"${TIER1_DIR}/utlsoacontainer.cpp"
 	"${TIER1_DIR}/utlstring.cpp"
 	"${TIER1_DIR}/utlsymbol.cpp"
 	"${TIER1_DIR}/utlbinaryblock.cpp"
 	"$<${IS_LINUX}:${TIER1_DIR}/pathmatch.cpp>"
+	"$<${IS_LINUX}:${TIER1_DIR}/pathmatchcache.cpp>"
 	"${TIER1_DIR}/snappy.cpp"
 	"${TIER1_DIR}/snappy-sinksource.cpp"
 	"${TIER1_DIR}/snappy-stubs-internal.cpp"
@@ -73,6 +77,7 @@ set( TIER1_SOURCE_FILES
 	"${SRCDIR}/public/tier1/checksum_sha1.h"
 	"${SRCDIR}/public/tier1/CommandBuffer.h"
 	"${SRCDIR}/public/tier1/convar.h"
+	"${SRCDIR}/public/tier1/datacodec.h"
 	"${SRCDIR}/public/tier1/datamanager.h"
 	"${SRCDIR}/public/datamap.h"
 	"${SRCDIR}/public/tier1/delegates.h"
@@ -90,6 +95,7 @@ set( TIER1_SOURCE_FILES
 	"${SRCDIR}/public/tier1/mempool.h"
 	"${SRCDIR}/public/tier1/memstack.h"
 	"${SRCDIR}/public/tier1/netadr.h"
+	"${SRCDIR}/public/tier1/pathmatchcache.h"
 	"${SRCDIR}/public/tier1/processor_detect.h"
 	"${SRCDIR}/public/tier1/rangecheckedvar.h"
 	"${SRCDIR}/public/tier1/refcount.h"
@@ -104,6 +110,7 @@ set( TIER1_SOURCE_FILES
 	"${SRCDIR}/public/tier1/utlblockmemory.h"
 	"${SRCDIR}/public/tier1/utlbuffer.h"
 	"${SRCDIR}/public/tier1/utlbufferutil.h"
+	"${SRCDIR}/public/tier1/utlbufferview.h"
 	"${SRCDIR}/public/tier1/utlcommon.h"
 	"${SRCDIR}/public/tier1/utldict.h"
 	"${SRCDIR}/public/tier1/utlenvelope.h"
@@ -118,6 +125,7 @@ set( TIER1_SOURCE_FILES
 	"${SRCDIR}/public/tier1/utlpriorityqueue.h"
 	"${SRCDIR}/public/tier1/utlqueue.h"
 	"${SRCDIR}/public/tier1/utlrbtree.h"
+	"${SRCDIR}/public/tier1/utlsoacontainer.h"
 	"${SRCDIR}/public/tier1/UtlSortVector.h"
 	"${SRCDIR}/public/tier1/utlstack.h"
 	"${SRCDIR}/public/tier1/utlstring.h"
@@ -364,6 +364,34 @@ void CUtlBuffer::Get( void* pMem, int size )
 }
 
 
+//-----------------------------------------------------------------------------
+// Scatter get
+//-----------------------------------------------------------------------------
+void CUtlBuffer::GetV( const UtlBufferVec_t *pVecs, int nCount )
+{
+	int nTotal = 0;
+	for ( int i = 0; i < nCount; ++i )
+	{
+		Assert( pVecs[i].m_nSize >= 0 );
+		nTotal += pVecs[i].m_nSize;
+	}
+
+	if ( nTotal > 0 && CheckGet( nTotal ) )
+	{
+		int Index = m_Get - m_nOffset;
+		Assert( m_Memory.IsIdxValid( Index ) && m_Memory.IsIdxValid( Index + nTotal - 1 ) );
+
+		const unsigned char *pSrc = &m_Memory[ Index ];
+		for ( int i = 0; i < nCount; ++i )
+		{
+			memcpy( pVecs[i].m_pBase, pSrc, pVecs[i].m_nSize );
+			pSrc += pVecs[i].m_nSize;
+		}
+		m_Get += nTotal;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // This will get at least 1 byte and up to nSize bytes. 
 // It will return the number of bytes actually read.
@@ -1330,6 +1358,38 @@ void CUtlBuffer::Put( const void *pMem, int size )
 }
 
 
+//-----------------------------------------------------------------------------
+// Gather put: grows at most once for the whole set of ranges
+//-----------------------------------------------------------------------------
+void CUtlBuffer::PutV( const UtlBufferVec_t *pVecs, int nCount )
+{
+	int nTotal = 0;
+	for ( int i = 0; i < nCount; ++i )
+	{
+		Assert( pVecs[i].m_nSize >= 0 );
+		nTotal += pVecs[i].m_nSize;
+	}
+
+	if ( nTotal && CheckPut( nTotal ) )
+	{
+		int Index = m_Put - m_nOffset;
+		Assert( m_Memory.IsIdxValid( Index ) && m_Memory.IsIdxValid( Index + nTotal - 1 ) );
+		if( Index >= 0 )
+		{
+			unsigned char *pDest = &m_Memory[ Index ];
+			for ( int i = 0; i < nCount; ++i )
+			{
+				memcpy( pDest, pVecs[i].m_pBase, pVecs[i].m_nSize );
+				pDest += pVecs[i].m_nSize;
+			}
+			m_Put += nTotal;
+
+			AddNullTermination();
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Writes a null-terminated string
 //-----------------------------------------------------------------------------
@@ -0,0 +1,145 @@
+//===========================================================================//
+//
+// Purpose: Non-owning, read-only CUtlBuffer views over shared memory.
+//
+//===========================================================================//
+
+#include "tier1/utlbufferview.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+//-----------------------------------------------------------------------------
+// CUtlRefCountedMemory
+//-----------------------------------------------------------------------------
+static void FreeHeapMemory( void *pMemory, int nSize, void *pContext )
+{
+	free( pMemory );
+}
+
+CUtlRefCountedMemory *CUtlRefCountedMemory::Allocate( int nSize )
+{
+	Assert( nSize >= 0 );
+	MEM_ALLOC_CREDIT();
+	void *pMemory = malloc( MAX( nSize, 1 ) );
+	return new CUtlRefCountedMemory( pMemory, nSize, &FreeHeapMemory, NULL );
+}
+
+CUtlRefCountedMemory *CUtlRefCountedMemory::Wrap( void *pMemory, int nSize, FreeFunc_t pfnFree, void *pContext )
+{
+	Assert( nSize >= 0 );
+	return new CUtlRefCountedMemory( pMemory, nSize, pfnFree, pContext );
+}
+
+CUtlRefCountedMemory::CUtlRefCountedMemory( void *pMemory, int nSize, FreeFunc_t pfnFree, void *pContext ) :
+	m_pMemory( pMemory ), m_nSize( nSize ), m_pfnFree( pfnFree ), m_pContext( pContext )
+{
+}
+
+CUtlRefCountedMemory::~CUtlRefCountedMemory()
+{
+	if ( m_pfnFree )
+	{
+		m_pfnFree( m_pMemory, m_nSize, m_pContext );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// CUtlBufferView
+//-----------------------------------------------------------------------------
+CUtlBufferView::CUtlBufferView() :
+	CUtlBuffer( 0, 0, READ_ONLY ), m_pOwner( NULL )
+{
+}
+
+CUtlBufferView::CUtlBufferView( const void *pMemory, int nSize, IRefCounted *pOwner, int nFlags ) :
+	CUtlBuffer( 0, 0, READ_ONLY ), m_pOwner( NULL )
+{
+	SetView( pMemory, nSize, pOwner, nFlags );
+}
+
+CUtlBufferView::CUtlBufferView( const CUtlBuffer &buf, IRefCounted *pOwner ) :
+	CUtlBuffer( 0, 0, READ_ONLY ), m_pOwner( NULL )
+{
+	const int nSize = buf.TellPut() - buf.TellGet();
+	SetView( nSize > 0 ? buf.PeekGet() : NULL, MAX( nSize, 0 ), pOwner, buf.GetFlags() & ( TEXT_BUFFER | CONTAINS_CRLF ) );
+}
+
+CUtlBufferView::CUtlBufferView( CUtlRefCountedMemory *pMemory, int nFlags ) :
+	CUtlBuffer( 0, 0, READ_ONLY ), m_pOwner( NULL )
+{
+	SetView( pMemory->Base(), pMemory->Size(), pMemory, nFlags );
+}
+
+CUtlBufferView::CUtlBufferView( const CUtlBufferView &other ) :
+	CUtlBuffer( 0, 0, READ_ONLY ), m_pOwner( NULL )
+{
+	*this = other;
+}
+
+CUtlBufferView &CUtlBufferView::operator=( const CUtlBufferView &other )
+{
+	if ( this != &other )
+	{
+		SetView( other.Base(), other.TellMaxPut(), other.m_pOwner, other.GetFlags() );
+		m_Get = other.m_Get;
+		m_Error = other.m_Error;
+	}
+	return *this;
+}
+
+CUtlBufferView::~CUtlBufferView()
+{
+	SafeRelease( m_pOwner );
+}
+
+void CUtlBufferView::SetView( const void *pMemory, int nSize, IRefCounted *pOwner, int nFlags )
+{
+	Assert( nSize >= 0 && ( pMemory || nSize == 0 ) );
+
+	// Grab the new owner first, it may be the one we currently hold
+	if ( pOwner )
+	{
+		pOwner->AddRef();
+	}
+	SafeRelease( m_pOwner );
+	m_pOwner = pOwner;
+
+	// Attached as modifiable memory so binary gets don't trip the const buffer asserts in CUtlMemory,
+	// puts are refused through READ_ONLY instead
+	m_Memory.SetExternalBuffer( (unsigned char *)const_cast< void * >( pMemory ), nSize );
+	m_Get = 0;
+	m_Put = nSize;
+	m_nMaxPut = nSize;
+	m_nTab = 0;
+	m_Error = 0;
+	m_nOffset = 0;
+	m_Flags = ( nFlags & ~EXTERNAL_GROWABLE ) | READ_ONLY;
+}
+
+void CUtlBufferView::ResetView()
+{
+	SetView( NULL, 0, NULL, 0 );
+}
+
+CUtlBufferView CUtlBufferView::Slice( int nOffset, int nSize ) const
+{
+	const int nViewSize = TellMaxPut();
+	nOffset = clamp( nOffset, 0, nViewSize );
+	nSize = clamp( nSize, 0, nViewSize - nOffset );
+
+	return CUtlBufferView( nSize ? (const unsigned char *)Base() + nOffset : NULL, nSize, m_pOwner, GetFlags() );
+}
+
+bool CUtlBufferView::SliceGet( CUtlBufferView &out, int nSize )
+{
+	if ( nSize < 0 || TellGet() + nSize > TellMaxPut() )
+		return false;
+
+	out = Slice( TellGet(), nSize );
+	SeekGet( SEEK_CURRENT, nSize );
+	return true;
+}
@@ -0,0 +1,157 @@
+//===========================================================================//
+//
+// Purpose: Storage for CSOAContainer, a structure-of-arrays container.
+//
+//===========================================================================//
+
+#include "tier1/utlsoacontainer.h"
+#include <stdarg.h>
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+// Bytes used by a group of 4 elements of each attribute type, indexed by EAttributeDataType
+static const size_t s_nDataTypeQuadSizes[] =
+{
+	sizeof( fltx4 ),		// ATTRDATATYPE_FLOAT
+	sizeof( FourVectors ),	// ATTRDATATYPE_4V
+	sizeof( fltx4 ),		// ATTRDATATYPE_INT
+	4 * sizeof( void * ),	// ATTRDATATYPE_POINTER
+};
+
+
+CSOAContainer::CSOAContainer( int nCols, int nRows, ... )
+{
+	Init();
+
+	va_list args;
+	va_start( args, nRows );
+	for ( ;; )
+	{
+		int nAttrIdx = va_arg( args, int );
+		if ( nAttrIdx == ATTRDATATYPE_NONE )
+			break;
+
+		EAttributeDataType nType = (EAttributeDataType)va_arg( args, int );
+		SetAttributeType( nAttrIdx, nType );
+	}
+	va_end( args );
+
+	AllocateData( nCols, nRows );
+}
+
+CSOAContainer::~CSOAContainer( void )
+{
+	Purge();
+}
+
+//-----------------------------------------------------------------------------
+// Frees the data; attribute types are kept so the container can be reallocated
+//-----------------------------------------------------------------------------
+void CSOAContainer::Purge( void )
+{
+	if ( m_pDataMemory )
+	{
+		MemAlloc_FreeAligned( m_pDataMemory );
+		m_pDataMemory = NULL;
+	}
+	m_nColumns = m_nPaddedColumns = m_nRows = m_nSlices = 0;
+	m_nNumQuadsPerRow = 0;
+}
+
+size_t CSOAContainer::ElementSize( void ) const
+{
+	size_t nSize = 0;
+	for ( int i = 0; i < MAX_SOA_FIELDS; i++ )
+	{
+		if ( m_nFieldPresentMask & ( 1 << i ) )
+		{
+			nSize += s_nDataTypeQuadSizes[ m_nDataType[i] ] / 4;
+		}
+	}
+	return nSize;
+}
+
+void CSOAContainer::AllocateData( int nNCols, int nNRows, int nSlices )
+{
+	Purge();
+
+	m_nColumns = nNCols;
+	m_nRows = nNRows;
+	m_nSlices = nSlices;
+	m_nPaddedColumns = ( nNCols + 3 ) & ~3;
+	m_nNumQuadsPerRow = m_nPaddedColumns / 4;
+
+	size_t nMemoryRequired = 0;
+	for ( int i = 0; i < MAX_SOA_FIELDS; i++ )
+	{
+		if ( m_nFieldPresentMask & ( 1 << i ) )
+		{
+			nMemoryRequired += s_nDataTypeQuadSizes[ m_nDataType[i] ] * m_nNumQuadsPerRow * m_nRows * m_nSlices;
+		}
+	}
+
+	m_pDataMemory = (uint8 *)MemAlloc_AllocAligned( nMemoryRequired, 16 );
+	memset( m_pDataMemory, 0, nMemoryRequired );
+
+	// Every attribute gets its own contiguous, 16 byte aligned run of rows and slices
+	uint8 *pBase = m_pDataMemory;
+	for ( int i = 0; i < MAX_SOA_FIELDS; i++ )
+	{
+		if ( m_nFieldPresentMask & ( 1 << i ) )
+		{
+			const size_t nQuadSize = s_nDataTypeQuadSizes[ m_nDataType[i] ];
+			m_pAttributePtrs[i] = pBase;
+			m_nStrideInBytes[i] = nQuadSize;
+			m_nRowStrideInBytes[i] = nQuadSize * m_nNumQuadsPerRow;
+			m_nSliceStrideInBytes[i] = m_nRowStrideInBytes[i] * m_nRows;
+			pBase += m_nSliceStrideInBytes[i] * m_nSlices;
+		}
+		else
+		{
+			m_pAttributePtrs[i] = NULL;
+			m_nStrideInBytes[i] = 0;
+			m_nRowStrideInBytes[i] = 0;
+			m_nSliceStrideInBytes[i] = 0;
+		}
+	}
+}
+
+void CSOAContainer::MoveDataFrom( CSOAContainer &other )
+{
+	if ( &other == this )
+		return;
+
+	Purge();
+
+	m_nColumns = other.m_nColumns;
+	m_nRows = other.m_nRows;
+	m_nSlices = other.m_nSlices;
+	m_nPaddedColumns = other.m_nPaddedColumns;
+	m_nNumQuadsPerRow = other.m_nNumQuadsPerRow;
+	m_pDataMemory = other.m_pDataMemory;
+	m_nFieldPresentMask = other.m_nFieldPresentMask;
+	memcpy( m_pAttributePtrs, other.m_pAttributePtrs, sizeof( m_pAttributePtrs ) );
+	memcpy( m_nDataType, other.m_nDataType, sizeof( m_nDataType ) );
+	memcpy( m_nStrideInBytes, other.m_nStrideInBytes, sizeof( m_nStrideInBytes ) );
+	memcpy( m_nRowStrideInBytes, other.m_nRowStrideInBytes, sizeof( m_nRowStrideInBytes ) );
+	memcpy( m_nSliceStrideInBytes, other.m_nSliceStrideInBytes, sizeof( m_nSliceStrideInBytes ) );
+
+	other.Init();
+}
+
+void CSOAContainer::CopyAttrFrom( CSOAContainer const &other, int nAttributeIdx )
+{
+	Assert( m_nDataType[ nAttributeIdx ] == other.m_nDataType[ nAttributeIdx ] );
+	Assert( m_nNumQuadsPerRow == other.m_nNumQuadsPerRow && m_nRows == other.m_nRows && m_nSlices == other.m_nSlices );
+
+	memcpy( m_pAttributePtrs[ nAttributeIdx ], other.m_pAttributePtrs[ nAttributeIdx ], m_nSliceStrideInBytes[ nAttributeIdx ] * m_nSlices );
+}
+
+void CSOAContainer::CopyAttrToAttr( int nSrcAttributeIndex, int nDestAttributeIndex )
+{
+	Assert( m_nDataType[ nSrcAttributeIndex ] == m_nDataType[ nDestAttributeIndex ] );
+
+	memcpy( m_pAttributePtrs[ nDestAttributeIndex ], m_pAttributePtrs[ nSrcAttributeIndex ], m_nSliceStrideInBytes[ nSrcAttributeIndex ] * m_nSlices );
+}